@@ -1,36 +1,282 @@
 #include "cache_manager.h"
 
+#include <doctest/doctest.h>
+
 #include <algorithm>
+#include <fstream>
 #include <loguru/loguru.hpp>
+#include <tuple>
 #include <unordered_map>
 
 #include "config.h"
 #include "indexer.h"
 #include "lsp.h"
 #include "platform.h"
+#include "query.h"
+#include "stats.h"
 
 namespace {
 
+// Replaces the escaped project root in the names of relocatable cache files.
+const char* k_relocatable_project_dir = "relocatable";
+
+// Returns the directory inside of a cache directory which holds the caches
+// for files inside of the project. Files outside of it are stored in the same
+// directory prefixed with '@'.
+std::string GetProjectCacheDir(bool relocatable) {
+    if (relocatable) return k_relocatable_project_dir;
+    return EscapeFileName(g_config->projectRoot);
+}
+
+// Paths inside of the project are stored relative to the project root in
+// relocatable caches. All other paths are absolute.
+std::string ToRelocatablePath(const std::string& path) {
+    if (StartsWith(path, g_config->projectRoot))
+        return path.substr(g_config->projectRoot.size());
+    return path;
+}
+
+// Inverse of ToRelocatablePath for a cache which may have been built on
+// another machine, so |cachePathMappings| are applied as well.
+std::string FromRelocatablePath(const std::string& path) {
+    if (path.empty()) return path;
+    if (!IsAbsolutePath(path)) return g_config->projectRoot + path;
+    for (const std::string& mapping : g_config->cachePathMappings) {
+        size_t eq = mapping.find('=');
+        if (eq == std::string::npos) continue;
+        std::string there = mapping.substr(0, eq);
+        if (StartsWith(path, there))
+            return mapping.substr(eq + 1) + path.substr(there.size());
+    }
+    return path;
+}
+
+// Returns the path a relocatable cache built on another machine has for the
+// local |path|, ie, the inverse of |cachePathMappings|.
+std::string ToMappedPath(const std::string& path) {
+    for (const std::string& mapping : g_config->cachePathMappings) {
+        size_t eq = mapping.find('=');
+        if (eq == std::string::npos) continue;
+        std::string here = mapping.substr(eq + 1);
+        if (StartsWith(path, here))
+            return mapping.substr(0, eq) + path.substr(here.size());
+    }
+    return path;
+}
+
+// Applies ToMappedPath to the path in the compiler argument |arg|, which may
+// follow a flag as in "-I/usr/include" or "--sysroot=/usr". Paths inside of
+// the project |root| are left alone, they are made relative when hashing.
+std::string ToMappedArgument(const std::string& arg, const std::string& root) {
+    for (size_t i = 0; i < arg.size(); ++i) {
+        // Absolute paths start with '/' or a drive letter.
+        if (arg[i] != '/' && (i + 1 == arg.size() || arg[i + 1] != ':'))
+            continue;
+        std::string path = arg.substr(i);
+        if (!IsAbsolutePath(path)) continue;
+        if (StartsWith(path, root)) return arg;
+        return arg.substr(0, i) + ToMappedPath(path);
+    }
+    return arg;
+}
+
+// Applies |fn| to every path stored in |file|.
+template <typename Fn>
+void RelocatePaths(IndexFile* file, Fn fn) {
+    file->import_file.path = fn(file->import_file.path);
+    for (AbsolutePath& dependency : file->dependencies)
+        dependency.path = fn(dependency.path);
+    for (IndexInclude& include : file->includes)
+        include.resolved_path = fn(include.resolved_path);
+}
+
+// With index.lazyHover, the hover and comments of the entities of a cache are
+// also written next to it, so that those of one entity can be read without
+// deserializing the whole cache. The file holds the number of entries, the
+// entries sorted by usr and kind, and then the texts they point into.
+struct CachedTextsEntry {
+    Usr usr;
+    // Offset of the hover, followed by the comments, in the texts.
+    uint32_t offset;
+    uint32_t hover_size;
+    uint32_t comments_size;
+    SymbolKind kind;
+    uint8_t padding[3];
+
+    std::tuple<Usr, SymbolKind> Key() const {
+        return std::make_tuple(usr, kind);
+    }
+};
+
+std::string SerializeTexts(const IndexFile& file) {
+    std::vector<CachedTextsEntry> entries;
+    std::string texts;
+    auto add = [&](SymbolKind kind, Usr usr, const auto& def) {
+        std::string_view hover = def.hover;
+        std::string_view comments = def.comments;
+        if (hover.empty() && comments.empty()) return;
+        CachedTextsEntry entry{};
+        entry.usr = usr;
+        entry.offset = texts.size();
+        entry.hover_size = hover.size();
+        entry.comments_size = comments.size();
+        entry.kind = kind;
+        entries.push_back(entry);
+        texts.append(hover.data(), hover.size());
+        texts.append(comments.data(), comments.size());
+    };
+    for (const IndexType& type : file.types)
+        add(SymbolKind::Type, type.usr, type.def);
+    for (const IndexFunc& func : file.funcs)
+        add(SymbolKind::Func, func.usr, func.def);
+    for (const IndexVar& var : file.vars)
+        add(SymbolKind::Var, var.usr, var.def);
+    std::sort(entries.begin(), entries.end(),
+              [](const CachedTextsEntry& a, const CachedTextsEntry& b) {
+                  return a.Key() < b.Key();
+              });
+
+    uint32_t num_entries = entries.size();
+    std::string result(reinterpret_cast<const char*>(&num_entries),
+                       sizeof(num_entries));
+    result.append(reinterpret_cast<const char*>(entries.data()),
+                  entries.size() * sizeof(CachedTextsEntry));
+    result += texts;
+    return result;
+}
+
+// Binary searches the entries of the texts file at |texts_path| and reads
+// only the texts of the entity |usr| of |kind|.
+bool LoadTexts(const std::string& texts_path, SymbolKind kind, Usr usr,
+               LazyDefTexts* result) {
+    std::ifstream file(texts_path, std::ios::in | std::ios::binary);
+    uint32_t num_entries;
+    if (!file.read(reinterpret_cast<char*>(&num_entries), sizeof(num_entries)))
+        return false;
+    auto read_entry = [&](uint32_t i, CachedTextsEntry* entry) {
+        file.seekg(sizeof(num_entries) + uint64_t(i) * sizeof(*entry));
+        return bool(file.read(reinterpret_cast<char*>(entry), sizeof(*entry)));
+    };
+
+    std::tuple<Usr, SymbolKind> key = std::make_tuple(usr, kind);
+    CachedTextsEntry entry;
+    uint32_t begin = 0, end = num_entries;
+    while (begin < end) {
+        uint32_t mid = begin + (end - begin) / 2;
+        if (!read_entry(mid, &entry)) return false;
+        if (entry.Key() < key)
+            begin = mid + 1;
+        else
+            end = mid;
+    }
+    if (begin == num_entries || !read_entry(begin, &entry) ||
+        entry.Key() != key)
+        return false;
+
+    std::string texts(entry.hover_size + entry.comments_size, '\0');
+    file.seekg(sizeof(num_entries) +
+               uint64_t(num_entries) * sizeof(CachedTextsEntry) +
+               entry.offset);
+    if (!texts.empty() && !file.read(&texts[0], texts.size())) return false;
+    result->hover = texts.substr(0, entry.hover_size);
+    result->comments = texts.substr(entry.hover_size);
+    return true;
+}
+
 // Manages loading caches from file paths for the indexer process.
 struct RealCacheManager : ICacheManager {
     explicit RealCacheManager() {}
     ~RealCacheManager() override = default;
 
     void WriteToCache(IndexFile& file) override {
-        std::string cache_path = GetCachePath(file.path);
+        std::string cache_path = GetCachePath(
+            g_config->cacheDirectory, g_config->cacheRelocatable, file.path);
         WriteToFile(cache_path, file.file_contents);
 
-        std::string indexed_content = Serialize(g_config->cacheFormat, file);
+        std::string indexed_content;
+        if (g_config->cacheRelocatable) {
+            AbsolutePath import_file = file.import_file;
+            std::vector<AbsolutePath> dependencies = file.dependencies;
+            std::vector<IndexInclude> includes = file.includes;
+            RelocatePaths(&file, &ToRelocatablePath);
+            indexed_content = Serialize(g_config->cacheFormat, file);
+            file.import_file = std::move(import_file);
+            file.dependencies = std::move(dependencies);
+            file.includes = std::move(includes);
+        } else {
+            indexed_content = Serialize(g_config->cacheFormat, file);
+        }
         WriteToFile(AppendSerializationFormat(cache_path), indexed_content);
+        if (g_config->index.lazyHover)
+            WriteToFile(cache_path + ".texts", SerializeTexts(file));
+    }
+
+    bool LoadHoverAndComments(const std::string& path, SymbolKind kind,
+                              Usr usr, LazyDefTexts* texts) override {
+        if (LoadTexts(GetCachePath(g_config->cacheDirectory,
+                                   g_config->cacheRelocatable, path) +
+                          ".texts",
+                      kind, usr, texts))
+            return true;
+        return !g_config->cacheBaseDirectory.empty() &&
+               LoadTexts(GetCachePath(g_config->cacheBaseDirectory,
+                                      true /*relocatable*/,
+                                      ToMappedPath(path)) +
+                             ".texts",
+                         kind, usr, texts);
     }
 
     optional<std::string> LoadCachedFileContents(
         const std::string& path) override {
-        return ReadContent(GetCachePath(path));
+        optional<std::string> content = ReadContent(GetCachePath(
+            g_config->cacheDirectory, g_config->cacheRelocatable, path));
+        if (!content && !g_config->cacheBaseDirectory.empty()) {
+            content = ReadContent(GetCachePath(g_config->cacheBaseDirectory,
+                                               true /*relocatable*/,
+                                               ToMappedPath(path)));
+        }
+        return content;
     }
 
     std::unique_ptr<IndexFile> RawCacheLoad(const std::string& path) override {
-        std::string cache_path = GetCachePath(path);
+        std::unique_ptr<IndexFile> file = LoadFrom(
+            GetCachePath(g_config->cacheDirectory, g_config->cacheRelocatable,
+                         path),
+            path);
+        bool from_base = false;
+        if (!file && !g_config->cacheBaseDirectory.empty()) {
+            file = LoadFrom(GetCachePath(g_config->cacheBaseDirectory,
+                                         true /*relocatable*/,
+                                         ToMappedPath(path)),
+                            path);
+            from_base = true;
+        }
+        if (!file || !g_config->cacheRelocatable) return file;
+
+        RelocatePaths(file.get(), &FromRelocatablePath);
+
+        // The cache was possibly built in another checkout, where files have
+        // other modification times. Keep using it if the file still has the
+        // contents it was indexed with, and store the new modification time
+        // so this check is only done once.
+        optional<int64_t> modification_time = GetLastModificationTime(path);
+        if (!modification_time) return file;
+        bool write_to_cache = from_base;
+        if (*modification_time != file->last_modification_time) {
+            optional<std::string> content = ReadContent(path);
+            // Left as is, so the file is reparsed.
+            if (!content || file->content_hash == 0 ||
+                HashContents(*content) != file->content_hash)
+                return file;
+            file->last_modification_time = *modification_time;
+            write_to_cache = true;
+        }
+        if (write_to_cache) WriteToCache(*file);
+        return file;
+    }
+
+    std::unique_ptr<IndexFile> LoadFrom(const std::string& cache_path,
+                                        const std::string& path) {
         optional<std::string> file_content = ReadContent(cache_path);
         optional<std::string> serialized_indexed_content =
             ReadContent(AppendSerializationFormat(cache_path));
@@ -41,19 +287,21 @@ struct RealCacheManager : ICacheManager {
                            IndexFile::kMajorVersion);
     }
 
-    std::string GetCachePath(const std::string& source_file) {
-        assert(!g_config->cacheDirectory.empty());
+    std::string GetCachePath(const std::string& cache_directory,
+                             bool relocatable,
+                             const std::string& source_file) {
+        assert(!cache_directory.empty());
         std::string cache_file;
         size_t len = g_config->projectRoot.size();
         if (StartsWith(source_file, g_config->projectRoot)) {
-            cache_file = EscapeFileName(g_config->projectRoot) + '/' +
+            cache_file = GetProjectCacheDir(relocatable) + '/' +
                          EscapeFileName(source_file.substr(len));
         } else {
-            cache_file = '@' + EscapeFileName(g_config->projectRoot) + '/' +
+            cache_file = '@' + GetProjectCacheDir(relocatable) + '/' +
                          EscapeFileName(source_file);
         }
 
-        return g_config->cacheDirectory + cache_file;
+        return cache_directory + cache_file;
     }
 
     std::string AppendSerializationFormat(const std::string& base) {
@@ -97,11 +345,71 @@ struct FakeCacheManager : ICacheManager {
         return nullptr;
     }
 
+    bool LoadHoverAndComments(const std::string& path, SymbolKind kind,
+                              Usr usr, LazyDefTexts* texts) override {
+        return false;
+    }
+
     std::vector<FakeCacheEntry> entries_;
 };
 
+void TrackLoadedCache(const IndexFile& file, int delta) {
+    Stats* stats = Stats::Instance();
+    stats->m_loaded_caches += delta;
+    stats->m_loaded_cache_bytes += delta * EstimateMemoryUsage(file);
+}
+
 }  // namespace
 
+// static
+void ICacheManager::InitCacheDirectories() {
+    std::string project_dir = GetProjectCacheDir(g_config->cacheRelocatable);
+    MakeDirectoryRecursive(g_config->cacheDirectory + project_dir);
+    MakeDirectoryRecursive(g_config->cacheDirectory + '@' + project_dir);
+
+    if (!g_config->cacheBaseDirectory.empty() && !g_config->cacheRelocatable) {
+        LOG_S(WARNING) << "cacheBaseDirectory requires cacheRelocatable";
+        g_config->cacheBaseDirectory.clear();
+    }
+    if (!g_config->cacheBaseDirectory.empty()) {
+        optional<AbsolutePath> base_dir = NormalizePath(
+            g_config->cacheBaseDirectory, false /*ensure_exists*/);
+        if (base_dir) {
+            g_config->cacheBaseDirectory = base_dir->path;
+            EnsureEndsInSlash(g_config->cacheBaseDirectory);
+        } else {
+            LOG_S(WARNING) << "Cannot find cache base directory "
+                           << g_config->cacheBaseDirectory;
+            g_config->cacheBaseDirectory.clear();
+        }
+    }
+}
+
+// static
+size_t ICacheManager::HashArguments(const std::vector<std::string>& args) {
+    size_t hash;
+    if (g_config->cacheRelocatable) {
+        // Hash the arguments as they were on the machine which built
+        // |cacheBaseDirectory|, like the paths inside of the cache.
+        std::string root = g_config->projectRoot;
+        EnsureEndsInSlash(root);
+        std::vector<std::string> mapped_args;
+        mapped_args.reserve(args.size());
+        for (const std::string& arg : args)
+            mapped_args.push_back(ToMappedArgument(arg, root));
+        hash = ::HashArguments(mapped_args, root);
+    } else {
+        hash = ::HashArguments(args);
+    }
+    // Usrs hashed in different ways cannot be mixed, so a file whose cache
+    // was written with the other hash is reindexed.
+    if (g_config->index.fastUsrHash) HashCombine(hash, 1);
+    // Caches written without index.lazyHover have no texts to read hover
+    // from, see LoadHoverAndComments.
+    if (g_config->index.lazyHover) HashCombine(hash, 2);
+    return hash;
+}
+
 // static
 std::shared_ptr<ICacheManager> ICacheManager::Make() {
     return std::make_shared<RealCacheManager>();
@@ -113,7 +421,9 @@ std::shared_ptr<ICacheManager> ICacheManager::MakeFake(
     return std::make_shared<FakeCacheManager>(entries);
 }
 
-ICacheManager::~ICacheManager() = default;
+ICacheManager::~ICacheManager() {
+    for (const auto& cache : m_caches) TrackLoadedCache(*cache.second, -1);
+}
 
 IndexFile* ICacheManager::TryLoad(const std::string& path) {
     auto it = m_caches.find(path);
@@ -122,6 +432,7 @@ IndexFile* ICacheManager::TryLoad(const std::string& path) {
     std::unique_ptr<IndexFile> cache = RawCacheLoad(path);
     if (!cache) return nullptr;
 
+    TrackLoadedCache(*cache, 1);
     m_caches[path] = std::move(cache);
     return m_caches[path].get();
 }
@@ -132,6 +443,7 @@ std::unique_ptr<IndexFile> ICacheManager::TryTakeOrLoad(
     if (it != m_caches.end()) {
         auto result = std::move(it->second);
         m_caches.erase(it);
+        TrackLoadedCache(*result, -1);
         return result;
     }
 
@@ -150,3 +462,71 @@ void ICacheManager::IterateLoadedCaches(std::function<void(IndexFile*)> fn) {
         fn(cache.second.get());
     }
 }
+
+TEST_SUITE("ICacheManager") {
+    TEST_CASE("relocatable paths") {
+        Config saved = *g_config;
+        g_config->projectRoot = "/ci/proj/";
+        g_config->cachePathMappings = {"/opt/ci/=/usr/", "invalid"};
+        REQUIRE(ToRelocatablePath("/ci/proj/src/a.cc") == "src/a.cc");
+        REQUIRE(ToRelocatablePath("/opt/ci/include/b.h") ==
+                "/opt/ci/include/b.h");
+
+        g_config->projectRoot = "/home/me/proj/";
+        REQUIRE(FromRelocatablePath("src/a.cc") == "/home/me/proj/src/a.cc");
+        REQUIRE(FromRelocatablePath("/opt/ci/include/b.h") ==
+                "/usr/include/b.h");
+        REQUIRE(FromRelocatablePath("/other/c.h") == "/other/c.h");
+        REQUIRE(FromRelocatablePath("") == "");
+        REQUIRE(ToMappedPath("/usr/include/b.h") == "/opt/ci/include/b.h");
+        *g_config = saved;
+    }
+
+    TEST_CASE("texts of one entity are read") {
+        IndexFile file(AbsolutePath("/a.cc", false /*validate*/));
+        IndexFunc* func = file.Resolve(file.ToFuncId(5));
+        func->def.hover = "void f()";
+        func->def.comments = "Does f.";
+        file.Resolve(file.ToVarId(5))->def.comments = "A var.";
+        file.Resolve(file.ToTypeId(7));
+
+        optional<AbsolutePath> dir = TryMakeTempDirectory();
+        REQUIRE(dir);
+        std::string texts_path = dir->path + "/a.cc.texts";
+        REQUIRE(WriteToFile(texts_path, SerializeTexts(file)));
+
+        LazyDefTexts texts;
+        REQUIRE(LoadTexts(texts_path, SymbolKind::Func, 5, &texts));
+        REQUIRE(texts.hover == "void f()");
+        REQUIRE(texts.comments == "Does f.");
+        REQUIRE(LoadTexts(texts_path, SymbolKind::Var, 5, &texts));
+        REQUIRE(texts.hover == "");
+        REQUIRE(texts.comments == "A var.");
+        REQUIRE(!LoadTexts(texts_path, SymbolKind::Type, 7, &texts));
+        REQUIRE(!LoadTexts(texts_path, SymbolKind::Func, 6, &texts));
+        REQUIRE(!LoadTexts(dir->path + "/b.cc.texts", SymbolKind::Func, 5,
+                           &texts));
+        RemoveDirectoryRecursive(*dir);
+    }
+
+    TEST_CASE("relocatable argument hashes") {
+        Config saved = *g_config;
+        g_config->cacheRelocatable = true;
+
+        g_config->projectRoot = "/ci/proj/";
+        g_config->cachePathMappings = {};
+        size_t ci_hash = ICacheManager::HashArguments(
+            {"clang", "-I/ci/proj/include", "-isystem", "/opt/ci/include",
+             "--sysroot=/opt/ci/sysroot", "/ci/proj/src/a.cc"});
+
+        g_config->projectRoot = "/home/me/proj";
+        g_config->cachePathMappings = {"/opt/ci/=/usr/"};
+        std::vector<std::string> args = {
+            "clang", "-I/home/me/proj/include", "-isystem", "/usr/include",
+            "--sysroot=/usr/sysroot", "/home/me/proj/src/a.cc"};
+        REQUIRE(ICacheManager::HashArguments(args) == ci_hash);
+        args.push_back("-I/usr/local/include");
+        REQUIRE(ICacheManager::HashArguments(args) != ci_hash);
+        *g_config = saved;
+    }
+}
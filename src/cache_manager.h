@@ -2,6 +2,7 @@
 
 #include <optional.h>
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
@@ -10,6 +11,9 @@
 
 struct Config;
 struct IndexFile;
+struct LazyDefTexts;
+enum class SymbolKind : uint8_t;
+using Usr = uint64_t;
 
 struct ICacheManager {
     struct FakeCacheEntry {
@@ -18,6 +22,13 @@ struct ICacheManager {
         std::string json;
     };
 
+    // Creates the directories caches are written to inside of cacheDirectory.
+    // Must be called after projectRoot and cacheDirectory are set.
+    static void InitCacheDirectories();
+    // Hashes compiler arguments for |IndexFile::args_hash|. If the cache is
+    // relocatable, the project root is not part of the hash.
+    static size_t HashArguments(const std::vector<std::string>& args);
+
     static std::shared_ptr<ICacheManager> Make();
     static std::shared_ptr<ICacheManager> MakeFake(
         const std::vector<FakeCacheEntry>& entries);
@@ -41,6 +52,12 @@ struct ICacheManager {
     virtual optional<std::string> LoadCachedFileContents(
         const std::string& path) = 0;
 
+    // Reads the hover and comments of the entity |usr| of |kind| from the
+    // cache of |path| without loading the whole cache. Returns false if the
+    // cache was not written with index.lazyHover or has no texts for it.
+    virtual bool LoadHoverAndComments(const std::string& path, SymbolKind kind,
+                                      Usr usr, LazyDefTexts* texts) = 0;
+
     // Iterate over all loaded caches.
     void IterateLoadedCaches(std::function<void(IndexFile*)> fn);
 
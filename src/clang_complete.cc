@@ -2,11 +2,14 @@
 
 #include <algorithm>
 #include <loguru.hpp>
+#include <limits>
 #include <thread>
 
 #include "clang_utils.h"
 #include "platform.h"
+#include "stats.h"
 #include "timer.h"
+#include "trace.h"
 #include "work_thread.h"
 
 namespace {
@@ -255,11 +258,37 @@ void BuildCompletionItemTexts(std::vector<lsCompletionItem>& out,
     }
 }
 
+// Returns the text the user types to select |completion_string|. Unless
+// completion.detailedLabel is set this is the label of its completion item.
+std::string GetTypedText(CXCompletionString completion_string) {
+    std::string text;
+    int num_chunks = clang_getNumCompletionChunks(completion_string);
+    for (int i = 0; i < num_chunks; ++i) {
+        switch (clang_getCompletionChunkKind(completion_string, i)) {
+            case CXCompletionChunk_TypedText:
+                text = ToString(
+                    clang_getCompletionChunkText(completion_string, i));
+                break;
+            case CXCompletionChunk_Optional: {
+                std::string nested =
+                    GetTypedText(clang_getCompletionChunkCompletionString(
+                        completion_string, i));
+                if (!nested.empty()) text = std::move(nested);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return text;
+}
+
 // |do_insert|: if |!do_insert|, do not append strings to |insert| after
 // a placeholder.
-void BuildDetailString(CXCompletionString completion_string, std::string& label,
-                       std::string& detail, std::string& insert,
-                       bool& do_insert, lsInsertTextFormat& format,
+void BuildDetailString(CXCompletionString completion_string,
+                       std::string& label, std::string& detail,
+                       std::string& insert, bool& do_insert,
+                       lsInsertTextFormat& format,
                        std::vector<std::string>* parameters,
                        bool include_snippets, int& angle_stack) {
     int num_chunks = clang_getNumCompletionChunks(completion_string);
@@ -381,6 +410,82 @@ void BuildDetailString(CXCompletionString completion_string, std::string& label,
     }
 }
 
+}  // namespace
+
+// Builds the parts of completion items which are only needed for the items
+// sent to the client, from the clang results they were created from.
+//
+// The clang results are owned by the completion session which produced them
+// and are disposed on the completion thread once the session has newer
+// results. Items of disposed results cannot be resolved anymore and are only
+// sent with their label.
+class ClangCompletionResolver : public ICompletionItemResolver {
+   public:
+    ClangCompletionResolver(CXCodeCompleteResults* cx_results,
+                            bool detailed_label, bool include_snippets)
+        : m_cx_results(cx_results),
+          m_detailed_label(detailed_label),
+          m_include_snippets(include_snippets) {}
+    ~ClangCompletionResolver() override { Dispose(); }
+
+    void Dispose() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cx_results) clang_disposeCodeCompleteResults(m_cx_results);
+        m_cx_results = nullptr;
+    }
+
+    bool IsExpired() override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return !m_cx_results;
+    }
+
+    void ResolveTexts(lsCompletionItem* item) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_cx_results) return;
+        CXCompletionString completion_string =
+            GetCompletionString(item->resolve_index_);
+
+        // BuildCompletionItemTexts already built everything else.
+        if (m_detailed_label) {
+            item->detail = ToString(
+                clang_getCompletionParent(completion_string, nullptr));
+            return;
+        }
+
+        std::string label;
+        bool do_insert = true;
+        int angle_stack = 0;
+        BuildDetailString(completion_string, label, item->detail,
+                          item->insertText, do_insert, item->insertTextFormat,
+                          &item->parameters_, m_include_snippets, angle_stack);
+        assert(angle_stack == 0);
+        if (m_include_snippets &&
+            item->insertTextFormat == lsInsertTextFormat::Snippet) {
+            item->insertText += "$0";
+        }
+    }
+
+    void ResolveDocumentation(lsCompletionItem* item) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_cx_results) return;
+        item->documentation = ToString(clang_getCompletionBriefComment(
+            GetCompletionString(item->resolve_index_)));
+    }
+
+   private:
+    CXCompletionString GetCompletionString(uint32_t index) const {
+        assert(index < m_cx_results->NumResults);
+        return m_cx_results->Results[index].CompletionString;
+    }
+
+    std::mutex m_mutex;
+    CXCodeCompleteResults* m_cx_results;
+    bool m_detailed_label;
+    bool m_include_snippets;
+};
+
+namespace {
+
 void TryEnsureDocumentParsed(ClangCompleteManager* manager,
                              std::shared_ptr<CompletionSession> session,
                              std::unique_ptr<ClangTranslationUnit>* tu,
@@ -456,14 +561,25 @@ void CompletionPreloadMain(ClangCompleteManager* completion_manager) {
             continue;
         }
 
+        TraceScope trace("completion", "Preload", request.path.path);
         std::unique_ptr<ClangTranslationUnit> parsing;
+        // Files which were only warmed are not open, so they should not get
+        // diagnostics.
         TryEnsureDocumentParsed(completion_manager, session, &parsing,
-                                &tu->index, true /*emit_diagnostics*/);
+                                &tu->index,
+                                !session->is_speculative /*emit_diagnostics*/);
 
         // Activate new translation unit.
-        std::lock_guard<std::mutex> lock(tu->lock);
-        tu->last_parsed_at = std::chrono::high_resolution_clock::now();
-        tu->tu = std::move(parsing);
+        {
+            std::lock_guard<std::mutex> lock(tu->lock);
+            tu->last_parsed_at = std::chrono::high_resolution_clock::now();
+            tu->tu = std::move(parsing);
+            tu->UpdateMemoryUsage();
+        }
+        // A speculative session does not get to push out the sessions of files
+        // the user has viewed, so it is not kept.
+        completion_manager->EvictSessions(
+            session->is_speculative ? std::string() : request.path.path);
     }
 }
 
@@ -481,6 +597,7 @@ void CompletionQueryMain(ClangCompleteManager* completion_manager) {
         }
 
         std::string path = request->path;
+        TraceScope trace("completion", "CodeComplete", path);
 
         std::shared_ptr<CompletionSession> session =
             completion_manager->TryGetSession(path, true /*mark_as_completion*/,
@@ -490,9 +607,12 @@ void CompletionQueryMain(ClangCompleteManager* completion_manager) {
         // one.
         std::lock_guard<std::mutex> lock(session->completion.lock);
         Timer timer;
-        TryEnsureDocumentParsed(
-            completion_manager, session, &session->completion.tu,
-            &session->completion.index, false /*emit_diagnostics*/);
+        {
+            TraceScope trace("completion", "TryEnsureDocumentParsed");
+            TryEnsureDocumentParsed(
+                completion_manager, session, &session->completion.tu,
+                &session->completion.index, false /*emit_diagnostics*/);
+        }
         timer.ResetAndPrint("[complete] TryEnsureDocumentParsed");
 
         // It is possible we failed to create the document despite
@@ -515,22 +635,42 @@ void CompletionQueryMain(ClangCompleteManager* completion_manager) {
         // CINDEX_VERSION_MINOR >= 48.
         unsigned const kCompleteOptions =
             CXCodeComplete_IncludeMacros | CXCodeComplete_IncludeBriefComments;
-        CXCodeCompleteResults* cx_results = clang_codeCompleteAt(
-            session->completion.tu->cx_tu, session->file.filename.path.c_str(),
-            line, column, unsaved.data(), (unsigned)unsaved.size(),
-            kCompleteOptions);
+        CXCodeCompleteResults* cx_results;
+        {
+            TraceScope trace("completion", "clang_codeCompleteAt");
+            cx_results = clang_codeCompleteAt(
+                session->completion.tu->cx_tu,
+                session->file.filename.path.c_str(), line, column,
+                unsaved.data(), (unsigned)unsaved.size(), kCompleteOptions);
+        }
         timer.ResetAndPrint("[complete] clangCodeCompleteAt");
+        // clang_codeCompleteAt reparses the file, after which the translation
+        // unit is usually larger than after its first parse. Sessions are
+        // evicted once the response was sent.
+        session->completion.UpdateMemoryUsage();
         if (!cx_results) {
             request->on_complete(request->id, {}, false /*is_cached_result*/);
+            completion_manager->EvictSessions(path);
             continue;
         }
 
+        // Only what is needed to filter and sort the results is built here,
+        // the rest is left to |resolver|. The previous results of the session
+        // are disposed here, on the completion thread.
+        auto resolver = std::make_shared<ClangCompletionResolver>(
+            cx_results, g_config->completion.detailedLabel,
+            g_config->completion.enableSnippets);
+        if (session->completion.last_results)
+            session->completion.last_results->Dispose();
+        session->completion.last_results = resolver;
+
         std::vector<lsCompletionItem> ls_result;
         // this is a guess but can be larger in case of optional parameters,
         // as they may be expanded into multiple items
         ls_result.reserve(cx_results->NumResults);
 
         timer.Reset();
+        TraceScope build_trace("completion", "BuildResults");
         for (unsigned i = 0; i < cx_results->NumResults; ++i) {
             CXCompletionResult& result = cx_results->Results[i];
 
@@ -550,14 +690,13 @@ void CompletionQueryMain(ClangCompleteManager* completion_manager) {
             lsCompletionItem ls_completion_item;
 
             ls_completion_item.kind = GetCompletionKind(result.CursorKind);
-            ls_completion_item.documentation = ToString(
-                clang_getCompletionBriefComment(result.CompletionString));
+            ls_completion_item.resolver_ = resolver;
+            ls_completion_item.resolve_index_ = i;
+            ls_completion_item.has_texts_ = false;
+            ls_completion_item.has_documentation_ = false;
 
-            // label/detail/filterText/insertText/priority
+            // label/filterText/priority
             if (g_config->completion.detailedLabel) {
-                ls_completion_item.detail = ToString(clang_getCompletionParent(
-                    result.CompletionString, nullptr));
-
                 auto first_idx = ls_result.size();
                 ls_result.push_back(ls_completion_item);
 
@@ -577,36 +716,25 @@ void CompletionQueryMain(ClangCompleteManager* completion_manager) {
                         ls_result[i].filterText);
                 }
             } else {
-                bool do_insert = true;
-                int angle_stack = 0;
-                BuildDetailString(
-                    result.CompletionString, ls_completion_item.label,
-                    ls_completion_item.detail, ls_completion_item.insertText,
-                    do_insert, ls_completion_item.insertTextFormat,
-                    &ls_completion_item.parameters_,
-                    g_config->completion.enableSnippets, angle_stack);
-                assert(angle_stack == 0);
-                if (g_config->completion.enableSnippets &&
-                    ls_completion_item.insertTextFormat ==
-                        lsInsertTextFormat::Snippet) {
-                    ls_completion_item.insertText += "$0";
-                }
+                ls_completion_item.label =
+                    GetTypedText(result.CompletionString);
                 ls_completion_item.priority_ = GetCompletionPriority(
                     result.CompletionString, result.CursorKind,
                     ls_completion_item.label);
-                ls_result.push_back(ls_completion_item);
+                ls_result.push_back(std::move(ls_completion_item));
             }
         }
 
         timer.ResetAndPrint("[complete] Building " +
                             std::to_string(ls_result.size()) +
                             " completion results");
+        if (IsTracingEnabled())
+            build_trace.SetDetail(std::to_string(ls_result.size()) +
+                                  " results");
 
         request->on_complete(request->id, ls_result,
                              false /*is_cached_result*/);
-
-        // Make sure |ls_results| is destroyed before clearing |cx_results|.
-        clang_disposeCodeCompleteResults(cx_results);
+        completion_manager->EvictSessions(path);
     }
 }
 
@@ -618,6 +746,7 @@ void DiagnosticsQueryMain(ClangCompleteManager* completion_manager) {
         if (!request || !g_config->diagnostics.onType) continue;
 
         std::string path = request->path;
+        TraceScope trace("diagnostics", "Diagnostics", path);
 
         std::shared_ptr<CompletionSession> session =
             completion_manager->TryGetSession(path, true /*mark_as_completion*/,
@@ -625,16 +754,16 @@ void DiagnosticsQueryMain(ClangCompleteManager* completion_manager) {
 
         // At this point, we must have a translation unit. Block until we have
         // one.
-        std::lock_guard<std::mutex> lock(session->diagnostics.lock);
+        CompletionSession::Tu* tu = session->GetDiagnosticsTu();
+        std::lock_guard<std::mutex> lock(tu->lock);
         Timer timer;
-        TryEnsureDocumentParsed(
-            completion_manager, session, &session->diagnostics.tu,
-            &session->diagnostics.index, false /*emit_diagnostics*/);
+        TryEnsureDocumentParsed(completion_manager, session, &tu->tu,
+                                &tu->index, false /*emit_diagnostics*/);
         timer.ResetAndPrint("[diagnostics] TryEnsureDocumentParsed");
 
         // It is possible we failed to create the document despite
         // |TryEnsureDocumentParsed|.
-        if (!session->diagnostics.tu) continue;
+        if (!tu->tu) continue;
 
         timer.Reset();
         WorkingFiles::Snapshot snapshot =
@@ -647,23 +776,25 @@ void DiagnosticsQueryMain(ClangCompleteManager* completion_manager) {
 
         // Emit diagnostics.
         timer.Reset();
-        session->diagnostics.tu = ClangTranslationUnit::Reparse(
-            std::move(session->diagnostics.tu), unsaved);
+        {
+            TraceScope trace("diagnostics", "Reparse");
+            tu->tu = ClangTranslationUnit::Reparse(std::move(tu->tu), unsaved);
+        }
         timer.ResetAndPrint("[diagnostics] clang_reparseTranslationUnit");
-        if (!session->diagnostics.tu) {
+        if (!tu->tu) {
             LOG_S(ERROR)
                 << "Reparsing translation unit for diagnostics failed for "
                 << path;
             continue;
         }
+        tu->UpdateMemoryUsage();
+        completion_manager->EvictSessions(path);
 
-        size_t num_diagnostics =
-            clang_getNumDiagnostics(session->diagnostics.tu->cx_tu);
+        size_t num_diagnostics = clang_getNumDiagnostics(tu->tu->cx_tu);
         std::vector<lsDiagnostic> ls_diagnostics;
         ls_diagnostics.reserve(num_diagnostics);
         for (unsigned i = 0; i < num_diagnostics; ++i) {
-            CXDiagnostic cx_diag =
-                clang_getDiagnostic(session->diagnostics.tu->cx_tu, i);
+            CXDiagnostic cx_diag = clang_getDiagnostic(tu->tu->cx_tu, i);
             optional<lsDiagnostic> diagnostic =
                 BuildAndDisposeDiagnostic(cx_diag, path);
             // Filter messages like "too many errors emitted, stopping now
@@ -676,16 +807,44 @@ void DiagnosticsQueryMain(ClangCompleteManager* completion_manager) {
     }
 }
 
+// Called when the user views or edits the file of |session|. Returns true if
+// the session was speculative.
+bool MarkSessionUsed(CompletionSession* session) {
+    if (!session->is_speculative.exchange(false)) return false;
+    ++Stats::Instance()->m_warmed_session_hits;
+    return true;
+}
+
 }  // namespace
 
 CompletionSession::Tu::Tu()
-    : index(0 /*exclude_declarations_from_pch*/, 0 /*display_diagnostics*/) {}
+    : index(0 /*exclude_declarations_from_pch*/, 0 /*display_diagnostics*/),
+      memory_usage(0) {}
+
+CompletionSession::Tu::~Tu() {
+    if (last_results) last_results->Dispose();
+}
+
+void CompletionSession::Tu::UpdateMemoryUsage() {
+    memory_usage = tu ? tu->GetMemoryUsage() : 0;
+}
 
 CompletionSession::CompletionSession(const Project::Entry& file,
                                      WorkingFiles* working_files)
     : file(file), working_files(working_files) {}
 
-CompletionSession::~CompletionSession() {}
+CompletionSession::~CompletionSession() {
+    if (is_speculative) ++Stats::Instance()->m_warmed_session_misses;
+}
+
+CompletionSession::Tu* CompletionSession::GetDiagnosticsTu() {
+    return g_config->completion.shareTranslationUnit ? &completion
+                                                     : &diagnostics;
+}
+
+size_t CompletionSession::GetMemoryUsage() const {
+    return completion.memory_usage + diagnostics.memory_usage;
+}
 
 ClangCompleteManager::PreloadRequest::PreloadRequest(const AbsolutePath& path)
     : request_time(std::chrono::high_resolution_clock::now()), path(path) {}
@@ -707,8 +866,10 @@ ClangCompleteManager::ClangCompleteManager(Project* project,
       m_working_files(working_files),
       m_on_diagnostic(on_diagnostic),
       m_on_dropped(on_dropped),
-      m_preloaded_sessions(k_max_preloaded_sessions),
-      m_completion_sessions(k_max_completion_sessions) {
+      // Sessions are dropped by EvictSessions, which reads the limits from
+      // g_config.
+      m_preloaded_sessions(std::numeric_limits<int>::max()),
+      m_completion_sessions(std::numeric_limits<int>::max()) {
     WorkThread::StartThread("comp-query", [&]() { CompletionQueryMain(this); });
     WorkThread::StartThread("comp-preload",
                             [&]() { CompletionPreloadMain(this); });
@@ -748,11 +909,29 @@ void ClangCompleteManager::NotifyView(const AbsolutePath& filename) {
     // will be parsed soon.
     //
 
-    // Only reparse the file if we create a new CompletionSession.
+    m_preload_predictor.OnView(filename);
+
+    // Only parse the file if it is not parsed or about to be already.
     if (EnsureCompletionOrCreatePreloadSession(filename))
         m_preload_requests.Enqueue(PreloadRequest(filename), true /*priority*/);
 }
 
+void ClangCompleteManager::NotifyOpen(const AbsolutePath& filename) {
+    std::vector<std::string> args =
+        m_project->FindCompilationEntryForFile(filename).args;
+    bool is_warm = false;
+    {
+        std::lock_guard<std::mutex> lock(m_sessions_lock);
+        std::shared_ptr<CompletionSession> session;
+        is_warm = m_preloaded_sessions.TryGet(filename, &session) &&
+                  session->is_speculative && session->file.args == args;
+    }
+    if (!is_warm) FlushSession(filename);
+    NotifyView(filename);
+    // The warm session was parsed without emitting diagnostics.
+    if (is_warm && g_config->diagnostics.onParse) DiagnosticsUpdate(filename);
+}
+
 void ClangCompleteManager::NotifyEdit(const AbsolutePath& filename) {
     //
     // We treat an edit like a view, because the completion logic will handle
@@ -799,15 +978,62 @@ bool ClangCompleteManager::EnsureCompletionOrCreatePreloadSession(
     std::lock_guard<std::mutex> lock(m_sessions_lock);
 
     // Check for an existing CompletionSession.
+    std::shared_ptr<CompletionSession> preloaded_session;
+    if (m_preloaded_sessions.TryGet(filename, &preloaded_session)) {
+        // The parse of a warmed session is queued at low priority behind the
+        // other warm-ups, so it needs a new request if it has not happened
+        // yet. The memory usage is only known once it has.
+        return MarkSessionUsed(preloaded_session.get()) &&
+               preloaded_session->completion.memory_usage == 0;
+    }
+    if (m_completion_sessions.Has(filename)) return false;
+
+    // No CompletionSession, create new one.
+    auto session = std::make_shared<CompletionSession>(
+        m_project->FindCompilationEntryForFile(filename), m_working_files);
+    m_preloaded_sessions.Insert(session->file.filename, session);
+    return true;
+}
+
+bool ClangCompleteManager::WarmSession(const AbsolutePath& filename) {
+    std::lock_guard<std::mutex> lock(m_sessions_lock);
+
     if (m_preloaded_sessions.Has(filename) ||
         m_completion_sessions.Has(filename)) {
         return false;
     }
 
-    // No CompletionSession, create new one.
+    const Config::Completion& config = g_config->completion;
+    if (m_preloaded_sessions.Size() >=
+        size_t(std::max(0, config.maxPreloadedSessions))) {
+        return false;
+    }
+    int num_speculative = 0;
+    size_t memory_usage = 0;
+    int num_parsed = 0;
+    auto count = [&](const std::shared_ptr<CompletionSession>& session) {
+        if (session->is_speculative) ++num_speculative;
+        size_t session_memory_usage = session->GetMemoryUsage();
+        memory_usage += session_memory_usage;
+        if (session_memory_usage) ++num_parsed;
+        return true;
+    };
+    m_preloaded_sessions.IterateValues(count);
+    m_completion_sessions.IterateValues(count);
+    if (num_speculative >= config.warmupSessions) return false;
+    // Assume the new session will be as large as the average one.
+    if (config.sessionMemoryBudgetMb > 0 && num_parsed > 0 &&
+        memory_usage + memory_usage / num_parsed >
+            size_t(config.sessionMemoryBudgetMb) * 1024 * 1024) {
+        return false;
+    }
+
     auto session = std::make_shared<CompletionSession>(
         m_project->FindCompilationEntryForFile(filename), m_working_files);
+    session->is_speculative = true;
     m_preloaded_sessions.Insert(session->file.filename, session);
+    ++Stats::Instance()->m_warmed_sessions;
+    m_preload_requests.Enqueue(PreloadRequest(filename), false /*priority*/);
     return true;
 }
 
@@ -822,7 +1048,8 @@ std::shared_ptr<CompletionSession> ClangCompleteManager::TryGetSession(
         // If this request is for a completion, we should move it to
         // |completion_sessions|.
         if (mark_as_completion) {
-            assert(!completion_sessions_.Has(filename));
+            MarkSessionUsed(preloaded_session.get());
+            assert(!m_completion_sessions.Has(filename));
             m_preloaded_sessions.TryTake(filename, nullptr);
             m_completion_sessions.Insert(filename, preloaded_session);
         }
@@ -857,3 +1084,55 @@ void ClangCompleteManager::FlushAllSessions() {
     m_preloaded_sessions.Clear();
     m_completion_sessions.Clear();
 }
+
+void ClangCompleteManager::EvictSessions(const std::string& keep) {
+    std::lock_guard<std::mutex> lock(m_sessions_lock);
+
+    auto evict = [&](LruSessionCache* sessions, const char* kind,
+                     bool speculative_only) {
+        std::string filename;
+        std::shared_ptr<CompletionSession> session;
+        if (!sessions->TryTakeOldest(
+                [&](const std::string& key,
+                    const std::shared_ptr<CompletionSession>& candidate) {
+                    return key != keep &&
+                           (!speculative_only || candidate->is_speculative);
+                },
+                &filename, &session))
+            return false;
+        // The session is destroyed once threads using it are done.
+        LOG_S(INFO) << "Dropped " << kind << " code completion session for "
+                    << filename << " ("
+                    << session->GetMemoryUsage() / (1024 * 1024) << " MB)";
+        return true;
+    };
+
+    const Config::Completion& config = g_config->completion;
+    while (m_preloaded_sessions.Size() >
+               size_t(std::max(0, config.maxPreloadedSessions)) &&
+           (evict(&m_preloaded_sessions, "speculative", true) ||
+            evict(&m_preloaded_sessions, "preloaded", false))) {
+    }
+    while (m_completion_sessions.Size() >
+               size_t(std::max(0, config.maxCompletionSessions)) &&
+           evict(&m_completion_sessions, "completion", false)) {
+    }
+
+    if (config.sessionMemoryBudgetMb <= 0) return;
+    size_t budget = size_t(config.sessionMemoryBudgetMb) * 1024 * 1024;
+    auto get_memory_usage = [&]() {
+        size_t bytes = 0;
+        auto add = [&](const std::shared_ptr<CompletionSession>& session) {
+            bytes += session->GetMemoryUsage();
+            return true;
+        };
+        m_preloaded_sessions.IterateValues(add);
+        m_completion_sessions.IterateValues(add);
+        return bytes;
+    };
+    while (get_memory_usage() > budget &&
+           (evict(&m_preloaded_sessions, "speculative", true) ||
+            evict(&m_preloaded_sessions, "preloaded", false) ||
+            evict(&m_completion_sessions, "completion", false))) {
+    }
+}
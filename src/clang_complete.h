@@ -2,6 +2,7 @@
 
 #include <clang-c/Index.h>
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -13,15 +14,19 @@
 #include "lru_cache.h"
 #include "lsp_completion.h"
 #include "lsp_diagnostic.h"
+#include "preload_predictor.h"
 #include "project.h"
 #include "threaded_queue.h"
 #include "working_files.h"
 
+class ClangCompletionResolver;
+
 struct CompletionSession
     : public std::enable_shared_from_this<CompletionSession> {
     // Translation unit for clang.
     struct Tu {
         Tu();
+        ~Tu();
 
         ClangIndex index;
 
@@ -31,6 +36,15 @@ struct CompletionSession
         // Acquired when |tu| is being used.
         std::mutex lock;
         std::unique_ptr<ClangTranslationUnit> tu;
+        // Bytes used by |tu| when it was last parsed.
+        std::atomic<size_t> memory_usage;
+        // Resolves the items of the last code completion in |tu|. Only
+        // the last results are kept, so completion items do not keep older
+        // results alive.
+        std::shared_ptr<ClangCompletionResolver> last_results;
+
+        // Must be called with |lock| held after |tu| has been (re)parsed.
+        void UpdateMemoryUsage();
     };
 
     Project::Entry file;
@@ -39,8 +53,18 @@ struct CompletionSession
     Tu completion;
     Tu diagnostics;
 
+    // Set if the session was created by ClangCompleteManager::WarmSession and
+    // the user has not viewed or edited the file since.
+    std::atomic<bool> is_speculative{false};
+
     CompletionSession(const Project::Entry& file, WorkingFiles* working_files);
     ~CompletionSession();
+
+    // The translation unit used for diagnostics, which is |completion| if
+    // completion.shareTranslationUnit is set.
+    Tu* GetDiagnosticsTu();
+    // Bytes used by the translation units of this session.
+    size_t GetMemoryUsage() const;
 };
 
 struct ClangCompleteManager {
@@ -90,6 +114,10 @@ struct ClangCompleteManager {
     // Notify the completion manager that |filename| has been viewed and we
     // should begin preloading completion data.
     void NotifyView(const AbsolutePath& filename);
+    // Notify the completion manager that |filename| has been opened. Any
+    // existing completion session is dropped, except one which was built by
+    // WarmSession with the current arguments, and preloading begins.
+    void NotifyOpen(const AbsolutePath& filename);
     // Notify the completion manager that |filename| has been edited.
     void NotifyEdit(const AbsolutePath& filename);
     // Notify the completion manager that |filename| has been saved. This
@@ -99,9 +127,16 @@ struct ClangCompleteManager {
     // existing completion session will be dropped.
     void NotifyClose(const AbsolutePath& filename);
 
-    // Ensures there is a completion or preloaded session. Returns true if a new
-    // session was created.
+    // Ensures there is a completion or preloaded session. Returns true if it
+    // needs to be parsed, ie, a new session was created or a session built by
+    // WarmSession was claimed before its parse.
     bool EnsureCompletionOrCreatePreloadSession(const AbsolutePath& filename);
+    // Creates a preloaded session for |filename|, which the user has not
+    // viewed, and queues a low priority parse. Returns false without doing
+    // anything if |filename| already has a session, or if the new session
+    // would not fit into completion.warmupSessions, maxPreloadedSessions or
+    // the memory budget without dropping another session.
+    bool WarmSession(const AbsolutePath& filename);
     // Tries to find an edit session for |filename|. This will move the session
     // from view to edit.
     std::shared_ptr<CompletionSession> TryGetSession(
@@ -112,16 +147,18 @@ struct ClangCompleteManager {
     void FlushSession(const std::string& filename);
     // Flushes all saved sessions
     void FlushAllSessions(void);
-
-    // TODO: make these configurable.
-    const int k_max_preloaded_sessions = 10;
-    const int k_max_completion_sessions = 5;
+    // Drops the least recently used sessions, speculative ones first and then
+    // preloaded ones, until the session limits and memory budget in
+    // g_config->completion are met. The session for |keep| is not dropped.
+    void EvictSessions(const std::string& keep);
 
     // Global state.
     Project* m_project;
     WorkingFiles* m_working_files;
     OnDiagnostic m_on_diagnostic;
     OnDropped m_on_dropped;
+    // Guesses the files to build speculative sessions for.
+    PreloadPredictor m_preload_predictor;
 
     using LruSessionCache =
         LruCache<std::string, std::shared_ptr<CompletionSession>>;
@@ -133,7 +170,8 @@ struct ClangCompleteManager {
     // completion on. This is more rare so these instances tend to stay alive
     // much longer than the ones in |preloaded_sessions_|.
     LruSessionCache m_completion_sessions;
-    // Mutex which protects |view_sessions_| and |edit_sessions_|.
+    // Mutex which protects |m_preloaded_sessions| and
+    // |m_completion_sessions|.
     std::mutex m_sessions_lock;
 
     // Request a code completion at the given location.
@@ -6,6 +6,27 @@
 #include <cassert>
 
 #include "clang_utils.h"
+#include "config.h"
+#include "utils.h"
+
+namespace {
+
+thread_local ClangUsrCache* g_usr_cache = nullptr;
+
+}  // namespace
+
+Usr HashClangUsr(std::string_view usr) {
+    if (g_config->index.fastUsrHash) return HashContents(usr);
+    return HashUsr(usr);
+}
+
+ClangUsrCache::ClangUsrCache() : m_previous(g_usr_cache) {
+    g_usr_cache = this;
+}
+
+ClangUsrCache::~ClangUsrCache() {
+    g_usr_cache = m_previous;
+}
 
 Range ResolveCXSourceRange(const CXSourceRange& range, CXFile* cx_file) {
     CXSourceLocation start = clang_getRangeStart(range);
@@ -149,21 +170,31 @@ std::string ClangCursor::get_usr() const {
 }
 
 Usr ClangCursor::get_usr_hash() const {
-    CXString usr = clang_getCursorUSR(cx_cursor);
-    Usr ret = HashUsr(clang_getCString(usr));
-    clang_disposeString(usr);
-    return ret;
+    optional<Usr> usr = get_opt_usr_hash();
+    if (usr) return *usr;
+    return HashClangUsr("");
 }
 
 optional<Usr> ClangCursor::get_opt_usr_hash() const {
+    ClangUsrCache* cache = g_usr_cache;
+    if (cache) {
+        auto it = cache->m_usrs.find(*this);
+        if (it != cache->m_usrs.end()) {
+            ++cache->num_cached;
+            return it->second;
+        }
+    }
+
     CXString usr = clang_getCursorUSR(cx_cursor);
     const char* str = clang_getCString(usr);
-    if (!str || str[0] == '\0') {
-        clang_disposeString(usr);
-        return nullopt;
-    }
-    Usr ret = HashUsr(str);
+    optional<Usr> ret;
+    if (str && str[0] != '\0') ret = HashClangUsr(str);
     clang_disposeString(usr);
+
+    if (cache) {
+        ++cache->num_computed;
+        cache->m_usrs[*this] = ret;
+    }
     return ret;
 }
 
@@ -2,15 +2,21 @@
 
 #include <clang-c/Index.h>
 #include <optional.h>
+#include <string_view.h>
 
 #include <array>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "position.h"
 
 using Usr = uint64_t;
 
+// Hashes a USR reported by clang. Uses HashUsr (SipHash), or HashContents
+// (xxHash), which is faster, if index.fastUsrHash is set.
+Usr HashClangUsr(std::string_view usr);
+
 Range ResolveCXSourceRange(const CXSourceRange& range,
                            CXFile* cx_file = nullptr);
 
@@ -113,3 +119,27 @@ struct hash<ClangCursor> {
     }
 };
 }  // namespace std
+
+// While alive, memoizes ClangCursor::get_usr_hash on the current thread, since
+// the indexer asks for the usr of the same declaration many times. Cursors are
+// only valid as long as their translation unit, so create one per translation
+// unit.
+class ClangUsrCache {
+   public:
+    ClangUsrCache();
+    ~ClangUsrCache();
+    ClangUsrCache(const ClangUsrCache&) = delete;
+    ClangUsrCache& operator=(const ClangUsrCache&) = delete;
+
+    // Number of usrs which were computed by clang, and number of lookups which
+    // were answered from the cache instead.
+    int num_computed = 0;
+    int num_cached = 0;
+
+   private:
+    friend class ClangCursor;
+
+    // nullopt if the cursor has no usr.
+    std::unordered_map<ClangCursor, optional<Usr>> m_usrs;
+    ClangUsrCache* m_previous;
+};
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <loguru.hpp>
 
+#include "cache_manager.h"
 #include "clang_cursor.h"
 #include "clang_utils.h"
 #include "indexer.h"
@@ -344,6 +345,7 @@ IndexFile* ConsumeFile(IndexParam* param, CXFile file) {
         param->file_contents[db->path] = FileContents(db->path, contents);
         // Set modification time.
         db->last_modification_time = clang_getFileTime(file);
+        db->content_hash = HashContents(contents);
     }
 
     // Register that we saw this file even if it is not being indexed so that we
@@ -712,12 +714,83 @@ void Uniquify(std::vector<IndexId::LexicalRef>& refs) {
     refs.resize(n);
 }
 
+// Accumulates a fingerprint for IndexFingerprints. Ids are added as the usr of
+// the entity they refer to, since local ids are assigned in the order entities
+// are seen and differ between two indexes of the same file.
+class Fingerprinter {
+   public:
+    explicit Fingerprinter(IndexFile* file) : m_file(file) {}
+
+    void Add(uint64_t value) {
+        // Same as a round of xxh64.
+        m_hash ^= value * 0xC2B2AE3D27D4EB4FULL;
+        m_hash = (m_hash << 31) | (m_hash >> 33);
+        m_hash *= 0x9E3779B185EBCA87ULL;
+    }
+    void Add(const std::string& s) { Add(HashContents(s)); }
+    void Add(const Range& range) {
+        Add(uint64_t(uint16_t(range.start.line)) << 48 |
+            uint64_t(uint16_t(range.start.column)) << 32 |
+            uint64_t(uint16_t(range.end.line)) << 16 |
+            uint64_t(uint16_t(range.end.column)));
+    }
+    void Add(IndexId::Type id) { AddUsr(m_file->types, id.id); }
+    void Add(IndexId::Func id) { AddUsr(m_file->funcs, id.id); }
+    void Add(IndexId::Var id) { AddUsr(m_file->vars, id.id); }
+    void Add(const Reference& ref) {
+        Add(ref.range);
+        Add(uint64_t(ref.kind) << 16 | uint64_t(ref.role));
+        // IdMap maps every id of a file reference to the file itself.
+        switch (ref.kind) {
+            case SymbolKind::Type:
+                Add(IndexId::Type(ref.id));
+                break;
+            case SymbolKind::Func:
+                Add(IndexId::Func(ref.id));
+                break;
+            case SymbolKind::Var:
+                Add(IndexId::Var(ref.id));
+                break;
+            case SymbolKind::File:
+            case SymbolKind::Invalid:
+                break;
+        }
+    }
+    void Add(const IndexFunc::Declaration& decl) { Add(decl.spell); }
+    template <typename T>
+    void Add(const Maybe<T>& value) {
+        Add(uint64_t(bool(value)));
+        if (value) Add(*value);
+    }
+    template <typename T>
+    void Add(const std::vector<T>& values) {
+        Add(uint64_t(values.size()));
+        for (const T& value : values) Add(value);
+    }
+
+    // Returns the fingerprint and starts over.
+    uint64_t Take() {
+        uint64_t result = m_hash ? m_hash : 1;
+        m_hash = 0;
+        return result;
+    }
+
+   private:
+    template <typename T>
+    void AddUsr(const std::vector<T>& entities, RawId id) {
+        Add(id < entities.size() ? entities[id].usr : uint64_t(id));
+    }
+
+    IndexFile* m_file;
+    uint64_t m_hash = 0;
+};
+
 }  // namespace
 
 // static
 const int IndexFile::kMajorVersion = 16;
 // static
-const int IndexFile::kMinorVersion = 0;
+const int IndexFile::kMinorVersion = 2;
 
 IndexFile::IndexFile(const AbsolutePath& path)
     : id_cache(path), path(path), file_contents("#error <NONE>") {}
@@ -775,6 +848,76 @@ std::string IndexFile::ToString() {
 
 IndexType::IndexType(IndexId::Type id, Usr usr) : usr(usr), id(id) {}
 
+void ComputeFingerprints(IndexFile* file) {
+    // Only the fields which ToQuery copies into the querydb need to be part of
+    // the def fingerprints.
+    Fingerprinter fp(file);
+    for (IndexType& type : file->types) {
+        const IndexType::Def& def = type.def;
+        fp.Add(def.detailed_name);
+        fp.Add(uint64_t(def.short_name_offset));
+        fp.Add(uint64_t(def.short_name_size));
+        fp.Add(uint64_t(def.kind));
+        fp.Add(def.hover);
+        fp.Add(def.comments);
+        fp.Add(def.spell);
+        fp.Add(def.extent);
+        fp.Add(def.alias_of);
+        fp.Add(def.bases);
+        fp.Add(def.types);
+        fp.Add(def.funcs);
+        fp.Add(def.vars);
+        type.fingerprints.def = fp.Take();
+        fp.Add(type.declarations);
+        type.fingerprints.declarations = fp.Take();
+        fp.Add(type.derived);
+        type.fingerprints.derived = fp.Take();
+        fp.Add(type.instances);
+        type.fingerprints.instances = fp.Take();
+        fp.Add(type.uses);
+        type.fingerprints.uses = fp.Take();
+    }
+    for (IndexFunc& func : file->funcs) {
+        const IndexFunc::Def& def = func.def;
+        fp.Add(def.detailed_name);
+        fp.Add(uint64_t(def.short_name_offset));
+        fp.Add(uint64_t(def.short_name_size));
+        fp.Add(uint64_t(def.kind) << 8 | uint64_t(def.storage));
+        fp.Add(def.hover);
+        fp.Add(def.comments);
+        fp.Add(def.spell);
+        fp.Add(def.extent);
+        fp.Add(def.declaring_type);
+        fp.Add(def.bases);
+        fp.Add(def.vars);
+        fp.Add(def.callees);
+        func.fingerprints.def = fp.Take();
+        fp.Add(func.declarations);
+        func.fingerprints.declarations = fp.Take();
+        fp.Add(func.derived);
+        func.fingerprints.derived = fp.Take();
+        fp.Add(func.uses);
+        func.fingerprints.uses = fp.Take();
+    }
+    for (IndexVar& var : file->vars) {
+        const IndexVar::Def& def = var.def;
+        fp.Add(def.detailed_name);
+        fp.Add(uint64_t(def.short_name_offset));
+        fp.Add(uint64_t(def.short_name_size));
+        fp.Add(uint64_t(def.kind) << 8 | uint64_t(def.storage));
+        fp.Add(def.hover);
+        fp.Add(def.comments);
+        fp.Add(def.spell);
+        fp.Add(def.extent);
+        fp.Add(def.type);
+        var.fingerprints.def = fp.Take();
+        fp.Add(var.declarations);
+        var.fingerprints.declarations = fp.Take();
+        fp.Add(var.uses);
+        var.fingerprints.uses = fp.Take();
+    }
+}
+
 void AddRef(IndexFile* db, std::vector<IndexId::LexicalRef>& refs, Range range,
             ClangCursor parent, role role = role::Reference) {
     switch (GetSymbolKind(parent.get_kind())) {
@@ -1496,7 +1639,8 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
 
         case CXIdxEntity_CXXNamespace: {
             Range spell = cursor.get_spell();
-            IndexId::Type ns_id = db->ToTypeId(HashUsr(decl->entityInfo->USR));
+            IndexId::Type ns_id =
+                db->ToTypeId(HashClangUsr(decl->entityInfo->USR));
             IndexType* ns = db->Resolve(ns_id);
             ns->def.kind = GetSymbolKind(decl->entityInfo->kind);
             if (ns->def.detailed_name.empty()) {
@@ -1536,7 +1680,8 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
                 cursor.template_specialization_to_template_definition())
                 break;
 
-            IndexId::Var var_id = db->ToVarId(HashUsr(decl->entityInfo->USR));
+            IndexId::Var var_id =
+                db->ToVarId(HashClangUsr(decl->entityInfo->USR));
             IndexVar* var = db->Resolve(var_id);
 
             // TODO: Eventually run with this if. Right now I want to iron out
@@ -1765,7 +1910,7 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
                                   decl->lexicalContainer);
 
             IndexId::Type type_id =
-                db->ToTypeId(HashUsr(decl->entityInfo->USR));
+                db->ToTypeId(HashClangUsr(decl->entityInfo->USR));
             IndexType* type = db->Resolve(type_id);
 
             if (alias_of) type->def.alias_of = alias_of.value();
@@ -1820,7 +1965,7 @@ void OnIndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* decl) {
             Range spell = cursor.get_spell();
 
             IndexId::Type type_id =
-                db->ToTypeId(HashUsr(decl->entityInfo->USR));
+                db->ToTypeId(HashClangUsr(decl->entityInfo->USR));
             IndexType* type = db->Resolve(type_id);
 
             // TODO: Eventually run with this if. Right now I want to iron out
@@ -2086,7 +2231,7 @@ void OnIndexReference(CXClientData client_data, const CXIdxEntityRefInfo* ref) {
             Range loc = cursor.get_spell();
 
             IndexId::Func called_id =
-                db->ToFuncId(HashUsr(ref->referencedEntity->USR));
+                db->ToFuncId(HashClangUsr(ref->referencedEntity->USR));
             IndexFunc* called = db->Resolve(called_id);
 
             std::string_view short_name = called->def.ShortName();
@@ -2228,6 +2373,9 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
 
     if (dump_ast) Dump(clang_getTranslationUnitCursor(tu->cx_tu));
 
+    // Destroyed before |tu|, whose cursors it keeps.
+    ClangUsrCache usr_cache;
+
     IndexerCallbacks callback = {0};
     // Available callbacks:
     // - abortQuery
@@ -2267,6 +2415,9 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
 
     ClangCursor(clang_getTranslationUnitCursor(tu->cx_tu))
         .VisitChildren(&VisitMacroDefinitionAndExpansions, &param);
+    LOG_S(INFO) << "Computed " << usr_cache.num_computed << " usrs for "
+                << *file << ", " << usr_cache.num_cached
+                << " more lookups were cached";
 
     std::unordered_map<AbsolutePath, int> inc_to_line;
     // TODO
@@ -2275,7 +2426,7 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
             inc_to_line[inc.resolved_path] = inc.line;
 
     auto result = param.file_consumer->TakeLocalState();
-    auto args_hash = HashArguments(args);
+    auto args_hash = ICacheManager::HashArguments(args);
     for (std::unique_ptr<IndexFile>& entry : result) {
         entry->import_file = *file;
         entry->args_hash = args_hash;
@@ -2291,6 +2442,7 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
             Uniquify(type.def.funcs);
         }
         for (IndexVar& var : entry->vars) Uniquify(var.uses);
+        ComputeFingerprints(entry.get());
 
         if (param.primary_file) {
             // If there are errors, show at least one at the include position.
@@ -2408,39 +2560,3 @@ std::string GetClangVersion() {
     std::string version_string = ToString(clang_getClangVersion());
     return SplitString(version_string, " ")[2];
 }
-
-// |SymbolRef| is serialized this way.
-// |Use| also uses this though it has an extra field |file|,
-// which is not used by Index* so it does not need to be serialized.
-void Reflect(Reader& visitor, Reference& value) {
-    if (visitor.Format() == serialize_format::Json) {
-        std::string t = visitor.GetString();
-        char* s = const_cast<char*>(t.c_str());
-        value.range = Range(s);
-        s = strchr(s, '|');
-        value.id.id = RawId(strtol(s + 1, &s, 10));
-        value.kind = static_cast<SymbolKind>(strtol(s + 1, &s, 10));
-        value.role = static_cast<role>(strtol(s + 1, &s, 10));
-    } else {
-        Reflect(visitor, value.range);
-        Reflect(visitor, value.id);
-        Reflect(visitor, value.kind);
-        Reflect(visitor, value.role);
-    }
-}
-void Reflect(Writer& visitor, Reference& value) {
-    if (visitor.Format() == serialize_format::Json) {
-        std::string s = value.range.ToString();
-        // RawId(-1) -> "-1"
-        s += '|' + std::to_string(
-                       static_cast<std::make_signed<RawId>::type>(value.id.id));
-        s += '|' + std::to_string(int(value.kind));
-        s += '|' + std::to_string(int(value.role));
-        Reflect(visitor, s);
-    } else {
-        Reflect(visitor, value.range);
-        Reflect(visitor, value.id);
-        Reflect(visitor, value.kind);
-        Reflect(visitor, value.role);
-    }
-}
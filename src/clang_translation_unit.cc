@@ -154,3 +154,12 @@ ClangTranslationUnit::ClangTranslationUnit(CXTranslationUnit tu) : cx_tu(tu) {}
 ClangTranslationUnit::~ClangTranslationUnit() {
   clang_disposeTranslationUnit(cx_tu);
 }
+
+size_t ClangTranslationUnit::GetMemoryUsage() const {
+  CXTUResourceUsage usage = clang_getCXTUResourceUsage(cx_tu);
+  size_t bytes = 0;
+  for (unsigned i = 0; i < usage.numEntries; ++i)
+    bytes += usage.entries[i].amount;
+  clang_disposeCXTUResourceUsage(usage);
+  return bytes;
+}
@@ -28,5 +28,9 @@ struct ClangTranslationUnit {
   explicit ClangTranslationUnit(CXTranslationUnit tu);
   ~ClangTranslationUnit();
 
+  // Returns the bytes of memory used by the translation unit as reported by
+  // libclang, which includes the AST and the buffers of the preamble.
+  size_t GetMemoryUsage() const;
+
   CXTranslationUnit cx_tu;
 };
\ No newline at end of file
@@ -1,19 +1,312 @@
 #include "code_complete_cache.h"
 
-void CodeCompleteCache::WithLock(std::function<void()> action) {
+#include <doctest/doctest.h>
+
+#include "lex_utils.h"
+#include "query.h"
+#include "utils.h"
+#include "working_files.h"
+
+CodeCompleteCache::CodeCompleteCache(int max_entries)
+    : m_entries(max_entries) {}
+
+// static
+CodeCompleteCache::Key CodeCompleteCache::MakeKey(
+    const AbsolutePath& path, const WorkingFile* file,
+    optional<LsPosition> position) {
+    Key key;
+    key.path = path;
+    key.position = position;
+    if (file && position) {
+        std::string_view content = file->buffer_content;
+        int offset = GetOffsetForPosition(*position, content);
+        key.prefix_hash = HashContents(content.substr(0, offset));
+    }
+    return key;
+}
+
+std::shared_ptr<const CodeCompleteCache::Dependencies>
+CodeCompleteCache::GetDependencies(QueryDatabase* db,
+                                   const AbsolutePath& path) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_dependencies.find(path);
+        if (it != m_dependencies.end()) return it->second;
+    }
+
+    auto dependencies = std::make_shared<Dependencies>();
+    dependencies->insert(path);
+    auto it = db->usr_to_file.find(path);
+    if (it != db->usr_to_file.end()) {
+        const QueryFile& file = db->files[it->second.id];
+        if (file.def) {
+            dependencies->insert(file.def->dependencies.begin(),
+                                 file.def->dependencies.end());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dependencies.emplace(path, std::move(dependencies))
+        .first->second;
+}
+
+std::shared_ptr<const std::vector<lsCompletionItem>> CodeCompleteCache::TryGet(
+    const Key& key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::shared_ptr<Entry> entry;
+    if (!m_entries.TryGet(key, &entry)) return nullptr;
+    // The items can only be sent with their labels once their resolver has
+    // expired, so they are computed again instead.
+    if (!entry->results.empty() && entry->results[0].resolver_ &&
+        entry->results[0].resolver_->IsExpired()) {
+        m_entries.TryTake(key, nullptr);
+        return nullptr;
+    }
+    return std::shared_ptr<const std::vector<lsCompletionItem>>(
+        entry, &entry->results);
+}
+
+std::shared_ptr<const std::vector<lsCompletionItem>> CodeCompleteCache::Insert(
+    const Key& key, std::vector<lsCompletionItem> results,
+    const std::shared_ptr<const Dependencies>& dependencies) {
+    auto entry = std::make_shared<Entry>();
+    entry->results = std::move(results);
+    entry->dependencies = dependencies;
+
     std::lock_guard<std::mutex> lock(m_mutex);
-    action();
+    m_entries.TryTake(key, nullptr);
+    m_entries.Insert(key, entry);
+    return std::shared_ptr<const std::vector<lsCompletionItem>>(
+        entry, &entry->results);
 }
 
-bool CodeCompleteCache::IsCacheValid(LsTextDocumentPositionParams position) {
+void CodeCompleteCache::Invalidate(const AbsolutePath& path) {
     std::lock_guard<std::mutex> lock(m_mutex);
-    return m_cached_path == position.text_document.uri.GetAbsolutePath() &&
-           m_cached_completion_position == position.position;
+    m_entries.RemoveIf([&](const std::shared_ptr<Entry>& entry) {
+        return entry->dependencies && entry->dependencies->count(path);
+    });
+    for (auto it = m_dependencies.begin(); it != m_dependencies.end();) {
+        if (it->second->count(path))
+            it = m_dependencies.erase(it);
+        else
+            ++it;
+    }
 }
 
 void CodeCompleteCache::Clear() {
     std::lock_guard<std::mutex> lock(m_mutex);
-    m_cached_path.reset();
-    m_cached_completion_position.reset();
-    m_cached_results.clear();
+    m_entries.Clear();
+    m_dependencies.clear();
+}
+
+// static
+CompletionResolveCache* CompletionResolveCache::Instance() {
+    static CompletionResolveCache instance;
+    return &instance;
+}
+
+void CompletionResolveCache::Store(std::vector<lsCompletionItem>* items) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+    m_items.clear();
+    for (lsCompletionItem& item : *items) {
+        if (item.has_documentation_) continue;
+        item.data = std::vector<int>{m_generation, int(m_items.size())};
+
+        // Only what is needed to resolve the documentation is kept.
+        lsCompletionItem unresolved;
+        unresolved.resolver_ = item.resolver_;
+        unresolved.resolve_index_ = item.resolve_index_;
+        unresolved.has_documentation_ = false;
+        m_items.push_back(std::move(unresolved));
+    }
+}
+
+void CompletionResolveCache::Resolve(lsCompletionItem* item) {
+    if (!item->data || item->data->size() != 2) return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int generation = (*item->data)[0];
+    int index = (*item->data)[1];
+    if (generation != m_generation || index < 0 ||
+        index >= int(m_items.size()))
+        return;
+    m_items[index].ResolveDocumentation();
+    item->documentation = m_items[index].documentation;
+}
+
+TEST_SUITE("CodeCompleteCache") {
+    CodeCompleteCache::Key MakeTestKey(const std::string& path, int line,
+                                       uint64_t prefix_hash) {
+        CodeCompleteCache::Key key;
+        key.path = AbsolutePath(path, false /*validate*/);
+        key.position = LsPosition(line, 0);
+        key.prefix_hash = prefix_hash;
+        return key;
+    }
+
+    std::shared_ptr<const CodeCompleteCache::Dependencies> MakeTestDependencies(
+        CodeCompleteCache::Dependencies dependencies) {
+        return std::make_shared<const CodeCompleteCache::Dependencies>(
+            std::move(dependencies));
+    }
+
+    std::vector<lsCompletionItem> MakeTestResults(const std::string& label) {
+        lsCompletionItem item;
+        item.label = label;
+        return {item};
+    }
+
+    TEST_CASE("entries are keyed by position and buffer prefix") {
+        CodeCompleteCache cache;
+        cache.Insert(MakeTestKey("a.cc", 1, 10), MakeTestResults("a1"),
+                     MakeTestDependencies(
+                         {AbsolutePath("a.cc", false /*validate*/)}));
+        cache.Insert(MakeTestKey("a.cc", 2, 10), MakeTestResults("a2"),
+                     MakeTestDependencies(
+                         {AbsolutePath("a.cc", false /*validate*/)}));
+
+        REQUIRE(cache.TryGet(MakeTestKey("a.cc", 1, 10))->at(0).label ==
+                "a1");
+        REQUIRE(cache.TryGet(MakeTestKey("a.cc", 2, 10))->at(0).label ==
+                "a2");
+        REQUIRE(!cache.TryGet(MakeTestKey("a.cc", 1, 11)));
+        REQUIRE(!cache.TryGet(MakeTestKey("b.cc", 1, 10)));
+
+        // Inserting an existing key replaces its results.
+        cache.Insert(MakeTestKey("a.cc", 1, 10), MakeTestResults("a3"),
+                     nullptr);
+        REQUIRE(cache.TryGet(MakeTestKey("a.cc", 1, 10))->at(0).label ==
+                "a3");
+    }
+
+    TEST_CASE("least recently used entries are evicted") {
+        CodeCompleteCache cache(2);
+        cache.Insert(MakeTestKey("a.cc", 1, 0), MakeTestResults("1"), nullptr);
+        cache.Insert(MakeTestKey("a.cc", 2, 0), MakeTestResults("2"), nullptr);
+        std::shared_ptr<const std::vector<lsCompletionItem>> first =
+            cache.TryGet(MakeTestKey("a.cc", 1, 0));
+        cache.Insert(MakeTestKey("a.cc", 3, 0), MakeTestResults("3"), nullptr);
+
+        REQUIRE(cache.TryGet(MakeTestKey("a.cc", 1, 0)));
+        REQUIRE(!cache.TryGet(MakeTestKey("a.cc", 2, 0)));
+        REQUIRE(cache.TryGet(MakeTestKey("a.cc", 3, 0)));
+        REQUIRE(first->at(0).label == "1");
+    }
+
+    TEST_CASE("only entries depending on a re-indexed file are dropped") {
+        AbsolutePath a_cc("a.cc", false /*validate*/);
+        AbsolutePath b_cc("b.cc", false /*validate*/);
+        AbsolutePath a_h("a.h", false /*validate*/);
+        AbsolutePath c_h("c.h", false /*validate*/);
+
+        CodeCompleteCache cache;
+        cache.Insert(MakeTestKey("a.cc", 1, 0), MakeTestResults("a"),
+                     MakeTestDependencies({a_cc, a_h}));
+        cache.Insert(MakeTestKey("b.cc", 1, 0), MakeTestResults("b"),
+                     MakeTestDependencies({b_cc, c_h}));
+
+        cache.Invalidate(AbsolutePath("unrelated.h", false /*validate*/));
+        REQUIRE(cache.TryGet(MakeTestKey("a.cc", 1, 0)));
+        REQUIRE(cache.TryGet(MakeTestKey("b.cc", 1, 0)));
+
+        cache.Invalidate(a_h);
+        REQUIRE(!cache.TryGet(MakeTestKey("a.cc", 1, 0)));
+        REQUIRE(cache.TryGet(MakeTestKey("b.cc", 1, 0)));
+
+        cache.Invalidate(b_cc);
+        REQUIRE(!cache.TryGet(MakeTestKey("b.cc", 1, 0)));
+    }
+
+    TEST_CASE("dependencies are shared until the file is re-indexed") {
+        AbsolutePath a_cc("a.cc", false /*validate*/);
+        QueryDatabase db;
+        CodeCompleteCache cache;
+
+        std::shared_ptr<const CodeCompleteCache::Dependencies> dependencies =
+            cache.GetDependencies(&db, a_cc);
+        REQUIRE(dependencies->count(a_cc));
+        REQUIRE(cache.GetDependencies(&db, a_cc) == dependencies);
+
+        cache.Invalidate(a_cc);
+        REQUIRE(cache.GetDependencies(&db, a_cc) != dependencies);
+    }
+
+    TEST_CASE("dependencies follow the includes of the re-indexed file") {
+        AbsolutePath a_cc("a.cc", false /*validate*/);
+        AbsolutePath a_h("a.h", false /*validate*/);
+        AbsolutePath b_h("b.h", false /*validate*/);
+        QueryDatabase db;
+        db.usr_to_file[a_cc] = QueryId::File(0);
+        db.files.emplace_back(a_cc);
+        db.files[0].def->dependencies = {a_h};
+        CodeCompleteCache cache;
+        REQUIRE(cache.GetDependencies(&db, a_cc)->count(a_h));
+
+        // a.cc now includes b.h instead of a.h.
+        db.files[0].def->dependencies = {b_h};
+        cache.Invalidate(a_cc);
+        std::shared_ptr<const CodeCompleteCache::Dependencies> dependencies =
+            cache.GetDependencies(&db, a_cc);
+        REQUIRE(!dependencies->count(a_h));
+        REQUIRE(dependencies->count(b_h));
+    }
+
+    struct FakeResolver : ICompletionItemResolver {
+        int num_resolved = 0;
+        bool is_expired = false;
+
+        void ResolveTexts(lsCompletionItem* item) override {}
+        void ResolveDocumentation(lsCompletionItem* item) override {
+            ++num_resolved;
+            item->documentation =
+                "doc " + std::to_string(item->resolve_index_);
+        }
+        bool IsExpired() override { return is_expired; }
+    };
+
+    TEST_CASE("results of expired resolvers are not reused") {
+        auto resolver = std::make_shared<FakeResolver>();
+        std::vector<lsCompletionItem> results = MakeTestResults("a");
+        results[0].resolver_ = resolver;
+        results[0].has_texts_ = false;
+
+        CodeCompleteCache cache;
+        cache.Insert(MakeTestKey("a.cc", 1, 0), results, nullptr);
+        REQUIRE(cache.TryGet(MakeTestKey("a.cc", 1, 0)));
+
+        resolver->is_expired = true;
+        REQUIRE(!cache.TryGet(MakeTestKey("a.cc", 1, 0)));
+    }
+
+    TEST_CASE("documentation is resolved for the last response") {
+        auto resolver = std::make_shared<FakeResolver>();
+        std::vector<lsCompletionItem> items(3);
+        for (uint32_t i = 0; i < items.size(); ++i) {
+            items[i].resolver_ = resolver;
+            items[i].resolve_index_ = i;
+            items[i].has_documentation_ = false;
+        }
+        items[1].ResolveDocumentation();
+
+        CompletionResolveCache cache;
+        cache.Store(&items);
+        REQUIRE(items[0].data);
+        REQUIRE(!items[1].data);
+        REQUIRE(items[2].data);
+
+        // The client only sends back what it received.
+        lsCompletionItem resolved;
+        resolved.data = items[2].data;
+        cache.Resolve(&resolved);
+        REQUIRE(resolved.documentation == std::string("doc 2"));
+        cache.Resolve(&resolved);
+        REQUIRE(resolver->num_resolved == 2);
+
+        // Items of an older response are not resolved.
+        lsCompletionItem stale;
+        stale.data = items[0].data;
+        cache.Store(&items);
+        cache.Resolve(&stale);
+        REQUIRE(!stale.documentation);
+    }
 }
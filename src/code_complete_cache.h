@@ -2,22 +2,95 @@
 
 #include <optional.h>
 
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "lru_cache.h"
 #include "lsp_completion.h"
 
+struct QueryDatabase;
+struct WorkingFile;
+
 // Cached completion information, so we can give fast completion results when
-// the user erases a character. vscode will resend the completion request if
-// that happens.
+// the user erases a character or comes back to an earlier completion point.
+// vscode will resend the completion request if that happens.
+//
+// Results are kept for the most recently used completion points. They are only
+// dropped when the file or one of the files it includes is re-indexed, since
+// that is when the results may have changed.
 struct CodeCompleteCache {
-    // NOTE: Make sure to access these variables under |WithLock|.
-    optional<AbsolutePath> m_cached_path;
-    optional<LsPosition> m_cached_completion_position;
-    std::vector<lsCompletionItem> m_cached_results;
+    using Dependencies = std::unordered_set<AbsolutePath>;
 
-    std::mutex m_mutex;
+    struct Key {
+        AbsolutePath path;
+        // Not set for global completion, whose results do not depend on where
+        // in the file they are requested.
+        optional<LsPosition> position;
+        // Hash of the buffer contents before |position|.
+        uint64_t prefix_hash = 0;
+
+        bool operator==(const Key& other) const {
+            return path == other.path && position == other.position &&
+                   prefix_hash == other.prefix_hash;
+        }
+    };
+
+    static const int k_default_max_entries = 16;
 
-    void WithLock(std::function<void()> action);
-    bool IsCacheValid(LsTextDocumentPositionParams position);
+    explicit CodeCompleteCache(int max_entries = k_default_max_entries);
+
+    // Builds the key for completing at |position| in |path|. |file| is the
+    // working file for |path|, or null.
+    static Key MakeKey(const AbsolutePath& path, const WorkingFile* file,
+                       optional<LsPosition> position);
+    // Returns the files the completion results for |path| depend on, ie,
+    // |path| and everything it includes. The set is built once and shared by
+    // every entry for |path| until one of the files is re-indexed.
+    std::shared_ptr<const Dependencies> GetDependencies(
+        QueryDatabase* db, const AbsolutePath& path);
+
+    // Returns the cached results for |key| or null. The results stay valid
+    // after the entry is evicted.
+    std::shared_ptr<const std::vector<lsCompletionItem>> TryGet(
+        const Key& key);
+    // |dependencies| is null if the results do not depend on any file. Returns
+    // the cached results.
+    std::shared_ptr<const std::vector<lsCompletionItem>> Insert(
+        const Key& key, std::vector<lsCompletionItem> results,
+        const std::shared_ptr<const Dependencies>& dependencies);
+    // Drops the entries and dependency sets which contain |path|.
+    void Invalidate(const AbsolutePath& path);
     void Clear();
+
+   private:
+    struct Entry {
+        std::vector<lsCompletionItem> results;
+        std::shared_ptr<const Dependencies> dependencies;
+    };
+
+    std::mutex m_mutex;
+    LruCache<Key, std::shared_ptr<Entry>> m_entries;
+    std::unordered_map<AbsolutePath, std::shared_ptr<const Dependencies>>
+        m_dependencies;
+};
+
+// The completion items of the last completion response whose documentation is
+// left to completionItem/resolve. The client sends |lsCompletionItem::data|
+// back to identify them.
+struct CompletionResolveCache {
+    static CompletionResolveCache* Instance();
+
+    // Sets |data| of the |items| whose documentation has not been resolved and
+    // remembers them until the next call.
+    void Store(std::vector<lsCompletionItem>* items);
+    // Sets the documentation of |item| if it is from the last response.
+    void Resolve(lsCompletionItem* item);
+
+   private:
+    std::mutex m_mutex;
+    int m_generation = 0;
+    std::vector<lsCompletionItem> m_items;
 };
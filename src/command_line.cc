@@ -21,6 +21,7 @@
 #include "import_manager.h"
 #include "import_pipeline.h"
 #include "include_complete.h"
+#include "index_only.h"
 #include "indexer.h"
 #include "lex_utils.h"
 #include "lru_cache.h"
@@ -29,17 +30,21 @@
 #include "message_handler.h"
 #include "options.h"
 #include "platform.h"
+#include "preload_predictor.h"
 #include "project.h"
 #include "query.h"
 #include "query_utils.h"
 #include "queue_manager.h"
 #include "recorder.h"
+#include "replay.h"
 #include "semantic_highlight_symbol_cache.h"
 #include "serializer.h"
 #include "serializers/json.h"
+#include "stats.h"
 #include "test.h"
 #include "timer.h"
 #include "timestamp_manager.h"
+#include "trace.h"
 #include "work_thread.h"
 #include "working_files.h"
 
@@ -81,6 +86,13 @@ Mode:
                 Run index tests. opt_filter_path can be used to specify which
                 test to run (ie, "foo" will run all tests which contain "foo"
                 in the path). If not provided all tests are run.
+  --index-only <project>
+                Index every file in the project and write the results to the
+                cache, using all cores, then exit and print the throughput.
+                Options such as cacheDirectory and cacheFormat are taken from
+                --init; cacheDirectory defaults to
+                <project>/.cquery_cached_index. A language server using the
+                same options starts from this cache.
   (default if no other mode is specified)
                 Run as a language server over stdin and stdout
 
@@ -90,6 +102,22 @@ Other command line options:
          https://github.com/cquery-project/cquery/wiki/Initialization-options
   --record <path>
                 Writes stdin to <path>.in and stdout to <path>.out
+  --replay <path>
+                Instead of reading stdin, replays the session recorded with
+                --record <path> and writes a JSON report of the latency of
+                each request. Indexing is finished before replaying requests
+                after initialization. Files in the recording must exist at the
+                same paths.
+  --replay-speed <factor>
+                Replays <factor> times faster than recorded; 0 replays as fast
+                as possible. Defaults to 1.
+  --replay-report <path>
+                Where --replay writes its report. Defaults to
+                <path>.report.json
+  --trace-file <path>
+                Writes a trace of indexing, requests, completion and
+                diagnostics to <path> on exit. Open it in chrome://tracing or
+                https://ui.perfetto.dev
   --log-file <path>
                 Logging file for diagnostics
   --log-file-append <path>
@@ -108,6 +136,29 @@ See more on https://github.com/cquery-project/cquery/wiki
 )help";
 }
 
+// Reads the --init JSON |init| into |config|. Prints an error and returns false
+// if it is invalid.
+bool ParseInitOptions(const std::string& init, Config* config) {
+    rapidjson::Document reader;
+    rapidjson::ParseResult ok = reader.Parse(init.c_str());
+    if (!ok) {
+        std::cerr << "Failed to parse --init as JSON: "
+                  << rapidjson::GetParseError_En(ok.Code()) << " ("
+                  << ok.Offset() << ")\n";
+        return false;
+    }
+    JsonReader json_reader{&reader};
+    try {
+        Reflect(json_reader, *config);
+    } catch (std::invalid_argument& e) {
+        std::cerr << "Fail to parse --init "
+                  << static_cast<JsonReader&>(json_reader).GetPath()
+                  << ", expected " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
 // Writes the environment to stdcerr.
 void PrintEnvironment(const char** env) {
     while (*env) {
@@ -180,6 +231,7 @@ bool QueryDbMainLoop(QueryDatabase* db, Project* project,
         bool found_handler = false;
         for (MessageHandler* handler : *MessageHandler::message_handlers) {
             if (handler->GetMethodType() == (*message)->GetMethodType()) {
+                TraceScope trace("lsp", handler->GetMethodType());
                 handler->Run(std::move(*message));
                 found_handler = true;
                 break;
@@ -196,7 +248,8 @@ bool QueryDbMainLoop(QueryDatabase* db, Project* project,
     }
 
     if (QueryDbImportMain(db, import_manager, status, semantic_cache,
-                          working_files)) {
+                          working_files, global_code_complete_cache,
+                          non_global_code_complete_cache)) {
         did_work = true;
     }
 
@@ -258,6 +311,7 @@ void RunQueryDbThread(const std::string& bin_name) {
 
     // Run query db main loop.
     SetCurrentThreadName("querydb");
+    SetTraceThreadName("querydb");
     while (true) {
         WriteQueryDbStatus(true);
         bool did_work = QueryDbMainLoop(
@@ -271,8 +325,15 @@ void RunQueryDbThread(const std::string& bin_name) {
             // Cleanup and free any unused memory.
             FreeUnusedMemory();
 
-            WriteQueryDbStatus(false);
+            // Use the idle time to parse files the user may open next, unless
+            // the indexer is still busy.
             auto* queue = QueueManager::Instance();
+            if (import_pipeline_status.num_active_threads == 0 &&
+                queue->index_request.IsEmpty()) {
+                WarmCompletionSessions(&db, &working_files, &clang_complete);
+            }
+
+            WriteQueryDbStatus(false);
             QueueManager::Instance()->querydb_waiter->Wait(
                 &queue->for_querydb, &queue->do_id_map,
                 &queue->on_indexed_for_querydb);
@@ -353,13 +414,25 @@ void LaunchStdoutThread(std::unordered_map<MethodType, Timer>* request_times) {
             Stdout_Request message = queue->for_stdout.Dequeue();
 
             if (ShouldDisplayMethodTiming(message.method)) {
-                Timer time = (*request_times)[message.method];
-                time.ResetAndPrint("[e2e] Running " +
-                                   std::string(message.method));
+                // Notifications sent by cquery have no request to time. The
+                // entry is erased so a later notification of the same method
+                // is not timed from this request.
+                auto it = request_times->find(message.method);
+                if (it != request_times->end()) {
+                    Stats::Instance()->RecordRequest(
+                        message.method, it->second.ElapsedMicroseconds());
+                    it->second.ResetAndPrint("[e2e] Running " +
+                                             std::string(message.method));
+                    request_times->erase(it);
+                }
             }
 
             RecordOutput(message.content);
 
+            if (IsReplaying()) {
+                OnReplayOutput(message.content);
+                continue;
+            }
             fwrite(message.content.c_str(), message.content.size(), 1, stdout);
             fflush(stdout);
         }
@@ -369,7 +442,7 @@ void LaunchStdoutThread(std::unordered_map<MethodType, Timer>* request_times) {
 void LanguageServerMain(const std::string& bin_name) {
     std::unordered_map<MethodType, Timer> request_times;
 
-    LaunchStdinLoop(&request_times);
+    if (!IsReplaying()) LaunchStdinLoop(&request_times);
 
     // We run a dedicated thread for writing to stdout because there can be an
     // unknown number of delays when output information.
@@ -388,6 +461,8 @@ int main(int argc, char** argv, const char** env) {
     }
 
     g_config = new Config();
+    // Starts the uptime reported by $cquery/stats.
+    Stats::Instance();
 
     TraceMe();
 
@@ -430,6 +505,9 @@ int main(int argc, char** argv, const char** env) {
 
     if (HasOption(options, "--record")) EnableRecording(options["--record"]);
 
+    if (HasOption(options, "--trace-file"))
+        EnableTracing(options["--trace-file"]);
+
     if (HasOption(options, "--check")) {
         loguru::g_stderr_verbosity = loguru::Verbosity_MAX;
 
@@ -470,6 +548,15 @@ int main(int argc, char** argv, const char** env) {
         if (res != 0 || context.shouldExit()) return res;
     }
 
+    if (HasOption(options, "--index-only")) {
+        language_server = false;
+        if (HasOption(options, "--init") &&
+            !ParseInitOptions(options["--init"], g_config)) {
+            return 1;
+        }
+        if (!RunIndexOnly(options["--index-only"])) return 1;
+    }
+
     if (HasOption(options, "--test-index")) {
         language_server = false;
         if (!RunIndexTests(options["--test-index"],
@@ -482,24 +569,19 @@ int main(int argc, char** argv, const char** env) {
             // We check syntax error here but override client-side
             // initializationOptions in messages/initialize.cc
             g_init_options = options["--init"];
-            rapidjson::Document reader;
-            rapidjson::ParseResult ok = reader.Parse(g_init_options.c_str());
-            if (!ok) {
-                std::cerr << "Failed to parse --init as JSON: "
-                          << rapidjson::GetParseError_En(ok.Code()) << " ("
-                          << ok.Offset() << ")\n";
-                return 1;
-            }
-            JsonReader json_reader{&reader};
-            try {
-                Config config;
-                Reflect(json_reader, config);
-            } catch (std::invalid_argument& e) {
-                std::cerr << "Fail to parse --init "
-                          << static_cast<JsonReader&>(json_reader).GetPath()
-                          << ", expected " << e.what() << "\n";
-                return 1;
-            }
+            Config config;
+            if (!ParseInitOptions(g_init_options, &config)) return 1;
+        }
+
+        if (HasOption(options, "--replay")) {
+            std::string path = options["--replay"];
+            double speed = 1;
+            if (HasOption(options, "--replay-speed"))
+                speed = atof(options["--replay-speed"].c_str());
+            std::string report_path = path + ".report.json";
+            if (HasOption(options, "--replay-report"))
+                report_path = options["--replay-report"];
+            if (!StartReplay(path, speed, report_path)) return 1;
         }
 
         LanguageServerMain(argv[0]);
@@ -48,6 +48,27 @@ struct Config {
     // whenever a struct member has changed.
     serialize_format cacheFormat = serialize_format::Json;
 
+    // If true, the cache does not depend on where the project is checked out,
+    // so it can be built by CI (ie, with --index-only) or copied from another
+    // checkout. Paths inside the project are stored relative to the project
+    // root, and a cached file whose modification time differs is still used if
+    // its contents are unchanged. Relocatable caches should not share a
+    // cacheDirectory with other projects.
+    bool cacheRelocatable = false;
+
+    // Read-only relocatable cache which is used for files that have no index
+    // in cacheDirectory. Indexes taken from it are copied into cacheDirectory
+    // once their contents have been validated. Requires cacheRelocatable.
+    //
+    // Example value: "/mnt/shared/cquery-cache/myproject/"
+    std::string cacheBaseDirectory;
+
+    // Paths outside of the project which differ between the machine that built
+    // a relocatable cache and this one, as "<path there>=<path here>" prefixes.
+    //
+    // Example value: ["/opt/ci/toolchain/=/usr/"]
+    std::vector<std::string> cachePathMappings;
+
     // Value to use for clang -resource-dir if not present in
     // compile_commands.json.
     //
@@ -100,6 +121,12 @@ struct Config {
     struct CodeLens {
         // Enables code lens on parameter and function variables.
         bool localVariables = true;
+        // If true, code lens are sent without their command, which is filled
+        // in by codeLens/resolve once the client displays them. A request
+        // then takes time in the number of symbols of the file instead of in
+        // the number of their references. Set to false for clients which do
+        // not resolve code lens.
+        bool lazyLocations = true;
     };
     CodeLens codeLens;
 
@@ -139,6 +166,36 @@ struct Config {
         // LSP clients that implement their own filtering and sorting logic.
         bool filterAndSort = true;
 
+        // If true, the documentation of completion items is only computed when
+        // the client resolves an item (completionItem/resolve) instead of for
+        // every item in the response. Clients which do not resolve completion
+        // items will not show documentation.
+        bool lazyDocumentation = false;
+
+        // Maximum number of files which have a completion session, ie, parsed
+        // translation units kept in memory. Preloaded sessions are for files
+        // the user has viewed but not requested completion in.
+        int maxPreloadedSessions = 10;
+        int maxCompletionSessions = 5;
+
+        // If positive, the least recently used completion sessions, preloaded
+        // ones first, are dropped once all sessions together use more than
+        // this many megabytes, as measured after each parse.
+        int sessionMemoryBudgetMb = 0;
+
+        // If true, completion and diagnostics of a file share one translation
+        // unit, which halves the memory of a session. Completion then has to
+        // wait for diagnostics of the same file and vice versa.
+        bool shareTranslationUnit = false;
+
+        // Number of completion sessions cquery may build ahead of time, while
+        // it is otherwise idle, for files the user is likely to open next:
+        // files recently navigated to, files included by the current file and
+        // other open files. They count towards maxPreloadedSessions and
+        // sessionMemoryBudgetMb but never push out sessions of viewed files.
+        // 0 disables warming.
+        int warmupSessions = 0;
+
         // Maximum path length to show in completion results. Paths longer than
         // this will be elided with ".." put at the front. Set to 0 or a
         // negative number to disable eliding.
@@ -231,6 +288,29 @@ struct Config {
 
         // Number of indexer threads. If 0, 80% of cores are used.
         int threads = 0;
+
+        // If true, the project and include directories are watched for
+        // changes (Linux only). Changed files are reindexed without the client
+        // sending workspace/didChangeWatchedFiles, and checking whether a file
+        // changed no longer needs to stat it. Changes made by other machines
+        // on a network filesystem are not noticed.
+        bool watchFiles = false;
+
+        // How long querydb may be busy applying index updates before it
+        // handles pending LSP requests. Index updates are merged into batches
+        // which fit this budget, and indexing of non-interactive files is
+        // paused while querydb is far behind.
+        int latencyBudgetMs = 50;
+
+        // If true, hover and comments are not kept in memory. They are read
+        // from the cache of the file which defines a symbol when the symbol
+        // is hovered, which saves a lot of memory in large projects.
+        // Changing this reindexes every file.
+        bool lazyHover = false;
+
+        // If true, usrs are hashed with xxHash instead of SipHash, which is
+        // faster. Changing this reindexes every file.
+        bool fastUsrHash = false;
     };
     Index index;
 
@@ -255,20 +335,25 @@ struct Config {
     };
     Xref xref;
 };
-MAKE_REFLECT_STRUCT(Config::CodeLens, localVariables);
+MAKE_REFLECT_STRUCT(Config::CodeLens, localVariables, lazyLocations);
 MAKE_REFLECT_STRUCT(Config::Completion, enableSnippets, detailedLabel,
-                    dropOldRequests, filterAndSort, includeMaxPathSize,
-                    includeSuffixWhitelist, includeBlacklist, includeWhitelist);
+                    dropOldRequests, filterAndSort, lazyDocumentation,
+                    maxPreloadedSessions, maxCompletionSessions,
+                    sessionMemoryBudgetMb, shareTranslationUnit,
+                    warmupSessions, includeMaxPathSize, includeSuffixWhitelist,
+                    includeBlacklist, includeWhitelist);
 MAKE_REFLECT_STRUCT(Config::Formatting, enabled)
 MAKE_REFLECT_STRUCT(Config::Diagnostics, blacklist, whitelist, frequencyMs,
                     onParse, onType)
 MAKE_REFLECT_STRUCT(Config::Highlight, enabled, blacklist, whitelist)
 MAKE_REFLECT_STRUCT(Config::Index, attributeMakeCallsToCtor, blacklist,
-                    whitelist, comments, enabled, logSkippedPaths, threads);
+                    whitelist, comments, enabled, logSkippedPaths, threads,
+                    watchFiles, latencyBudgetMs, lazyHover, fastUsrHash);
 MAKE_REFLECT_STRUCT(Config::WorkspaceSymbol, maxNum, sort);
 MAKE_REFLECT_STRUCT(Config::Xref, maxNum);
 MAKE_REFLECT_STRUCT(Config, compilationDatabaseCommand,
                     compilationDatabaseDirectory, cacheDirectory, cacheFormat,
+                    cacheRelocatable, cacheBaseDirectory, cachePathMappings,
                     resourceDirectory,
 
                     discoverSystemIncludes, extraClangArguments,
@@ -0,0 +1,224 @@
+#include "file_watcher.h"
+
+#include <loguru.hpp>
+
+#include "config.h"
+#include "platform.h"
+#include "timer.h"
+#include "utils.h"
+#include "work_thread.h"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <limits>
+
+// static
+const int64_t FileWatcher::k_unknown = std::numeric_limits<int64_t>::min();
+// static
+const int64_t FileWatcher::k_missing = std::numeric_limits<int64_t>::min() + 1;
+
+// static
+FileWatcher* FileWatcher::Instance() {
+    static FileWatcher instance;
+    return &instance;
+}
+
+optional<int64_t> FileWatcher::GetModificationTime(const AbsolutePath& path) {
+    optional<FileId> directory_id =
+        PathInterner::Instance()->TryGet(GetDirName(path.path));
+    if (!directory_id || !m_watched_directories.Get(*directory_id))
+        return GetLastModificationTime(path);
+
+    FileId file_id = PathInterner::Instance()->Intern(path.path);
+    int64_t cached = m_modification_times.Get(file_id);
+    if (cached == k_missing) return nullopt;
+    if (cached != k_unknown) return cached;
+
+    uint64_t generation = m_generation.load();
+    optional<int64_t> modification_time = GetLastModificationTime(path);
+    if (m_generation.load() != generation) return modification_time;
+    int64_t stored = modification_time.value_or(k_missing);
+    m_modification_times.Set(file_id, stored);
+    // An invalidation may have happened between the check and the store, in
+    // which case |stored| may be older than the change; forget it again
+    // unless another lookup replaced it already.
+    if (m_generation.load() != generation) {
+        m_modification_times.Update(file_id, [&](int64_t current) {
+            return current == stored ? k_unknown : current;
+        });
+    }
+    return modification_time;
+}
+
+void FileWatcher::Invalidate(const std::string& path) {
+    ++m_generation;
+    if (optional<FileId> file_id = PathInterner::Instance()->TryGet(path))
+        m_modification_times.Set(*file_id, k_unknown);
+}
+
+#if defined(__linux__)
+
+namespace {
+const uint32_t k_watch_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB |
+                              IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                              IN_MOVED_TO | IN_ONLYDIR;
+}  // namespace
+
+bool FileWatcher::Start(const std::vector<std::string>& directories,
+                        OnChange on_change) {
+    m_fd = inotify_init1(IN_CLOEXEC);
+    if (m_fd < 0) {
+        LOG_S(WARNING) << "Unable to initialize inotify: " << strerror(errno);
+        return false;
+    }
+    m_on_change = std::move(on_change);
+
+    WorkThread::StartThread("file_watcher", [this, directories]() {
+        Timer time;
+        for (std::string directory : directories) {
+            EnsureEndsInSlash(directory);
+            WatchRecursive(directory);
+        }
+        time.ResetAndPrint("[perf] Watching " +
+                           std::to_string(m_watches.size()) + " directories");
+        Run();
+    });
+    return true;
+}
+
+void FileWatcher::WatchRecursive(const std::string& directory) {
+    // Do not watch the cache, it changes whenever a file is indexed.
+    if (!g_config->cacheDirectory.empty() &&
+        StartsWith(directory, g_config->cacheDirectory)) {
+        return;
+    }
+    FileId directory_id = PathInterner::Instance()->Intern(directory);
+    if (m_watched_directories.Get(directory_id)) return;
+
+    int wd = inotify_add_watch(m_fd, directory.c_str(), k_watch_mask);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            LOG_S(WARNING) << "Reached the inotify watch limit at " << directory
+                           << "; increase fs.inotify.max_user_watches to "
+                              "watch more directories";
+        }
+        return;
+    }
+    m_watches[wd] = directory;
+    m_watched_directories.Set(directory_id, true);
+
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return;
+    while (dirent* entry = readdir(dir)) {
+        // Skips ".", ".." and hidden directories like .git.
+        if (entry->d_name[0] == '.') continue;
+        // Symlinks are not followed to avoid cycles.
+        if (entry->d_type != DT_DIR) continue;
+        WatchRecursive(directory + entry->d_name + '/');
+    }
+    closedir(dir);
+}
+
+void FileWatcher::UnwatchRecursive(const std::string& directory) {
+    for (auto it = m_watches.begin(); it != m_watches.end();) {
+        if (StartsWith(it->second, directory)) {
+            inotify_rm_watch(m_fd, it->first);
+            m_watched_directories.Set(
+                PathInterner::Instance()->Intern(it->second), false);
+            it = m_watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FileWatcher::Run() {
+    alignas(inotify_event) char buffer[64 * 1024];
+    while (true) {
+        ssize_t length = read(m_fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EINTR) continue;
+            LOG_S(ERROR) << "Unable to read inotify events: "
+                         << strerror(errno);
+            return;
+        }
+
+        // Editors write a file in several steps, so only report each file
+        // once per batch of events.
+        std::unordered_map<std::string, ChangeType> changes;
+        for (char* p = buffer; p < buffer + length;) {
+            auto* event = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were dropped, so nothing in the table can be trusted.
+                LOG_S(WARNING) << "inotify queue overflowed; invalidating all "
+                                  "modification times";
+                ++m_generation;
+                for (FileId id = 0; id < PathInterner::Instance()->Size(); ++id)
+                    m_modification_times.Set(id, k_unknown);
+                continue;
+            }
+
+            auto watch = m_watches.find(event->wd);
+            if (watch == m_watches.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                // The directory was deleted or moved away.
+                m_watched_directories.Set(
+                    PathInterner::Instance()->Intern(watch->second), false);
+                m_watches.erase(watch);
+                continue;
+            }
+            if (!event->len) continue;
+
+            std::string path = watch->second + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    WatchRecursive(path + '/');
+                    // Files may have been added before the watch was.
+                    GetFilesAndDirectoriesInFolder(
+                        path, true /*recursive*/, true /*add_folder_to_path*/,
+                        [&](const std::string& file) {
+                            if (IsDirectory(file)) return;
+                            Invalidate(file);
+                            changes[file] = ChangeType::kChanged;
+                        });
+                }
+                if (event->mask & IN_MOVED_FROM)
+                    UnwatchRecursive(path + '/');
+                continue;
+            }
+
+            Invalidate(path);
+            if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                changes[path] = ChangeType::kChanged;
+            else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                changes[path] = ChangeType::kDeleted;
+        }
+
+        for (auto& change : changes)
+            m_on_change(AbsolutePath(change.first), change.second);
+    }
+}
+
+#else
+
+bool FileWatcher::Start(const std::vector<std::string>& directories,
+                        OnChange on_change) {
+    LOG_S(WARNING) << "index.watchFiles is only supported on Linux";
+    return false;
+}
+
+void FileWatcher::WatchRecursive(const std::string& directory) {}
+
+void FileWatcher::UnwatchRecursive(const std::string& directory) {}
+
+void FileWatcher::Run() {}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <optional.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "file_types.h"
+#include "path_interner.h"
+
+// Watches directories for changes, keeping a table of modification times for
+// the files inside of them so that checking whether a file changed does not
+// need to stat it, and reporting changes as they happen.
+//
+// This uses inotify and is only available on Linux. Elsewhere, or before
+// Start() is called, every lookup falls through to GetLastModificationTime.
+struct FileWatcher {
+    enum class ChangeType { kChanged, kDeleted };
+    using OnChange =
+        std::function<void(const AbsolutePath& path, ChangeType type)>;
+
+    static FileWatcher* Instance();
+
+    // Starts watching |directories| and all of their subdirectories on a
+    // background thread. |on_change| is called on that thread for every file
+    // which was written or deleted. Returns false if watching is unsupported.
+    bool Start(const std::vector<std::string>& directories, OnChange on_change);
+
+    // Returns the modification time of |path|, or nullopt if it does not
+    // exist. Only files in unwatched directories are stat'd every time.
+    optional<int64_t> GetModificationTime(const AbsolutePath& path);
+
+   private:
+    // Values in |m_modification_times| which are not timestamps.
+    static const int64_t k_unknown;
+    static const int64_t k_missing;
+
+    void WatchRecursive(const std::string& directory);
+    // Stops watching |directory| after it was moved away, since events from
+    // it would be reported under its old path.
+    void UnwatchRecursive(const std::string& directory);
+    void Invalidate(const std::string& path);
+    void Run();
+
+    OnChange m_on_change;
+    int m_fd = -1;
+    // inotify watch descriptor -> watched directory. Only used on the watcher
+    // thread once started.
+    std::unordered_map<int, std::string> m_watches;
+    // Indexed by the FileId of a directory; true if it is being watched.
+    FileIdTable<bool> m_watched_directories{false};
+    // Indexed by the FileId of a file in a watched directory.
+    FileIdTable<int64_t> m_modification_times{k_unknown};
+    // Incremented whenever an entry of |m_modification_times| is invalidated.
+    // A stat result is only kept if no invalidation raced with it, as it may
+    // otherwise be older than the change that was just reported.
+    std::atomic<uint64_t> m_generation{0};
+};
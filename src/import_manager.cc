@@ -1,9 +1,19 @@
 #include "import_manager.h"
 
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <functional>
 #include <mutex>
 #include <ostream>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "assert.h"
+#include "timer.h"
+#include "timestamp_manager.h"
 
 std::ostream& operator<<(std::ostream& os, const PipelineStatus& status) {
     switch (status) {
@@ -26,11 +36,115 @@ std::ostream& operator<<(std::ostream& os, const PipelineStatus& status) {
 }
 
 PipelineStatus ImportManager::GetStatus(const std::string& path) {
-    // Try reading the value
-    {
-        std::shared_lock<std::shared_timed_mutex> lock(m_status_mutex);
-        auto it = m_status.find(path);
-        if (it != m_status.end()) return it->second;
+    optional<FileId> file_id = PathInterner::Instance()->TryGet(path);
+    if (!file_id) return PipelineStatus::kNotSeen;
+    return GetStatus(*file_id);
+}
+
+PipelineStatus ImportManager::GetStatus(FileId file_id) {
+    return m_status.Get(file_id);
+}
+
+TEST_SUITE("ImportManager") {
+    TEST_CASE("SetStatusAtomic") {
+        ImportManager manager;
+        std::string path = "/import_manager_test/a.cc";
+        REQUIRE(manager.GetStatus(path) == PipelineStatus::kNotSeen);
+        auto start_import = [](PipelineStatus status) {
+            if (status == PipelineStatus::kNotSeen)
+                return PipelineStatus::kProcessingInitialImport;
+            return status;
+        };
+        REQUIRE(manager.SetStatusAtomic(path, start_import));
+        REQUIRE(!manager.SetStatusAtomic(path, start_import));
+        REQUIRE(manager.GetStatus(path) ==
+                PipelineStatus::kProcessingInitialImport);
+    }
+
+    TEST_CASE("concurrent updates are not lost") {
+        // Every indexer thread tries to start the import of every file, like
+        // common headers; each file is still imported once.
+        const int k_files = 1000;
+        const int k_threads = 8;
+        auto path = [](int i) {
+            return "/import_manager_concurrent_test/" + std::to_string(i);
+        };
+        auto start_import = [](PipelineStatus status) {
+            if (status == PipelineStatus::kNotSeen)
+                return PipelineStatus::kProcessingInitialImport;
+            return status;
+        };
+
+        ImportManager manager;
+        std::atomic<int> num_started(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < k_threads; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < k_files; ++i) {
+                    if (manager.SetStatusAtomic(path((i + t * 7919) % k_files),
+                                                start_import))
+                        ++num_started;
+                }
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+
+        REQUIRE(num_started == k_files);
+        for (int i = 0; i < k_files; ++i) {
+            REQUIRE(manager.GetStatus(path(i)) ==
+                    PipelineStatus::kProcessingInitialImport);
+        }
+    }
+
+    // Run with --test-unit --no-skip -tc="*contention*".
+    TEST_CASE("contention benchmark" * doctest::skip()) {
+        const int k_files = 20000;
+        std::vector<std::string> paths;
+        for (int i = 0; i < k_files; ++i)
+            paths.push_back("/import_manager_benchmark/" + std::to_string(i));
+
+        // The previous implementation, for comparison.
+        std::shared_timed_mutex locked_mutex;
+        std::unordered_map<std::string, PipelineStatus> locked_status;
+
+        auto cycle = [](PipelineStatus status) {
+            return status == PipelineStatus::kImported
+                       ? PipelineStatus::kProcessingUpdate
+                       : PipelineStatus::kImported;
+        };
+        auto run = [&](const char* name, int num_threads,
+                       std::function<void(const std::string&)> update) {
+            Timer timer;
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads; ++t) {
+                threads.emplace_back([&, t]() {
+                    // Every thread touches every file, like common headers
+                    // being checked by every indexer thread.
+                    for (int i = 0; i < k_files; ++i)
+                        update(paths[(i + t * 7919) % k_files]);
+                });
+            }
+            for (std::thread& thread : threads) thread.join();
+            timer.ResetAndPrint(std::string(name) + " with " +
+                                std::to_string(num_threads) + " threads");
+        };
+
+        for (int num_threads : {1, 4, 16, 64}) {
+            run("single lock", num_threads, [&](const std::string& path) {
+                std::unique_lock<std::shared_timed_mutex> lock(locked_mutex);
+                PipelineStatus& status = locked_status[path];
+                status = cycle(status);
+            });
+
+            ImportManager manager;
+            run("ImportManager", num_threads, [&](const std::string& path) {
+                manager.SetStatusAtomic(path, cycle);
+            });
+
+            TimestampManager timestamps;
+            run("TimestampManager", num_threads, [&](const std::string& path) {
+                timestamps.UpdateCachedModificationTime(path, 1, 0);
+            });
+        }
     }
-    return PipelineStatus::kNotSeen;
 }
@@ -6,12 +6,14 @@
 #include <chrono>
 #include <loguru.hpp>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "cache_manager.h"
 #include "code_complete_cache.h"
 #include "config.h"
 #include "diagnostics_engine.h"
+#include "file_watcher.h"
 #include "iindexer.h"
 #include "import_manager.h"
 #include "lsp.h"
@@ -20,8 +22,10 @@
 #include "project.h"
 #include "query_utils.h"
 #include "queue_manager.h"
+#include "stats.h"
 #include "timer.h"
 #include "timestamp_manager.h"
+#include "trace.h"
 
 namespace {
 
@@ -32,41 +36,57 @@ struct OutProgress : public LsOutMessage<OutProgress> {
         int onIdMappedCount = 0;
         int onIndexedCount = 0;
         int activeThreads = 0;
+        // State of the ImportPipelineController.
+        long long queryDbBacklogFiles = 0;
+        double applyUsPerFile = 0;
+        double requestWaitMs = 0;
+        int maxMergedFiles = 0;
+        bool indexingThrottled = false;
     };
     std::string method = "$cquery/progress";
     Params params;
 };
 MAKE_REFLECT_STRUCT(OutProgress::Params, indexRequestCount, doIdMapCount,
-                    onIdMappedCount, onIndexedCount, activeThreads);
+                    onIdMappedCount, onIndexedCount, activeThreads,
+                    queryDbBacklogFiles, applyUsPerFile, requestWaitMs,
+                    maxMergedFiles, indexingThrottled);
 MAKE_REFLECT_STRUCT(OutProgress, jsonrpc, method, params);
 
-// Instead of processing messages forever, we only process upto
-// |kIterationSize| messages of a type at one time. While the import time
-// likely stays the same, this should reduce overall queue lengths which means
-// the user gets a usable index faster.
-constexpr int k_iteration_size = 200;
-struct IterationLoop {
-    int remaining = k_iteration_size;
-    void IncreaseCount() { remaining *= 50; }
-
-    bool Next() { return remaining-- > 0; }
-    void Reset() { remaining = k_iteration_size; }
-};
+// Used until querydb has applied an index update and measured the real cost.
+const double k_initial_apply_us_per_file = 1000;
+// Weight of a new sample in the moving averages of the controller.
+const double k_controller_smoothing = 0.2;
+// Upper bound for merged index updates, regardless of how cheap they are.
+const size_t k_max_merged_files = 10000;
+// querydb work, in latency budgets, which may be queued before new index
+// updates are merged instead.
+const double k_querydb_backlog_budgets = 20;
+// querydb work, in latency budgets, at which indexers stop parsing
+// non-interactive files.
+const double k_throttle_backlog_budgets = 200;
 
 struct IModificationTimestampFetcher {
     virtual ~IModificationTimestampFetcher() = default;
     virtual optional<int64_t> GetModificationTime(const AbsolutePath& path) = 0;
+    // Returns HashContents of the current contents of |path|.
+    virtual optional<uint64_t> GetContentHash(const AbsolutePath& path) = 0;
 };
 struct RealModificationTimestampFetcher : IModificationTimestampFetcher {
     ~RealModificationTimestampFetcher() override = default;
 
     // IModificationTimestamp:
     optional<int64_t> GetModificationTime(const AbsolutePath& path) override {
-        return GetLastModificationTime(path);
+        return FileWatcher::Instance()->GetModificationTime(path);
+    }
+    optional<uint64_t> GetContentHash(const AbsolutePath& path) override {
+        optional<std::string> content = ReadContent(path);
+        if (!content) return nullopt;
+        return HashContents(*content);
     }
 };
 struct FakeModificationTimestampFetcher : IModificationTimestampFetcher {
     std::unordered_map<std::string, optional<int64_t>> entries;
+    std::unordered_map<std::string, uint64_t> content_hashes;
 
     ~FakeModificationTimestampFetcher() override = default;
 
@@ -76,6 +96,11 @@ struct FakeModificationTimestampFetcher : IModificationTimestampFetcher {
         assert(it != entries.end());
         return it->second;
     }
+    optional<uint64_t> GetContentHash(const AbsolutePath& path) override {
+        auto it = content_hashes.find(path);
+        if (it == content_hashes.end()) return nullopt;
+        return it->second;
+    }
 };
 
 struct ActiveThread {
@@ -101,6 +126,12 @@ struct ActiveThread {
         out.params.onIndexedCount = queue->on_indexed_for_merge.Size() +
                                     queue->on_indexed_for_querydb.Size();
         out.params.activeThreads = status_->num_active_threads;
+        const ImportPipelineController& controller = status_->controller;
+        out.params.queryDbBacklogFiles = controller.queued_files_for_querydb;
+        out.params.applyUsPerFile = controller.apply_us_per_file;
+        out.params.requestWaitMs = controller.request_wait_us / 1000;
+        out.params.maxMergedFiles = int(controller.MaxMergedFiles());
+        out.params.indexingThrottled = controller.ShouldThrottleIndexing();
 
         // Ignore this progress update if the last update was too recent.
         if (g_config->progressReportFrequencyMs != 0) {
@@ -150,6 +181,29 @@ ChangeResult ComputeChangeStatus(
         timestamp_manager->GetLastCachedModificationTime(cache_manager.get(),
                                                          path);
 
+    // The timestamp changed but the contents are what they were when the file
+    // was indexed, ie, after switching branches back and forth or touching
+    // the file. Remember the new timestamp, also in the cache so this check is
+    // not repeated on the next startup, and skip the parse.
+    if (last_cached_modification &&
+        modification_timestamp != *last_cached_modification) {
+        uint64_t last_content_hash =
+            timestamp_manager->GetLastCachedContentHash(path);
+        if (last_content_hash != 0 &&
+            modification_timestamp_fetcher->GetContentHash(path) ==
+                last_content_hash) {
+            LOG_S(INFO) << "Timestamp has changed but contents have not for "
+                        << path << unwrap_opt(from);
+            timestamp_manager->UpdateCachedModificationTime(
+                path, *modification_timestamp, last_content_hash);
+            if (IndexFile* cached = cache_manager->TryLoad(path)) {
+                cached->last_modification_time = *modification_timestamp;
+                cache_manager->WriteToCache(*cached);
+            }
+            last_cached_modification = modification_timestamp;
+        }
+    }
+
     // File has been changed.
     if (!last_cached_modification ||
         modification_timestamp != *last_cached_modification) {
@@ -158,7 +212,8 @@ ChangeResult ComputeChangeStatus(
     }
 
     if (opt_previous_index) {
-        if (HashArguments(args) != opt_previous_index->args_hash) {
+        if (ICacheManager::HashArguments(args) !=
+            opt_previous_index->args_hash) {
             LOG_S(INFO) << "Arguments have changed for " << path
                         << unwrap_opt(from);
             return ChangeResult::kYes;
@@ -177,6 +232,7 @@ CacheLoadResult TryLoadFromCache(
     ImportManager* import_manager,
     const std::shared_ptr<ICacheManager>& cache_manager, bool is_interactive,
     const Project::Entry& entry, const AbsolutePath& path_to_index) {
+    TraceScope trace("index", "LoadCache", path_to_index.path);
     IndexFile* previous_index = cache_manager->TryLoad(path_to_index);
     if (!previous_index) return CacheLoadResult::kParse;
 
@@ -298,8 +354,12 @@ void ParseFile(DiagnosticsEngine* diag_engine, WorkingFiles* working_files,
     std::vector<FileContents> file_contents;
     if (request.contents)
         file_contents.push_back(FileContents(request.path, *request.contents));
-    auto indexes = indexer->Index(file_consumer_shared, path_to_index,
-                                  entry.args, file_contents);
+    optional<std::vector<std::unique_ptr<IndexFile>>> indexes;
+    {
+        TraceScope trace("index", "Parse", path_to_index.path);
+        indexes = indexer->Index(file_consumer_shared, path_to_index,
+                                 entry.args, file_contents);
+    }
 
     if (!indexes) {
         if (g_config->index.enabled && request.id.has_value()) {
@@ -312,6 +372,11 @@ void ParseFile(DiagnosticsEngine* diag_engine, WorkingFiles* working_files,
         return;
     }
 
+    size_t num_bytes = 0;
+    for (const std::unique_ptr<IndexFile>& index : *indexes)
+        num_bytes += index->file_contents.size();
+    Stats::Instance()->RecordIndexed(num_bytes);
+
     std::vector<Index_DoIdMap> result;
 
     // Add the set of indexes we want to actually import from the index
@@ -380,7 +445,8 @@ void ParseFile(DiagnosticsEngine* diag_engine, WorkingFiles* working_files,
                         << request.current->path;
             request.cache_manager->WriteToCache(*request.current);
             timestamp_manager->UpdateCachedModificationTime(
-                request.current->path, request.current->last_modification_time);
+                request.current->path, request.current->last_modification_time,
+                request.current->content_hash);
         }
     }
 
@@ -388,15 +454,19 @@ void ParseFile(DiagnosticsEngine* diag_engine, WorkingFiles* working_files,
                                                    request.is_interactive);
 }
 
+// If |interactive_only| is true, only requests for files the user is looking
+// at are parsed.
 bool IndexMain_DoParse(
     DiagnosticsEngine* diag_engine, WorkingFiles* working_files,
     FileConsumerSharedState* file_consumer_shared,
     TimestampManager* timestamp_manager,
     IModificationTimestampFetcher* modification_timestamp_fetcher,
-    ImportManager* import_manager, IIndexer* indexer) {
+    ImportManager* import_manager, IIndexer* indexer,
+    bool interactive_only = false) {
     auto* queue = QueueManager::Instance();
     optional<Index_Request> request =
-        queue->index_request.TryDequeue(true /*priority*/);
+        interactive_only ? queue->index_request.TryDequeuePriority()
+                         : queue->index_request.TryDequeue(true /*priority*/);
     if (!request) return false;
 
     Project::Entry entry;
@@ -408,12 +478,14 @@ bool IndexMain_DoParse(
     return true;
 }
 
-bool IndexMain_DoCreateIndexUpdate(TimestampManager* timestamp_manager) {
+bool IndexMain_DoCreateIndexUpdate(TimestampManager* timestamp_manager,
+                                   ImportPipelineController* controller) {
     auto* queue = QueueManager::Instance();
 
+    // Id mapped files are already in memory, so all of them are turned into
+    // updates. How many reach querydb at once is up to |controller|.
     bool did_work = false;
-    IterationLoop loop;
-    while (loop.Next()) {
+    while (true) {
         optional<Index_OnIdMapped> response =
             queue->on_id_mapped.TryDequeue(true /*priority*/);
         if (!response) return did_work;
@@ -428,6 +500,8 @@ bool IndexMain_DoCreateIndexUpdate(TimestampManager* timestamp_manager) {
         }
 
         // Build delta update.
+        TraceScope trace("index", "CreateDelta",
+                         response->current->file->path.path);
         IndexUpdate update = IndexUpdate::CreateDelta(
             previous_id_map, response->current->ids.get(), previous_index,
             response->current->file.get());
@@ -435,19 +509,22 @@ bool IndexMain_DoCreateIndexUpdate(TimestampManager* timestamp_manager) {
                     << response->current->file->path
                     << " (is_delta=" << !!response->previous << ")";
 
+        // Interactive updates always go straight to querydb so the user sees
+        // them asap.
+        size_t num_files = update.files_def_update.size();
         IndexOnIndexed reply(std::move(update));
-        const int k_max_size_for_querydb = 1000;
-        ThreadedQueue<IndexOnIndexed>& q =
-            queue->on_indexed_for_querydb.Size() < k_max_size_for_querydb
-                ? queue->on_indexed_for_querydb
-                : queue->on_indexed_for_merge;
-        q.Enqueue(std::move(reply), response->is_interactive /*priority*/);
+        if (response->is_interactive || !controller->ShouldMerge()) {
+            controller->OnQueuedForQueryDb(num_files);
+            queue->on_indexed_for_querydb.Enqueue(
+                std::move(reply), response->is_interactive /*priority*/);
+        } else {
+            queue->on_indexed_for_merge.Enqueue(std::move(reply),
+                                                false /*priority*/);
+        }
     }
-
-    return did_work;
 }
 
-bool IndexMergeIndexUpdates() {
+bool IndexMergeIndexUpdates(ImportPipelineController* controller) {
     // Merge low-priority requests, since priority requests should get serviced
     // by querydb asap.
 
@@ -455,10 +532,13 @@ bool IndexMergeIndexUpdates() {
     optional<IndexOnIndexed> root =
         queue->on_indexed_for_merge.TryDequeue(false /*priority*/);
     if (!root) return false;
+    TraceScope trace("index", "Merge");
 
+    // querydb applies a merged update in one go, so keep it small enough to
+    // not block LSP requests for longer than the latency budget.
+    size_t max_files = controller->MaxMergedFiles();
     bool did_merge = false;
-    IterationLoop loop;
-    while (loop.Next()) {
+    while (root->update.files_def_update.size() < max_files) {
         optional<IndexOnIndexed> to_join =
             queue->on_indexed_for_merge.TryDequeue(false /*priority*/);
         if (!to_join) break;
@@ -466,17 +546,74 @@ bool IndexMergeIndexUpdates() {
         root->update.Merge(std::move(to_join->update));
     }
 
-    const int k_max_size_for_querydb = 10;
-    ThreadedQueue<IndexOnIndexed>& q =
-        queue->on_indexed_for_querydb.Size() < k_max_size_for_querydb
-            ? queue->on_indexed_for_querydb
-            : queue->on_indexed_for_merge;
-    q.Enqueue(std::move(*root), false /*priority*/);
+    size_t num_files = root->update.files_def_update.size();
+    if (IsTracingEnabled())
+        trace.SetDetail(std::to_string(num_files) + " files");
+    if (num_files >= max_files || !controller->ShouldMerge()) {
+        controller->OnQueuedForQueryDb(num_files);
+        queue->on_indexed_for_querydb.Enqueue(std::move(*root),
+                                              false /*priority*/);
+    } else {
+        queue->on_indexed_for_merge.Enqueue(std::move(*root),
+                                            false /*priority*/);
+    }
     return did_merge;
 }
 
 }  // namespace
 
+ImportPipelineController::ImportPipelineController()
+    : apply_us_per_file(k_initial_apply_us_per_file),
+      request_wait_us(0),
+      merge_scale(1),
+      queued_files_for_querydb(0) {}
+
+void ImportPipelineController::OnApplied(size_t num_files,
+                                         long long elapsed_us) {
+    if (num_files == 0) return;
+    apply_us_per_file =
+        (1 - k_controller_smoothing) * apply_us_per_file +
+        k_controller_smoothing * (double(elapsed_us) / num_files);
+    // Slowly grow merged updates again while they are well within budget.
+    if (elapsed_us < LatencyBudgetUs() / 2)
+        merge_scale = std::min(1.0, merge_scale * 1.05);
+}
+
+void ImportPipelineController::OnRequestWaited(long long wait_us) {
+    request_wait_us = (1 - k_controller_smoothing) * request_wait_us +
+                      k_controller_smoothing * wait_us;
+    if (wait_us > LatencyBudgetUs())
+        merge_scale = std::max(1.0 / k_max_merged_files, merge_scale * 0.5);
+}
+
+void ImportPipelineController::OnQueuedForQueryDb(size_t num_files) {
+    queued_files_for_querydb += num_files;
+}
+
+void ImportPipelineController::OnDequeuedForQueryDb(size_t num_files) {
+    queued_files_for_querydb -= num_files;
+}
+
+long long ImportPipelineController::LatencyBudgetUs() const {
+    return std::max(1, g_config->index.latencyBudgetMs) * 1000LL;
+}
+
+size_t ImportPipelineController::MaxMergedFiles() const {
+    double files = LatencyBudgetUs() / apply_us_per_file * merge_scale;
+    return std::max<size_t>(
+        1, std::min<size_t>(k_max_merged_files, size_t(files)));
+}
+
+bool ImportPipelineController::ShouldMerge() const {
+    return queued_files_for_querydb * apply_us_per_file >
+           k_querydb_backlog_budgets * LatencyBudgetUs();
+}
+
+bool ImportPipelineController::ShouldThrottleIndexing() const {
+    return queued_files_for_querydb * apply_us_per_file >
+           k_throttle_backlog_budgets * LatencyBudgetUs();
+}
+
 ImportPipelineStatus::ImportPipelineStatus()
     : num_active_threads(0), next_progress_output(0) {}
 
@@ -484,9 +621,7 @@ void IndexerMain(DiagnosticsEngine* diag_engine,
                  FileConsumerSharedState* file_consumer_shared,
                  TimestampManager* timestamp_manager,
                  ImportManager* import_manager, ImportPipelineStatus* status,
-                 Project* project, WorkingFiles* working_files,
-                 CodeCompleteCache* global_code_complete_cache,
-                 CodeCompleteCache* non_global_code_complete_cache) {
+                 Project* project, WorkingFiles* working_files) {
     RealModificationTimestampFetcher modification_timestamp_fetcher;
     auto* queue = QueueManager::Instance();
     // Build one index per-indexer, as building the index acquires a global
@@ -508,29 +643,33 @@ void IndexerMain(DiagnosticsEngine* diag_engine,
             // IndexMain_DoCreateIndexUpdate so we don't starve querydb from
             // doing any work. Running both also lets the user query the
             // partially constructed index.
+            //
+            // If querydb is far behind, only parse interactive files so that
+            // the backlog (and memory usage) does not keep growing.
             did_work = IndexMain_DoParse(
                            diag_engine, working_files, file_consumer_shared,
                            timestamp_manager, &modification_timestamp_fetcher,
-                           import_manager, indexer.get()) ||
+                           import_manager, indexer.get(),
+                           status->controller.ShouldThrottleIndexing()) ||
                        did_work;
 
-            did_work =
-                IndexMain_DoCreateIndexUpdate(timestamp_manager) || did_work;
+            did_work = IndexMain_DoCreateIndexUpdate(timestamp_manager,
+                                                     &status->controller) ||
+                       did_work;
 
             // Nothing to index and no index updates to create, so join some
             // already created index updates to reduce work on querydb thread.
-            if (!did_work) did_work = IndexMergeIndexUpdates() || did_work;
-
-            // Our completion cache might not be correct once we've indexed a
-            // file so it should be cleared.
-            if (did_work) {
-                global_code_complete_cache->Clear();
-                non_global_code_complete_cache->Clear();
-            }
+            if (!did_work)
+                did_work =
+                    IndexMergeIndexUpdates(&status->controller) || did_work;
         }
 
-        // We didn't do any work, so wait for a notification.
-        if (!did_work) {
+        // We didn't do any work, so wait for a notification. While querydb is
+        // backlogged there may be queued work this thread must not take, so
+        // poll instead of spinning on the queues.
+        if (!did_work && status->controller.ShouldMerge()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        } else if (!did_work) {
             QueueManager::Instance()->indexer_waiter->Wait(
                 &queue->index_request, &queue->on_id_mapped,
                 &queue->load_previous_index, &queue->on_indexed_for_merge);
@@ -542,6 +681,7 @@ namespace {
 void QueryDbDoIdMap(QueueManager* queue, QueryDatabase* db,
                     ImportManager* import_manager, Index_DoIdMap* request) {
     assert(request->current);
+    TraceScope trace("querydb", "IdMap", request->current->path.path);
     Index_OnIdMapped response(request->cache_manager, request->is_interactive,
                               request->write_to_disk);
     auto make_map = [db](std::unique_ptr<IndexFile> file)
@@ -563,12 +703,35 @@ void QueryDbOnIndexed(QueueManager* queue, QueryDatabase* db,
                       ImportManager* import_manager,
                       ImportPipelineStatus* status,
                       SemanticHighlightSymbolCache* semantic_cache,
-                      WorkingFiles* working_files, IndexOnIndexed* response) {
+                      WorkingFiles* working_files,
+                      CodeCompleteCache* global_code_complete_cache,
+                      CodeCompleteCache* non_global_code_complete_cache,
+                      IndexOnIndexed* response) {
+    size_t num_files = response->update.files_def_update.size();
+    status->controller.OnDequeuedForQueryDb(num_files);
+
     Timer time;
-    db->ApplyIndexUpdate(&response->update);
-    time.ResetAndPrint(
-        "Applying index update for " +
-        std::to_string(response->update.files_def_update.size()) + " files");
+    {
+        TraceScope trace("querydb", "ApplyIndexUpdate");
+        if (IsTracingEnabled()) {
+            trace.SetDetail(
+                num_files == 1
+                    ? response->update.files_def_update[0].value.path.path
+                    : std::to_string(num_files) + " files");
+        }
+        db->ApplyIndexUpdate(&response->update);
+    }
+    status->controller.OnApplied(num_files, time.ElapsedMicroseconds());
+    time.ResetAndPrint("Applying index update for " +
+                       std::to_string(num_files) + " files");
+
+    // Completion results, and the dependencies they were computed with, are
+    // dropped once querydb has the new dependencies of the updated files.
+    // Before that, a completion request would memoize the old ones again.
+    for (auto& updated_file : response->update.files_def_update) {
+        global_code_complete_cache->Invalidate(updated_file.value.path);
+        non_global_code_complete_cache->Invalidate(updated_file.value.path);
+    }
 
     // Update indexed content, inactive lines, and semantic highlighting.
     for (auto& updated_file : response->update.files_def_update) {
@@ -607,31 +770,49 @@ void QueryDbOnIndexed(QueueManager* queue, QueryDatabase* db,
 bool QueryDbImportMain(QueryDatabase* db, ImportManager* import_manager,
                        ImportPipelineStatus* status,
                        SemanticHighlightSymbolCache* semantic_cache,
-                       WorkingFiles* working_files) {
+                       WorkingFiles* working_files,
+                       CodeCompleteCache* global_code_complete_cache,
+                       CodeCompleteCache* non_global_code_complete_cache) {
     auto* queue = QueueManager::Instance();
 
     ActiveThread active_thread(status);
 
     bool did_work = false;
 
-    IterationLoop loop;
-    loop.IncreaseCount();
-    while (loop.Next()) {
+    // Return to handling LSP requests once one is waiting or the latency
+    // budget is used up, but always make some progress on imports.
+    ImportPipelineController& controller = status->controller;
+    Timer pass_time;
+    auto should_yield = [&](long long budget_us) {
+        return !queue->for_querydb.IsEmpty() ||
+               pass_time.ElapsedMicroseconds() >= budget_us;
+    };
+
+    // Id mapping is cheap compared to applying updates, but leave at least
+    // half of the budget for the latter.
+    while (true) {
         optional<Index_DoIdMap> request =
             queue->do_id_map.TryDequeue(true /*priority*/);
         if (!request) break;
         did_work = true;
         QueryDbDoIdMap(queue, db, import_manager, &*request);
+        if (should_yield(controller.LatencyBudgetUs() / 2)) break;
     }
 
-    loop.Reset();
-    while (loop.Next()) {
+    while (true) {
         optional<IndexOnIndexed> response =
             queue->on_indexed_for_querydb.TryDequeue(true /*priority*/);
         if (!response) break;
         did_work = true;
+        Timer update_time;
         QueryDbOnIndexed(queue, db, import_manager, status, semantic_cache,
-                         working_files, &*response);
+                         working_files, global_code_complete_cache,
+                         non_global_code_complete_cache, &*response);
+        if (!queue->for_querydb.IsEmpty()) {
+            controller.OnRequestWaited(update_time.ElapsedMicroseconds());
+            break;
+        }
+        if (should_yield(controller.LatencyBudgetUs())) break;
     }
 
     return did_work;
@@ -709,7 +890,8 @@ TEST_SUITE("ImportPipeline") {
             REQUIRE(check("aa.cc") == ChangeResult::kYes);
             REQUIRE(check("aa.cc") == ChangeResult::kYes);
             REQUIRE(check("aa.cc") == ChangeResult::kYes);
-            timestamp_manager.UpdateCachedModificationTime("aa.cc", timestamp);
+            timestamp_manager.UpdateCachedModificationTime("aa.cc", timestamp,
+                                                           0);
             REQUIRE(check("aa.cc") == ChangeResult::kNo);
         };
         check_timestamp_change(5);
@@ -717,8 +899,20 @@ TEST_SUITE("ImportPipeline") {
         check_timestamp_change(5);
         check_timestamp_change(4);
 
+        // A timestamp change is ignored if the contents still have the hash
+        // they were indexed with.
+        timestamp_manager.UpdateCachedModificationTime("aa.cc", 5, 42);
+        modification_timestamp_fetcher.entries["aa.cc"] = 7;
+        modification_timestamp_fetcher.content_hashes["aa.cc"] = 42;
+        REQUIRE(check("aa.cc") == ChangeResult::kNo);
+        REQUIRE(*timestamp_manager.GetLastCachedModificationTime(
+                    cache_manager.get(), "aa.cc") == 7);
+        modification_timestamp_fetcher.entries["aa.cc"] = 8;
+        modification_timestamp_fetcher.content_hashes["aa.cc"] = 43;
+        REQUIRE(check("aa.cc") == ChangeResult::kYes);
+
         // Argument change implies reimport, even if timestamp has not changed.
-        timestamp_manager.UpdateCachedModificationTime("aa.cc", 5);
+        timestamp_manager.UpdateCachedModificationTime("aa.cc", 5, 0);
         modification_timestamp_fetcher.entries["aa.cc"] = 5;
         REQUIRE(check("aa.cc", false /*is_dependency*/,
                       false /*is_interactive*/, {"b"} /*old_args*/,
@@ -776,4 +970,27 @@ TEST_SUITE("ImportPipeline") {
 
         REQUIRE(file_consumer_shared.used_files.empty());
     }
+
+    TEST_CASE("controller") {
+        ImportPipelineController controller;
+        long long budget_us = controller.LatencyBudgetUs();
+
+        // Merged updates are sized to the measured apply cost.
+        for (int i = 0; i < 50; ++i) controller.OnApplied(10, budget_us);
+        REQUIRE(controller.MaxMergedFiles() == 10);
+
+        // Requests which still wait too long shrink merged updates further.
+        controller.OnRequestWaited(2 * budget_us);
+        REQUIRE(controller.MaxMergedFiles() == 5);
+
+        // A querydb backlog leads to merging first, then throttling.
+        REQUIRE(!controller.ShouldMerge());
+        controller.OnQueuedForQueryDb(1000);
+        REQUIRE(controller.ShouldMerge());
+        REQUIRE(!controller.ShouldThrottleIndexing());
+        controller.OnQueuedForQueryDb(10000);
+        REQUIRE(controller.ShouldThrottleIndexing());
+        controller.OnDequeuedForQueryDb(11000);
+        REQUIRE(!controller.ShouldMerge());
+    }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstddef>
 
 struct DiagnosticsEngine;
 struct FileConsumerSharedState;
@@ -12,10 +13,50 @@ struct TimestampManager;
 struct WorkingFiles;
 struct CodeCompleteCache;
 
+// Balances indexer throughput against querydb latency. querydb reports how
+// long applying index updates takes and whether LSP requests had to wait for
+// it. From that the controller decides how many files a merged index update
+// may cover, when new index updates should be merged instead of queued for
+// querydb, and when indexers should stop picking up non-interactive work so
+// querydb can catch up.
+struct ImportPipelineController {
+    ImportPipelineController();
+
+    // Called by querydb after applying an index update for |num_files| files.
+    void OnApplied(size_t num_files, long long elapsed_us);
+    // Called by querydb when an LSP request arrived while it was applying an
+    // index update which took |wait_us|.
+    void OnRequestWaited(long long wait_us);
+    // Track the number of files in on_indexed_for_querydb.
+    void OnQueuedForQueryDb(size_t num_files);
+    void OnDequeuedForQueryDb(size_t num_files);
+
+    // How long querydb may be busy before handling LSP requests.
+    long long LatencyBudgetUs() const;
+    // Maximum number of files a merged index update may cover.
+    size_t MaxMergedFiles() const;
+    // True if querydb already has enough queued work, so new index updates
+    // should be merged instead.
+    bool ShouldMerge() const;
+    // True if indexers should only parse interactive requests until querydb
+    // catches up.
+    bool ShouldThrottleIndexing() const;
+
+    // Estimated time querydb takes to apply the index for one file.
+    std::atomic<double> apply_us_per_file;
+    // Recent time LSP requests waited for an index update to be applied.
+    std::atomic<double> request_wait_us;
+    // Shrinks merged updates when requests wait longer than the budget even
+    // though |apply_us_per_file| predicts otherwise. In (0, 1].
+    std::atomic<double> merge_scale;
+    std::atomic<long long> queued_files_for_querydb;
+};
+
 // FIXME: rename
 struct ImportPipelineStatus {
     std::atomic<int> num_active_threads;
     std::atomic<long long> next_progress_output;
+    ImportPipelineController controller;
 
     ImportPipelineStatus();
 };
@@ -24,11 +65,11 @@ void IndexerMain(DiagnosticsEngine* diag_engine,
                  FileConsumerSharedState* file_consumer_shared,
                  TimestampManager* timestamp_manager,
                  ImportManager* import_manager, ImportPipelineStatus* status,
-                 Project* project, WorkingFiles* working_files,
-                 CodeCompleteCache* global_code_complete_cache,
-                 CodeCompleteCache* non_global_code_complete_cache);
+                 Project* project, WorkingFiles* working_files);
 
 bool QueryDbImportMain(QueryDatabase* db, ImportManager* import_manager,
                        ImportPipelineStatus* status,
                        SemanticHighlightSymbolCache* semantic_cache,
-                       WorkingFiles* working_files);
+                       WorkingFiles* working_files,
+                       CodeCompleteCache* global_code_complete_cache,
+                       CodeCompleteCache* non_global_code_complete_cache);
@@ -0,0 +1,123 @@
+#include "index_only.h"
+
+#include <loguru.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "cache_manager.h"
+#include "config.h"
+#include "file_consumer.h"
+#include "iindexer.h"
+#include "indexer.h"
+#include "platform.h"
+#include "project.h"
+#include "timer.h"
+
+bool RunIndexOnly(const std::string& project_dir) {
+    optional<AbsolutePath> project_path = NormalizePath(project_dir);
+    if (!project_path) {
+        LOG_S(ERROR) << "Cannot find project directory " << project_dir;
+        return false;
+    }
+    std::string root = project_path->path;
+    EnsureEndsInSlash(root);
+    g_config->projectRoot = root;
+
+    if (g_config->cacheDirectory.empty())
+        g_config->cacheDirectory = root + ".cquery_cached_index/";
+    optional<AbsolutePath> cache_dir =
+        NormalizePath(g_config->cacheDirectory, false /*ensure_exists*/);
+    if (!cache_dir) {
+        LOG_S(ERROR) << "Cannot find cache directory "
+                     << g_config->cacheDirectory;
+        return false;
+    }
+    g_config->cacheDirectory = cache_dir->path;
+    EnsureEndsInSlash(g_config->cacheDirectory);
+    ICacheManager::InitCacheDirectories();
+
+    if (g_config->resourceDirectory.empty()) {
+        optional<AbsolutePath> resource_dir = GetDefaultResourceDirectory();
+        if (!resource_dir) {
+            LOG_S(ERROR) << "Cannot resolve resource directory";
+            return false;
+        }
+        g_config->resourceDirectory = resource_dir->path;
+    }
+
+    Timer time;
+    Project project;
+    project.Load(root);
+    time.ResetAndPrint("[perf] Loaded compilation entries (" +
+                       std::to_string(project.entries.size()) + " files)");
+
+    // Index what the language server would, ie, respect index.whitelist and
+    // index.blacklist.
+    std::vector<const Project::Entry*> entries;
+    project.ForAllFilteredFiles(
+        [&](int i, const Project::Entry& entry) { entries.push_back(&entry); });
+
+    // Unlike the language server, nothing else needs the CPU, so use all
+    // cores unless told otherwise.
+    int num_threads = g_config->index.threads;
+    if (num_threads <= 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads =
+        std::min<int>(num_threads, std::max<size_t>(1, entries.size()));
+
+    // Headers are only indexed by the first translation unit which includes
+    // them, same as in the language server.
+    FileConsumerSharedState file_consumer_shared;
+    std::atomic<size_t> next_entry(0);
+    std::atomic<long long> num_indexed(0);
+    std::atomic<long long> num_failed(0);
+    std::atomic<long long> num_files(0);
+    std::atomic<long long> num_bytes(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            SetCurrentThreadName("indexer" + std::to_string(i));
+            std::unique_ptr<IIndexer> indexer = IIndexer::MakeClangIndexer();
+            std::shared_ptr<ICacheManager> cache_manager =
+                ICacheManager::Make();
+            for (size_t e = next_entry++; e < entries.size();
+                 e = next_entry++) {
+                const Project::Entry& entry = *entries[e];
+                optional<std::vector<std::unique_ptr<IndexFile>>> indexes =
+                    indexer->Index(&file_consumer_shared, entry.filename,
+                                   entry.args, {});
+                if (!indexes) {
+                    LOG_S(WARNING) << "Failed to index " << entry.filename;
+                    ++num_failed;
+                    continue;
+                }
+                for (const std::unique_ptr<IndexFile>& index : *indexes) {
+                    cache_manager->WriteToCache(*index);
+                    ++num_files;
+                    num_bytes += index->file_contents.size();
+                }
+                long long done = ++num_indexed + num_failed;
+                if (done % 100 == 0) {
+                    LOG_S(INFO) << "Indexed " << done << "/" << entries.size()
+                                << " translation units";
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    double seconds = time.ElapsedMicroseconds() / 1e6;
+    double megabytes = num_bytes / (1024.0 * 1024.0);
+    printf(
+        "Indexed %lld translation units (%lld files, %.1f MB) with %d threads "
+        "in %.1fs: %.1f translation units/s, %.1f MB/s. %lld failed.\n",
+        num_indexed.load(), num_files.load(), megabytes, num_threads, seconds,
+        seconds > 0 ? num_indexed / seconds : 0.0,
+        seconds > 0 ? megabytes / seconds : 0.0, num_failed.load());
+    return num_indexed > 0 || entries.empty();
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+// Indexes every translation unit of the project in |project_dir| on all cores
+// and writes the results to the cache, without starting a language server or
+// building a querydb. Options are taken from g_config; cacheDirectory defaults
+// to <project_dir>/.cquery_cached_index/. Prints a throughput summary and
+// returns false if nothing could be indexed.
+bool RunIndexOnly(const std::string& project_dir);
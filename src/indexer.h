@@ -7,6 +7,8 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <unordered_map>
 #include <vector>
 
@@ -129,17 +131,53 @@ struct IndexId {
     using Var = Id<IndexVar>;
     using SymbolRef = IndexSymbolRef;
     using LexicalRef = IndexLexicalRef;
+    using String = std::string;
 };
 
-void Reflect(Reader& visitor, Reference& value);
-void Reflect(Writer& visitor, Reference& value);
+// |SymbolRef| is serialized this way.
+// |Use| also uses this though it has an extra field |file|,
+// which is not used by Index* so it does not need to be serialized.
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, Reference& value) {
+    if (visitor.Format() == serialize_format::Json) {
+        std::string t = visitor.GetString();
+        char* s = const_cast<char*>(t.c_str());
+        value.range = Range(s);
+        s = strchr(s, '|');
+        value.id.id = RawId(strtol(s + 1, &s, 10));
+        value.kind = static_cast<SymbolKind>(strtol(s + 1, &s, 10));
+        value.role = static_cast<role>(strtol(s + 1, &s, 10));
+    } else {
+        Reflect(visitor, value.range);
+        Reflect(visitor, value.id);
+        Reflect(visitor, value.kind);
+        Reflect(visitor, value.role);
+    }
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, Reference& value) {
+    if (visitor.Format() == serialize_format::Json) {
+        std::string s = value.range.ToString();
+        // RawId(-1) -> "-1"
+        s += '|' + std::to_string(
+                       static_cast<std::make_signed<RawId>::type>(value.id.id));
+        s += '|' + std::to_string(int(value.kind));
+        s += '|' + std::to_string(int(value.role));
+        Reflect(visitor, s);
+    } else {
+        Reflect(visitor, value.range);
+        Reflect(visitor, value.id);
+        Reflect(visitor, value.kind);
+        Reflect(visitor, value.role);
+    }
+}
 
 template <typename Id>
 struct TypeDefDefinitionData {
     // General metadata.
-    std::string detailed_name;
-    std::string hover;
-    std::string comments;
+    typename Id::String detailed_name;
+    typename Id::String hover;
+    typename Id::String comments;
 
     // While a class/type can technically have a separate
     // declaration/definition, it doesn't really happen in practice. The
@@ -182,8 +220,9 @@ struct TypeDefDefinitionData {
     }
 
     std::string_view ShortName() const {
-        return std::string_view(detailed_name.c_str() + short_name_offset,
-                                short_name_size);
+        return std::string_view(
+            std::string_view(detailed_name).data() + short_name_offset,
+            short_name_size);
     }
     // Used by cquery_inheritance_hierarchy.cc:Expand generic lambda
     std::string_view DetailedName(bool) const { return detailed_name; }
@@ -208,6 +247,20 @@ void Reflect(TVisitor& visitor, TypeDefDefinitionData<Family>& value) {
     REFLECT_MEMBER_END();
 }
 
+// Fingerprints of the parts of an entity which IndexUpdate compares, with
+// local ids replaced by the usrs they refer to, so that they can be compared
+// across two indexes of the same file. IndexUpdate skips the parts whose
+// fingerprints did not change. 0 means unknown, ie, not computed.
+struct IndexFingerprints {
+    uint64_t def = 0;
+    uint64_t declarations = 0;
+    uint64_t derived = 0;
+    uint64_t instances = 0;
+    uint64_t uses = 0;
+};
+MAKE_REFLECT_STRUCT(IndexFingerprints, def, declarations, derived, instances,
+                    uses);
+
 struct IndexType {
     using Def = TypeDefDefinitionData<IndexId>;
 
@@ -227,6 +280,8 @@ struct IndexType {
     // NOTE: Do not insert directly! Use AddUsage instead.
     std::vector<IndexId::LexicalRef> uses;
 
+    IndexFingerprints fingerprints;
+
     IndexType() {}  // For serialization.
     IndexType(IndexId::Type id, Usr usr);
 
@@ -237,9 +292,9 @@ MAKE_HASHABLE(IndexType, t.id);
 template <typename Id>
 struct FuncDefDefinitionData {
     // General metadata.
-    std::string detailed_name;
-    std::string hover;
-    std::string comments;
+    typename Id::String detailed_name;
+    typename Id::String hover;
+    typename Id::String comments;
     Maybe<typename Id::LexicalRef> spell;
     Maybe<typename Id::LexicalRef> extent;
 
@@ -272,8 +327,9 @@ struct FuncDefDefinitionData {
     }
 
     std::string_view ShortName() const {
-        return std::string_view(detailed_name.c_str() + short_name_offset,
-                                short_name_size);
+        return std::string_view(
+            std::string_view(detailed_name).data() + short_name_offset,
+            short_name_size);
     }
     std::string_view DetailedName(bool params) const {
         if (params) return detailed_name;
@@ -330,6 +386,8 @@ struct IndexFunc {
     // def.spell.
     std::vector<IndexId::LexicalRef> uses;
 
+    IndexFingerprints fingerprints;
+
     IndexFunc() {}  // For serialization.
     IndexFunc(IndexId::Func id, Usr usr) : usr(usr), id(id) {}
 
@@ -341,9 +399,9 @@ MAKE_REFLECT_STRUCT(IndexFunc::Declaration, spell, param_spellings);
 template <typename Id>
 struct VarDefDefinitionData {
     // General metadata.
-    std::string detailed_name;
-    std::string hover;
-    std::string comments;
+    typename Id::String detailed_name;
+    typename Id::String hover;
+    typename Id::String comments;
     // TODO: definitions should be a list of ranges, since there can be more
     //       than one - when??
     Maybe<typename Id::LexicalRef> spell;
@@ -375,25 +433,26 @@ struct VarDefDefinitionData {
     }
 
     std::string_view ShortName() const {
-        return std::string_view(detailed_name.c_str() + short_name_offset,
-                                short_name_size);
+        return std::string_view(
+            std::string_view(detailed_name).data() + short_name_offset,
+            short_name_size);
     }
     std::string DetailedName(bool qualified) const {
-        if (qualified) return detailed_name;
+        std::string_view name = detailed_name;
+        if (qualified) return std::string(name);
         int i = short_name_offset;
         for (int paren = 0; i; i--) {
             // Skip parentheses in "(anon struct)::name"
-            if (detailed_name[i - 1] == ')')
+            if (name[i - 1] == ')')
                 paren++;
-            else if (detailed_name[i - 1] == '(')
+            else if (name[i - 1] == '(')
                 paren--;
-            else if (!(paren > 0 || isalnum(detailed_name[i - 1]) ||
-                       detailed_name[i - 1] == '_' ||
-                       detailed_name[i - 1] == ':'))
+            else if (!(paren > 0 || isalnum(name[i - 1]) ||
+                       name[i - 1] == '_' || name[i - 1] == ':'))
                 break;
         }
-        return detailed_name.substr(0, i) +
-               detailed_name.substr(short_name_offset);
+        return std::string(name.substr(0, i)) +
+               std::string(name.substr(short_name_offset));
     }
 };
 
@@ -425,6 +484,8 @@ struct IndexVar {
     std::vector<IndexId::LexicalRef> declarations;
     std::vector<IndexId::LexicalRef> uses;
 
+    IndexFingerprints fingerprints;
+
     IndexVar() {}  // For serialization.
     IndexVar(IndexId::Var id, Usr usr) : usr(usr), id(id) {}
 
@@ -466,6 +527,9 @@ struct IndexFile {
     AbsolutePath path;
     size_t args_hash;
     int64_t last_modification_time = 0;
+    // HashContents of |file_contents|, so a file whose timestamp changed but
+    // whose contents did not is not reindexed. 0 if unknown.
+    uint64_t content_hash = 0;
     LanguageId language = LanguageId::Unknown;
 
     // The path to the translation unit cc file which caused the creation of
@@ -522,6 +586,9 @@ optional<std::vector<std::unique_ptr<IndexFile>>> Parse(
     const std::vector<FileContents>& file_contents, ClangIndex* index,
     bool dump_ast = false);
 
+// Computes the fingerprints of every type, function and variable in |file|.
+void ComputeFingerprints(IndexFile* file);
+
 void ConcatTypeAndName(std::string& type, const std::string& name);
 
 void IndexInit();
@@ -30,6 +30,15 @@ struct LruCache {
   // terminates early.
   template <typename TFunc>
   void IterateValues(TFunc func);
+  // Removes the entries for which |func| returns true.
+  template <typename TFunc>
+  void RemoveIf(TFunc func);
+  // Removes the least recently used entry for whose key and value |can_take|
+  // returns true. Returns false if there is no such entry.
+  template <typename TFunc>
+  bool TryTakeOldest(TFunc can_take, TKey* key, TValue* dest);
+  // Number of entries in the cache.
+  size_t Size() const { return entries_.size(); }
 
   // Empties the cache
   void Clear(void);
@@ -134,6 +143,38 @@ void LruCache<TKey, TValue>::IterateValues(TFunc func) {
   }
 }
 
+template <typename TKey, typename TValue>
+template <typename TFunc>
+void LruCache<TKey, TValue>::RemoveIf(TFunc func) {
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [&](const Entry& entry) {
+                                  return func(entry.value);
+                                }),
+                 entries_.end());
+}
+
+template <typename TKey, typename TValue>
+template <typename TFunc>
+bool LruCache<TKey, TValue>::TryTakeOldest(TFunc can_take,
+                                           TKey* key,
+                                           TValue* dest) {
+  auto oldest = entries_.end();
+  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+    if (can_take(it->key, it->value) &&
+        (oldest == entries_.end() || *it < *oldest))
+      oldest = it;
+  }
+  if (oldest == entries_.end())
+    return false;
+
+  if (key)
+    *key = oldest->key;
+  if (dest)
+    *dest = oldest->value;
+  entries_.erase(oldest);
+  return true;
+}
+
 template <typename TKey, typename TValue>
 void LruCache<TKey, TValue>::IncrementScore() {
   // Overflow.
@@ -97,8 +97,11 @@ optional<std::string> ReadJsonRpcContentFrom(
                 content_length = atoi(stringified_header_field.c_str() +
                                       strlen(k_content_length_start));
             } else if (StartsWith(stringified_header_field,
-                                  k_content_type_start)) {
-                // Content-Type field is ignored.
+                                  k_content_type_start) ||
+                       StartsWith(stringified_header_field,
+                                  k_recorded_time_header)) {
+                // Content-Type field is ignored. Recordings made with --record
+                // also contain a timestamp, which is ignored as well.
             } else {
                 LOG_S(INFO) << "Unknown field in the header";
                 return nullopt;
@@ -159,6 +162,9 @@ TEST_SUITE("FindIncludeLine") {
         REQUIRE(parse_correct("Content-Length: 0\r\n\r\n") == "");
         REQUIRE(parse_correct("Content-Length: 1\r\n\r\na") == "a");
         REQUIRE(parse_correct("Content-Length: 4\r\n\r\nabcd") == "abcd");
+        REQUIRE(parse_correct(
+                    "Cquery-Time-Ms: 12\r\nContent-Length: 1\r\n\r\na") ==
+                "a");
 
         REQUIRE(parse_incorrect("ggg") == optional<std::string>());
         REQUIRE(parse_incorrect("Content-Length: 0\r\n") ==
@@ -197,8 +203,9 @@ optional<std::string> MessageRegistry::ReadMessageFromStdin(
 
 optional<std::string> MessageRegistry::Parse(
     Reader& visitor, std::unique_ptr<InMessage>* message) {
-    if (!visitor.HasMember("jsonrpc") ||
-        std::string(visitor["jsonrpc"]->GetString()) != "2.0") {
+    std::string jsonrpc;
+    ReflectMember(visitor, "jsonrpc", jsonrpc);
+    if (jsonrpc != "2.0") {
         LOG_S(FATAL) << "Bad or missing jsonrpc version";
         exit(1);
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "lsp.h"
+#include "symbol.h"
 
 // codeAction
 struct CommandArgs {
@@ -10,8 +11,29 @@ struct CommandArgs {
 MAKE_REFLECT_STRUCT_WRITER_AS_ARRAY(CommandArgs, text_document_uri, edits);
 
 // codeLens
-struct LsCodeLensUserData {};
-MAKE_REFLECT_EMPTY_STRUCT(LsCodeLensUserData);
+// What a code lens counts and lists.
+enum class LsCodeLensKind : uint8_t {
+    Refs,
+    Calls,
+    DirectCalls,
+    BaseCalls,
+    DerivedCalls,
+    Derived,
+    Bases,
+    Vars
+};
+MAKE_REFLECT_TYPE_PROXY(LsCodeLensKind);
+
+// Identifies a code lens whose command is left to codeLens/resolve, see
+// codeLens.lazyLocations.
+struct LsCodeLensUserData {
+    SymbolKind kind = SymbolKind::Invalid;
+    // Querydb ids of the entity and of the file the code lens is in.
+    uint32_t id = 0;
+    uint32_t file = 0;
+    LsCodeLensKind lens = LsCodeLensKind::Refs;
+};
+MAKE_REFLECT_STRUCT(LsCodeLensUserData, kind, id, file, lens);
 
 struct LsCodeLensCommandArguments {
     LsDocumentUri uri;
@@ -44,3 +66,6 @@ inline void Reflect(Reader& visitor, LsCodeLensCommandArguments& value) {
         }
     });
 }
+
+using TCodeLens =
+    LsCodeLens<optional<LsCodeLensUserData>, LsCodeLensCommandArguments>;
@@ -1,4 +1,7 @@
 #pragma once
+
+#include <memory>
+
 #include "lsp.h"
 
 // The kind of a completion entry.
@@ -50,6 +53,23 @@ enum class lsInsertTextFormat {
 };
 MAKE_REFLECT_TYPE_PROXY(lsInsertTextFormat);
 
+struct lsCompletionItem;
+
+// Computes the parts of completion items which are only needed for the items
+// which are sent to the client. Code completion can return tens of thousands
+// of results, so these are not built for all of them.
+struct ICompletionItemResolver {
+    virtual ~ICompletionItemResolver() = default;
+
+    // Sets |detail|, |insertText|, |insertTextFormat| and |parameters_|.
+    virtual void ResolveTexts(lsCompletionItem* item) = 0;
+    // Sets |documentation|.
+    virtual void ResolveDocumentation(lsCompletionItem* item) = 0;
+    // Returns true if the items can no longer be resolved, so they should not
+    // be reused.
+    virtual bool IsExpired() { return false; }
+};
+
 struct lsCompletionItem {
     // A set of function parameters. Used internally for signature help. Not
     // sent to vscode.
@@ -78,6 +98,14 @@ struct lsCompletionItem {
     // Use <> or "" by default as include path.
     bool use_angle_brackets_ = false;
 
+    // Computes the fields which were left out when this item was built, see
+    // ResolveTexts and ResolveDocumentation. |resolve_index_| identifies the
+    // item for |resolver_|.
+    std::shared_ptr<ICompletionItemResolver> resolver_;
+    uint32_t resolve_index_ = 0;
+    bool has_texts_ = true;
+    bool has_documentation_ = true;
+
     // A string that shoud be used when comparing this item
     // with other items. When `falsy` the label is used.
     std::string sortText;
@@ -113,7 +141,7 @@ struct lsCompletionItem {
 
     // An data entry field that is preserved on a completion item between
     // a completion and a completion resolve request.
-    // data ? : any
+    optional<std::vector<int>> data;
 
     // Use this helper to figure out what content the completion item will
     // insert into the document, as it could live in either |textEdit|,
@@ -123,7 +151,18 @@ struct lsCompletionItem {
         if (!insertText.empty()) return insertText;
         return label;
     }
+
+    void ResolveTexts() {
+        if (has_texts_) return;
+        has_texts_ = true;
+        resolver_->ResolveTexts(this);
+    }
+    void ResolveDocumentation() {
+        if (has_documentation_) return;
+        has_documentation_ = true;
+        resolver_->ResolveDocumentation(this);
+    }
 };
 MAKE_REFLECT_STRUCT(lsCompletionItem, label, kind, detail, documentation,
                     sortText, insertText, filterText, insertTextFormat,
-                    textEdit);
+                    textEdit, data);
@@ -8,7 +8,8 @@
 // state. T should define a function `bool T::HasValueForMaybe()`.
 template <typename T>
 class Maybe {
-    T storage;
+    // Value-initialized so that empty values compare equal.
+    T storage{};
 
    public:
     constexpr Maybe() = default;
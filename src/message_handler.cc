@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <loguru.hpp>
+#include <unordered_set>
 
 #include "lex_utils.h"
 #include "project.h"
@@ -37,6 +38,78 @@ struct ScanLineEvent {
         return symbol->kind < other.symbol->kind;
     }
 };
+
+// Returns the references listed by a code lens, or nullopt if |data| does not
+// refer to an entity.
+optional<std::vector<QueryId::LexicalRef>> GetCodeLensRefs(
+    QueryDatabase* db, const LsCodeLensUserData& data) {
+    switch (data.kind) {
+        case SymbolKind::Type: {
+            if (data.id >= db->types.size()) return nullopt;
+            QueryType& type = db->types[data.id];
+            if (data.lens == LsCodeLensKind::Refs) return type.uses.ToVector();
+            if (data.lens == LsCodeLensKind::Derived)
+                return GetDeclarations(db, type.derived);
+            if (data.lens == LsCodeLensKind::Vars)
+                return GetDeclarations(db, type.instances);
+            break;
+        }
+        case SymbolKind::Func: {
+            if (data.id >= db->funcs.size()) return nullopt;
+            QueryFunc& func = db->funcs[data.id];
+            switch (data.lens) {
+                case LsCodeLensKind::Calls:
+                case LsCodeLensKind::DirectCalls:
+                    return func.uses.ToVector();
+                case LsCodeLensKind::BaseCalls:
+                    return GetRefsForAllBases(db, func);
+                case LsCodeLensKind::DerivedCalls:
+                    return GetRefsForAllDerived(db, func);
+                case LsCodeLensKind::Derived:
+                    return GetDeclarations(db, func.derived);
+                case LsCodeLensKind::Bases:
+                    if (const QueryFunc::Def* def = func.AnyDef())
+                        return GetDeclarations(db, def->bases);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case SymbolKind::Var: {
+            if (data.id >= db->vars.size()) return nullopt;
+            if (data.lens == LsCodeLensKind::Refs)
+                return db->vars[data.id].uses.ToVector();
+            break;
+        }
+        default:
+            break;
+    }
+    return nullopt;
+}
+
+// Labels of a code lens for one and for any other number of references.
+std::pair<const char*, const char*> GetCodeLensNouns(LsCodeLensKind lens) {
+    switch (lens) {
+        case LsCodeLensKind::Refs:
+            return {"ref", "refs"};
+        case LsCodeLensKind::Calls:
+            return {"call", "calls"};
+        case LsCodeLensKind::DirectCalls:
+            return {"direct call", "direct calls"};
+        case LsCodeLensKind::BaseCalls:
+            return {"base call", "base calls"};
+        case LsCodeLensKind::DerivedCalls:
+            return {"derived call", "derived calls"};
+        case LsCodeLensKind::Derived:
+            return {"derived", "derived"};
+        case LsCodeLensKind::Bases:
+            return {"base", "base"};
+        case LsCodeLensKind::Vars:
+            return {"var", "vars"};
+    }
+    return {"", ""};
+}
 }  // namespace
 
 MessageHandler::MessageHandler() {
@@ -290,3 +363,36 @@ void EmitSemanticHighlighting(QueryDatabase* db,
 bool ShouldIgnoreFileForIndexing(const std::string& path) {
     return StartsWith(path, "git:");
 }
+
+bool ResolveCodeLens(QueryDatabase* db, WorkingFiles* working_files,
+                     TCodeLens* code_lens) {
+    if (!code_lens->data || code_lens->data->file >= db->files.size())
+        return false;
+    const LsCodeLensUserData& data = *code_lens->data;
+    optional<std::vector<QueryId::LexicalRef>> refs =
+        GetCodeLensRefs(db, data);
+    if (!refs) return false;
+
+    code_lens->command = LsCommand<LsCodeLensCommandArguments>();
+    code_lens->command->command = "cquery.showReferences";
+    code_lens->command->arguments.uri =
+        GetLsDocumentUri(db, QueryId::File(data.file));
+    code_lens->command->arguments.position = code_lens->range.start;
+
+    // Add unique uses.
+    std::unordered_set<LsLocation> unique_uses;
+    for (QueryId::LexicalRef ref : *refs) {
+        if (optional<LsLocation> location =
+                GetLsLocation(db, working_files, ref))
+            unique_uses.insert(*location);
+    }
+    code_lens->command->arguments.locations.assign(unique_uses.begin(),
+                                                   unique_uses.end());
+
+    // User visible label
+    size_t num_usages = unique_uses.size();
+    std::pair<const char*, const char*> nouns = GetCodeLensNouns(data.lens);
+    code_lens->command->title = std::to_string(num_usages) + " ";
+    code_lens->command->title += num_usages == 1 ? nouns.first : nouns.second;
+    return true;
+}
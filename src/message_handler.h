@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "lsp.h"
+#include "lsp_code_action.h"
 #include "method.h"
 #include "query.h"
 
@@ -110,3 +111,8 @@ void EmitSemanticHighlighting(QueryDatabase* db,
                               WorkingFile* working_file, QueryFile* file);
 
 bool ShouldIgnoreFileForIndexing(const std::string& path);
+
+// Sets the command of |code_lens|, ie, the number and the locations of what it
+// counts, from its |data|. Returns false if |data| does not refer to an entity.
+bool ResolveCodeLens(QueryDatabase* db, WorkingFiles* working_files,
+                     TCodeLens* code_lens);
@@ -0,0 +1,37 @@
+#include "code_complete_cache.h"
+#include "message_handler.h"
+#include "queue_manager.h"
+
+namespace {
+MethodType k_method_type = "completionItem/resolve";
+
+struct InCompletionItemResolve : public RequestInMessage {
+    MethodType GetMethodType() const override { return k_method_type; }
+    lsCompletionItem params;
+};
+MAKE_REFLECT_STRUCT(InCompletionItemResolve, id, params);
+REGISTER_IN_MESSAGE(InCompletionItemResolve);
+
+struct OutCompletionItemResolve
+    : public LsOutMessage<OutCompletionItemResolve> {
+    LsRequestId id;
+    lsCompletionItem result;
+};
+MAKE_REFLECT_STRUCT(OutCompletionItemResolve, jsonrpc, id, result);
+
+// Fills in the documentation left out of completion responses when
+// completion.lazyDocumentation is set.
+struct HandlerCompletionItemResolve
+    : BaseMessageHandler<InCompletionItemResolve> {
+    MethodType GetMethodType() const override { return k_method_type; }
+
+    void Run(InCompletionItemResolve* request) override {
+        OutCompletionItemResolve out;
+        out.id = request->id;
+        out.result = std::move(request->params);
+        CompletionResolveCache::Instance()->Resolve(&out.result);
+        QueueManager::WriteStdout(k_method_type, out);
+    }
+};
+REGISTER_MESSAGE_HANDLER(HandlerCompletionItemResolve);
+}  // namespace
@@ -1,5 +1,7 @@
 #include <loguru.hpp>
 
+#include <unordered_map>
+
 #include "message_handler.h"
 #include "query_utils.h"
 #include "queue_manager.h"
@@ -67,81 +69,91 @@ MAKE_REFLECT_STRUCT(OutCqueryCallHierarchy::Entry, id, name, location,
 MAKE_REFLECT_STRUCT_OPTIONALS_MANDATORY(OutCqueryCallHierarchy, jsonrpc, id,
                                         result);
 
-bool Expand(MessageHandler* m, OutCqueryCallHierarchy::Entry* entry,
-            bool callee, call_type call_type, bool detailed_name, int levels) {
-    const QueryFunc& func = m->db->GetFunc(entry->id);
-    const QueryFunc::Def* def = func.AnyDef();
-    entry->num_children = 0;
-    if (!def) return false;
-    auto handle = [&](QueryId::LexicalRef ref, enum call_type call_type) {
-        entry->num_children++;
-        if (levels > 0) {
-            OutCqueryCallHierarchy::Entry entry1;
-            entry1.id = QueryId::Func(ref.id);
-            if (auto loc = GetLsLocation(m->db, m->working_files, ref))
-                entry1.location = *loc;
-            entry1.call_type = call_type;
-            if (Expand(m, &entry1, callee, call_type, detailed_name,
-                       levels - 1))
-                entry->children.push_back(std::move(entry1));
-        }
+// The children of the functions in one request. Deep hierarchies reach the
+// same functions many times, so the edges of each function are only collected
+// once.
+class CallGraph {
+   public:
+    struct Edge {
+        QueryId::LexicalRef ref;
+        call_type call_type;
     };
-    auto handle_uses = [&](const QueryFunc& func, enum call_type call_type) {
-        if (callee) {
-            if (const auto* def = func.AnyDef())
+
+    CallGraph(QueryDatabase* db, bool callee) : m_db(db), m_callee(callee) {}
+
+    // Returns the callers or callees of |id| and, depending on |call_type|,
+    // of the functions it overrides or which override it.
+    const std::vector<Edge>& GetEdges(QueryId::Func id, call_type call_type) {
+        // References to elements of an unordered_map stay valid on insertion.
+        auto it = m_edges[uint8_t(call_type)].find(id);
+        if (it != m_edges[uint8_t(call_type)].end()) return it->second;
+
+        std::vector<Edge>& edges = m_edges[uint8_t(call_type)][id];
+        QueryFunc& func = m_db->GetFunc(id);
+        AddEdges(func, call_type::Direct, &edges);
+        EachFuncInHierarchy(m_db, func, call_type & call_type::Base,
+                            call_type & call_type::Derived,
+                            [&](QueryFunc& func1, bool is_base) {
+                                AddEdges(func1,
+                                         is_base ? call_type::Base
+                                                 : call_type::Derived,
+                                         &edges);
+                            });
+        return edges;
+    }
+
+   private:
+    void AddEdges(const QueryFunc& func, call_type call_type,
+                  std::vector<Edge>* edges) {
+        if (m_callee) {
+            if (const QueryFunc::Def* def = func.AnyDef()) {
                 for (const QueryId::SymbolRef& ref : def->callees) {
-                    if (ref.kind == SymbolKind::Func)
-                        handle(QueryId::LexicalRef(ref.range, ref.id, ref.kind,
-                                                   ref.role, def->file),
-                               call_type);
+                    if (ref.kind == SymbolKind::Func) {
+                        edges->push_back({QueryId::LexicalRef(
+                                              ref.range, ref.id, ref.kind,
+                                              ref.role, def->file),
+                                          call_type});
+                    }
                 }
+            }
         } else {
-            for (QueryId::LexicalRef ref : func.uses)
-                if (ref.kind == SymbolKind::Func) handle(ref, call_type);
+            for (const QueryId::LexicalRef& ref : func.callers)
+                edges->push_back({ref, call_type});
         }
-    };
+    }
 
-    std::unordered_set<Usr> seen;
-    seen.insert(func.usr);
-    std::vector<const QueryFunc*> stack;
+    QueryDatabase* m_db;
+    bool m_callee;
+    // Indexed by call_type.
+    std::unordered_map<QueryId::Func, std::vector<Edge>> m_edges[4];
+};
+
+bool Expand(MessageHandler* m, CallGraph* graph,
+            OutCqueryCallHierarchy::Entry* entry, call_type call_type,
+            bool detailed_name, int levels) {
+    const QueryFunc& func = m->db->GetFunc(entry->id);
+    const QueryFunc::Def* def = func.AnyDef();
+    entry->num_children = 0;
+    if (!def) return false;
     if (detailed_name)
         entry->name = def->detailed_name;
     else
         entry->name = def->ShortName();
-    handle_uses(func, call_type::Direct);
-
-    // Callers/callees of base functions.
-    if (call_type & call_type::Base) {
-        stack.push_back(&func);
-        while (stack.size()) {
-            const QueryFunc& func1 = *stack.back();
-            stack.pop_back();
-            if (auto* def1 = func1.AnyDef()) {
-                EachDefinedFunc(m->db, def1->bases, [&](QueryFunc& func2) {
-                    if (!seen.count(func2.usr)) {
-                        seen.insert(func2.usr);
-                        stack.push_back(&func2);
-                        handle_uses(func2, call_type::Base);
-                    }
-                });
-            }
-        }
-    }
 
-    // Callers/callees of derived functions.
-    if (call_type & call_type::Derived) {
-        stack.push_back(&func);
-        while (stack.size()) {
-            const QueryFunc& func1 = *stack.back();
-            stack.pop_back();
-            EachDefinedFunc(m->db, func1.derived, [&](QueryFunc& func2) {
-                if (!seen.count(func2.usr)) {
-                    seen.insert(func2.usr);
-                    stack.push_back(&func2);
-                    handle_uses(func2, call_type::Derived);
-                }
-            });
-        }
+    const std::vector<CallGraph::Edge>& edges =
+        graph->GetEdges(entry->id, call_type);
+    entry->num_children = int(edges.size());
+    if (levels <= 0) return true;
+    for (const CallGraph::Edge& edge : edges) {
+        OutCqueryCallHierarchy::Entry entry1;
+        entry1.id = QueryId::Func(edge.ref.id);
+        if (auto loc = GetLsLocation(m->db, m->working_files, edge.ref))
+            entry1.location = *loc;
+        entry1.call_type = edge.call_type;
+        // Children are expanded with the kind of edge which led to them.
+        if (Expand(m, graph, &entry1, edge.call_type, detailed_name,
+                   levels - 1))
+            entry->children.push_back(std::move(entry1));
     }
     return true;
 }
@@ -165,7 +177,8 @@ struct HandlerCqueryCallHierarchy : BaseMessageHandler<InCqueryCallHierarchy> {
                     GetLsLocation(db, working_files, *def->spell))
                 entry.location = *loc;
         }
-        Expand(this, &entry, callee, call_type, detailed_name, levels);
+        CallGraph graph(db, callee);
+        Expand(this, &graph, &entry, call_type, detailed_name, levels);
         return entry;
     }
 
@@ -178,9 +191,11 @@ struct HandlerCqueryCallHierarchy : BaseMessageHandler<InCqueryCallHierarchy> {
             OutCqueryCallHierarchy::Entry entry;
             entry.id = *params.id;
             entry.call_type = call_type::Direct;
-            if (entry.id.id < db->funcs.size())
-                Expand(this, &entry, params.callee, params.call_type,
+            if (entry.id.id < db->funcs.size()) {
+                CallGraph graph(db, params.callee);
+                Expand(this, &graph, &entry, params.call_type,
                        params.detailed_name, params.levels);
+            }
             out.result = std::move(entry);
         } else {
             QueryFile* file;
@@ -31,13 +31,13 @@ struct Handler_CqueryCallers : BaseMessageHandler<In_CqueryCallers> {
                  working_file, file, request->params.position)) {
             if (sym.kind == SymbolKind::Func) {
                 QueryFunc& func = db->GetFunc(sym);
-                std::vector<QueryId::LexicalRef> uses = func.uses;
-                for (QueryId::LexicalRef func_ref :
-                     GetRefsForAllBases(db, func))
-                    uses.push_back(func_ref);
-                for (QueryId::LexicalRef func_ref :
-                     GetRefsForAllDerived(db, func))
-                    uses.push_back(func_ref);
+                std::vector<QueryId::LexicalRef> uses = func.uses.ToVector();
+                EachFuncInHierarchy(db, func, true /*bases*/, true /*derived*/,
+                                    [&](QueryFunc& func1, bool is_base) {
+                                        uses.insert(uses.end(),
+                                                    func1.uses.begin(),
+                                                    func1.uses.end());
+                                    });
                 out.result = GetLsLocations(db, working_files, uses);
                 break;
             }
@@ -3,6 +3,7 @@
 #include <unordered_set>
 
 #include "cache_manager.h"
+#include "file_watcher.h"
 #include "match.h"
 #include "message_handler.h"
 #include "platform.h"
@@ -65,7 +66,7 @@ struct HandlerCqueryFreshenIndex : BaseMessageHandler<InCqueryFreshenIndex> {
             need_index.insert(file->def->path);
 
             optional<int64_t> modification_timestamp =
-                GetLastModificationTime(file->def->path);
+                FileWatcher::Instance()->GetModificationTime(file->def->path);
             if (!modification_timestamp) continue;
             optional<int64_t> cached_modification =
                 timestamp_manager->GetLastCachedModificationTime(
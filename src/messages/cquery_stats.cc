@@ -0,0 +1,160 @@
+#include "import_pipeline.h"
+#include "message_handler.h"
+#include "queue_manager.h"
+#include "stats.h"
+
+namespace {
+MethodType kMethodType = "$cquery/stats";
+
+struct In_CqueryStats : public RequestInMessage {
+    MethodType GetMethodType() const override { return kMethodType; }
+};
+MAKE_REFLECT_STRUCT(In_CqueryStats, id);
+REGISTER_IN_MESSAGE(In_CqueryStats);
+
+struct Out_CqueryStats : public LsOutMessage<Out_CqueryStats> {
+    struct Request {
+        std::string method;
+        long long count = 0;
+        double meanMs = 0;
+        double p50Ms = 0;
+        double p90Ms = 0;
+        double p99Ms = 0;
+        double maxMs = 0;
+        // Number of requests in each power-of-two microsecond bucket, see
+        // |LatencyHistogram|. Trailing empty buckets are omitted.
+        std::vector<long long> bucketsUs;
+    };
+    struct Queue {
+        std::string name;
+        long long depth = 0;
+        long long dequeued = 0;
+        double meanWaitMs = 0;
+        double maxWaitMs = 0;
+    };
+    struct Indexer {
+        long long translationUnits = 0;
+        long long bytes = 0;
+        double translationUnitsPerSecond = 0;
+        double bytesPerSecond = 0;
+        int activeThreads = 0;
+    };
+    struct Caches {
+        long long loadedFiles = 0;
+        long long bytes = 0;
+    };
+    struct WarmSessions {
+        long long built = 0;
+        long long used = 0;
+        long long droppedUnused = 0;
+        // used / (used + droppedUnused), or 0 if no session was either yet.
+        double hitRate = 0;
+    };
+    struct Result {
+        long long uptimeMs = 0;
+        std::vector<Request> requests;
+        std::vector<Queue> queues;
+        Indexer indexer;
+        std::vector<MemoryUsage> queryDbMemory;
+        Caches cacheMemory;
+        WarmSessions warmSessions;
+    };
+
+    LsRequestId id;
+    Result result;
+};
+MAKE_REFLECT_STRUCT(Out_CqueryStats::Request, method, count, meanMs, p50Ms,
+                    p90Ms, p99Ms, maxMs, bucketsUs);
+MAKE_REFLECT_STRUCT(Out_CqueryStats::Queue, name, depth, dequeued, meanWaitMs,
+                    maxWaitMs);
+MAKE_REFLECT_STRUCT(Out_CqueryStats::Indexer, translationUnits, bytes,
+                    translationUnitsPerSecond, bytesPerSecond, activeThreads);
+MAKE_REFLECT_STRUCT(Out_CqueryStats::Caches, loadedFiles, bytes);
+MAKE_REFLECT_STRUCT(Out_CqueryStats::WarmSessions, built, used, droppedUnused,
+                    hitRate);
+MAKE_REFLECT_STRUCT(Out_CqueryStats::Result, uptimeMs, requests, queues,
+                    indexer, queryDbMemory, cacheMemory, warmSessions);
+MAKE_REFLECT_STRUCT(Out_CqueryStats, jsonrpc, id, result);
+
+double ToMs(long long us) { return us / 1000.0; }
+
+template <typename T>
+void AddQueue(std::vector<Out_CqueryStats::Queue>* out, const char* name,
+              const ThreadedQueue<T>& queue) {
+    const QueueWaitStats& stats = queue.WaitStats();
+    Out_CqueryStats::Queue entry;
+    entry.name = name;
+    entry.depth = queue.Size();
+    entry.dequeued = stats.num_dequeued;
+    if (entry.dequeued)
+        entry.meanWaitMs = ToMs(stats.total_wait_us) / entry.dequeued;
+    entry.maxWaitMs = ToMs(stats.max_wait_us);
+    out->push_back(entry);
+}
+
+struct Handler_CqueryStats : BaseMessageHandler<In_CqueryStats> {
+    MethodType GetMethodType() const override { return kMethodType; }
+    void Run(In_CqueryStats* request) override {
+        Stats* stats = Stats::Instance();
+        Out_CqueryStats out;
+        out.id = request->id;
+        out.result.uptimeMs = stats->m_uptime.ElapsedMicroseconds() / 1000;
+
+        stats->IterateRequests(
+            [&](const std::string& method, const LatencyHistogram& histogram) {
+                Out_CqueryStats::Request entry;
+                entry.method = method;
+                entry.count = histogram.m_count;
+                if (entry.count)
+                    entry.meanMs = ToMs(histogram.m_total_us) / entry.count;
+                entry.p50Ms = ToMs(histogram.PercentileUs(50));
+                entry.p90Ms = ToMs(histogram.PercentileUs(90));
+                entry.p99Ms = ToMs(histogram.PercentileUs(99));
+                entry.maxMs = ToMs(histogram.m_max_us);
+                for (const std::atomic<long long>& bucket :
+                     histogram.m_buckets) {
+                    entry.bucketsUs.push_back(bucket);
+                }
+                while (!entry.bucketsUs.empty() && !entry.bucketsUs.back())
+                    entry.bucketsUs.pop_back();
+                out.result.requests.push_back(entry);
+            });
+
+        QueueManager* queue = QueueManager::Instance();
+        std::vector<Out_CqueryStats::Queue>* queues = &out.result.queues;
+        AddQueue(queues, "forStdout", queue->for_stdout);
+        AddQueue(queues, "forQuerydb", queue->for_querydb);
+        AddQueue(queues, "doIdMap", queue->do_id_map);
+        AddQueue(queues, "indexRequest", queue->index_request);
+        AddQueue(queues, "loadPreviousIndex", queue->load_previous_index);
+        AddQueue(queues, "onIdMapped", queue->on_id_mapped);
+        AddQueue(queues, "onIndexedForMerge", queue->on_indexed_for_merge);
+        AddQueue(queues, "onIndexedForQuerydb", queue->on_indexed_for_querydb);
+
+        Out_CqueryStats::Indexer& indexer = out.result.indexer;
+        indexer.translationUnits = stats->m_indexed_translation_units;
+        indexer.bytes = stats->m_indexed_bytes;
+        double uptime_s = out.result.uptimeMs / 1000.0;
+        if (uptime_s > 0) {
+            indexer.translationUnitsPerSecond =
+                indexer.translationUnits / uptime_s;
+            indexer.bytesPerSecond = indexer.bytes / uptime_s;
+        }
+        indexer.activeThreads = import_pipeline_status->num_active_threads;
+
+        out.result.queryDbMemory = EstimateMemoryUsage(*db);
+        out.result.cacheMemory.loadedFiles = stats->m_loaded_caches;
+        out.result.cacheMemory.bytes = stats->m_loaded_cache_bytes;
+
+        Out_CqueryStats::WarmSessions& warm = out.result.warmSessions;
+        warm.built = stats->m_warmed_sessions;
+        warm.used = stats->m_warmed_session_hits;
+        warm.droppedUnused = stats->m_warmed_session_misses;
+        if (warm.used + warm.droppedUnused)
+            warm.hitRate = double(warm.used) / (warm.used + warm.droppedUnused);
+
+        QueueManager::WriteStdout(kMethodType, out);
+    }
+};
+REGISTER_MESSAGE_HANDLER(Handler_CqueryStats);
+}  // namespace
@@ -29,7 +29,9 @@ struct Handler_CqueryWait : MessageHandler {
             has_work |= QueueManager::Instance()->HasWork();
             has_work |=
                 QueryDbImportMain(db, import_manager, import_pipeline_status,
-                                  semantic_cache, working_files);
+                                  semantic_cache, working_files,
+                                  global_code_complete_cache,
+                                  non_global_code_complete_cache);
             if (!has_work)
                 ++idle_count;
             else
@@ -1,10 +1,14 @@
+#include <doctest/doctest.h>
 #include <iostream>
 #include <loguru.hpp>
 #include <stdexcept>
 #include <thread>
 
 #include "cache_manager.h"
+#include "clang_complete.h"
 #include "diagnostics_engine.h"
+#include "file_watcher.h"
+#include "import_manager.h"
 #include "import_pipeline.h"
 #include "include_complete.h"
 #include "message_handler.h"
@@ -27,15 +31,15 @@ MethodType k_method_type = "initialize";
 // Code Lens options.
 struct LsCodeLensOptions {
     // Code lens has a resolve provider as well.
-    bool resolve_provider = false;
+    bool resolveProvider = false;
 };
-MAKE_REFLECT_STRUCT(LsCodeLensOptions, resolve_provider);
+MAKE_REFLECT_STRUCT(LsCodeLensOptions, resolveProvider);
 
 // Completion options.
 struct LsCompletionOptions {
     // The server provides support to resolve additional
     // information for a completion item.
-    bool resolve_provider = false;
+    bool resolveProvider = false;
 
     // The characters that trigger completion automatically.
     // vscode doesn't support trigger character sequences, so we use ':'
@@ -45,7 +49,7 @@ struct LsCompletionOptions {
     std::vector<std::string> trigger_characters = {".", ":",  ">", "#",
                                                    "<", "\"", "/"};
 };
-MAKE_REFLECT_STRUCT(LsCompletionOptions, resolve_provider, trigger_characters);
+MAKE_REFLECT_STRUCT(LsCompletionOptions, resolveProvider, trigger_characters);
 
 // Format document on type options
 struct LsDocumentOnTypeFormattingOptions {
@@ -535,6 +539,11 @@ struct Handler_Initialize : BaseMessageHandler<In_InitializeRequest> {
             Out_InitializeResponse out;
             out.id = request->id;
 
+            out.result.capabilities.completionProvider.resolveProvider =
+                g_config->completion.lazyDocumentation;
+            out.result.capabilities.codeLensProvider.resolveProvider =
+                g_config->codeLens.lazyLocations;
+
             // Check if formatting should be enabled.
             out.result.capabilities.documentFormattingProvider = false;
             out.result.capabilities.documentRangeFormattingProvider = false;
@@ -569,10 +578,7 @@ struct Handler_Initialize : BaseMessageHandler<In_InitializeRequest> {
             g_config->projectRoot = project_path;
             // Create two cache directories for files inside and outside of the
             // project.
-            MakeDirectoryRecursive(g_config->cacheDirectory +
-                                   EscapeFileName(g_config->projectRoot));
-            MakeDirectoryRecursive(g_config->cacheDirectory + '@' +
-                                   EscapeFileName(g_config->projectRoot));
+            ICacheManager::InitCacheDirectories();
 
             Timer time;
             diag_engine->Init();
@@ -602,9 +608,8 @@ struct Handler_Initialize : BaseMessageHandler<In_InitializeRequest> {
                 WorkThread::StartThread("indexer" + std::to_string(i), [=]() {
                     IndexerMain(diag_engine, file_consumer_shared,
                                 timestamp_manager, import_manager,
-                                import_pipeline_status, project, working_files,
-                                global_code_complete_cache,
-                                non_global_code_complete_cache);
+                                import_pipeline_status, project,
+                                working_files);
                 });
             }
 
@@ -612,6 +617,53 @@ struct Handler_Initialize : BaseMessageHandler<In_InitializeRequest> {
             // files, because that takes a long time.
             include_complete->Rescan();
 
+            if (g_config->index.watchFiles) {
+                std::vector<std::string> directories = {project_path};
+                for (const Directory& dir : project->quote_include_directories)
+                    directories.push_back(dir.path);
+                for (const Directory& dir : project->angle_include_directories)
+                    directories.push_back(dir.path);
+                FileWatcher::Instance()->Start(
+                    directories, [=](const AbsolutePath& path,
+                                     FileWatcher::ChangeType type) {
+                        // Only files that have been indexed, either as a
+                        // project entry or as a dependency, need an update.
+                        if (import_manager->GetStatus(path) ==
+                            PipelineStatus::kNotSeen) {
+                            return;
+                        }
+                        optional<uint64_t> buffer_hash;
+                        working_files->DoActionOnFile(
+                            path, [&](WorkingFile* file) {
+                                if (file)
+                                    buffer_hash =
+                                        HashContents(file->buffer_content);
+                            });
+                        bool is_interactive = !!buffer_hash;
+                        optional<std::string> contents;
+                        if (type == FileWatcher::ChangeType::kDeleted) {
+                            contents = std::string();
+                        } else if (is_interactive) {
+                            // The editor saved the file, which didSave
+                            // already handles.
+                            optional<std::string> content = ReadContent(path);
+                            if (content &&
+                                HashContents(*content) == *buffer_hash)
+                                return;
+                        }
+                        QueueManager::Instance()->index_request.Enqueue(
+                            Index_Request(
+                                path,
+                                project->FindCompilationEntryForFile(path).args,
+                                is_interactive, contents,
+                                ICacheManager::Make()),
+                            false /*priority*/);
+                        if (is_interactive &&
+                            type == FileWatcher::ChangeType::kChanged)
+                            clang_complete->NotifySave(path);
+                    });
+            }
+
             time.Reset();
             project->Index(QueueManager::Instance(), working_files,
                            request->id);
@@ -622,3 +674,23 @@ struct Handler_Initialize : BaseMessageHandler<In_InitializeRequest> {
 };
 REGISTER_MESSAGE_HANDLER(Handler_Initialize);
 }  // namespace
+
+TEST_SUITE("Initialize") {
+    TEST_CASE("resolve providers use protocol names") {
+        lsServerCapabilities capabilities;
+        capabilities.completionProvider.resolveProvider = true;
+        capabilities.codeLensProvider.resolveProvider = true;
+
+        rapidjson::StringBuffer output;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+        JsonWriter json_writer(&writer);
+        Reflect(json_writer, capabilities);
+
+        rapidjson::Document document;
+        document.Parse(output.GetString());
+        REQUIRE(!document.HasParseError());
+        REQUIRE(document["completionProvider"]["resolveProvider"].GetBool());
+        REQUIRE(document["codeLensProvider"]["resolveProvider"].GetBool());
+        REQUIRE(!document["completionProvider"].HasMember("resolve_provider"));
+    }
+}
@@ -12,7 +12,6 @@ struct LsDocumentCodeLensParams {
 };
 MAKE_REFLECT_STRUCT(LsDocumentCodeLensParams, text_document);
 
-using TCodeLens = LsCodeLens<LsCodeLensUserData, LsCodeLensCommandArguments>;
 struct InTextDocumentCodeLens : public RequestInMessage {
     MethodType GetMethodType() const override { return k_method_type; }
     LsDocumentCodeLensParams params;
@@ -22,8 +21,7 @@ REGISTER_IN_MESSAGE(InTextDocumentCodeLens);
 
 struct OutTextDocumentCodeLens : public LsOutMessage<OutTextDocumentCodeLens> {
     LsRequestId id;
-    std::vector<LsCodeLens<LsCodeLensUserData, LsCodeLensCommandArguments>>
-        result;
+    std::vector<TCodeLens> result;
 };
 MAKE_REFLECT_STRUCT(OutTextDocumentCodeLens, jsonrpc, id, result);
 
@@ -39,41 +37,33 @@ QueryId::LexicalRef OffsetStartColumn(QueryId::LexicalRef ref, int16_t offset) {
     return ref;
 }
 
-void AddCodeLens(const char* singular, const char* plural,
-                 CommonCodeLensParams* common, QueryId::LexicalRef ref,
-                 const std::vector<QueryId::LexicalRef>& uses,
+// Adds a code lens at |ref| for |lens| of |sym|. |count| is the number of
+// references it lists as maintained by querydb, so that code lens which would
+// be hidden are skipped without looking at the references. Unless
+// codeLens.lazyLocations is set, the references are resolved right away.
+void AddCodeLens(CommonCodeLensParams* common, QueryId::LexicalRef ref,
+                 QueryId::SymbolRef sym, LsCodeLensKind lens, size_t count,
                  bool force_display) {
+    if (!force_display && count == 0) return;
     TCodeLens code_lens;
     optional<LsRange> range = GetLsRange(common->working_file, ref.range);
     if (!range) return;
     if (ref.file == QueryId::File()) return;
     code_lens.range = *range;
-    code_lens.command = LsCommand<LsCodeLensCommandArguments>();
-    code_lens.command->command = "cquery.showReferences";
-    code_lens.command->arguments.uri = GetLsDocumentUri(common->db, ref.file);
-    code_lens.command->arguments.position = code_lens.range.start;
-
-    // Add unique uses.
-    std::unordered_set<LsLocation> unique_uses;
-    for (QueryId::LexicalRef use1 : uses) {
-        optional<LsLocation> location =
-            GetLsLocation(common->db, common->working_files, use1);
-        if (!location) continue;
-        unique_uses.insert(*location);
+    code_lens.data = LsCodeLensUserData();
+    code_lens.data->kind = sym.kind;
+    code_lens.data->id = sym.id.id;
+    code_lens.data->file = ref.file.id;
+    code_lens.data->lens = lens;
+
+    if (!g_config->codeLens.lazyLocations) {
+        if (!ResolveCodeLens(common->db, common->working_files, &code_lens))
+            return;
+        code_lens.data = nullopt;
+        if (!force_display && code_lens.command->arguments.locations.empty())
+            return;
     }
-    code_lens.command->arguments.locations.assign(unique_uses.begin(),
-                                                  unique_uses.end());
-
-    // User visible label
-    size_t num_usages = unique_uses.size();
-    code_lens.command->title = std::to_string(num_usages) + " ";
-    if (num_usages == 1)
-        code_lens.command->title += singular;
-    else
-        code_lens.command->title += plural;
-
-    if (force_display || unique_uses.size() > 0)
-        common->result->push_back(code_lens);
+    common->result->push_back(code_lens);
 }
 
 struct HandlerTextDocumentCodeLens
@@ -113,16 +103,14 @@ struct HandlerTextDocumentCodeLens
                     const QueryType::Def* def = type.AnyDef();
                     if (!def || def->kind == ls_symbol_kind::Namespace)
                         continue;
-                    AddCodeLens("ref", "refs", &common,
-                                OffsetStartColumn(ref, 0), type.uses,
+                    AddCodeLens(&common, OffsetStartColumn(ref, 0), sym,
+                                LsCodeLensKind::Refs, type.uses.size(),
                                 true /*force_display*/);
-                    AddCodeLens("derived", "derived", &common,
-                                OffsetStartColumn(ref, 1),
-                                GetDeclarations(db, type.derived),
+                    AddCodeLens(&common, OffsetStartColumn(ref, 1), sym,
+                                LsCodeLensKind::Derived, type.derived.size(),
                                 false /*force_display*/);
-                    AddCodeLens("var", "vars", &common,
-                                OffsetStartColumn(ref, 2),
-                                GetDeclarations(db, type.instances),
+                    AddCodeLens(&common, OffsetStartColumn(ref, 2), sym,
+                                LsCodeLensKind::Vars, type.instances.size(),
                                 false /*force_display*/);
                     break;
                 }
@@ -147,34 +135,33 @@ struct HandlerTextDocumentCodeLens
                         return *def;
                     };
 
-                    std::vector<QueryId::LexicalRef> base_callers =
-                        GetRefsForAllBases(db, func);
-                    std::vector<QueryId::LexicalRef> derived_callers =
-                        GetRefsForAllDerived(db, func);
-                    if (base_callers.empty() && derived_callers.empty()) {
+                    if (func.num_base_calls == 0 &&
+                        func.num_derived_calls == 0) {
                         QueryId::LexicalRef loc = try_ensure_spelling(ref);
-                        AddCodeLens("call", "calls", &common,
-                                    OffsetStartColumn(loc, offset++), func.uses,
-                                    true /*force_display*/);
+                        AddCodeLens(&common, OffsetStartColumn(loc, offset++),
+                                    sym, LsCodeLensKind::Calls,
+                                    func.uses.size(), true /*force_display*/);
                     } else {
                         QueryId::LexicalRef loc = try_ensure_spelling(ref);
-                        AddCodeLens("direct call", "direct calls", &common,
-                                    OffsetStartColumn(loc, offset++), func.uses,
-                                    false /*force_display*/);
-                        if (!base_callers.empty())
-                            AddCodeLens("base call", "base calls", &common,
-                                        OffsetStartColumn(loc, offset++),
-                                        base_callers, false /*force_display*/);
-                        if (!derived_callers.empty())
-                            AddCodeLens(
-                                "derived call", "derived calls", &common,
-                                OffsetStartColumn(loc, offset++),
-                                derived_callers, false /*force_display*/);
+                        AddCodeLens(&common, OffsetStartColumn(loc, offset++),
+                                    sym, LsCodeLensKind::DirectCalls,
+                                    func.uses.size(), false /*force_display*/);
+                        if (func.num_base_calls)
+                            AddCodeLens(&common,
+                                        OffsetStartColumn(loc, offset++), sym,
+                                        LsCodeLensKind::BaseCalls,
+                                        func.num_base_calls,
+                                        false /*force_display*/);
+                        if (func.num_derived_calls)
+                            AddCodeLens(&common,
+                                        OffsetStartColumn(loc, offset++), sym,
+                                        LsCodeLensKind::DerivedCalls,
+                                        func.num_derived_calls,
+                                        false /*force_display*/);
                     }
 
-                    AddCodeLens("derived", "derived", &common,
-                                OffsetStartColumn(ref, offset++),
-                                GetDeclarations(db, func.derived),
+                    AddCodeLens(&common, OffsetStartColumn(ref, offset++), sym,
+                                LsCodeLensKind::Derived, func.derived.size(),
                                 false /*force_display*/);
 
                     // "Base"
@@ -205,9 +192,8 @@ struct HandlerTextDocumentCodeLens
                             }
                         }
                     } else {
-                        AddCodeLens("base", "base", &common,
-                                    OffsetStartColumn(ref, 1),
-                                    GetDeclarations(db, def->bases),
+                        AddCodeLens(&common, OffsetStartColumn(ref, 1), sym,
+                                    LsCodeLensKind::Bases, def->bases.size(),
                                     false /*force_display*/);
                     }
 
@@ -226,8 +212,8 @@ struct HandlerTextDocumentCodeLens
                     if (def->kind == ls_symbol_kind::Macro)
                         force_display = false;
 
-                    AddCodeLens("ref", "refs", &common,
-                                OffsetStartColumn(ref, 0), var.uses,
+                    AddCodeLens(&common, OffsetStartColumn(ref, 0), sym,
+                                LsCodeLensKind::Refs, var.uses.size(),
                                 force_display);
                     break;
                 }
@@ -0,0 +1,50 @@
+#include <loguru.hpp>
+
+#include "lsp_code_action.h"
+#include "message_handler.h"
+#include "queue_manager.h"
+
+namespace {
+MethodType k_method_type = "codeLens/resolve";
+
+struct InTextDocumentCodeLensResolve : public RequestInMessage {
+    MethodType GetMethodType() const override { return k_method_type; }
+    TCodeLens params;
+};
+MAKE_REFLECT_STRUCT(InTextDocumentCodeLensResolve, id, params);
+REGISTER_IN_MESSAGE(InTextDocumentCodeLensResolve);
+
+struct OutTextDocumentCodeLensResolve
+    : public LsOutMessage<OutTextDocumentCodeLensResolve> {
+    LsRequestId id;
+    TCodeLens result;
+};
+MAKE_REFLECT_STRUCT(OutTextDocumentCodeLensResolve, jsonrpc, id, result);
+
+// Fills in the command, ie, the locations, left out of code lens responses
+// when codeLens.lazyLocations is set.
+struct HandlerTextDocumentCodeLensResolve
+    : BaseMessageHandler<InTextDocumentCodeLensResolve> {
+    MethodType GetMethodType() const override { return k_method_type; }
+
+    void Run(InTextDocumentCodeLensResolve* request) override {
+        OutTextDocumentCodeLensResolve out;
+        out.id = request->id;
+        out.result = std::move(request->params);
+        if (!ResolveCodeLens(db, working_files, &out.result)) {
+            // The symbol is gone, ie, the file was reindexed since the code
+            // lens was sent. Returning the lens without a command would show
+            // an empty lens, so fail the request instead.
+            LOG_S(INFO) << "Unable to resolve code lens";
+            OutError error;
+            error.id = request->id;
+            error.error.code = lsErrorCodes::InvalidParams;
+            error.error.message = "Code lens refers to an unknown symbol";
+            QueueManager::WriteStdout(k_method_type, error);
+            return;
+        }
+        QueueManager::WriteStdout(k_method_type, out);
+    }
+};
+REGISTER_MESSAGE_HANDLER(HandlerTextDocumentCodeLensResolve);
+}  // namespace
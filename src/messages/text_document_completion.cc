@@ -1,6 +1,10 @@
 #include <doctest/doctest.h>
 
 #include <loguru.hpp>
+
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <regex>
 
 #include "clang_complete.h"
@@ -11,6 +15,7 @@
 #include "message_handler.h"
 #include "queue_manager.h"
 #include "timer.h"
+#include "utils.h"
 #include "working_files.h"
 
 namespace {
@@ -159,87 +164,164 @@ std::string ToSortText(size_t rank) {
             digits[rank / n % n], digits[rank % n]};
 }
 
+// Only this many completion items are sent to the client.
+const size_t k_max_result_size = 100u;
+
+// Items which survived the previous call to FilterAndSortCompletionResponse.
+// While the user types at a completion point, the same results are filtered
+// with an ever longer prefix; only items which matched the shorter prefix can
+// match the longer one, so only those are scored again.
+struct CompletionFilterCache {
+    std::mutex m_mutex;
+    // The unfiltered completion results.
+    std::weak_ptr<const std::vector<lsCompletionItem>> m_items;
+    std::string m_complete_text;
+    // Indices of the items which are a subsequence match of |m_complete_text|.
+    std::vector<uint32_t> m_survivors;
+};
+CompletionFilterCache completion_filter_cache;
+
+std::string_view FilterText(const lsCompletionItem& item) {
+    return item.filterText ? *item.filterText : item.label;
+}
+
+// Builds the parts of |items| which were left out of the completion results,
+// now that it is known which items are sent. If completion.lazyDocumentation
+// is set, documentation is left to completionItem/resolve.
+void ResolveCompletionItems(std::vector<lsCompletionItem>* items) {
+    for (lsCompletionItem& item : *items) {
+        item.ResolveTexts();
+        if (!g_config->completion.lazyDocumentation)
+            item.ResolveDocumentation();
+    }
+    if (g_config->completion.lazyDocumentation)
+        CompletionResolveCache::Instance()->Store(items);
+}
+
 // Pre-filters completion responses before sending to vscode. This results in a
 // significantly snappier completion experience as vscode is easily overloaded
 // when given 1000+ completion items.
-void FilterAndSortCompletionResponse(OutTextDocumentComplete* complete_response,
-                                     const std::string& complete_text,
-                                     bool has_open_paren, bool enable) {
-    if (!enable) return;
-
-    ScopedPerfTimer timer("FilterAndSortCompletionResponse");
-
-// Used to inject more completions.
-#if false
-  const size_t kNumIterations = 250;
-  size_t size = complete_response->result.items.size();
-  complete_response->result.items.reserve(size * (kNumIterations + 1));
-  for (size_t iteration = 0; iteration < kNumIterations; ++iteration) {
-    for (size_t i = 0; i < size; ++i) {
-      auto item = complete_response->result.items[i];
-      item.label += "#" + std::to_string(iteration);
-      complete_response->result.items.push_back(item);
+//
+// Only the items which are sent are copied from |items| into
+// |complete_response|. If |cache| is given, it is used to only rescore the
+// items which matched the previous |complete_text| when the user has typed
+// more characters.
+void FilterAndSortCompletionResponse(
+    OutTextDocumentComplete* complete_response,
+    const std::shared_ptr<const std::vector<lsCompletionItem>>& items,
+    const std::string& complete_text, bool has_open_paren, bool enable,
+    CompletionFilterCache* cache = nullptr) {
+    std::vector<lsCompletionItem>& result = complete_response->result.items;
+    if (!enable) {
+        result = *items;
+        ResolveCompletionItems(&result);
+        return;
     }
-  }
-#endif
 
-    auto& items = complete_response->result.items;
+    ScopedPerfTimer timer("FilterAndSortCompletionResponse");
 
     auto finalize = [&]() {
-        const size_t k_max_result_size = 100u;
-        if (items.size() > k_max_result_size) {
-            items.resize(k_max_result_size);
-            complete_response->result.is_incomplete = true;
-        }
+        ResolveCompletionItems(&result);
 
         if (has_open_paren) {
-            for (auto& item : items) {
+            for (auto& item : result) {
                 item.insertText = item.label;
             }
         }
 
         // Set sortText. Note that this happens after resizing - we could do it
         // before, but then we should also sort by priority.
-        for (size_t i = 0; i < items.size(); ++i)
-            items[i].sortText = ToSortText(i);
+        for (size_t i = 0; i < result.size(); ++i)
+            result[i].sortText = ToSortText(i);
     };
 
     // No complete text; don't run any filtering logic except to trim the items.
     if (complete_text.empty()) {
+        if (items->size() > k_max_result_size) {
+            result.assign(items->begin(), items->begin() + k_max_result_size);
+            complete_response->result.is_incomplete = true;
+        } else {
+            result = *items;
+        }
         finalize();
         return;
     }
 
-    // Make sure all items have |filterText| set, code that follow needs it.
-    for (auto& item : items) {
-        if (!item.filterText) item.filterText = item.label;
+    // Indices of the items which may match |complete_text|.
+    std::vector<uint32_t> candidates;
+    bool is_refinement = false;
+    if (cache) {
+        std::lock_guard<std::mutex> lock(cache->m_mutex);
+        if (cache->m_items.lock() == items &&
+            !cache->m_complete_text.empty() &&
+            StartsWith(complete_text, cache->m_complete_text)) {
+            candidates = cache->m_survivors;
+            is_refinement = true;
+        }
+    }
+    if (!is_refinement) {
+        candidates.resize(items->size());
+        std::iota(candidates.begin(), candidates.end(), 0u);
     }
 
     // Fuzzy match and remove awful candidates.
+    struct Match {
+        int score;
+        uint32_t index;
+    };
     FuzzyMatcher fuzzy(complete_text);
-    for (auto& item : items) {
-        item.score_ =
-            CaseFoldingSubsequenceMatch(complete_text, *item.filterText).first
-                ? fuzzy.Match(*item.filterText)
-                : FuzzyMatcher::k_min_score;
+    std::vector<uint32_t> survivors;
+    std::vector<Match> matches;
+    for (uint32_t i : candidates) {
+        std::string_view filter_text = FilterText((*items)[i]);
+        if (!CaseFoldingSubsequenceMatch(complete_text, filter_text).first)
+            continue;
+        survivors.push_back(i);
+        int score = fuzzy.Match(filter_text);
+        if (score > FuzzyMatcher::k_min_score) matches.push_back({score, i});
+    }
+
+    if (cache) {
+        std::lock_guard<std::mutex> lock(cache->m_mutex);
+        cache->m_items = items;
+        cache->m_complete_text = complete_text;
+        cache->m_survivors = std::move(survivors);
+    }
+
+    // Only the best k_max_result_size matches are sent, so there is no need to
+    // order the rest.
+    auto less = [&items](const Match& lhs_match, const Match& rhs_match) {
+        if (lhs_match.score != rhs_match.score)
+            return lhs_match.score > rhs_match.score;
+        const lsCompletionItem& lhs = (*items)[lhs_match.index];
+        const lsCompletionItem& rhs = (*items)[rhs_match.index];
+        if (lhs.priority_ != rhs.priority_)
+            return lhs.priority_ < rhs.priority_;
+        std::string_view lhs_text = FilterText(lhs);
+        std::string_view rhs_text = FilterText(rhs);
+        if (lhs_text.size() != rhs_text.size())
+            return lhs_text.size() < rhs_text.size();
+        if (lhs_text != rhs_text) return lhs_text < rhs_text;
+        return lhs_match.index < rhs_match.index;
+    };
+    if (matches.size() > k_max_result_size) {
+        std::partial_sort(matches.begin(), matches.begin() + k_max_result_size,
+                          matches.end(), less);
+        matches.resize(k_max_result_size);
+        complete_response->result.is_incomplete = true;
+    } else {
+        std::sort(matches.begin(), matches.end(), less);
     }
-    items.erase(std::remove_if(items.begin(), items.end(),
-                               [](const lsCompletionItem& item) {
-                                   return item.score_ <=
-                                          FuzzyMatcher::k_min_score;
-                               }),
-                items.end());
-    std::sort(items.begin(), items.end(),
-              [](const lsCompletionItem& lhs, const lsCompletionItem& rhs) {
-                  if (lhs.score_ != rhs.score_) return lhs.score_ > rhs.score_;
-                  if (lhs.priority_ != rhs.priority_)
-                      return lhs.priority_ < rhs.priority_;
-                  if (lhs.filterText->size() != rhs.filterText->size())
-                      return lhs.filterText->size() < rhs.filterText->size();
-                  return *lhs.filterText < *rhs.filterText;
-              });
-
-    // Trim result.
+
+    result.reserve(matches.size());
+    for (const Match& match : matches) {
+        result.push_back((*items)[match.index]);
+        result.back().score_ = match.score;
+        // Clients filter by label unless |filterText| is set.
+        if (!result.back().filterText)
+            result.back().filterText = result.back().label;
+    }
+
     finalize();
 }
 
@@ -358,23 +440,27 @@ struct HandlerTextDocumentCompletion : MessageHandler {
                                  [&result](std::string_view k) {
                                      return k == result.keyword;
                                  })) {
-                    out.result.items =
-                        PreprocessorKeywordCompletionItems(result.match);
                     FilterAndSortCompletionResponse(
-                        &out, result.keyword, has_open_paren,
+                        &out,
+                        std::make_shared<const std::vector<lsCompletionItem>>(
+                            PreprocessorKeywordCompletionItems(result.match)),
+                        result.keyword, has_open_paren,
                         g_config->completion.filterAndSort);
                 }
             } else if (result.keyword.compare("include") == 0) {
+                std::shared_ptr<const std::vector<lsCompletionItem>> items;
                 {
                     // do include completion
                     std::unique_lock<std::mutex> lock(
                         include_complete->completion_items_mutex,
                         std::defer_lock);
                     if (include_complete->is_scanning) lock.lock();
-                    out.result.items = include_complete->completion_items;
+                    items =
+                        std::make_shared<const std::vector<lsCompletionItem>>(
+                            include_complete->completion_items);
                 }
                 FilterAndSortCompletionResponse(
-                    &out, result.pattern, has_open_paren,
+                    &out, items, result.pattern, has_open_paren,
                     g_config->completion.filterAndSort);
                 DecorateIncludePaths(result.match, &out.result.items);
             }
@@ -388,20 +474,31 @@ struct HandlerTextDocumentCompletion : MessageHandler {
 
             QueueManager::WriteStdout(k_method_type, out);
         } else {
-            ClangCompleteManager::OnComplete callback =
-                [this, request, existing_completion, end_pos,
-                 is_global_completion,
-                 has_open_paren](const LsRequestId& id,
-                                 std::vector<lsCompletionItem> results,
-                                 bool is_cached_result) {
+            // Global completion results do not depend on the position, so
+            // there is one entry per file for them.
+            CodeCompleteCache* cache = is_global_completion
+                                           ? global_code_complete_cache
+                                           : non_global_code_complete_cache;
+            optional<LsPosition> cache_position;
+            if (!is_global_completion)
+                cache_position = request->params.position;
+            CodeCompleteCache::Key cache_key =
+                CodeCompleteCache::MakeKey(path, file, cache_position);
+            std::shared_ptr<const CodeCompleteCache::Dependencies>
+                dependencies = cache->GetDependencies(db, path);
+
+            auto reply =
+                [request, existing_completion, end_pos, has_open_paren](
+                    const std::shared_ptr<const std::vector<lsCompletionItem>>&
+                        results) {
                     OutTextDocumentComplete out;
                     out.id = request->id;
-                    out.result.items = results;
 
                     // Emit completion results.
                     FilterAndSortCompletionResponse(
-                        &out, existing_completion, has_open_paren,
-                        g_config->completion.filterAndSort);
+                        &out, results, existing_completion, has_open_paren,
+                        g_config->completion.filterAndSort,
+                        &completion_filter_cache);
                     // Add text edits with the same text, but whose ranges
                     // include the whole token from start to end.
                     for (auto& item : out.result.items) {
@@ -411,76 +508,49 @@ struct HandlerTextDocumentCompletion : MessageHandler {
                     }
 
                     QueueManager::WriteStdout(k_method_type, out);
-
-                    // Cache completion results.
-                    if (!is_cached_result) {
-                        AbsolutePath path =
-                            request->params.text_document.uri.GetAbsolutePath();
-                        if (is_global_completion) {
-                            global_code_complete_cache->WithLock([&]() {
-                                global_code_complete_cache->m_cached_path =
-                                    path;
-                                global_code_complete_cache->m_cached_results =
-                                    results;
-                            });
-                        } else {
-                            non_global_code_complete_cache->WithLock([&]() {
-                                non_global_code_complete_cache->m_cached_path =
-                                    path;
-                                non_global_code_complete_cache
-                                    ->m_cached_completion_position =
-                                    request->params.position;
-                                non_global_code_complete_cache
-                                    ->m_cached_results = results;
-                            });
-                        }
-                    }
+                };
+            // Completion results are cached before they are filtered, so the
+            // following keystrokes at this completion point refine the same
+            // results.
+            ClangCompleteManager::OnComplete callback =
+                [reply, cache, cache_key, dependencies](
+                    const LsRequestId& id,
+                    const std::vector<lsCompletionItem>& results,
+                    bool is_cached_result) {
+                    assert(!is_cached_result);
+                    reply(cache->Insert(cache_key, results, dependencies));
                 };
 
-            bool is_cache_match = false;
-            global_code_complete_cache->WithLock([&]() {
-                is_cache_match =
-                    is_global_completion &&
-                    global_code_complete_cache->m_cached_path == path &&
-                    !global_code_complete_cache->m_cached_results.empty();
-            });
-            if (is_cache_match) {
+            std::shared_ptr<const std::vector<lsCompletionItem>>
+                cached_results = cache->TryGet(cache_key);
+            // An empty global result is more likely a failed completion than
+            // the truth, so compute it again.
+            if (is_global_completion && cached_results &&
+                cached_results->empty())
+                cached_results = nullptr;
+            if (cached_results && is_global_completion) {
                 ClangCompleteManager::OnComplete freshen_global =
-                    [this](const LsRequestId& id,
-                           std::vector<lsCompletionItem> results,
-                           bool is_cached_result) {
+                    [cache, cache_key, dependencies](
+                        const LsRequestId& id,
+                        const std::vector<lsCompletionItem>& results,
+                        bool is_cached_result) {
                         assert(!is_cached_result);
-
-                        // note: path is updated in the normal completion
-                        // handler.
-                        global_code_complete_cache->WithLock([&]() {
-                            global_code_complete_cache->m_cached_results =
-                                results;
-                        });
+                        cache->Insert(cache_key, results, dependencies);
                     };
 
                 // Reply immediately with the cache, and then send a new
                 // completion request in the background that will be freshen the
                 // global index.
-                global_code_complete_cache->WithLock([&]() {
-                    callback(request->id,
-                             global_code_complete_cache->m_cached_results,
-                             true /*is_cached_result*/);
-                });
+                reply(cached_results);
                 // Do not pass the request id, since we've already sent a
                 // response for the id.
                 clang_complete->CodeComplete(LsRequestId(), request->params,
                                              freshen_global);
-            } else if (non_global_code_complete_cache->IsCacheValid(
-                           request->params)) {
+            } else if (cached_results) {
                 // Don't bother updating a non-global completion request, since
                 // cache hits are much less likely and the cache is much more
                 // likely to be up to date.
-                non_global_code_complete_cache->WithLock([&]() {
-                    callback(request->id,
-                             non_global_code_complete_cache->m_cached_results,
-                             true /*is_cached_result*/);
-                });
+                reply(cached_results);
             } else {
                 // No cache hit.
                 clang_complete->CodeComplete(request->id, request->params,
@@ -513,4 +583,92 @@ TEST_SUITE("Completion lexing") {
         REQUIRE(check(std::vector<std::string>{"    ", "   <  "}, 0, 0));
     }
 }
+
+TEST_SUITE("Completion filtering") {
+    std::shared_ptr<const std::vector<lsCompletionItem>> MakeCompletionItems(
+        size_t count) {
+        static const char* words[] = {"set", "get",   "value", "Value",
+                                      "foo", "bar",   "size",  "Size",
+                                      "at",  "count", "make",  "index"};
+        const size_t num_words = sizeof(words) / sizeof(words[0]);
+        auto items = std::make_shared<std::vector<lsCompletionItem>>(count);
+        for (size_t i = 0; i < count; ++i) {
+            (*items)[i].label = std::string(words[i % num_words]) +
+                                words[i / num_words % num_words] + "_" +
+                                std::to_string(i);
+            (*items)[i].priority_ = unsigned(i % 3);
+        }
+        return items;
+    }
+
+    std::vector<std::string> FilterLabels(
+        const std::shared_ptr<const std::vector<lsCompletionItem>>& items,
+        const std::string& complete_text,
+        CompletionFilterCache* cache) {
+        OutTextDocumentComplete out;
+        FilterAndSortCompletionResponse(&out, items, complete_text,
+                                        false /*has_open_paren*/,
+                                        true /*enable*/, cache);
+        std::vector<std::string> labels;
+        for (const lsCompletionItem& item : out.result.items)
+            labels.push_back(item.label);
+        return labels;
+    }
+
+    TEST_CASE("top-k") {
+        std::shared_ptr<const std::vector<lsCompletionItem>> items =
+            MakeCompletionItems(1000);
+        std::vector<std::string> labels = FilterLabels(items, "sv", nullptr);
+        REQUIRE(labels.size() == k_max_result_size);
+        for (const std::string& label : labels)
+            REQUIRE(CaseFoldingSubsequenceMatch("sv", label).first);
+        REQUIRE(FilterLabels(items, "zzz", nullptr).empty());
+    }
+
+    TEST_CASE("refinement matches full filtering") {
+        std::shared_ptr<const std::vector<lsCompletionItem>> items =
+            MakeCompletionItems(1000);
+        CompletionFilterCache cache;
+        for (std::string complete_text :
+             {"s", "se", "set", "setV", "setVa", "se", "sev", "g", "ge"}) {
+            REQUIRE(FilterLabels(items, complete_text, &cache) ==
+                    FilterLabels(items, complete_text, nullptr));
+        }
+
+        // Different results do not reuse the cached survivors, even if they
+        // have the same items.
+        std::shared_ptr<const std::vector<lsCompletionItem>> other =
+            MakeCompletionItems(500);
+        REQUIRE(FilterLabels(other, "gets", &cache) ==
+                FilterLabels(other, "gets", nullptr));
+        FilterLabels(other, "g", &cache);
+        REQUIRE(FilterLabels(MakeCompletionItems(500), "ge", &cache) ==
+                FilterLabels(other, "ge", nullptr));
+    }
+
+    // Run with --test-unit --no-skip -tc="*filtering benchmark*".
+    TEST_CASE("filtering benchmark" * doctest::skip()) {
+        const size_t k_num_items = 20000;
+        std::shared_ptr<const std::vector<lsCompletionItem>> items =
+            MakeCompletionItems(k_num_items);
+        std::vector<std::string> keystrokes = {
+            "s", "se", "set", "setV", "setVa", "setVal", "setValu", "setValue"};
+
+        for (bool use_cache : {false, true}) {
+            CompletionFilterCache cache;
+            Timer timer;
+            for (const std::string& complete_text : keystrokes) {
+                OutTextDocumentComplete out;
+                timer.Reset();
+                FilterAndSortCompletionResponse(
+                    &out, items, complete_text, false /*has_open_paren*/,
+                    true /*enable*/, use_cache ? &cache : nullptr);
+                timer.ResetAndPrint(
+                    std::string(use_cache ? "[refined] " : "[full] ") +
+                    "Filtered " + std::to_string(k_num_items) +
+                    " items with \"" + complete_text + "\"");
+            }
+        }
+    }
+}
 }  // namespace
@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 
+#include "clang_complete.h"
 #include "lex_utils.h"
 #include "message_handler.h"
 #include "query_utils.h"
@@ -172,6 +173,12 @@ struct HandlerTextDocumentDefinition
             }
         }
 
+        // The user is likely to go to one of the results next.
+        std::vector<AbsolutePath> targets;
+        for (const LsLocation& location : out.result)
+            targets.push_back(location.uri.GetAbsolutePath());
+        clang_complete->m_preload_predictor.OnNavigate(targets);
+
         QueueManager::WriteStdout(k_method_type, out);
     }
 };
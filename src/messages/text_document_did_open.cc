@@ -75,8 +75,7 @@ struct HandlerTextDocumentDidOpen : BaseMessageHandler<InTextDocumentDidOpen> {
         }
 
         // Clear any existing completion state and preload completion.
-        clang_complete->FlushSession(entry.filename);
-        clang_complete->NotifyView(path);
+        clang_complete->NotifyOpen(path);
     }
 };
 REGISTER_MESSAGE_HANDLER(HandlerTextDocumentDidOpen);
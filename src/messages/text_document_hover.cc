@@ -5,28 +5,19 @@
 namespace {
 MethodType k_method_type = "textDocument/hover";
 
-// Find the comments for |sym|, if any.
-optional<LsMarkedString> GetComments(QueryDatabase* db,
-                                     QueryId::SymbolRef sym) {
-    auto make = [](std::string_view comment) -> optional<LsMarkedString> {
-        LsMarkedString result;
-        result.value = std::string(comment.data(), comment.length());
-        return result;
-    };
-
-    optional<LsMarkedString> result;
-    WithEntity(db, sym, [&](const auto& entity) {
-        if (const auto* def = entity.AnyDef()) {
-            if (!def->comments.empty()) result = make(def->comments);
-        }
-    });
+// Returns the comments in |texts|, if any.
+optional<LsMarkedString> GetComments(const LazyDefTexts& texts) {
+    if (texts.comments.empty()) return nullopt;
+    LsMarkedString result;
+    result.value = texts.comments;
     return result;
 }
 
 // Returns the hover or detailed name for `sym`, if any.
 optional<LsMarkedString> GetHoverOrName(QueryDatabase* db,
                                         const std::string& language,
-                                        QueryId::SymbolRef sym) {
+                                        QueryId::SymbolRef sym,
+                                        const LazyDefTexts& texts) {
     auto make = [&](std::string_view comment) {
         LsMarkedString result;
         result.language = language;
@@ -34,12 +25,11 @@ optional<LsMarkedString> GetHoverOrName(QueryDatabase* db,
         return result;
     };
 
+    if (!texts.hover.empty()) return make(texts.hover);
     optional<LsMarkedString> result;
     WithEntity(db, sym, [&](const auto& entity) {
         if (const auto* def = entity.AnyDef()) {
-            if (!def->hover.empty())
-                result = make(def->hover);
-            else if (!def->detailed_name.empty())
+            if (!def->detailed_name.empty())
                 result = make(def->detailed_name);
         }
     });
@@ -89,9 +79,11 @@ struct HandlerTextDocumentHover : BaseMessageHandler<InTextDocumentHover> {
                 working_files->GetFileByFilename(file->def->path), sym.range);
             if (!ls_range) continue;
 
-            optional<LsMarkedString> comments = GetComments(db, sym);
+            std::shared_ptr<LazyDefTexts> texts = GetHoverAndComments(db, sym);
+            if (!texts) continue;
+            optional<LsMarkedString> comments = GetComments(*texts);
             optional<LsMarkedString> hover =
-                GetHoverOrName(db, file->def->language, sym);
+                GetHoverOrName(db, file->def->language, sym, *texts);
             if (comments || hover) {
                 out.result = OutTextDocumentHover::Result();
                 out.result->range = *ls_range;
@@ -1,5 +1,6 @@
 #include <loguru.hpp>
 
+#include "clang_complete.h"
 #include "message_handler.h"
 #include "query_utils.h"
 #include "queue_manager.h"
@@ -88,6 +89,13 @@ struct HandlerTextDocumentReferences
 
         if ((int)out.result.size() >= g_config->xref.maxNum)
             out.result.resize(g_config->xref.maxNum);
+
+        // The user is likely to go to one of the results next.
+        std::vector<AbsolutePath> targets;
+        for (const LsLocation& location : out.result)
+            targets.push_back(location.uri.GetAbsolutePath());
+        clang_complete->m_preload_predictor.OnNavigate(targets);
+
         QueueManager::WriteStdout(k_method_type, out);
     }
 };
@@ -100,18 +100,26 @@ struct HandlerTextDocumentSignatureHelp : MessageHandler {
         }
         if (search.empty()) return;
 
+        AbsolutePath path = params.text_document.uri.GetAbsolutePath();
+        CodeCompleteCache::Key cache_key =
+            CodeCompleteCache::MakeKey(path, file, params.position);
+        std::shared_ptr<const CodeCompleteCache::Dependencies> dependencies =
+            signature_cache->GetDependencies(db, path);
+
         InTextDocumentSignatureHelp* msg =
             static_cast<InTextDocumentSignatureHelp*>(message.release());
         ClangCompleteManager::OnComplete callback =
-            [this, msg, search, active_param](
+            [this, msg, search, active_param, cache_key, dependencies](
                 const LsRequestId& id,
                 const std::vector<lsCompletionItem>& results,
                 bool is_cached_result) {
                 OutTextDocumentSignatureHelp out;
                 out.id = id;
 
-                for (auto& result : results) {
-                    if (result.label != search) continue;
+                for (const lsCompletionItem& candidate : results) {
+                    if (candidate.label != search) continue;
+                    lsCompletionItem result = candidate;
+                    result.ResolveTexts();
 
                     LsSignatureInformation signature;
                     signature.label = result.detail;
@@ -143,24 +151,16 @@ struct HandlerTextDocumentSignatureHelp : MessageHandler {
                 Timer timer;
                 QueueManager::WriteStdout(k_method_type, out);
 
-                if (!is_cached_result) {
-                    signature_cache->WithLock([&]() {
-                        signature_cache->m_cached_path =
-                            msg->params.text_document.uri.GetAbsolutePath();
-                        signature_cache->m_cached_completion_position =
-                            msg->params.position;
-                        signature_cache->m_cached_results = results;
-                    });
-                }
+                if (!is_cached_result)
+                    signature_cache->Insert(cache_key, results, dependencies);
 
                 delete msg;
             };
 
-        if (signature_cache->IsCacheValid(params)) {
-            signature_cache->WithLock([&]() {
-                callback(request->id, signature_cache->m_cached_results,
-                         true /*is_cached_result*/);
-            });
+        std::shared_ptr<const std::vector<lsCompletionItem>> cached_results =
+            signature_cache->TryGet(cache_key);
+        if (cached_results) {
+            callback(request->id, *cached_results, true /*is_cached_result*/);
         } else {
             clang_complete->CodeComplete(request->id, params,
                                          std::move(callback));
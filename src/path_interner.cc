@@ -0,0 +1,101 @@
+#include "path_interner.h"
+
+#include <doctest/doctest.h>
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+// static
+PathInterner* PathInterner::Instance() {
+    static PathInterner instance;
+    return &instance;
+}
+
+FileId PathInterner::Intern(const std::string& path) {
+    Shard& shard = m_shards[std::hash<std::string>()(path) % k_shard_count];
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+        auto it = shard.ids.find(path);
+        if (it != shard.ids.end()) return it->second;
+    }
+
+    std::unique_lock<std::shared_timed_mutex> lock(shard.mutex);
+    // Another thread may have interned |path| while the lock was released.
+    auto it = shard.ids.find(path);
+    if (it != shard.ids.end()) return it->second;
+
+    FileId id;
+    {
+        std::unique_lock<std::shared_timed_mutex> paths_lock(m_paths_mutex);
+        id = FileId(m_paths.size());
+        m_paths.push_back(path);
+    }
+    shard.ids[path] = id;
+    return id;
+}
+
+optional<FileId> PathInterner::TryGet(const std::string& path) const {
+    const Shard& shard =
+        m_shards[std::hash<std::string>()(path) % k_shard_count];
+    std::shared_lock<std::shared_timed_mutex> lock(shard.mutex);
+    auto it = shard.ids.find(path);
+    if (it == shard.ids.end()) return nullopt;
+    return it->second;
+}
+
+std::string PathInterner::GetPath(FileId id) const {
+    std::shared_lock<std::shared_timed_mutex> lock(m_paths_mutex);
+    return m_paths.at(id);
+}
+
+size_t PathInterner::Size() const {
+    std::shared_lock<std::shared_timed_mutex> lock(m_paths_mutex);
+    return m_paths.size();
+}
+
+TEST_SUITE("PathInterner") {
+    TEST_CASE("ids are dense and stable") {
+        PathInterner interner;
+        REQUIRE(!interner.TryGet("/a.cc"));
+        FileId a = interner.Intern("/a.cc");
+        FileId b = interner.Intern("/b.cc");
+        REQUIRE(a == 0);
+        REQUIRE(b == 1);
+        REQUIRE(interner.Intern("/a.cc") == a);
+        REQUIRE(interner.TryGet("/b.cc") == b);
+        REQUIRE(interner.GetPath(b) == "/b.cc");
+        REQUIRE(interner.Size() == 2);
+    }
+
+    TEST_CASE("concurrent interning") {
+        PathInterner interner;
+        const int k_threads = 8;
+        const int k_paths = 1000;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < k_threads; ++t) {
+            threads.emplace_back([&]() {
+                for (int i = 0; i < k_paths; ++i)
+                    interner.Intern("/" + std::to_string(i) + ".cc");
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+
+        REQUIRE(interner.Size() == k_paths);
+        for (int i = 0; i < k_paths; ++i) {
+            std::string path = "/" + std::to_string(i) + ".cc";
+            REQUIRE(interner.GetPath(*interner.TryGet(path)) == path);
+        }
+    }
+
+    TEST_CASE("FileIdTable") {
+        FileIdTable<int64_t> table(-1);
+        REQUIRE(table.Get(10000) == -1);
+        table.Set(10000, 5);
+        REQUIRE(table.Get(10000) == 5);
+        REQUIRE(table.Get(9999) == -1);
+        REQUIRE(table.Update(10000, [](int64_t v) { return v + 1; }));
+        REQUIRE(!table.Update(10000, [](int64_t v) { return v; }));
+        REQUIRE(table.Get(10000) == 6);
+    }
+}
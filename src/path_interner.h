@@ -0,0 +1,109 @@
+#pragma once
+
+#include <optional.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Dense id of an interned path. Ids are handed out sequentially starting at 0
+// and are never reused, so they can index directly into flat tables.
+using FileId = uint32_t;
+
+// Process-wide table mapping paths to FileIds. The table is split into shards
+// by path hash so that threads interning different paths rarely contend, and
+// looking up an already interned path only takes a shared lock.
+class PathInterner {
+   public:
+    static PathInterner* Instance();
+
+    // Returns the id of |path|, assigning a new one if it has not been seen.
+    FileId Intern(const std::string& path);
+    // Returns the id of |path| if it has already been interned.
+    optional<FileId> TryGet(const std::string& path) const;
+    // Returns the path which was interned as |id|.
+    std::string GetPath(FileId id) const;
+    // Number of interned paths. All ids are below this.
+    size_t Size() const;
+
+   private:
+    static const size_t k_shard_count = 64;
+
+    struct Shard {
+        mutable std::shared_timed_mutex mutex;
+        std::unordered_map<std::string, FileId> ids;
+    };
+
+    std::array<Shard, k_shard_count> m_shards;
+
+    // FileId -> path. std::deque so existing elements never move.
+    mutable std::shared_timed_mutex m_paths_mutex;
+    std::deque<std::string> m_paths;
+};
+
+// Table of atomic values indexed by FileId which can be read and updated from
+// any thread without locking. Storage is allocated in fixed-size chunks on
+// first write, so growing the table never moves existing values.
+template <typename T>
+class FileIdTable {
+   public:
+    explicit FileIdTable(T empty_value) : m_empty_value(empty_value) {
+        for (std::atomic<Chunk*>& chunk : m_chunks) chunk = nullptr;
+    }
+    ~FileIdTable() {
+        for (std::atomic<Chunk*>& chunk : m_chunks) delete chunk.load();
+    }
+    FileIdTable(const FileIdTable&) = delete;
+    FileIdTable& operator=(const FileIdTable&) = delete;
+
+    T Get(FileId id) const {
+        Chunk* chunk = m_chunks[id / k_chunk_size].load();
+        if (!chunk) return m_empty_value;
+        return (*chunk)[id % k_chunk_size].load();
+    }
+
+    void Set(FileId id, T value) { GetSlot(id).store(value); }
+
+    // Atomically replaces the value for |id| with |update(current_value)|.
+    // |update| may be called several times if other threads race on the same
+    // id, so it must not have side effects. Returns true if the value changed.
+    template <typename TFn>
+    bool Update(FileId id, TFn update) {
+        std::atomic<T>& slot = GetSlot(id);
+        T current = slot.load();
+        while (true) {
+            T next = update(current);
+            if (next == current) return false;
+            if (slot.compare_exchange_weak(current, next)) return true;
+        }
+    }
+
+   private:
+    static const size_t k_chunk_size = 4096;
+    // Allows for 16M distinct files.
+    static const size_t k_max_chunks = 4096;
+
+    using Chunk = std::array<std::atomic<T>, k_chunk_size>;
+
+    std::atomic<T>& GetSlot(FileId id) {
+        std::atomic<Chunk*>& slot = m_chunks.at(id / k_chunk_size);
+        Chunk* chunk = slot.load();
+        if (!chunk) {
+            std::unique_ptr<Chunk> created = std::make_unique<Chunk>();
+            for (std::atomic<T>& value : *created) value = m_empty_value;
+            // Another thread may have allocated the chunk in the meantime.
+            if (slot.compare_exchange_strong(chunk, created.get()))
+                chunk = created.release();
+        }
+        return (*chunk)[id % k_chunk_size];
+    }
+
+    T m_empty_value;
+    std::array<std::atomic<Chunk*>, k_max_chunks> m_chunks;
+};
@@ -127,47 +127,3 @@ bool Range::operator<(const Range& that) const {
     if (start != that.start) return start < that.start;
     return end < that.end;
 }
-
-// Position
-void Reflect(Reader& visitor, Position& value) {
-    if (visitor.Format() == serialize_format::Json) {
-        std::string s = visitor.GetString();
-        value = Position(s.c_str());
-    } else {
-        Reflect(visitor, value.line);
-        Reflect(visitor, value.column);
-    }
-}
-void Reflect(Writer& visitor, Position& value) {
-    if (visitor.Format() == serialize_format::Json) {
-        std::string output = value.ToString();
-        visitor.String(output.c_str(), output.size());
-    } else {
-        Reflect(visitor, value.line);
-        Reflect(visitor, value.column);
-    }
-}
-
-// Range
-void Reflect(Reader& visitor, Range& value) {
-    if (visitor.Format() == serialize_format::Json) {
-        std::string s = visitor.GetString();
-        value = Range(s.c_str());
-    } else {
-        Reflect(visitor, value.start.line);
-        Reflect(visitor, value.start.column);
-        Reflect(visitor, value.end.line);
-        Reflect(visitor, value.end.column);
-    }
-}
-void Reflect(Writer& visitor, Range& value) {
-    if (visitor.Format() == serialize_format::Json) {
-        std::string output = value.ToString();
-        visitor.String(output.c_str(), output.size());
-    } else {
-        Reflect(visitor, value.start.line);
-        Reflect(visitor, value.start.column);
-        Reflect(visitor, value.end.line);
-        Reflect(visitor, value.end.column);
-    }
-}
@@ -53,7 +53,48 @@ struct Range {
 MAKE_HASHABLE(Range, t.start, t.end);
 
 // Reflection
-void Reflect(Reader& visitor, Position& value);
-void Reflect(Writer& visitor, Position& value);
-void Reflect(Reader& visitor, Range& value);
-void Reflect(Writer& visitor, Range& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, Position& value) {
+    if (visitor.Format() == serialize_format::Json) {
+        std::string s = visitor.GetString();
+        value = Position(s.c_str());
+    } else {
+        Reflect(visitor, value.line);
+        Reflect(visitor, value.column);
+    }
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, Position& value) {
+    if (visitor.Format() == serialize_format::Json) {
+        std::string output = value.ToString();
+        visitor.String(output.c_str(), output.size());
+    } else {
+        Reflect(visitor, value.line);
+        Reflect(visitor, value.column);
+    }
+}
+
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, Range& value) {
+    if (visitor.Format() == serialize_format::Json) {
+        std::string s = visitor.GetString();
+        value = Range(s.c_str());
+    } else {
+        Reflect(visitor, value.start.line);
+        Reflect(visitor, value.start.column);
+        Reflect(visitor, value.end.line);
+        Reflect(visitor, value.end.column);
+    }
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, Range& value) {
+    if (visitor.Format() == serialize_format::Json) {
+        std::string output = value.ToString();
+        visitor.String(output.c_str(), output.size());
+    } else {
+        Reflect(visitor, value.start.line);
+        Reflect(visitor, value.start.column);
+        Reflect(visitor, value.end.line);
+        Reflect(visitor, value.end.column);
+    }
+}
@@ -0,0 +1,165 @@
+#include "preload_predictor.h"
+
+#include <doctest/doctest.h>
+#include <loguru.hpp>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "clang_complete.h"
+#include "config.h"
+#include "query.h"
+#include "utils.h"
+#include "working_files.h"
+
+namespace {
+
+// Total score of one navigation request.
+const double k_navigation_score = 1.0;
+// Navigation scores are multiplied by this whenever the active file changes
+// and forgotten once they drop below |k_min_navigation_score|.
+const double k_navigation_decay = 0.5;
+const double k_min_navigation_score = 0.05;
+const double k_include_score = 0.4;
+const double k_open_file_score = 0.25;
+
+}  // namespace
+
+void PreloadPredictor::OnView(const AbsolutePath& path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_active_file && *m_active_file == path) return;
+    m_active_file = path;
+
+    // The user got to |path|, so it no longer needs to be predicted.
+    m_navigation_scores.erase(path);
+    for (auto it = m_navigation_scores.begin();
+         it != m_navigation_scores.end();) {
+        it->second *= k_navigation_decay;
+        if (it->second < k_min_navigation_score)
+            it = m_navigation_scores.erase(it);
+        else
+            ++it;
+    }
+}
+
+void PreloadPredictor::OnNavigate(const std::vector<AbsolutePath>& targets) {
+    std::unordered_set<AbsolutePath> files(targets.begin(), targets.end());
+    if (files.empty()) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const AbsolutePath& file : files)
+        m_navigation_scores[file] += k_navigation_score / files.size();
+}
+
+optional<AbsolutePath> PreloadPredictor::GetActiveFile() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_active_file;
+}
+
+std::vector<AbsolutePath> PreloadPredictor::Predict(
+    const std::vector<AbsolutePath>& includes,
+    const std::vector<AbsolutePath>& open_files, size_t max_files) {
+    std::unordered_map<AbsolutePath, double> scores;
+    optional<AbsolutePath> active_file;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        scores = m_navigation_scores;
+        active_file = m_active_file;
+    }
+    for (const AbsolutePath& file :
+         std::unordered_set<AbsolutePath>(includes.begin(), includes.end()))
+        scores[file] += k_include_score;
+    for (const AbsolutePath& file : open_files)
+        scores[file] += k_open_file_score;
+    if (active_file) scores.erase(*active_file);
+
+    std::vector<std::pair<double, AbsolutePath>> ranked;
+    for (auto& entry : scores) ranked.emplace_back(entry.second, entry.first);
+    // Ties are broken by path so that predictions are stable.
+    std::sort(ranked.begin(), ranked.end(),
+              [](const std::pair<double, AbsolutePath>& a,
+                 const std::pair<double, AbsolutePath>& b) {
+                  if (a.first != b.first) return a.first > b.first;
+                  return a.second.path < b.second.path;
+              });
+
+    std::vector<AbsolutePath> result;
+    for (size_t i = 0; i < ranked.size() && i < max_files; ++i)
+        result.push_back(ranked[i].second);
+    return result;
+}
+
+void WarmCompletionSessions(QueryDatabase* db, WorkingFiles* working_files,
+                            ClangCompleteManager* clang_complete) {
+    int max_sessions = g_config->completion.warmupSessions;
+    if (max_sessions <= 0) return;
+    PreloadPredictor* predictor = &clang_complete->m_preload_predictor;
+    optional<AbsolutePath> active_file = predictor->GetActiveFile();
+    if (!active_file) return;
+
+    std::vector<AbsolutePath> includes;
+    auto it = db->usr_to_file.find(*active_file);
+    if (it != db->usr_to_file.end()) {
+        const QueryFile& file = db->files[it->second.id];
+        if (file.def) {
+            for (const IndexInclude& include : file.def->includes) {
+                includes.push_back(
+                    AbsolutePath(include.resolved_path, false /*validate*/));
+            }
+        }
+    }
+    std::vector<AbsolutePath> open_files;
+    working_files->DoAction([&]() {
+        for (const std::unique_ptr<WorkingFile>& file : working_files->files)
+            open_files.push_back(file->filename);
+    });
+
+    // Consider a few more files than can be warmed, since some of them may
+    // already have a session.
+    for (const AbsolutePath& path :
+         predictor->Predict(includes, open_files, 2 * max_sessions)) {
+        // Files outside of the project, ie, system headers, are rarely edited.
+        if (!StartsWith(path.path, g_config->projectRoot)) continue;
+        if (clang_complete->WarmSession(path))
+            LOG_S(INFO) << "Warming code completion session for " << path;
+    }
+}
+
+TEST_SUITE("PreloadPredictor") {
+    AbsolutePath Path(const std::string& path) {
+        return AbsolutePath(path, false /*validate*/);
+    }
+
+    TEST_CASE("navigation targets come first") {
+        PreloadPredictor predictor;
+        predictor.OnView(Path("/a.cc"));
+        predictor.OnNavigate({Path("/b.h")});
+        predictor.OnNavigate({Path("/c.cc"), Path("/d.cc"), Path("/d.cc")});
+        std::vector<AbsolutePath> result = predictor.Predict(
+            {Path("/e.h"), Path("/b.h")}, {Path("/a.cc"), Path("/f.cc")}, 10);
+        std::vector<AbsolutePath> expected = {Path("/b.h"), Path("/c.cc"),
+                                              Path("/d.cc"), Path("/e.h"),
+                                              Path("/f.cc")};
+        REQUIRE(result == expected);
+        REQUIRE(predictor.Predict({}, {}, 1) ==
+                std::vector<AbsolutePath>{Path("/b.h")});
+    }
+
+    TEST_CASE("navigation scores decay") {
+        PreloadPredictor predictor;
+        predictor.OnView(Path("/a.cc"));
+        predictor.OnNavigate({Path("/b.cc")});
+        predictor.OnView(Path("/c.cc"));
+        // Viewing the same file again does not decay.
+        predictor.OnView(Path("/c.cc"));
+        REQUIRE(predictor.m_navigation_scores[Path("/b.cc")] == 0.5);
+        // The viewed file is not predicted anymore.
+        predictor.OnNavigate({Path("/d.cc")});
+        predictor.OnView(Path("/d.cc"));
+        REQUIRE(predictor.Predict({}, {Path("/d.cc")}, 10) ==
+                std::vector<AbsolutePath>{Path("/b.cc")});
+        for (int i = 0; i < 4; ++i)
+            predictor.OnView(Path(i % 2 ? "/a.cc" : "/c.cc"));
+        REQUIRE(predictor.Predict({}, {}, 10).empty());
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <optional.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "file_types.h"
+
+struct ClangCompleteManager;
+struct QueryDatabase;
+struct WorkingFiles;
+
+// Guesses which files the user will view next, so their completion sessions
+// can be built before they are needed. A file scores for each definition or
+// references request which led to it, for being included by the active file
+// and for being open in the editor. Navigation scores decay every time the
+// user switches files, so old history is forgotten.
+struct PreloadPredictor {
+    // Called when |path| is viewed or edited.
+    void OnView(const AbsolutePath& path);
+    // Called when a definition or references request returned locations in
+    // |targets|. Each request contributes the same total score, split between
+    // the distinct files it returned.
+    void OnNavigate(const std::vector<AbsolutePath>& targets);
+
+    // The file the user viewed last.
+    optional<AbsolutePath> GetActiveFile();
+    // Returns up to |max_files| files, most likely first. |includes| are the
+    // files included by the active file and |open_files| the files open in the
+    // editor. The active file is never returned.
+    std::vector<AbsolutePath> Predict(
+        const std::vector<AbsolutePath>& includes,
+        const std::vector<AbsolutePath>& open_files, size_t max_files);
+
+    std::mutex m_mutex;
+    optional<AbsolutePath> m_active_file;
+    std::unordered_map<AbsolutePath, double> m_navigation_scores;
+};
+
+// Builds completion sessions for the files predicted by
+// |clang_complete->m_preload_predictor|, up to completion.warmupSessions. Must
+// be called on the querydb thread, when it is otherwise idle.
+void WarmCompletionSessions(QueryDatabase* db, WorkingFiles* working_files,
+                            ClangCompleteManager* clang_complete);
@@ -2,6 +2,7 @@
 
 #include <clang-c/CXCompilationDatabase.h>
 #include <doctest/doctest.h>
+#include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 
 #include <loguru.hpp>
@@ -16,6 +17,7 @@
 #include "platform.h"
 #include "queue_manager.h"
 #include "serializers/json.h"
+#include "serializers/msgpack.h"
 #include "timer.h"
 #include "utils.h"
 #include "working_files.h"
@@ -26,10 +28,14 @@
 
 #include <optional.h>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <limits>
 #include <sstream>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -42,6 +48,7 @@ struct CompileCommandsEntry {
     std::vector<std::string> args;
 };
 MAKE_REFLECT_STRUCT(CompileCommandsEntry, directory, file, command, args);
+MAKE_REFLECT_STRUCT(Project::Entry, filename, args, is_inferred);
 
 namespace {
 
@@ -80,11 +87,68 @@ enum class project_mode {
     ExternalCommand
 };
 
+// A compilation entry whose arguments have been processed, but which does not
+// have the system include flags appended yet. Discovering system includes runs
+// a compiler, so it is deferred until every entry has been processed.
+struct PendingEntry {
+    // Hash of the compile command this entry was processed from.
+    uint64_t command_hash = 0;
+    Project::Entry entry;
+    // False if the compile command had no arguments. Such entries do not get
+    // any system includes.
+    bool has_args = false;
+    std::string compiler_driver;
+    LanguageId language = LanguageId::Unknown;
+    std::string directory;
+};
+MAKE_REFLECT_STRUCT(PendingEntry, command_hash, entry, has_args,
+                    compiler_driver, language, directory);
+
+// What system includes were discovered with. They are only discovered again
+// for a language if this changes.
+struct SystemIncludesKey {
+    std::string compiler_driver;
+    // Flags which change the system includes, see GetSystemIncludeFlags.
+    std::vector<std::string> flags;
+
+    bool operator==(const SystemIncludesKey& o) const {
+        return compiler_driver == o.compiler_driver && flags == o.flags;
+    }
+};
+
+// Processed project state which is persisted in the cache directory between
+// sessions, so that a restart only processes compile commands which changed.
+struct ProjectCache {
+    struct SystemIncludes {
+        LanguageId language = LanguageId::Unknown;
+        std::string compiler_driver;
+        std::vector<std::string> compiler_flags;
+        optional<int64_t> compiler_driver_modification_time;
+        std::vector<std::string> flags;
+    };
+
+    // Hash of the options which change how compile commands are processed.
+    uint64_t settings_hash = 0;
+    std::string comp_db_path;
+    optional<int64_t> comp_db_modification_time;
+    std::vector<PendingEntry> entries;
+    std::vector<SystemIncludes> system_includes;
+    std::vector<std::string> quote_dirs;
+    std::vector<std::string> angle_dirs;
+
+    // Not serialized. Maps PendingEntry::command_hash to the entry.
+    std::unordered_map<uint64_t, const PendingEntry*> entries_by_hash;
+};
+MAKE_REFLECT_STRUCT(ProjectCache::SystemIncludes, language, compiler_driver,
+                    compiler_flags, compiler_driver_modification_time, flags);
+MAKE_REFLECT_STRUCT(ProjectCache, settings_hash, comp_db_path,
+                    comp_db_modification_time, entries, system_includes,
+                    quote_dirs, angle_dirs);
+
 struct ProjectConfig {
+    // System include directories and defines, keyed by language.
     std::unordered_map<LanguageId, std::vector<std::string>>
         discovered_system_includes;
-    std::unordered_map<LanguageId, std::vector<std::string>>
-        discovered_system_defines;
     std::unordered_set<Directory> quote_dirs;
     std::unordered_set<Directory> angle_dirs;
     std::vector<std::string> extra_flags;
@@ -92,45 +156,25 @@ struct ProjectConfig {
     std::string resource_dir;
     project_mode mode = project_mode::CompileCommandsJson;
     NormalizationCache normalization_cache;
+    // Compiler driver and flags that system includes were discovered with,
+    // keyed by language.
+    std::unordered_map<LanguageId, SystemIncludesKey> system_include_keys;
+    // Location and modification time of the compile_commands.json that was
+    // loaded, if any.
+    std::string comp_db_path;
+    optional<int64_t> comp_db_modification_time;
+    // State from the previous session. Compile commands found in it are not
+    // processed again.
+    const ProjectCache* previous = nullptr;
 };
 
-const std::vector<std::string>& GetSystemIncludes(
-    ProjectConfig* project_config, const std::string& compiler_driver,
-    LanguageId language, const std::string& working_directory,
+// Returns the flags of a compile command which may change the system include
+// directories, so they are passed on when discovering them.
+std::vector<std::string> GetSystemIncludeFlags(
     const std::vector<std::string>& flags) {
-    auto it = project_config->discovered_system_includes.find(language);
-    if (it != project_config->discovered_system_includes.end())
-        return it->second;
-
-    if (g_disable_normalize_path_for_test ||
-        !g_config->discoverSystemIncludes) {
-        project_config->discovered_system_includes[language] = {};
-        return project_config->discovered_system_includes[language];
-    }
-
-    std::string language_string;
-    switch (language) {
-        case LanguageId::Unknown:
-            language_string = "c++";
-            break;
-        case LanguageId::C:
-            language_string = "c";
-            break;
-        case LanguageId::Cpp:
-            language_string = "c++";
-            break;
-        case LanguageId::ObjC:
-            language_string = "objective-c";
-            break;
-        case LanguageId::ObjCpp:
-            language_string = "objective-c++";
-            break;
-    }
-
-    // Capture these flags in |extra_flags|, since they may change system
-    // include directories.
     static std::vector<std::string> k_flags_to_pass = {
-        "--gcc-toolchain", "--sysroot", "-isysroot", "-stdlib", "--target"};
+        "--gcc-toolchain", "--sysroot", "-isysroot", "-stdlib", "--target",
+        "-target"};
     static std::vector<std::string> k_standalone_flags_to_pass = {
         "-nostdinc", "-nostdinc++", "-nobuiltininc"};
     std::vector<std::string> extra_flags;
@@ -152,6 +196,36 @@ const std::vector<std::string>& GetSystemIncludes(
             if (flag == to_pass_flag) extra_flags.push_back(flag);
         }
     }
+    return extra_flags;
+}
+
+// Runs the project's compiler (or a fallback compiler) to find the system
+// include directories and preprocessor defines for |language|. This spawns
+// processes, so the result should be cached.
+std::vector<std::string> DiscoverSystemIncludes(
+    const std::string& compiler_driver, LanguageId language,
+    const std::string& working_directory,
+    const std::vector<std::string>& flags) {
+    std::string language_string;
+    switch (language) {
+        case LanguageId::Unknown:
+            language_string = "c++";
+            break;
+        case LanguageId::C:
+            language_string = "c";
+            break;
+        case LanguageId::Cpp:
+            language_string = "c++";
+            break;
+        case LanguageId::ObjC:
+            language_string = "objective-c";
+            break;
+        case LanguageId::ObjCpp:
+            language_string = "objective-c++";
+            break;
+    }
+
+    std::vector<std::string> extra_flags = GetSystemIncludeFlags(flags);
 
     std::vector<std::string> compiler_drivers;
     if (IsAbsolutePath(compiler_driver)) {
@@ -163,32 +237,42 @@ const std::vector<std::string>& GetSystemIncludes(
         compiler_drivers.emplace_back("g++");
     }
 
-    project_config->discovered_system_includes[language] =
-        FindSystemIncludeDirectories(compiler_drivers, language_string,
-                                     working_directory, extra_flags);
-    project_config->discovered_system_defines[language] = FindSystemDefines(
+    std::vector<std::string> includes = FindSystemIncludeDirectories(
+        compiler_drivers, language_string, working_directory, extra_flags);
+    std::vector<std::string> defines = FindSystemDefines(
         compiler_drivers, language_string, working_directory, extra_flags);
     LOG_S(INFO) << "Using system include directory flags\n  "
-                << StringJoin(
-                       project_config->discovered_system_includes[language],
-                       "\n  ");
+                << StringJoin(includes, "\n  ");
     LOG_S(INFO) << "Using system preprocessor defines\n  "
-                << StringJoin(
-                       project_config->discovered_system_defines[language],
-                       "\n  ");
+                << StringJoin(defines, "\n  ");
     LOG_S(INFO) << "To disable this set the discoverSystemIncludes config "
                 << "option to false.";
 
-    project_config->discovered_system_includes[language].reserve(
-        project_config->discovered_system_includes[language].size() +
-        project_config->discovered_system_defines[language].size());
+    AddRange(&includes, std::move(defines));
+    return includes;
+}
+
+bool ShouldDiscoverSystemIncludes() {
+    return !g_disable_normalize_path_for_test &&
+           g_config->discoverSystemIncludes;
+}
 
-    for (const auto& element :
-         project_config->discovered_system_defines[language]) {
-        project_config->discovered_system_includes[language].emplace_back(
-            element);
+const std::vector<std::string>& GetSystemIncludes(
+    ProjectConfig* project_config, const std::string& compiler_driver,
+    LanguageId language, const std::string& working_directory,
+    const std::vector<std::string>& flags) {
+    auto it = project_config->discovered_system_includes.find(language);
+    if (it != project_config->discovered_system_includes.end())
+        return it->second;
+
+    if (!ShouldDiscoverSystemIncludes()) {
+        project_config->discovered_system_includes[language] = {};
+        return project_config->discovered_system_includes[language];
     }
 
+    project_config->discovered_system_includes[language] =
+        DiscoverSystemIncludes(compiler_driver, language, working_directory,
+                               flags);
     return project_config->discovered_system_includes[language];
 }
 
@@ -257,8 +341,11 @@ LanguageId SourceFileLanguage(const std::string& path) {
     return LanguageId::Unknown;
 }
 
-Project::Entry GetCompilationEntryFromCompileCommandEntry(
-    ProjectConfig* config, const CompileCommandsEntry& entry) {
+// Processes the arguments of |entry|. This only touches |config|'s
+// normalization cache and include directory sets, so entries can be processed
+// in parallel as long as each thread has its own |config|.
+PendingEntry ProcessCompileCommandEntry(ProjectConfig* config,
+                                        const CompileCommandsEntry& entry) {
     auto cleanup_maybe_relative_path =
         [&](const std::string& path) -> AbsolutePath {
         // TODO/FIXME: Normalization will fail for paths that do not exist.
@@ -274,7 +361,8 @@ Project::Entry GetCompilationEntryFromCompileCommandEntry(
         return config->normalization_cache.Get(entry.directory + "/" + path);
     };
 
-    Project::Entry result;
+    PendingEntry pending;
+    Project::Entry& result = pending.entry;
     result.filename = config->normalization_cache.Get(entry.file);
     const std::string base_name = GetBaseName(entry.file);
 
@@ -292,7 +380,7 @@ Project::Entry GetCompilationEntryFromCompileCommandEntry(
             args.push_back(arg);
         }
     }
-    if (args.empty()) return result;
+    if (args.empty()) return pending;
 
     std::string first_arg = args[0];
     // Windows' filesystem is not case sensitive, so we compare only
@@ -451,10 +539,156 @@ Project::Entry GetCompilationEntryFromCompileCommandEntry(
         result.args.push_back("-fparse-all-comments");
     }
 
-    const auto& system_includes = GetSystemIncludes(
-        config, compiler_driver, lang, entry.directory, result.args);
-    for (const auto& flag : system_includes) result.args.push_back(flag);
+    pending.has_args = true;
+    pending.compiler_driver = compiler_driver;
+    pending.language = lang;
+    pending.directory = entry.directory;
+    return pending;
+}
+
+Project::Entry GetCompilationEntryFromCompileCommandEntry(
+    ProjectConfig* config, const CompileCommandsEntry& entry) {
+    PendingEntry pending = ProcessCompileCommandEntry(config, entry);
+    if (pending.has_args) {
+        AddRange(&pending.entry.args,
+                 GetSystemIncludes(config, pending.compiler_driver,
+                                   pending.language, pending.directory,
+                                   pending.entry.args));
+    }
+    return std::move(pending.entry);
+}
+
+uint64_t HashCompileCommand(const CompileCommandsEntry& command) {
+    std::string key = command.directory;
+    key += '\0';
+    key += command.file;
+    for (const std::string& arg : command.args) {
+        key += '\0';
+        key += arg;
+    }
+    return HashUsr(key);
+}
+
+// Processes every command in |commands| using all cores. Each worker owns a
+// copy of |config| so normalization and include directory collection do not
+// need to synchronize; the include directories are merged back into |config|
+// afterwards. Commands which are unchanged since the previous session are
+// taken from |config->previous| instead.
+std::vector<PendingEntry> ProcessCompileCommandEntries(
+    ProjectConfig* config, std::vector<CompileCommandsEntry> commands) {
+    // Spinning up a worker is not worth it for only a few commands.
+    const size_t k_min_commands_per_worker = 64;
+    size_t num_workers =
+        std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                         commands.size() / k_min_commands_per_worker);
+    num_workers = std::max<size_t>(num_workers, 1);
+
+    std::vector<PendingEntry> pending(commands.size());
+    std::vector<ProjectConfig> worker_configs(num_workers, *config);
+    std::vector<std::future<void>> workers;
+    std::atomic<size_t> num_reused(0);
+    size_t chunk_size = (commands.size() + num_workers - 1) / num_workers;
+    for (size_t w = 0; w < num_workers; ++w) {
+        size_t begin = std::min(commands.size(), w * chunk_size);
+        size_t end = std::min(commands.size(), begin + chunk_size);
+        ProjectConfig* worker_config = &worker_configs[w];
+        workers.push_back(std::async(std::launch::async, [&, worker_config,
+                                                          begin, end]() {
+            for (size_t i = begin; i < end; ++i) {
+                CompileCommandsEntry& command = commands[i];
+                uint64_t command_hash = HashCompileCommand(command);
+                if (config->previous) {
+                    auto it =
+                        config->previous->entries_by_hash.find(command_hash);
+                    if (it != config->previous->entries_by_hash.end()) {
+                        pending[i] = *it->second;
+                        ++num_reused;
+                        continue;
+                    }
+                }
+
+                command.file =
+                    worker_config->normalization_cache.Get(command.file);
+                pending[i] = ProcessCompileCommandEntry(worker_config, command);
+                pending[i].command_hash = command_hash;
+            }
+        }));
+    }
+    for (std::future<void>& worker : workers) worker.get();
+
+    for (ProjectConfig& worker_config : worker_configs) {
+        config->quote_dirs.insert(worker_config.quote_dirs.begin(),
+                                  worker_config.quote_dirs.end());
+        config->angle_dirs.insert(worker_config.angle_dirs.begin(),
+                                  worker_config.angle_dirs.end());
+    }
+
+    if (config->previous) {
+        LOG_S(INFO) << "Reused " << num_reused << " of " << pending.size()
+                    << " compilation entries from the project cache";
+    }
+    return pending;
+}
+
+// Returns the modification time of the compiler that system includes are
+// discovered with for |compiler_driver|, so cached system includes can be
+// invalidated when that compiler is updated.
+optional<int64_t> GetCompilerDriverModificationTime(
+    const std::string& compiler_driver) {
+    if (IsAbsolutePath(compiler_driver))
+        return GetLastModificationTime(compiler_driver);
+    return GetLastModificationTime(
+        GetExecutablePathNextToCqueryBinary("cquery-clang"));
+}
 
+// Discovers system includes concurrently for every distinct language in
+// |pending| which does not have them yet. The first entry of each language
+// decides which compiler is probed, like the serial path does.
+void DiscoverSystemIncludesForEntries(ProjectConfig* config,
+                                      const std::vector<PendingEntry>& pending) {
+    if (!ShouldDiscoverSystemIncludes()) return;
+
+    std::unordered_map<LanguageId, std::future<std::vector<std::string>>>
+        probes;
+    std::unordered_set<LanguageId> seen;
+    for (const PendingEntry& p : pending) {
+        if (!p.has_args || !seen.insert(p.language).second) continue;
+        // System includes carried over from the previous session are only
+        // valid if the project still builds with the same compiler, sysroot,
+        // target and standard library.
+        SystemIncludesKey key{p.compiler_driver,
+                              GetSystemIncludeFlags(p.entry.args)};
+        auto it = config->system_include_keys.find(p.language);
+        if (it != config->system_include_keys.end() && it->second == key &&
+            config->discovered_system_includes.count(p.language)) {
+            continue;
+        }
+        config->discovered_system_includes.erase(p.language);
+        config->system_include_keys[p.language] = std::move(key);
+        probes[p.language] = std::async(std::launch::async, [&p]() {
+            return DiscoverSystemIncludes(p.compiler_driver, p.language,
+                                          p.directory, p.entry.args);
+        });
+    }
+    for (auto& probe : probes)
+        config->discovered_system_includes[probe.first] = probe.second.get();
+}
+
+// Appends the system includes to every entry in |pending|.
+std::vector<Project::Entry> FinishPendingEntries(
+    ProjectConfig* config, std::vector<PendingEntry> pending) {
+    DiscoverSystemIncludesForEntries(config, pending);
+
+    std::vector<Project::Entry> result;
+    result.reserve(pending.size());
+    for (PendingEntry& p : pending) {
+        if (p.has_args) {
+            AddRange(&p.entry.args,
+                     GetSystemIncludes(config, p.compiler_driver, p.language,
+                                       p.directory, p.entry.args));
+        }
+        result.push_back(std::move(p.entry));
+    }
     return result;
 }
 
@@ -469,9 +703,8 @@ std::vector<std::string> ReadCompilerArgumentsFromFile(
     return args;
 }
 
-std::vector<Project::Entry> LoadFromDirectoryListing(
+std::vector<PendingEntry> LoadFromDirectoryListing(
     ProjectConfig* config, bool use_global_config = false) {
-    std::vector<Project::Entry> result;
     config->mode = project_mode::DotCquery;
 
     std::unordered_map<std::string, std::vector<std::string>> folder_args;
@@ -548,6 +781,8 @@ std::vector<Project::Entry> LoadFromDirectoryListing(
             return project_dir_args;
         };
 
+    std::vector<CompileCommandsEntry> commands;
+    commands.reserve(files.size());
     for (const std::string& file : files) {
         CompileCommandsEntry e;
         e.directory = config->project_dir;
@@ -555,13 +790,202 @@ std::vector<Project::Entry> LoadFromDirectoryListing(
         e.args = get_compiler_argument_for_file(file);
         if (e.args.empty()) e.args.push_back("%clang");  // Add a Dummy.
         e.args.push_back(e.file);
-        result.push_back(GetCompilationEntryFromCompileCommandEntry(config, e));
+        commands.push_back(std::move(e));
+    }
+
+    return ProcessCompileCommandEntries(config, std::move(commands));
+}
+
+// Splits |command| into arguments using POSIX shell quoting rules. This
+// matches how clang's JSON compilation database unescapes "command" strings.
+std::vector<std::string> SplitUnixCommandLine(const std::string& command) {
+    std::vector<std::string> args;
+    std::string current;
+    bool in_arg = false;
+    for (size_t i = 0; i < command.size(); ++i) {
+        char c = command[i];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            if (in_arg) args.push_back(std::move(current));
+            current.clear();
+            in_arg = false;
+            continue;
+        }
+
+        in_arg = true;
+        if (c == '\\') {
+            if (i + 1 < command.size()) current += command[++i];
+        } else if (c == '\'') {
+            for (++i; i < command.size() && command[i] != '\''; ++i)
+                current += command[i];
+        } else if (c == '"') {
+            for (++i; i < command.size() && command[i] != '"'; ++i) {
+                if (command[i] == '\\' && i + 1 < command.size()) ++i;
+                current += command[i];
+            }
+        } else {
+            current += c;
+        }
+    }
+    if (in_arg) args.push_back(std::move(current));
+    return args;
+}
+
+// Splits |command| into arguments using the Windows command line rules, ie,
+// backslashes are only special when they precede a double quote.
+std::vector<std::string> SplitWindowsCommandLine(const std::string& command) {
+    std::vector<std::string> args;
+    std::string current;
+    bool in_arg = false;
+    bool in_quotes = false;
+    for (size_t i = 0; i < command.size(); ++i) {
+        char c = command[i];
+        if (!in_quotes && (c == ' ' || c == '\t' || c == '\n' || c == '\r')) {
+            if (in_arg) args.push_back(std::move(current));
+            current.clear();
+            in_arg = false;
+            continue;
+        }
+
+        in_arg = true;
+        if (c == '\\') {
+            size_t num_backslashes = 0;
+            while (i < command.size() && command[i] == '\\') {
+                ++num_backslashes;
+                ++i;
+            }
+            if (i < command.size() && command[i] == '"') {
+                current.append(num_backslashes / 2, '\\');
+                if (num_backslashes % 2 == 1)
+                    current += '"';
+                else
+                    --i;  // Let the quote be processed normally.
+            } else {
+                current.append(num_backslashes, '\\');
+                --i;
+            }
+        } else if (c == '"') {
+            // Inside quotes, "" is a literal quote.
+            if (in_quotes && i + 1 < command.size() && command[i + 1] == '"') {
+                current += '"';
+                ++i;
+            } else {
+                in_quotes = !in_quotes;
+            }
+        } else {
+            current += c;
+        }
     }
+    if (in_arg) args.push_back(std::move(current));
+    return args;
+}
+
+// Parses the contents of a compile_commands.json file. Relative "file" paths
+// are resolved against their "directory". Returns nullopt if |content| is not
+// a valid compilation database.
+optional<std::vector<CompileCommandsEntry>> ParseCompileCommandsJson(
+    std::string content) {
+    rapidjson::Document document;
+    document.ParseInsitu(&content[0]);
+    if (document.HasParseError() || !document.IsArray()) return nullopt;
+
+    auto get_string = [](const rapidjson::Value& object, const char* key,
+                         std::string* out) {
+        auto it = object.FindMember(key);
+        if (it == object.MemberEnd() || !it->value.IsString()) return false;
+        out->assign(it->value.GetString(), it->value.GetStringLength());
+        return true;
+    };
+
+    std::vector<CompileCommandsEntry> result;
+    result.reserve(document.Size());
+    for (const rapidjson::Value& object : document.GetArray()) {
+        if (!object.IsObject()) return nullopt;
 
+        CompileCommandsEntry entry;
+        if (!get_string(object, "directory", &entry.directory) ||
+            !get_string(object, "file", &entry.file)) {
+            return nullopt;
+        }
+
+        auto arguments = object.FindMember("arguments");
+        if (arguments != object.MemberEnd() && arguments->value.IsArray()) {
+            entry.args.reserve(arguments->value.Size());
+            for (const rapidjson::Value& arg : arguments->value.GetArray()) {
+                if (!arg.IsString()) return nullopt;
+                entry.args.emplace_back(arg.GetString(), arg.GetStringLength());
+            }
+        } else if (get_string(object, "command", &entry.command)) {
+#if defined(_WIN32)
+            entry.args = SplitWindowsCommandLine(entry.command);
+#else
+            entry.args = SplitUnixCommandLine(entry.command);
+#endif
+            entry.command.clear();
+        } else {
+            return nullopt;
+        }
+
+        if (!IsAbsolutePath(entry.file))
+            entry.file = entry.directory + "/" + entry.file;
+        result.push_back(std::move(entry));
+    }
+    return result;
+}
+
+// Reads compile_commands.json at |path| without going through libclang, which
+// is much faster for large databases.
+optional<std::vector<CompileCommandsEntry>> ReadCompileCommandsJson(
+    const std::string& path) {
+    optional<std::string> content = ReadContent(path);
+    if (!content) return nullopt;
+    return ParseCompileCommandsJson(std::move(*content));
+}
+
+// Reads the compilation database in |comp_db_dir| using libclang. This is only
+// used as a fallback when the JSON cannot be parsed directly.
+optional<std::vector<CompileCommandsEntry>> ReadCompileCommandsWithLibclang(
+    const std::string& comp_db_dir) {
+    CXCompilationDatabase_Error cx_db_load_error =
+        CXCompilationDatabase_CanNotLoadDatabase;
+    CXCompilationDatabase cx_db = clang_CompilationDatabase_fromDirectory(
+        comp_db_dir.c_str(), &cx_db_load_error);
+    if (cx_db_load_error != CXCompilationDatabase_NoError) return nullopt;
+
+    CXCompileCommands cx_commands =
+        clang_CompilationDatabase_getAllCompileCommands(cx_db);
+    unsigned int num_commands = clang_CompileCommands_getSize(cx_commands);
+
+    std::vector<CompileCommandsEntry> result;
+    result.reserve(num_commands);
+    for (unsigned int i = 0; i < num_commands; i++) {
+        CXCompileCommand cx_command =
+            clang_CompileCommands_getCommand(cx_commands, i);
+
+        CompileCommandsEntry entry;
+        entry.directory =
+            ToString(clang_CompileCommand_getDirectory(cx_command));
+        std::string relative_filename =
+            ToString(clang_CompileCommand_getFilename(cx_command));
+        if (IsAbsolutePath(relative_filename))
+            entry.file = relative_filename;
+        else
+            entry.file = entry.directory + "/" + relative_filename;
+
+        unsigned num_args = clang_CompileCommand_getNumArgs(cx_command);
+        entry.args.reserve(num_args);
+        for (unsigned j = 0; j < num_args; ++j) {
+            entry.args.push_back(
+                ToString(clang_CompileCommand_getArg(cx_command, j)));
+        }
+        result.push_back(std::move(entry));
+    }
+
+    clang_CompileCommands_dispose(cx_commands);
+    clang_CompilationDatabase_dispose(cx_db);
     return result;
 }
 
-std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
+std::vector<PendingEntry> LoadCompilationEntriesFromDirectory(
     ProjectConfig* project, const std::string& opt_compilation_db_dir) {
     // If there is a .cquery file always load using directory listing.
     // The .cquery file can be in the project or home dir but the project
@@ -579,11 +1003,9 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
     } else {
         project->mode = project_mode::ExternalCommand;
 
-        // generally it would be nice if we could just let clang load the
-        // compilation database (compile_commands.json) from memory.
-        // However, clang insists on reading compile_commands.json from a
-        // directory, so we create a temporary directory just for clang to read
-        // from.
+        // Write the output to a temporary directory so it is loaded like any
+        // other compile_commands.json. The libclang fallback insists on
+        // reading compile_commands.json from a directory.
 
         auto tmpdir = TryMakeTempDirectory();
         if (!tmpdir.has_value()) {
@@ -603,10 +1025,6 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
             << contents.value_or("");
     }
 
-    CXCompilationDatabase_Error cx_db_load_error =
-        CXCompilationDatabase_CanNotLoadDatabase;
-    CXCompilationDatabase cx_db = nullptr;
-
     if (!IsAbsolutePath(comp_db_dir)) {
         comp_db_dir = project->normalization_cache.Get(project->project_dir +
                                                        comp_db_dir);
@@ -614,18 +1032,47 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
 
     EnsureEndsInSlash(comp_db_dir);
 
+    std::string found_comp_db_dir;
     LOG_S(INFO) << "Trying to load " << comp_db_dir << "compile_commands.json";
-    // Do not call clang_CompilationDatabase_fromDirectory if
-    // compile_commands.json does not exist; it will report an error on stderr.
     if (FileExists(comp_db_dir + "compile_commands.json")) {
-        cx_db = clang_CompilationDatabase_fromDirectory(comp_db_dir.c_str(),
-                                                        &cx_db_load_error);
+        found_comp_db_dir = comp_db_dir;
     } else {
         LOG_S(INFO) << "Trying to load " << project->project_dir
                     << "compile_commands.json";
-        if (FileExists(project->project_dir + "compile_commands.json")) {
-            cx_db = clang_CompilationDatabase_fromDirectory(
-                project->project_dir.c_str(), &cx_db_load_error);
+        if (FileExists(project->project_dir + "compile_commands.json"))
+            found_comp_db_dir = project->project_dir;
+    }
+
+    optional<std::vector<CompileCommandsEntry>> commands;
+    if (!found_comp_db_dir.empty() &&
+        project->mode == project_mode::CompileCommandsJson) {
+        project->comp_db_path = found_comp_db_dir + "compile_commands.json";
+        project->comp_db_modification_time =
+            GetLastModificationTime(project->comp_db_path);
+
+        // compile_commands.json has not changed since the previous session, so
+        // the cached entries can be used as-is.
+        const ProjectCache* previous = project->previous;
+        if (previous && project->comp_db_modification_time &&
+            previous->comp_db_path == project->comp_db_path &&
+            previous->comp_db_modification_time ==
+                project->comp_db_modification_time) {
+            LOG_S(INFO) << "Using cached compilation entries for "
+                        << project->comp_db_path;
+            return previous->entries;
+        }
+    }
+    if (!found_comp_db_dir.empty()) {
+        Timer parse_time;
+        commands =
+            ReadCompileCommandsJson(found_comp_db_dir + "compile_commands.json");
+        if (commands) {
+            parse_time.ResetAndPrint("compile_commands.json parse time");
+        } else {
+            LOG_S(WARNING) << "Unable to parse " << found_comp_db_dir
+                           << "compile_commands.json directly; retrying "
+                              "with libclang";
+            commands = ReadCompileCommandsWithLibclang(found_comp_db_dir);
         }
     }
 
@@ -633,76 +1080,195 @@ std::vector<Project::Entry> LoadCompilationEntriesFromDirectory(
         RemoveDirectoryRecursive(comp_db_dir);
     }
 
-    if (cx_db_load_error != CXCompilationDatabase_NoError) {
+    if (!commands) {
         LOG_S(INFO) << "Unable to load compile_commands.json located at \""
                     << comp_db_dir << "\"; using directory listing instead.";
         return LoadFromDirectoryListing(project, true);
     }
 
-    Timer clang_time;
     Timer our_time;
-    clang_time.Pause();
-    our_time.Pause();
-
-    clang_time.Resume();
-    CXCompileCommands cx_commands =
-        clang_CompilationDatabase_getAllCompileCommands(cx_db);
-    unsigned int num_commands = clang_CompileCommands_getSize(cx_commands);
-    clang_time.Pause();
+    std::vector<PendingEntry> result =
+        ProcessCompileCommandEntries(project, std::move(*commands));
+    our_time.ResetAndPrint("compile_commands.json our time");
+    return result;
+}
 
-    std::vector<Project::Entry> result;
-    for (unsigned int i = 0; i < num_commands; i++) {
-        clang_time.Resume();
-        CXCompileCommand cx_command =
-            clang_CompileCommands_getCommand(cx_commands, i);
+// Bump this whenever the way compile commands are processed changes, so that
+// project caches written by an older cquery are not reused.
+const int k_project_cache_version = 2;
+
+// Hashes everything besides the compile commands themselves which affects the
+// processed entries. A project cache is only reused if this matches.
+uint64_t ComputeProjectSettingsHash(const ProjectConfig& config) {
+    std::string key = std::to_string(k_project_cache_version);
+    auto append = [&key](const std::string& value) {
+        key += '\0';
+        key += value;
+    };
+    append(config.project_dir);
+    append(config.resource_dir);
+    for (const std::string& flag : config.extra_flags) append(flag);
+    append(std::to_string(g_config->index.comments));
+    append(std::to_string(g_config->discoverSystemIncludes));
+    append(g_config->compilationDatabaseCommand);
+    append(g_config->compilationDatabaseDirectory);
+    // Processing may change between cquery builds.
+    append(std::to_string(
+        GetLastModificationTime(GetExecutablePath()).value_or(0)));
+    return HashUsr(key);
+}
 
-        std::string directory =
-            ToString(clang_CompileCommand_getDirectory(cx_command));
-        std::string relative_filename =
-            ToString(clang_CompileCommand_getFilename(cx_command));
+// The project cache is kept per project directory, which is not created by
+// ICacheManager::InitCacheDirectories when cacheRelocatable is set.
+std::string GetProjectCacheDirectory(const ProjectConfig& config) {
+    return g_config->cacheDirectory + EscapeFileName(config.project_dir);
+}
 
-        unsigned num_args = clang_CompileCommand_getNumArgs(cx_command);
-        CompileCommandsEntry entry;
-        entry.args.reserve(num_args);
-        for (unsigned j = 0; j < num_args; ++j) {
-            entry.args.push_back(
-                ToString(clang_CompileCommand_getArg(cx_command, j)));
-        }
-        clang_time.Pause();  // TODO: don't call ToString in this block.
-        // LOG_S(INFO) << "Got args " << StringJoin(entry.args);
+std::string GetProjectCachePath(const ProjectConfig& config) {
+    std::string path = GetProjectCacheDirectory(config) + "/@project";
+    switch (g_config->cacheFormat) {
+        case serialize_format::Json:
+            return path + ".json";
+        case serialize_format::MessagePack:
+            return path + ".mpack";
+    }
+    assert(false);
+    return path + ".json";
+}
 
-        our_time.Resume();
-        entry.directory = directory;
-        std::string absolute_filename;
-        if (IsAbsolutePath(relative_filename)) {
-            absolute_filename = relative_filename;
-        } else {
-            absolute_filename = directory + "/" + relative_filename;
+// Loads the project cache written by the previous session, or nullopt if there
+// is none or it was written with different settings.
+optional<ProjectCache> LoadProjectCache(const ProjectConfig& config) {
+    if (g_config->cacheDirectory.empty()) return nullopt;
+
+    std::string cache_path = GetProjectCachePath(config);
+    optional<std::string> content = ReadContent(cache_path);
+    if (!content || content->empty()) return nullopt;
+
+    ProjectCache cache;
+    try {
+        switch (g_config->cacheFormat) {
+            case serialize_format::Json: {
+                rapidjson::Document reader;
+                reader.Parse(content->c_str());
+                if (reader.HasParseError())
+                    throw std::invalid_argument("Invalid");
+                JsonReader json_reader{&reader};
+                Reflect(json_reader, cache);
+                break;
+            }
+            case serialize_format::MessagePack: {
+                msgpack::unpacker upk;
+                upk.reserve_buffer(content->size());
+                memcpy(upk.buffer(), content->data(), content->size());
+                upk.buffer_consumed(content->size());
+                MessagePackReader reader(&upk);
+                Reflect(reader, cache);
+                break;
+            }
         }
-        entry.file = project->normalization_cache.Get(absolute_filename);
+    } catch (std::invalid_argument& e) {
+        LOG_S(INFO) << "Failed to deserialize project cache " << cache_path
+                    << ": " << e.what();
+        return nullopt;
+    }
 
-        result.push_back(
-            GetCompilationEntryFromCompileCommandEntry(project, entry));
-        our_time.Pause();
+    if (cache.settings_hash != ComputeProjectSettingsHash(config)) {
+        LOG_S(INFO) << "Ignoring project cache " << cache_path
+                    << "; settings have changed";
+        return nullopt;
     }
 
-    clang_time.Resume();
-    clang_CompileCommands_dispose(cx_commands);
-    clang_CompilationDatabase_dispose(cx_db);
-    clang_time.Pause();
+    for (const PendingEntry& entry : cache.entries)
+        cache.entries_by_hash[entry.command_hash] = &entry;
+    return cache;
+}
 
-    clang_time.ResetAndPrint("compile_commands.json clang time");
-    our_time.ResetAndPrint("compile_commands.json our time");
-    return result;
+// Seeds |config| with the parts of |cache| which are still valid.
+void ApplyProjectCache(ProjectConfig* config, const ProjectCache& cache) {
+    config->previous = &cache;
+
+    // Cached include directories are kept even if the entries which added them
+    // were removed. Extra search directories only make include completion
+    // offer more results, so this does not warrant reprocessing everything.
+    for (const std::string& dir : cache.quote_dirs)
+        config->quote_dirs.insert(Directory(AbsolutePath(dir)));
+    for (const std::string& dir : cache.angle_dirs)
+        config->angle_dirs.insert(Directory(AbsolutePath(dir)));
+
+    // System includes are reused as long as the compiler they were discovered
+    // with has not been updated.
+    for (const ProjectCache::SystemIncludes& includes : cache.system_includes) {
+        if (!includes.compiler_driver_modification_time ||
+            GetCompilerDriverModificationTime(includes.compiler_driver) !=
+                includes.compiler_driver_modification_time) {
+            continue;
+        }
+        config->discovered_system_includes[includes.language] = includes.flags;
+        config->system_include_keys[includes.language] = SystemIncludesKey{
+            includes.compiler_driver, includes.compiler_flags};
+    }
+}
+
+void SaveProjectCache(const ProjectConfig& config,
+                      std::vector<PendingEntry> pending) {
+    if (g_config->cacheDirectory.empty()) return;
+
+    ProjectCache cache;
+    cache.settings_hash = ComputeProjectSettingsHash(config);
+    cache.comp_db_path = config.comp_db_path;
+    cache.comp_db_modification_time = config.comp_db_modification_time;
+    cache.entries = std::move(pending);
+    for (auto& includes : config.discovered_system_includes) {
+        ProjectCache::SystemIncludes cached;
+        cached.language = includes.first;
+        auto key = config.system_include_keys.find(includes.first);
+        if (key != config.system_include_keys.end()) {
+            cached.compiler_driver = key->second.compiler_driver;
+            cached.compiler_flags = key->second.flags;
+            cached.compiler_driver_modification_time =
+                GetCompilerDriverModificationTime(key->second.compiler_driver);
+        }
+        cached.flags = includes.second;
+        cache.system_includes.push_back(std::move(cached));
+    }
+    for (const Directory& dir : config.quote_dirs)
+        cache.quote_dirs.push_back(dir.path);
+    for (const Directory& dir : config.angle_dirs)
+        cache.angle_dirs.push_back(dir.path);
+
+    std::string content;
+    switch (g_config->cacheFormat) {
+        case serialize_format::Json: {
+            rapidjson::StringBuffer output;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+            JsonWriter json_writer(&writer);
+            Reflect(json_writer, cache);
+            content = output.GetString();
+            break;
+        }
+        case serialize_format::MessagePack: {
+            msgpack::sbuffer buf;
+            msgpack::packer<msgpack::sbuffer> pk(&buf);
+            MessagePackWriter msgpack_writer(&pk);
+            Reflect(msgpack_writer, cache);
+            content = std::string(buf.data(), buf.size());
+            break;
+        }
+    }
+    MakeDirectoryRecursive(
+        AbsolutePath(GetProjectCacheDirectory(config), false /*validate*/));
+    if (!WriteToFile(GetProjectCachePath(config), content))
+        LOG_S(WARNING) << "Failed to save the project cache";
 }
 
+const int k_match_prefix_weight = 100;
+const int k_mismatch_directory_weight = 100;
+const int k_match_postfix_weight = 1;
+
 // Computes a score based on how well |a| and |b| match. This is used for
 // argument guessing.
 int ComputeGuessScore(const std::string& a, const std::string& b) {
-    const int k_match_prefix_weight = 100;
-    const int k_mismatch_directory_weight = 100;
-    const int k_match_postfix_weight = 1;
-
     int score = 0;
     size_t i = 0;
 
@@ -731,6 +1297,61 @@ int ComputeGuessScore(const std::string& a, const std::string& b) {
     return score;
 }
 
+// Returns the index of the entry with the highest ComputeGuessScore against
+// |filename|, or -1 if there are no entries. Ties go to the earliest entry.
+// |sorted| holds the indices of |entries| ordered by filename.
+//
+// The score is dominated by the common prefix, which can only get shorter
+// when moving away from where |filename| would be inserted into |sorted|. Walk
+// outwards from there and stop in each direction once no further entry can
+// reach the best score.
+int FindBestInferenceCandidate(const std::vector<Project::Entry>& entries,
+                               const std::vector<int>& sorted,
+                               const std::string& filename) {
+    // Best score any entry sharing a prefix of length |i| with |filename| can
+    // have: every further directory in |filename| is a mismatch, and at best
+    // all of |filename| matches as a common ending.
+    std::vector<int> max_score(filename.size() + 1);
+    int remaining_directories = 0;
+    for (size_t i = filename.size() + 1; i-- > 0;) {
+        if (i < filename.size() && filename[i] == '/') ++remaining_directories;
+        max_score[i] = int(i) * k_match_prefix_weight -
+                       remaining_directories * k_mismatch_directory_weight +
+                       int(filename.size()) * k_match_postfix_weight;
+    }
+
+    int best = -1;
+    int best_score = std::numeric_limits<int>::min();
+    auto consider = [&](int i) {
+        const std::string& path = entries[i].filename.path;
+        size_t prefix = 0;
+        while (prefix < path.size() && prefix < filename.size() &&
+               path[prefix] == filename[prefix]) {
+            ++prefix;
+        }
+        if (best != -1 && max_score[prefix] < best_score) return false;
+
+        int score = ComputeGuessScore(filename, path);
+        if (score > best_score || (score == best_score && i < best)) {
+            best = i;
+            best_score = score;
+        }
+        return true;
+    };
+
+    size_t mid =
+        std::lower_bound(sorted.begin(), sorted.end(), filename,
+                         [&](int i, const std::string& path) {
+                             return entries[i].filename.path < path;
+                         }) -
+        sorted.begin();
+    for (size_t i = mid; i < sorted.size() && consider(sorted[i]); ++i) {
+    }
+    for (size_t i = mid; i > 0 && consider(sorted[i - 1]); --i) {
+    }
+    return best;
+}
+
 }  // namespace
 
 void Project::Load(const AbsolutePath& root_directory) {
@@ -739,10 +1360,17 @@ void Project::Load(const AbsolutePath& root_directory) {
     project.extra_flags = g_config->extraClangArguments;
     project.project_dir = root_directory;
     project.resource_dir = g_config->resourceDirectory;
-    entries = LoadCompilationEntriesFromDirectory(
+    optional<ProjectCache> cache = LoadProjectCache(project);
+    if (cache)
+        ApplyProjectCache(&project, *cache);
+    std::vector<PendingEntry> pending = LoadCompilationEntriesFromDirectory(
         &project, g_config->compilationDatabaseDirectory.empty()
                       ? "build"
                       : g_config->compilationDatabaseDirectory);
+    DiscoverSystemIncludesForEntries(&project, pending);
+    SaveProjectCache(project, pending);
+    project.previous = nullptr;
+    entries = FinishPendingEntries(&project, std::move(pending));
 
     // Cleanup / postprocess include directories.
     quote_include_directories.assign(project.quote_dirs.begin(),
@@ -757,9 +1385,14 @@ void Project::Load(const AbsolutePath& root_directory) {
     }
 
     // Setup project entries.
+    absolute_path_to_entry_index_.clear();
     absolute_path_to_entry_index_.resize(entries.size());
     for (int i = 0; i < entries.size(); ++i)
         absolute_path_to_entry_index_[entries[i].filename] = i;
+
+    std::lock_guard<std::mutex> lock(inference_mutex_);
+    inference_index_.clear();
+    inferred_entries_.clear();
 }
 
 void Project::SetFlagsForFile(const std::vector<std::string>& flags,
@@ -776,6 +1409,11 @@ void Project::SetFlagsForFile(const std::vector<std::string>& flags,
         entry.args = flags;
         this->entries.emplace_back(entry);
     }
+
+    // Inferred entries may have been copied from the changed entry.
+    std::lock_guard<std::mutex> lock(inference_mutex_);
+    inference_index_.clear();
+    inferred_entries_.clear();
 }
 
 Project::Entry Project::FindCompilationEntryForFile(
@@ -784,16 +1422,23 @@ Project::Entry Project::FindCompilationEntryForFile(
     if (it != absolute_path_to_entry_index_.end()) return entries[it->second];
 
     // We couldn't find the file. Try to infer it.
-    // TODO: Cache inferred file in a separate array (using a lock or similar)
-    Entry* best_entry = nullptr;
-    int best_score = std::numeric_limits<int>::min();
-    for (Entry& entry : entries) {
-        int score = ComputeGuessScore(filename, entry.filename);
-        if (score > best_score) {
-            best_score = score;
-            best_entry = &entry;
-        }
+    std::lock_guard<std::mutex> lock(inference_mutex_);
+    if (inference_index_.size() != entries.size()) {
+        inference_index_.resize(entries.size());
+        for (int i = 0; i < entries.size(); ++i) inference_index_[i] = i;
+        std::sort(inference_index_.begin(), inference_index_.end(),
+                  [&](int a, int b) {
+                      return entries[a].filename.path <
+                             entries[b].filename.path;
+                  });
+        inferred_entries_.clear();
     }
+    auto inferred = inferred_entries_.find(filename);
+    if (inferred != inferred_entries_.end()) return inferred->second;
+
+    int best_index =
+        FindBestInferenceCandidate(entries, inference_index_, filename);
+    const Entry* best_entry = best_index == -1 ? nullptr : &entries[best_index];
 
     Project::Entry result;
     result.is_inferred = true;
@@ -815,6 +1460,7 @@ Project::Entry Project::FindCompilationEntryForFile(
         }
     }
 
+    inferred_entries_[filename] = result;
     return result;
 }
 
@@ -1641,6 +2287,91 @@ TEST_SUITE("Project") {
              "-fparse-all-comments"});
     }
 
+    TEST_CASE("Split command line") {
+        REQUIRE(SplitUnixCommandLine("clang++  -c foo.cc") ==
+                std::vector<std::string>{"clang++", "-c", "foo.cc"});
+        REQUIRE(SplitUnixCommandLine(
+                    R"(clang -DA="a b" '-DB=\x' -DC=c\ d "" foo.cc)") ==
+                std::vector<std::string>{"clang", "-DA=a b", "-DB=\\x",
+                                         "-DC=c d", "", "foo.cc"});
+        REQUIRE(SplitUnixCommandLine(R"(clang "-DA=\"q\"")") ==
+                std::vector<std::string>{"clang", "-DA=\"q\""});
+
+        REQUIRE(SplitWindowsCommandLine(R"(cl.exe /I"C:\a b\c" C:\d\e.cc)") ==
+                std::vector<std::string>{"cl.exe", "/IC:\\a b\\c",
+                                         "C:\\d\\e.cc"});
+        REQUIRE(SplitWindowsCommandLine(R"(cl.exe "/DA=\"q\"" a\\"b c")") ==
+                std::vector<std::string>{"cl.exe", "/DA=\"q\"", "a\\b c"});
+    }
+
+    TEST_CASE("System include flags") {
+        REQUIRE(GetSystemIncludeFlags({"clang++", "-c", "--sysroot", "/s",
+                                       "-target", "arm-linux-gnueabi",
+                                       "-stdlib=libc++", "-Wall", "a.cc"}) ==
+                std::vector<std::string>{"--sysroot", "/s", "-target",
+                                         "arm-linux-gnueabi",
+                                         "-stdlib=libc++"});
+        REQUIRE(GetSystemIncludeFlags({"clang", "-isysroot/sdk",
+                                       "--target=x86_64-apple-darwin",
+                                       "-nostdinc", "a.c"}) ==
+                std::vector<std::string>{"-isysroot/sdk",
+                                         "--target=x86_64-apple-darwin",
+                                         "-nostdinc"});
+    }
+
+    TEST_CASE("Parse compile_commands.json") {
+        optional<std::vector<CompileCommandsEntry>> entries =
+            ParseCompileCommandsJson(R"([
+              {"directory": "/w", "file": "a.cc",
+               "arguments": ["clang++", "-c", "a.cc"]},
+              {"directory": "/w", "file": "/x/b.cc",
+               "command": "clang++ -DB=\"1 2\" -c /x/b.cc"}
+            ])");
+        REQUIRE(entries.has_value());
+        REQUIRE(entries->size() == 2);
+        REQUIRE((*entries)[0].file == "/w/a.cc");
+        REQUIRE((*entries)[0].args ==
+                std::vector<std::string>{"clang++", "-c", "a.cc"});
+        REQUIRE((*entries)[1].file == "/x/b.cc");
+#if !defined(_WIN32)
+        REQUIRE((*entries)[1].args ==
+                std::vector<std::string>{"clang++", "-DB=1 2", "-c",
+                                         "/x/b.cc"});
+#endif
+
+        REQUIRE(!ParseCompileCommandsJson("[{\"file\": \"a.cc\"}]"));
+        REQUIRE(!ParseCompileCommandsJson("{"));
+    }
+
+    TEST_CASE("Reuse cached compilation entries") {
+        CompileCommandsEntry changed;
+        changed.directory = "/w";
+        changed.file = "/w/a.cc";
+        changed.args = {"clang", "-DA", "a.cc"};
+        CompileCommandsEntry unchanged;
+        unchanged.directory = "/w";
+        unchanged.file = "/w/b.cc";
+        unchanged.args = {"clang", "b.cc"};
+
+        ProjectCache cache;
+        PendingEntry cached;
+        cached.command_hash = HashCompileCommand(unchanged);
+        cached.entry.filename = AbsolutePath("/w/b.cc");
+        cached.entry.args = {"cached"};
+        cache.entries.push_back(cached);
+        cache.entries_by_hash[cached.command_hash] = &cache.entries[0];
+
+        ProjectConfig config;
+        config.project_dir = "/w/";
+        config.previous = &cache;
+        std::vector<PendingEntry> pending =
+            ProcessCompileCommandEntries(&config, {changed, unchanged});
+        REQUIRE(pending.size() == 2);
+        REQUIRE(pending[0].entry.args != std::vector<std::string>{"cached"});
+        REQUIRE(pending[0].command_hash == HashCompileCommand(changed));
+        REQUIRE(pending[1].entry.args == std::vector<std::string>{"cached"});
+    }
+
     TEST_CASE("Directory extraction") {
         ProjectConfig config;
         config.project_dir = "/w/c/s/";
@@ -1724,6 +2455,52 @@ TEST_SUITE("Project") {
         }
     }
 
+    TEST_CASE("Entry inference matches scoring every entry") {
+        Project p;
+        for (const char* path :
+             {"/a/b/c/d/bar.cc", "/a/b/c/baz.cc", "/a/b/cx/foo_test.cc",
+              "/a/b/c/d/e/qux_test.cc", "/a/z.cc", "/b/x/y.cc"}) {
+            Project::Entry e;
+            e.args = {"arg" + std::to_string(p.entries.size())};
+            e.filename = AbsolutePath(path);
+            p.entries.push_back(e);
+        }
+
+        for (const char* path :
+             {"/a/b/c/d/new.cc", "/a/b/c/new_test.cc", "/a/b/cy/new.cc",
+              "/a/new.cc", "/b/x/y/z/w.cc", "/c/new.cc", "new.cc"}) {
+            std::string best;
+            int best_score = std::numeric_limits<int>::min();
+            for (const Project::Entry& e : p.entries) {
+                int score = ComputeGuessScore(path, e.filename);
+                if (score > best_score) {
+                    best_score = score;
+                    best = e.args[0];
+                }
+            }
+            Project::Entry entry =
+                p.FindCompilationEntryForFile(AbsolutePath(path));
+            REQUIRE(entry.args == std::vector<std::string>{best});
+        }
+    }
+
+    TEST_CASE("Inferred entries are invalidated") {
+        Project p;
+        {
+            Project::Entry e;
+            e.args = {"arg1"};
+            e.filename = AbsolutePath("/a/b/bar.cc");
+            p.entries.push_back(e);
+        }
+        p.absolute_path_to_entry_index_[p.entries[0].filename] = 0;
+
+        REQUIRE(p.FindCompilationEntryForFile(AbsolutePath("/a/b/new.cc"))
+                    .args == std::vector<std::string>{"arg1"});
+        p.SetFlagsForFile({"arg2"}, AbsolutePath("/a/b/bar.cc"));
+        REQUIRE(p.FindCompilationEntryForFile(AbsolutePath("/a/b/new.cc"))
+                    .args == std::vector<std::string>{"arg2"});
+    }
+
     TEST_CASE("Entry inference remaps file names") {
         Project p;
         {
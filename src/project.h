@@ -30,6 +30,15 @@ struct Project {
     std::vector<Entry> entries;
     spp::sparse_hash_map<AbsolutePath, int> absolute_path_to_entry_index_;
 
+    // Indices into |entries| ordered by filename, so entry inference does not
+    // need to score every entry. Rebuilt on demand when it no longer covers
+    // |entries|.
+    std::vector<int> inference_index_;
+    // Entries previously inferred by FindCompilationEntryForFile. Cleared
+    // whenever |entries| changes.
+    spp::sparse_hash_map<AbsolutePath, Entry> inferred_entries_;
+    std::mutex inference_mutex_;
+
     // Loads a project for the given |directory|.
     //
     // If |g_config->compilationDatabaseDirectory| is not empty, look for
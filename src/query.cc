@@ -3,6 +3,7 @@
 #include <doctest/doctest.h>
 #include <optional.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <functional>
@@ -11,9 +12,12 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#include "config.h"
 #include "indexer.h"
+#include "query_utils.h"
 #include "serializer.h"
 #include "serializers/json.h"
+#include "timer.h"
 
 // TODO: Make all copy constructors explicit.
 
@@ -45,8 +49,10 @@ optional<QueryType::Def> ToQuery(const IdMap& id_map,
     result.short_name_offset = type.short_name_offset;
     result.short_name_size = type.short_name_size;
     result.kind = type.kind;
-    if (!type.hover.empty()) result.hover = type.hover;
-    if (!type.comments.empty()) result.comments = type.comments;
+    if (!g_config->index.lazyHover) {
+        result.hover = type.hover;
+        result.comments = type.comments;
+    }
     result.file = id_map.primary_file;
     result.spell = id_map.ToQuery(type.spell);
     result.extent = id_map.ToQuery(type.extent);
@@ -68,8 +74,10 @@ optional<QueryFunc::Def> ToQuery(const IdMap& id_map,
     result.short_name_size = func.short_name_size;
     result.kind = func.kind;
     result.storage = func.storage;
-    if (!func.hover.empty()) result.hover = func.hover;
-    if (!func.comments.empty()) result.comments = func.comments;
+    if (!g_config->index.lazyHover) {
+        result.hover = func.hover;
+        result.comments = func.comments;
+    }
     result.file = id_map.primary_file;
     result.spell = id_map.ToQuery(func.spell);
     result.extent = id_map.ToQuery(func.extent);
@@ -87,8 +95,10 @@ optional<QueryVar::Def> ToQuery(const IdMap& id_map, const IndexVar::Def& var) {
     result.detailed_name = var.detailed_name;
     result.short_name_offset = var.short_name_offset;
     result.short_name_size = var.short_name_size;
-    if (!var.hover.empty()) result.hover = var.hover;
-    if (!var.comments.empty()) result.comments = var.comments;
+    if (!g_config->index.lazyHover) {
+        result.hover = var.hover;
+        result.comments = var.comments;
+    }
     result.file = id_map.primary_file;
     result.spell = id_map.ToQuery(var.spell);
     result.extent = id_map.ToQuery(var.extent);
@@ -155,6 +165,12 @@ bool ComputeDifferenceForUpdate(std::vector<T>&& previous,
     return !removed->empty() || !added->empty();
 }
 
+// Fingerprints are 0 when they are not known, ie, for an index loaded from a
+// cache which was written without them.
+bool SameFingerprint(uint64_t previous, uint64_t current) {
+    return previous != 0 && previous == current;
+}
+
 template <typename T>
 void CompareGroups(std::vector<T>& previous_data, std::vector<T>& current_data,
                    std::function<void(T*)> on_removed,
@@ -364,6 +380,182 @@ void PushFront(std::vector<T>& v, T&& value) {
 
 }  // namespace
 
+namespace {
+
+void WriteVarint(uint64_t value, std::string* out) {
+    while (value >= 0x80) {
+        out->push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(char(value));
+}
+
+uint64_t ReadVarint(const std::string& in, size_t* pos) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = uint8_t(in[(*pos)++]);
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (byte < 0x80) return value;
+    }
+}
+
+// Maps small negative numbers to small varints.
+uint64_t ZigZag(int64_t value) {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+int64_t UnZigZag(uint64_t value) {
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+// Appends |ref| to |out| as the difference to |prev|, the previous use in the
+// same file. Columns are relative to the previous column on the same line.
+void EncodeRef(const QueryId::LexicalRef& prev,
+               const QueryId::LexicalRef& ref,
+               std::string* out) {
+    const Position& start = ref.range.start;
+    const Position& end = ref.range.end;
+    const Position& prev_start = prev.range.start;
+    WriteVarint(ZigZag(start.line - prev_start.line), out);
+    WriteVarint(ZigZag(start.column - (start.line == prev_start.line
+                                           ? prev_start.column
+                                           : 0)),
+                out);
+    WriteVarint(ZigZag(end.line - start.line), out);
+    WriteVarint(
+        ZigZag(end.column - (end.line == start.line ? start.column : 0)), out);
+    WriteVarint(ZigZag(int64_t(int32_t(ref.id.id)) - int32_t(prev.id.id)),
+                out);
+    WriteVarint(uint64_t(ref.role) << 3 | uint64_t(ref.kind), out);
+}
+
+// Decodes the use at |*pos| in |in|. |ref| is the previous use on input.
+void DecodeRef(const std::string& in, size_t* pos, QueryId::LexicalRef* ref) {
+    Position& start = ref->range.start;
+    Position& end = ref->range.end;
+    int16_t prev_line = start.line;
+    start.line = int16_t(prev_line + UnZigZag(ReadVarint(in, pos)));
+    start.column =
+        int16_t((start.line == prev_line ? start.column : 0) +
+                UnZigZag(ReadVarint(in, pos)));
+    end.line = int16_t(start.line + UnZigZag(ReadVarint(in, pos)));
+    end.column = int16_t((end.line == start.line ? start.column : 0) +
+                         UnZigZag(ReadVarint(in, pos)));
+    ref->id = AnyId(
+        RawId(int32_t(ref->id.id) + UnZigZag(ReadVarint(in, pos))));
+    uint64_t kind_and_role = ReadVarint(in, pos);
+    ref->kind = SymbolKind(kind_and_role & 7);
+    ref->role = role(kind_and_role >> 3);
+}
+
+bool CompareFile(const QueryId::LexicalRef& a, const QueryId::LexicalRef& b) {
+    return a.file.id < b.file.id;
+}
+
+}  // namespace
+
+QueryRefList::Iterator::Iterator(const std::vector<Group>* groups,
+                                 size_t group)
+    : m_groups(groups), m_group(group) {
+    if (m_group < m_groups->size()) Decode();
+}
+
+QueryRefList::Iterator& QueryRefList::Iterator::operator++() {
+    if (m_pos == (*m_groups)[m_group].bytes.size()) {
+        ++m_group;
+        m_pos = 0;
+        m_ref = QueryId::LexicalRef();
+        if (m_group == m_groups->size()) return *this;
+    }
+    Decode();
+    return *this;
+}
+
+void QueryRefList::Iterator::Decode() {
+    const Group& group = (*m_groups)[m_group];
+    DecodeRef(group.bytes, &m_pos, &m_ref);
+    m_ref.file = group.file;
+}
+
+std::vector<QueryId::LexicalRef> QueryRefList::ToVector() const {
+    std::vector<QueryId::LexicalRef> result;
+    result.reserve(m_size);
+    result.insert(result.end(), begin(), end());
+    return result;
+}
+
+size_t QueryRefList::AllocatedBytes() const {
+    static const size_t k_inline_capacity = std::string().capacity();
+    size_t bytes = m_groups.capacity() * sizeof(Group);
+    for (const Group& group : m_groups) {
+        if (group.bytes.capacity() > k_inline_capacity)
+            bytes += group.bytes.capacity() + 1;
+    }
+    return bytes;
+}
+
+void QueryRefList::Update(const std::vector<QueryId::LexicalRef>& to_add,
+                          const std::vector<QueryId::LexicalRef>& to_remove) {
+    // Merged index updates may contain uses from many files, so split them by
+    // file first.
+    std::vector<QueryId::LexicalRef> adds = to_add;
+    std::vector<QueryId::LexicalRef> removes = to_remove;
+    std::stable_sort(adds.begin(), adds.end(), CompareFile);
+    std::sort(removes.begin(), removes.end(), CompareFile);
+
+    auto add_it = adds.begin(), remove_it = removes.begin();
+    while (add_it != adds.end() || remove_it != removes.end()) {
+        QueryId::File file;
+        if (remove_it == removes.end() ||
+            (add_it != adds.end() && add_it->file.id < remove_it->file.id))
+            file = add_it->file;
+        else
+            file = remove_it->file;
+        auto add_end = std::find_if(add_it, adds.end(), [&](const auto& ref) {
+            return ref.file != file;
+        });
+        auto remove_end =
+            std::find_if(remove_it, removes.end(),
+                         [&](const auto& ref) { return ref.file != file; });
+
+        auto group = std::lower_bound(
+            m_groups.begin(), m_groups.end(), file,
+            [](const Group& g, QueryId::File f) { return g.file.id < f.id; });
+        std::vector<QueryId::LexicalRef> refs;
+        if (group != m_groups.end() && group->file == file) {
+            Iterator it(&m_groups, group - m_groups.begin());
+            for (uint32_t i = 0; i < group->size; ++i, ++it)
+                refs.push_back(*it);
+            m_size -= group->size;
+        } else {
+            group = m_groups.insert(group, Group());
+            group->file = file;
+        }
+
+        refs.insert(refs.end(), add_it, add_end);
+        std::sort(remove_it, remove_end);
+        RemoveIf(&refs, [&](const QueryId::LexicalRef& ref) {
+            return std::binary_search(remove_it, remove_end, ref);
+        });
+        std::sort(refs.begin(), refs.end());
+
+        if (refs.empty()) {
+            m_groups.erase(group);
+        } else {
+            group->size = uint32_t(refs.size());
+            group->bytes.clear();
+            QueryId::LexicalRef prev;
+            for (const QueryId::LexicalRef& ref : refs) {
+                EncodeRef(prev, ref, &group->bytes);
+                prev = ref;
+            }
+            group->bytes.shrink_to_fit();
+            m_size += refs.size();
+        }
+        add_it = add_end;
+        remove_it = remove_end;
+    }
+}
+
 IdMap::IdMap(QueryDatabase* query_db, const IdCache& local_ids)
     : local_ids(local_ids) {
     primary_file = *GetQueryFileIdFromPath(query_db, local_ids.primary_file);
@@ -462,7 +654,8 @@ IndexUpdate::IndexUpdate(const IdMap& previous_id_map,
 // |index_name| is the name of the variable on the index type.
 // |type| is the type of the variable.
 #define PROCESS_UPDATE_DIFF(type_id, query_name, index_name, type)           \
-    {                                                                        \
+    if (!SameFingerprint(previous->fingerprints.index_name,                  \
+                         current->fingerprints.index_name)) {                \
         /* Check for changes. */                                             \
         std::vector<type> removed, added;                                    \
         auto query_previous = previous_id_map.ToQuery(previous->index_name); \
@@ -538,16 +731,19 @@ IndexUpdate::IndexUpdate(const IdMap& previous_id_map,
         /*onFound:*/
         [this, &previous_id_map, &current_id_map](IndexType* previous,
                                                   IndexType* current) {
-            optional<QueryType::Def> previous_remapped_def =
-                ToQuery(previous_id_map, previous->def);
-            optional<QueryType::Def> current_remapped_def =
-                ToQuery(current_id_map, current->def);
-            if (current_remapped_def &&
-                previous_remapped_def != current_remapped_def &&
-                !current_remapped_def->detailed_name.empty()) {
-                types_def_update.push_back(
-                    QueryType::DefUpdate(current_id_map.ToQuery(current->id),
-                                         std::move(*current_remapped_def)));
+            if (!SameFingerprint(previous->fingerprints.def,
+                                 current->fingerprints.def)) {
+                optional<QueryType::Def> previous_remapped_def =
+                    ToQuery(previous_id_map, previous->def);
+                optional<QueryType::Def> current_remapped_def =
+                    ToQuery(current_id_map, current->def);
+                if (current_remapped_def &&
+                    previous_remapped_def != current_remapped_def &&
+                    !current_remapped_def->detailed_name.empty()) {
+                    types_def_update.push_back(QueryType::DefUpdate(
+                        current_id_map.ToQuery(current->id),
+                        std::move(*current_remapped_def)));
+                }
             }
 
             PROCESS_UPDATE_DIFF(QueryId::Type, types_declarations, declarations,
@@ -605,16 +801,19 @@ IndexUpdate::IndexUpdate(const IdMap& previous_id_map,
         /*onFound:*/
         [this, &previous_id_map, &current_id_map](IndexFunc* previous,
                                                   IndexFunc* current) {
-            optional<QueryFunc::Def> previous_remapped_def =
-                ToQuery(previous_id_map, previous->def);
-            optional<QueryFunc::Def> current_remapped_def =
-                ToQuery(current_id_map, current->def);
-            if (current_remapped_def &&
-                previous_remapped_def != current_remapped_def &&
-                !current_remapped_def->detailed_name.empty()) {
-                funcs_def_update.push_back(
-                    QueryFunc::DefUpdate(current_id_map.ToQuery(current->id),
-                                         std::move(*current_remapped_def)));
+            if (!SameFingerprint(previous->fingerprints.def,
+                                 current->fingerprints.def)) {
+                optional<QueryFunc::Def> previous_remapped_def =
+                    ToQuery(previous_id_map, previous->def);
+                optional<QueryFunc::Def> current_remapped_def =
+                    ToQuery(current_id_map, current->def);
+                if (current_remapped_def &&
+                    previous_remapped_def != current_remapped_def &&
+                    !current_remapped_def->detailed_name.empty()) {
+                    funcs_def_update.push_back(QueryFunc::DefUpdate(
+                        current_id_map.ToQuery(current->id),
+                        std::move(*current_remapped_def)));
+                }
             }
 
             PROCESS_UPDATE_DIFF(QueryId::Func, funcs_declarations, declarations,
@@ -662,16 +861,19 @@ IndexUpdate::IndexUpdate(const IdMap& previous_id_map,
         /*onFound:*/
         [this, &previous_id_map, &current_id_map](IndexVar* previous,
                                                   IndexVar* current) {
-            optional<QueryVar::Def> previous_remapped_def =
-                ToQuery(previous_id_map, previous->def);
-            optional<QueryVar::Def> current_remapped_def =
-                ToQuery(current_id_map, current->def);
-            if (current_remapped_def &&
-                previous_remapped_def != current_remapped_def &&
-                !current_remapped_def->detailed_name.empty())
-                vars_def_update.push_back(
-                    QueryVar::DefUpdate(current_id_map.ToQuery(current->id),
-                                        std::move(*current_remapped_def)));
+            if (!SameFingerprint(previous->fingerprints.def,
+                                 current->fingerprints.def)) {
+                optional<QueryVar::Def> previous_remapped_def =
+                    ToQuery(previous_id_map, previous->def);
+                optional<QueryVar::Def> current_remapped_def =
+                    ToQuery(current_id_map, current->def);
+                if (current_remapped_def &&
+                    previous_remapped_def != current_remapped_def &&
+                    !current_remapped_def->detailed_name.empty())
+                    vars_def_update.push_back(QueryVar::DefUpdate(
+                        current_id_map.ToQuery(current->id),
+                        std::move(*current_remapped_def)));
+            }
 
             PROCESS_UPDATE_DIFF(QueryId::Var, vars_declarations, declarations,
                                 QueryId::LexicalRef);
@@ -769,6 +971,80 @@ void QueryDatabase::Remove(
     }
 }
 
+namespace {
+
+// Calls |fn| with the functions which |func| overrides if |bases| is set, or
+// else with the functions which override |func|.
+template <typename Fn>
+void EachOverrideEdge(QueryDatabase* db, QueryFunc& func, bool bases, Fn&& fn) {
+    if (!bases) {
+        EachDefinedFunc(db, func.derived, fn);
+    } else if (const QueryFunc::Def* def = func.AnyDef()) {
+        EachDefinedFunc(db, def->bases, fn);
+    }
+}
+
+// Appends |func| and the functions connected to it through overrides in
+// either direction to |component|, unless they are in |seen| already.
+void CollectOverrideComponent(QueryDatabase* db, QueryFunc* func,
+                              std::unordered_set<QueryFunc*>* seen,
+                              std::vector<QueryFunc*>* component) {
+    if (!seen->insert(func).second) return;
+    size_t begin = component->size();
+    component->push_back(func);
+    for (size_t i = begin; i < component->size(); ++i) {
+        for (bool bases : {true, false}) {
+            EachOverrideEdge(db, *(*component)[i], bases, [&](QueryFunc& next) {
+                if (seen->insert(&next).second) component->push_back(&next);
+            });
+        }
+    }
+}
+
+// Calls |set_count| with each function of |component| and the number of uses
+// of the functions it overrides, directly or not, if |bases| is set, or else
+// of the functions which override it. This sums the counts of the nearest
+// functions, so it returns false without calling |set_count| when a function
+// can be reached through two paths or a cycle, which would count it twice.
+template <typename SetCount>
+bool SumReachableUses(QueryDatabase* db,
+                      const std::vector<QueryFunc*>& component, bool bases,
+                      SetCount&& set_count) {
+    std::unordered_map<QueryFunc*, uint32_t> num_parents;
+    bool is_forest = true;
+    for (QueryFunc* func : component) {
+        EachOverrideEdge(db, *func, bases, [&](QueryFunc& child) {
+            if (++num_parents[&child] > 1) is_forest = false;
+        });
+    }
+    if (!is_forest) return false;
+
+    // Parents come before their children. Functions on a cycle are not
+    // reachable from a function without a parent.
+    std::vector<QueryFunc*> order;
+    for (QueryFunc* func : component) {
+        if (!num_parents.count(func)) order.push_back(func);
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        EachOverrideEdge(db, *order[i], bases,
+                         [&](QueryFunc& child) { order.push_back(&child); });
+    }
+    if (order.size() != component.size()) return false;
+
+    std::unordered_map<QueryFunc*, uint32_t> counts;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        uint32_t count = 0;
+        EachOverrideEdge(db, **it, bases, [&](QueryFunc& child) {
+            count += uint32_t(child.uses.size()) + counts[&child];
+        });
+        counts[*it] = count;
+    }
+    for (QueryFunc* func : component) set_count(*func, counts[func]);
+    return true;
+}
+
+}  // namespace
+
 void QueryDatabase::ApplyIndexUpdate(IndexUpdate* update) {
 // This function runs on the querydb thread.
 
@@ -784,6 +1060,31 @@ void QueryDatabase::ApplyIndexUpdate(IndexUpdate* update) {
         RemoveRange(&def.def_var_name, merge_update.to_remove);       \
         VerifyUnique(def.def_var_name);                               \
     }
+#define HANDLE_MERGEABLE_REFS(update_var_name, def_var_name, storage_name) \
+    for (auto& merge_update : update->update_var_name) {                   \
+        auto& def = storage_name[merge_update.id.id];                      \
+        def.def_var_name.Update(merge_update.to_add,                       \
+                                merge_update.to_remove);                   \
+    }
+
+    // The call counts of a function depend on the uses of the functions in
+    // its hierarchy, so the counts of the hierarchies of the functions in
+    // |update| need to be recomputed, both as they were and as they will be.
+    std::vector<QueryFunc*> changed_funcs;
+    for (const auto& entry : update->funcs_removed)
+        changed_funcs.push_back(&funcs[entry.value.id]);
+    for (const auto& def_update : update->funcs_def_update)
+        changed_funcs.push_back(&funcs[def_update.id.id]);
+    for (const auto& merge_update : update->funcs_derived)
+        changed_funcs.push_back(&funcs[merge_update.id.id]);
+    for (const auto& merge_update : update->funcs_uses)
+        changed_funcs.push_back(&funcs[merge_update.id.id]);
+    {
+        std::unordered_set<QueryFunc*> seen;
+        for (size_t i = 0, n = changed_funcs.size(); i < n; ++i)
+            CollectOverrideComponent(this, changed_funcs[i], &seen,
+                                     &changed_funcs);
+    }
 
     for (const AbsolutePath& filename : update->files_removed)
         files[usr_to_file[filename].id].def = nullopt;
@@ -794,20 +1095,73 @@ void QueryDatabase::ApplyIndexUpdate(IndexUpdate* update) {
     HANDLE_MERGEABLE(types_declarations, declarations, types);
     HANDLE_MERGEABLE(types_derived, derived, types);
     HANDLE_MERGEABLE(types_instances, instances, types);
-    HANDLE_MERGEABLE(types_uses, uses, types);
+    HANDLE_MERGEABLE_REFS(types_uses, uses, types);
 
     Remove(update->funcs_removed);
     ImportOrUpdate(std::move(update->funcs_def_update));
     HANDLE_MERGEABLE(funcs_declarations, declarations, funcs);
     HANDLE_MERGEABLE(funcs_derived, derived, funcs);
-    HANDLE_MERGEABLE(funcs_uses, uses, funcs);
+    HANDLE_MERGEABLE_REFS(funcs_uses, uses, funcs);
+    for (const QueryFunc::UsesUpdate& merge_update : update->funcs_uses) {
+        auto is_call = [](const QueryId::LexicalRef& ref) {
+            return ref.kind == SymbolKind::Func;
+        };
+        std::vector<QueryId::LexicalRef> to_add, to_remove;
+        std::copy_if(merge_update.to_add.begin(), merge_update.to_add.end(),
+                     std::back_inserter(to_add), is_call);
+        std::copy_if(merge_update.to_remove.begin(),
+                     merge_update.to_remove.end(),
+                     std::back_inserter(to_remove), is_call);
+        if (!to_add.empty() || !to_remove.empty())
+            funcs[merge_update.id.id].callers.Update(to_add, to_remove);
+    }
 
     Remove(update->vars_removed);
     ImportOrUpdate(std::move(update->vars_def_update));
     HANDLE_MERGEABLE(vars_declarations, declarations, vars);
-    HANDLE_MERGEABLE(vars_uses, uses, vars);
+    HANDLE_MERGEABLE_REFS(vars_uses, uses, vars);
+
+    UpdateCallCounts(changed_funcs);
 
 #undef HANDLE_MERGEABLE
+#undef HANDLE_MERGEABLE_REFS
+}
+
+void QueryDatabase::UpdateCallCounts(const std::vector<QueryFunc*>& changed) {
+    std::unordered_set<QueryFunc*> seen;
+    std::vector<QueryFunc*> component;
+    for (QueryFunc* func : changed) {
+        if (seen.count(func)) continue;
+        component.clear();
+        CollectOverrideComponent(this, func, &seen, &component);
+        // Most functions neither override nor are overridden.
+        if (component.size() == 1) {
+            func->num_base_calls = 0;
+            func->num_derived_calls = 0;
+            continue;
+        }
+
+        for (bool bases : {true, false}) {
+            auto set_count = [&](QueryFunc& func1, uint32_t count) {
+                if (bases)
+                    func1.num_base_calls = count;
+                else
+                    func1.num_derived_calls = count;
+            };
+            if (SumReachableUses(this, component, bases, set_count))
+                continue;
+            // Some function is reachable through two paths, ie, there is a
+            // diamond; walk the hierarchy of every function instead.
+            for (QueryFunc* func1 : component) {
+                uint32_t count = 0;
+                EachFuncInHierarchy(this, *func1, bases, !bases,
+                                    [&](QueryFunc& func2, bool) {
+                                        count += func2.uses.size();
+                                    });
+                set_count(*func1, count);
+            }
+        }
+    }
 }
 
 void QueryDatabase::ImportOrUpdate(
@@ -820,6 +1174,9 @@ void QueryDatabase::ImportOrUpdate(
 
         existing.def = def.value;
         UpdateSymbols(&existing.symbol_idx, SymbolKind::File, def.id);
+        lazy_texts.RemoveIf([&](const std::shared_ptr<LazyDefTexts>& texts) {
+            return texts->path == def.value.path.path;
+        });
     }
 }
 
@@ -1068,14 +1425,266 @@ TEST_SUITE("query") {
             &previous_map, &current_map, &previous, &current);
 
         db.ApplyIndexUpdate(&import_update);
+        std::vector<QueryId::LexicalRef> uses = db.funcs[0].uses.ToVector();
+        REQUIRE(uses.size() == 2);
+        REQUIRE(uses[0].range == Range(Position(1, 0)));
+        REQUIRE(uses[1].range == Range(Position(2, 0)));
+
+        db.ApplyIndexUpdate(&delta_update);
+        uses = db.funcs[0].uses.ToVector();
+        REQUIRE(uses.size() == 2);
+        REQUIRE(uses[0].range == Range(Position(4, 0)));
+        REQUIRE(uses[1].range == Range(Position(5, 0)));
+    }
+
+    TEST_CASE("callers follow uses") {
+        IndexFile previous(AbsolutePath("foo.cc"));
+        IndexFile current(AbsolutePath("foo.cc"));
+
+        IndexFunc* pf = previous.Resolve(previous.ToFuncId(HashUsr("usr")));
+        IndexFunc* cf = current.Resolve(current.ToFuncId(HashUsr("usr")));
+        // Only uses inside of a function are calls.
+        pf->uses.push_back(IndexId::LexicalRef(Range(Position(1, 0)), AnyId(0),
+                                               SymbolKind::Func, {}));
+        pf->uses.push_back(IndexId::LexicalRef(Range(Position(2, 0)), AnyId(0),
+                                               SymbolKind::File, {}));
+        cf->uses.push_back(IndexId::LexicalRef(Range(Position(2, 0)), AnyId(0),
+                                               SymbolKind::File, {}));
+        cf->uses.push_back(IndexId::LexicalRef(Range(Position(3, 0)), AnyId(0),
+                                               SymbolKind::Func, {}));
+
+        QueryDatabase db;
+        IdMap previous_map(&db, previous.id_cache);
+        IdMap current_map(&db, current.id_cache);
+        IndexUpdate import_update = IndexUpdate::CreateDelta(
+            nullptr, &previous_map, nullptr, &previous);
+        IndexUpdate delta_update = IndexUpdate::CreateDelta(
+            &previous_map, &current_map, &previous, &current);
+
+        db.ApplyIndexUpdate(&import_update);
+        std::vector<QueryId::LexicalRef> callers =
+            db.funcs[0].callers.ToVector();
         REQUIRE(db.funcs[0].uses.size() == 2);
-        REQUIRE(db.funcs[0].uses[0].range == Range(Position(1, 0)));
-        REQUIRE(db.funcs[0].uses[1].range == Range(Position(2, 0)));
+        REQUIRE(callers.size() == 1);
+        REQUIRE(callers[0].range == Range(Position(1, 0)));
 
         db.ApplyIndexUpdate(&delta_update);
+        callers = db.funcs[0].callers.ToVector();
         REQUIRE(db.funcs[0].uses.size() == 2);
-        REQUIRE(db.funcs[0].uses[0].range == Range(Position(4, 0)));
-        REQUIRE(db.funcs[0].uses[1].range == Range(Position(5, 0)));
+        REQUIRE(callers.size() == 1);
+        REQUIRE(callers[0].range == Range(Position(3, 0)));
+        REQUIRE(callers[0].id == AnyId(0));
+    }
+
+    TEST_CASE("call counts follow the hierarchy") {
+        IndexFile previous(AbsolutePath("foo.cc"));
+        IndexFile current(AbsolutePath("foo.cc"));
+
+        // b overrides a, which is called twice; b is called once.
+        for (IndexFile* file : {&previous, &current}) {
+            IndexId::Func a = file->ToFuncId(HashUsr("a"));
+            IndexId::Func b = file->ToFuncId(HashUsr("b"));
+            file->Resolve(a)->def.detailed_name = "virtual void A::f()";
+            file->Resolve(b)->def.detailed_name = "void B::f()";
+            file->Resolve(a)->uses.push_back(IndexId::LexicalRef(
+                Range(Position(1, 0)), a, SymbolKind::Func, role::Call));
+            file->Resolve(a)->uses.push_back(IndexId::LexicalRef(
+                Range(Position(2, 0)), a, SymbolKind::Func, role::Call));
+            file->Resolve(b)->uses.push_back(IndexId::LexicalRef(
+                Range(Position(3, 0)), a, SymbolKind::Func, role::Call));
+            if (file == &previous) {
+                file->Resolve(a)->derived.push_back(b);
+                file->Resolve(b)->def.bases.push_back(a);
+            }
+        }
+
+        QueryDatabase db;
+        IdMap previous_map(&db, previous.id_cache);
+        IdMap current_map(&db, current.id_cache);
+        IndexUpdate import_update = IndexUpdate::CreateDelta(
+            nullptr, &previous_map, nullptr, &previous);
+        IndexUpdate delta_update = IndexUpdate::CreateDelta(
+            &previous_map, &current_map, &previous, &current);
+
+        db.ApplyIndexUpdate(&import_update);
+        QueryFunc& a = db.funcs[db.usr_to_func[HashUsr("a")].id];
+        QueryFunc& b = db.funcs[db.usr_to_func[HashUsr("b")].id];
+        REQUIRE(a.num_base_calls == 0);
+        REQUIRE(a.num_derived_calls == 1);
+        REQUIRE(b.num_base_calls == 2);
+        REQUIRE(b.num_derived_calls == 0);
+
+        // b does not override a anymore.
+        db.ApplyIndexUpdate(&delta_update);
+        REQUIRE(a.num_derived_calls == 0);
+        REQUIRE(b.num_base_calls == 0);
+    }
+
+    TEST_CASE("call counts count a diamond once") {
+        IndexFile file(AbsolutePath("foo.cc"));
+        // b and c override a; d overrides both. Each is called once.
+        std::vector<IndexId::Func> ids;
+        for (const char* usr : {"a", "b", "c", "d"})
+            ids.push_back(file.ToFuncId(HashUsr(usr)));
+        for (size_t i = 0; i < ids.size(); ++i) {
+            IndexFunc* func = file.Resolve(ids[i]);
+            func->def.detailed_name = "void f" + std::to_string(i) + "()";
+            func->uses.push_back(
+                IndexId::LexicalRef(Range(Position(int16_t(i), 0)), ids[i],
+                                    SymbolKind::Func, role::Call));
+        }
+        for (size_t derived : {1, 2}) {
+            file.Resolve(ids[0])->derived.push_back(ids[derived]);
+            file.Resolve(ids[derived])->def.bases.push_back(ids[0]);
+            file.Resolve(ids[derived])->derived.push_back(ids[3]);
+            file.Resolve(ids[3])->def.bases.push_back(ids[derived]);
+        }
+
+        QueryDatabase db;
+        IdMap id_map(&db, file.id_cache);
+        IndexUpdate update =
+            IndexUpdate::CreateDelta(nullptr, &id_map, nullptr, &file);
+        db.ApplyIndexUpdate(&update);
+        QueryFunc& a = db.funcs[db.usr_to_func[HashUsr("a")].id];
+        QueryFunc& b = db.funcs[db.usr_to_func[HashUsr("b")].id];
+        QueryFunc& d = db.funcs[db.usr_to_func[HashUsr("d")].id];
+        REQUIRE(a.num_derived_calls == 3);
+        REQUIRE(b.num_base_calls == 1);
+        REQUIRE(b.num_derived_calls == 1);
+        REQUIRE(d.num_base_calls == 3);
+    }
+
+    TEST_CASE("unchanged fingerprints are skipped") {
+        IndexFile previous(AbsolutePath("foo.cc"));
+        IndexFile current(AbsolutePath("foo.cc"));
+
+        // Local ids are assigned in a different order.
+        IndexId::Func pa = previous.ToFuncId(HashUsr("a"));
+        IndexId::Func pb = previous.ToFuncId(HashUsr("b"));
+        IndexId::Func cb = current.ToFuncId(HashUsr("b"));
+        IndexId::Func ca = current.ToFuncId(HashUsr("a"));
+        previous.Resolve(pa)->def.detailed_name = "void a()";
+        previous.Resolve(pb)->def.detailed_name = "void b()";
+        current.Resolve(ca)->def.detailed_name = "void a()";
+        current.Resolve(cb)->def.detailed_name = "void b()";
+        // b calls a.
+        previous.Resolve(pa)->uses.push_back(IndexId::LexicalRef(
+            Range(Position(1, 0)), pb, SymbolKind::Func, role::Call));
+        current.Resolve(ca)->uses.push_back(IndexId::LexicalRef(
+            Range(Position(1, 0)), cb, SymbolKind::Func, role::Call));
+        // b moved.
+        previous.Resolve(pb)->def.spell = IndexId::LexicalRef(
+            Range(Position(2, 0)), AnyId(), SymbolKind::File, role::Definition);
+        current.Resolve(cb)->def.spell = IndexId::LexicalRef(
+            Range(Position(3, 0)), AnyId(), SymbolKind::File, role::Definition);
+
+        ComputeFingerprints(&previous);
+        ComputeFingerprints(&current);
+        REQUIRE(previous.Resolve(pa)->fingerprints.def ==
+                current.Resolve(ca)->fingerprints.def);
+        REQUIRE(previous.Resolve(pa)->fingerprints.uses ==
+                current.Resolve(ca)->fingerprints.uses);
+        REQUIRE(previous.Resolve(pb)->fingerprints.def !=
+                current.Resolve(cb)->fingerprints.def);
+
+        IndexUpdate update = GetDelta(previous, current);
+        REQUIRE(update.funcs_uses.empty());
+        REQUIRE(update.funcs_def_update.size() == 1);
+        REQUIRE(update.funcs_def_update[0].value.detailed_name == "void b()");
+
+        // Equal fingerprints are trusted even if the contents differ.
+        current.Resolve(ca)->uses[0].range = Range(Position(4, 0));
+        update = GetDelta(previous, current);
+        REQUIRE(update.funcs_uses.empty());
+    }
+
+    TEST_CASE("fingerprints do not change the delta") {
+        // A header which is reindexed after a one-line edit that does not
+        // move any other line.
+        const int k_funcs = 100;
+        const int k_uses = 5;
+        IndexFile previous(AbsolutePath("foo.h"));
+        for (int i = 0; i < k_funcs; ++i) previous.ToFuncId(Usr(i + 1));
+        for (int i = 0; i < k_funcs; ++i) {
+            IndexFunc* func = previous.Resolve(IndexId::Func(i));
+            func->def.detailed_name = "void f" + std::to_string(i) + "(int)";
+            func->def.spell =
+                IndexId::LexicalRef(Range(Position(i, 5)), AnyId(),
+                                    SymbolKind::File, role::Definition);
+            for (int j = 0; j < k_uses; ++j) {
+                func->uses.push_back(IndexId::LexicalRef(
+                    Range(Position(i + j, 4)), AnyId((i + j) % k_funcs),
+                    SymbolKind::Func, role::Call));
+            }
+        }
+        IndexFile current = previous;
+        current.Resolve(IndexId::Func(k_funcs / 2))->def.detailed_name =
+            "void f(long)";
+
+        QueryDatabase db;
+        IdMap previous_map(&db, previous.id_cache);
+        IdMap current_map(&db, current.id_cache);
+        for (bool fingerprints : {false, true}) {
+            if (fingerprints) {
+                ComputeFingerprints(&previous);
+                ComputeFingerprints(&current);
+            }
+            IndexUpdate update = IndexUpdate::CreateDelta(
+                &previous_map, &current_map, &previous, &current);
+            REQUIRE(update.funcs_uses.empty());
+            REQUIRE(update.funcs_def_update.size() == 1);
+            REQUIRE(update.funcs_def_update[0].value.detailed_name ==
+                    "void f(long)");
+        }
+    }
+
+    // Run with --test-unit --no-skip -tc="*delta benchmark*".
+    TEST_CASE("delta benchmark" * doctest::skip()) {
+        // A large header which is reindexed after a one-line edit that does
+        // not move any other line.
+        const int k_funcs = 20000;
+        const int k_uses = 10;
+        const int k_iterations = 10;
+        IndexFile previous(AbsolutePath("foo.h"));
+        for (int i = 0; i < k_funcs; ++i) previous.ToFuncId(Usr(i + 1));
+        for (int i = 0; i < k_funcs; ++i) {
+            IndexFunc* func = previous.Resolve(IndexId::Func(i));
+            func->def.detailed_name = "void f" + std::to_string(i) + "(int)";
+            func->def.spell =
+                IndexId::LexicalRef(Range(Position(i, 5)), AnyId(),
+                                    SymbolKind::File, role::Definition);
+            for (int j = 0; j < k_uses; ++j) {
+                func->uses.push_back(IndexId::LexicalRef(
+                    Range(Position(i + j, 4)), AnyId((i + j) % k_funcs),
+                    SymbolKind::Func, role::Call));
+            }
+        }
+        IndexFile current = previous;
+        current.Resolve(IndexId::Func(k_funcs / 2))->def.detailed_name =
+            "void f(long)";
+
+        QueryDatabase db;
+        IdMap previous_map(&db, previous.id_cache);
+        IdMap current_map(&db, current.id_cache);
+        for (bool fingerprints : {false, true}) {
+            Timer timer;
+            if (fingerprints) {
+                ComputeFingerprints(&previous);
+                ComputeFingerprints(&current);
+                timer.ResetAndPrint("[bench] ComputeFingerprints twice");
+            }
+            size_t num_updates = 0;
+            for (int i = 0; i < k_iterations; ++i) {
+                IndexUpdate update = IndexUpdate::CreateDelta(
+                    &previous_map, &current_map, &previous, &current);
+                num_updates += update.funcs_def_update.size() +
+                               update.funcs_uses.size();
+            }
+            REQUIRE(num_updates == k_iterations);
+            timer.ResetAndPrint(std::string("[bench] CreateDelta ") +
+                                (fingerprints ? "with" : "without") +
+                                " fingerprints");
+        }
     }
 
     TEST_CASE("Remove variable with usage") {
@@ -1209,3 +1818,109 @@ TEST_SUITE("query") {
         REQUIRE(db.vars[0].uses.size() == 0);
     }
 }
+
+TEST_SUITE("QueryRefList") {
+    QueryId::LexicalRef MakeRef(int file, int line, int column, int id) {
+        return QueryId::LexicalRef(
+            Range(Position(line, column), Position(line, column + 3)),
+            AnyId(id), SymbolKind::Func, role::Reference, QueryId::File(file));
+    }
+
+    TEST_CASE("update and iterate") {
+        QueryRefList list;
+        list.Update({MakeRef(2, 10, 4, 7), MakeRef(1, 5, 0, -1),
+                     MakeRef(2, 3, 8, 1000000), MakeRef(1, 5, 2, 3)},
+                    {});
+        REQUIRE(list.size() == 4);
+        std::vector<QueryId::LexicalRef> refs = list.ToVector();
+        REQUIRE(refs.size() == 4);
+        // Grouped by file and sorted by range.
+        REQUIRE(refs[0] == MakeRef(1, 5, 0, -1));
+        REQUIRE(refs[0].file == QueryId::File(1));
+        REQUIRE(refs[1] == MakeRef(1, 5, 2, 3));
+        REQUIRE(refs[2] == MakeRef(2, 3, 8, 1000000));
+        REQUIRE(refs[3] == MakeRef(2, 10, 4, 7));
+        REQUIRE(refs[3].file == QueryId::File(2));
+
+        // Only the uses of file 1 are replaced.
+        list.Update({MakeRef(1, 6, 0, 3)},
+                    {MakeRef(1, 5, 0, -1), MakeRef(1, 5, 2, 3)});
+        refs = list.ToVector();
+        REQUIRE(refs.size() == 3);
+        REQUIRE(refs[0] == MakeRef(1, 6, 0, 3));
+        REQUIRE(refs[1] == MakeRef(2, 3, 8, 1000000));
+
+        list.Update({}, {MakeRef(1, 6, 0, 3), MakeRef(2, 3, 8, 1000000),
+                         MakeRef(2, 10, 4, 7)});
+        REQUIRE(list.empty());
+        REQUIRE(list.begin() == list.end());
+    }
+
+    TEST_CASE("uses are stored compactly") {
+        // A popular type, used in many places of many files.
+        const int k_files = 50;
+        const int k_uses_per_file = 200;
+        std::vector<QueryId::LexicalRef> uses;
+        QueryRefList list;
+        for (int file = 0; file < k_files; ++file) {
+            std::vector<QueryId::LexicalRef> file_uses;
+            for (int i = 0; i < k_uses_per_file; ++i) {
+                file_uses.push_back(MakeRef(file, i * 3 + file % 7, 4 + i % 40,
+                                            file * 100 + i / 10));
+            }
+            uses.insert(uses.end(), file_uses.begin(), file_uses.end());
+            list.Update(file_uses, {});
+        }
+
+        REQUIRE(list.size() == uses.size());
+        REQUIRE(list.ToVector() == uses);
+        // Nearby uses are delta encoded in a few bytes each.
+        REQUIRE(list.AllocatedBytes() <
+                uses.size() * sizeof(QueryId::LexicalRef));
+    }
+
+    // Run with --test-unit --no-skip -tc="*uses benchmark*".
+    TEST_CASE("uses benchmark" * doctest::skip()) {
+        // A popular type, used in many places of many files.
+        const int k_files = 2000;
+        const int k_uses_per_file = 500;
+        std::vector<QueryId::LexicalRef> uses;
+        for (int file = 0; file < k_files; ++file) {
+            for (int i = 0; i < k_uses_per_file; ++i) {
+                int line = i * 3 + file % 7;
+                uses.push_back(MakeRef(file, line, 4 + i % 40,
+                                       file * 100 + i / 10));
+            }
+        }
+
+        QueryRefList list;
+        Timer timer;
+        for (int file = 0; file < k_files; ++file) {
+            auto begin = uses.begin() + file * k_uses_per_file;
+            list.Update(std::vector<QueryId::LexicalRef>(
+                            begin, begin + k_uses_per_file),
+                        {});
+        }
+        timer.ResetAndPrint("[bench] QueryRefList: import " +
+                            std::to_string(uses.size()) + " uses");
+
+        LOG_S(INFO) << "[bench] std::vector: "
+                    << uses.capacity() * sizeof(QueryId::LexicalRef)
+                    << " bytes; QueryRefList: " << list.AllocatedBytes()
+                    << " bytes";
+
+        long long checksum = 0;
+        timer.Reset();
+        for (int i = 0; i < 10; ++i) {
+            for (QueryId::LexicalRef use : uses)
+                checksum += use.range.start.line;
+        }
+        timer.ResetAndPrint("[bench] std::vector: iterate 10 times");
+        for (int i = 0; i < 10; ++i) {
+            for (QueryId::LexicalRef use : list)
+                checksum -= use.range.start.line;
+        }
+        timer.ResetAndPrint("[bench] QueryRefList: iterate 10 times");
+        REQUIRE(checksum == 0);
+    }
+}
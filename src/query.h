@@ -3,9 +3,13 @@
 #include <sparsepp/spp.h>
 
 #include <functional>
+#include <iterator>
+#include <string>
 
 #include "indexer.h"
+#include "lru_cache.h"
 #include "serializer.h"
+#include "string_pool.h"
 
 struct QueryFile;
 struct QueryType;
@@ -40,6 +44,69 @@ struct QueryId {
     using Var = Id<QueryVar>;
     using SymbolRef = QuerySymbolRef;
     using LexicalRef = QueryLexicalRef;
+    // Definitions are kept for as long as the project is open, so their
+    // strings are shared between files.
+    using String = PooledString;
+};
+
+// Compact storage for the uses of a querydb entity. Popular symbols have
+// millions of uses, so instead of a std::vector<QueryId::LexicalRef> the uses
+// are grouped by file and sorted by range, and each one is stored as varints
+// of the difference to the previous one, which takes about a third of the
+// memory. Uses are decoded while iterating.
+class QueryRefList {
+    struct Group {
+        QueryId::File file;
+        uint32_t size = 0;
+        std::string bytes;
+    };
+
+   public:
+    class Iterator {
+       public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = QueryId::LexicalRef;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const QueryId::LexicalRef*;
+        using reference = const QueryId::LexicalRef&;
+
+        Iterator(const std::vector<Group>* groups, size_t group);
+
+        const QueryId::LexicalRef& operator*() const { return m_ref; }
+        const QueryId::LexicalRef* operator->() const { return &m_ref; }
+        Iterator& operator++();
+        bool operator==(const Iterator& o) const {
+            return m_group == o.m_group && m_pos == o.m_pos;
+        }
+        bool operator!=(const Iterator& o) const { return !(*this == o); }
+
+       private:
+        void Decode();
+
+        const std::vector<Group>* m_groups;
+        size_t m_group;
+        // Offset of the next use in the bytes of |m_group|.
+        size_t m_pos = 0;
+        QueryId::LexicalRef m_ref;
+    };
+
+    Iterator begin() const { return Iterator(&m_groups, 0); }
+    Iterator end() const { return Iterator(&m_groups, m_groups.size()); }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    std::vector<QueryId::LexicalRef> ToVector() const;
+    // Heap memory used by the list.
+    size_t AllocatedBytes() const;
+
+    // Adds |to_add| and then removes |to_remove|. Only the files they belong
+    // to are reencoded.
+    void Update(const std::vector<QueryId::LexicalRef>& to_add,
+                const std::vector<QueryId::LexicalRef>& to_remove);
+
+   private:
+    // Sorted by file.
+    std::vector<Group> m_groups;
+    size_t m_size = 0;
 };
 
 // There are two sources of reindex updates: the (single) definition of a
@@ -157,7 +224,7 @@ struct QueryType : QueryEntity<QueryType, TypeDefDefinitionData<QueryId>> {
     std::vector<QueryId::LexicalRef> declarations;
     std::vector<QueryId::Type> derived;
     std::vector<QueryId::Var> instances;
-    std::vector<QueryId::LexicalRef> uses;
+    QueryRefList uses;
 
     explicit QueryType(const Usr& usr) : usr(usr) {}
 };
@@ -170,7 +237,15 @@ struct QueryFunc : QueryEntity<QueryFunc, FuncDefDefinitionData<QueryId>> {
     std::vector<Def> def;
     std::vector<QueryId::LexicalRef> declarations;
     std::vector<QueryId::Func> derived;
-    std::vector<QueryId::LexicalRef> uses;
+    QueryRefList uses;
+    // The uses whose lexical parent is a function, ie, the incoming edges of
+    // the call graph. The outgoing edges are |Def::callees|.
+    QueryRefList callers;
+    // Number of uses of the functions which this function overrides, and of
+    // the functions which override it, directly or through another function.
+    // Kept up to date by QueryDatabase::ApplyIndexUpdate for code lens.
+    uint32_t num_base_calls = 0;
+    uint32_t num_derived_calls = 0;
 
     explicit QueryFunc(const Usr& usr) : usr(usr) {}
 };
@@ -180,7 +255,7 @@ struct QueryVar : QueryEntity<QueryVar, VarDefDefinitionData<QueryId>> {
     size_t symbol_idx = -1;
     std::vector<Def> def;
     std::vector<QueryId::LexicalRef> declarations;
-    std::vector<QueryId::LexicalRef> uses;
+    QueryRefList uses;
 
     explicit QueryVar(const Usr& usr) : usr(usr) {}
 };
@@ -229,6 +304,14 @@ struct IndexUpdate {
                 IndexFile& previous, IndexFile& current);
 };
 
+// Hover and comments of a definition read from the cache of |path|, see
+// index.lazyHover and GetHoverAndComments.
+struct LazyDefTexts {
+    std::string path;
+    std::string hover;
+    std::string comments;
+};
+
 // The query database is heavily optimized for fast queries. It is stored
 // in-memory.
 struct QueryDatabase {
@@ -247,6 +330,12 @@ struct QueryDatabase {
     spp::sparse_hash_map<Usr, QueryId::Func> usr_to_func;
     spp::sparse_hash_map<Usr, QueryId::Var> usr_to_var;
 
+    // Recently hovered definitions if index.lazyHover is set. Entries are
+    // dropped when the file they were read from is updated.
+    static const int k_lazy_texts_size = 256;
+    LruCache<SymbolIdx, std::shared_ptr<LazyDefTexts>> lazy_texts{
+        k_lazy_texts_size};
+
     // Removes data for the given ids in the given files.
     void Remove(
         const std::vector<WithId<QueryId::File, QueryId::Type>>& to_remove);
@@ -257,6 +346,9 @@ struct QueryDatabase {
 
     // Insert the contents of |update| into |db|.
     void ApplyIndexUpdate(IndexUpdate* update);
+    // Recomputes |num_base_calls| and |num_derived_calls| of |changed| and of
+    // the functions connected to them through overrides.
+    void UpdateCallCounts(const std::vector<QueryFunc*>& changed);
     void ImportOrUpdate(const std::vector<QueryFile::DefUpdate>& updates);
     void ImportOrUpdate(std::vector<QueryType::DefUpdate>&& updates);
     void ImportOrUpdate(std::vector<QueryFunc::DefUpdate>&& updates);
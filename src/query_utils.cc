@@ -2,8 +2,9 @@
 
 #include <climits>
 #include <loguru.hpp>
-#include <unordered_set>
 
+#include "cache_manager.h"
+#include "config.h"
 #include "queue_manager.h"
 
 namespace {
@@ -118,44 +119,22 @@ std::vector<QueryId::LexicalRef> GetNonDefDeclarations(QueryDatabase* db,
 std::vector<QueryId::LexicalRef> GetRefsForAllBases(QueryDatabase* db,
                                                     QueryFunc& root) {
     std::vector<QueryId::LexicalRef> ret;
-    std::vector<QueryFunc*> stack{&root};
-    std::unordered_set<Usr> seen;
-    seen.insert(root.usr);
-    while (!stack.empty()) {
-        QueryFunc& func = *stack.back();
-        stack.pop_back();
-        if (auto* def = func.AnyDef()) {
-            EachDefinedFunc(db, def->bases, [&](QueryFunc& func1) {
-                if (!seen.count(func1.usr)) {
-                    seen.insert(func1.usr);
-                    stack.push_back(&func1);
-                    AddRange(&ret, func1.uses);
-                }
-            });
-        }
-    }
-
+    EachFuncInHierarchy(db, root, true /*bases*/, false /*derived*/,
+                        [&](QueryFunc& func, bool is_base) {
+                            ret.insert(ret.end(), func.uses.begin(),
+                                       func.uses.end());
+                        });
     return ret;
 }
 
 std::vector<QueryId::LexicalRef> GetRefsForAllDerived(QueryDatabase* db,
                                                       QueryFunc& root) {
     std::vector<QueryId::LexicalRef> ret;
-    std::vector<QueryFunc*> stack{&root};
-    std::unordered_set<Usr> seen;
-    seen.insert(root.usr);
-    while (!stack.empty()) {
-        QueryFunc& func = *stack.back();
-        stack.pop_back();
-        EachDefinedFunc(db, func.derived, [&](QueryFunc& func1) {
-            if (!seen.count(func1.usr)) {
-                seen.insert(func1.usr);
-                stack.push_back(&func1);
-                AddRange(&ret, func1.uses);
-            }
-        });
-    }
-
+    EachFuncInHierarchy(db, root, false /*bases*/, true /*derived*/,
+                        [&](QueryFunc& func, bool is_base) {
+                            ret.insert(ret.end(), func.uses.begin(),
+                                       func.uses.end());
+                        });
     return ret;
 }
 
@@ -296,6 +275,43 @@ optional<LsSymbolInformation> GetSymbolInfo(QueryDatabase* db,
     return nullopt;
 }
 
+namespace {
+
+template <typename TDef>
+void CopyHoverAndComments(const TDef& def, LazyDefTexts* texts) {
+    texts->hover = std::string(std::string_view(def.hover));
+    texts->comments = std::string(std::string_view(def.comments));
+}
+
+}  // namespace
+
+std::shared_ptr<LazyDefTexts> GetHoverAndComments(QueryDatabase* db,
+                                                  SymbolIdx sym) {
+    std::shared_ptr<LazyDefTexts> result;
+    WithEntity(db, sym, [&](const auto& entity) {
+        const auto* def = entity.AnyDef();
+        if (!def) return;
+        if (!g_config->index.lazyHover) {
+            result = std::make_shared<LazyDefTexts>();
+            CopyHoverAndComments(*def, result.get());
+            return;
+        }
+
+        const QueryFile& file = db->files[def->file.id];
+        if (!file.def) return;
+        const std::string& path = file.def->path.path;
+        if (db->lazy_texts.TryGet(sym, &result) && result->path == path)
+            return;
+
+        result = std::make_shared<LazyDefTexts>();
+        result->path = path;
+        ICacheManager::Make()->LoadHoverAndComments(path, sym.kind, entity.usr,
+                                                    result.get());
+        db->lazy_texts.Insert(sym, result);
+    });
+    return result;
+}
+
 std::vector<QueryId::SymbolRef> FindSymbolsAtLocation(WorkingFile* working_file,
                                                       QueryFile* file,
                                                       LsPosition position) {
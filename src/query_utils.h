@@ -2,6 +2,8 @@
 
 #include <optional.h>
 
+#include <unordered_set>
+
 #include "query.h"
 #include "working_files.h"
 
@@ -46,6 +48,11 @@ std::vector<LsLocation> GetLsLocations(
 optional<LsSymbolInformation> GetSymbolInfo(QueryDatabase* db,
                                             WorkingFiles* working_files,
                                             SymbolIdx sym, bool use_short_name);
+// Returns the hover and comments of the definition of |sym|, or null if it
+// has no definition. If index.lazyHover is set they are read from the cache of
+// the file which defines |sym|.
+std::shared_ptr<LazyDefTexts> GetHoverAndComments(QueryDatabase* db,
+                                                  SymbolIdx sym);
 
 std::vector<QueryId::SymbolRef> FindSymbolsAtLocation(WorkingFile* working_file,
                                                       QueryFile* file,
@@ -129,6 +136,50 @@ void EachDefinedFunc(QueryDatabase* db, const std::vector<QueryId::Func>& ids,
         if (!obj.def.empty()) fn(obj);
     }
 }
+// Calls |fn| with each function which |root| overrides, directly or through
+// another function, if |bases| is set, and then with each function which
+// overrides |root| if |derived| is set. The second argument of |fn| is true
+// for base functions. Every function is visited once and |root| is not
+// visited.
+template <typename Fn>
+void EachFuncInHierarchy(QueryDatabase* db, QueryFunc& root, bool bases,
+                         bool derived, Fn&& fn) {
+    // Most functions neither override nor are overridden.
+    const QueryFunc::Def* root_def = root.AnyDef();
+    if ((!bases || !root_def || root_def->bases.empty()) &&
+        (!derived || root.derived.empty()))
+        return;
+    std::unordered_set<const QueryFunc*> seen{&root};
+    std::vector<QueryFunc*> stack;
+    if (bases) {
+        stack.push_back(&root);
+        while (!stack.empty()) {
+            QueryFunc* func = stack.back();
+            stack.pop_back();
+            if (const QueryFunc::Def* def = func->AnyDef()) {
+                EachDefinedFunc(db, def->bases, [&](QueryFunc& base) {
+                    if (seen.insert(&base).second) {
+                        stack.push_back(&base);
+                        fn(base, true);
+                    }
+                });
+            }
+        }
+    }
+    if (derived) {
+        stack.push_back(&root);
+        while (!stack.empty()) {
+            QueryFunc* func = stack.back();
+            stack.pop_back();
+            EachDefinedFunc(db, func->derived, [&](QueryFunc& derived_func) {
+                if (seen.insert(&derived_func).second) {
+                    stack.push_back(&derived_func);
+                    fn(derived_func, false);
+                }
+            });
+        }
+    }
+}
 template <typename Fn>
 void EachDefinedVar(QueryDatabase* db, const std::vector<QueryId::Var>& ids,
                     Fn&& fn) {
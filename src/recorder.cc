@@ -4,9 +4,14 @@
 #include <fstream>
 #include <loguru.hpp>
 
+#include "timer.h"
+
+const char* k_recorded_time_header = "Cquery-Time-Ms: ";
+
 namespace {
 std::ofstream* g_file_in = nullptr;
 std::ofstream* g_file_out = nullptr;
+Timer* g_recording_time = nullptr;
 }  // namespace
 
 void EnableRecording(std::string path) {
@@ -36,12 +41,16 @@ void EnableRecording(std::string path) {
         delete g_file_out;
         g_file_in = nullptr;
         g_file_out = nullptr;
+        return;
     }
+    g_recording_time = new Timer();
 }
 
 void RecordInput(std::string_view content) {
     if (!g_file_in) return;
-    (*g_file_in) << "Content-Length: " << content.size() << "\r\n\r\n"
+    (*g_file_in) << k_recorded_time_header
+                 << g_recording_time->ElapsedMicroseconds() / 1000 << "\r\n"
+                 << "Content-Length: " << content.size() << "\r\n\r\n"
                  << content;
     (*g_file_in).flush();
 }
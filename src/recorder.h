@@ -4,6 +4,11 @@
 
 #include <string>
 
+// Header field which precedes every message in <path>.in. Its value is the
+// number of milliseconds since recording started, which --replay uses to send
+// messages at the recorded pace.
+extern const char* k_recorded_time_header;
+
 void EnableRecording(std::string path);
 void RecordInput(std::string_view content);
 void RecordOutput(std::string_view content);
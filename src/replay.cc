@@ -0,0 +1,438 @@
+#include "replay.h"
+
+#include <doctest/doctest.h>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <loguru.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "lsp.h"
+#include "queue_manager.h"
+#include "recorder.h"
+#include "serializers/json.h"
+#include "timer.h"
+#include "utils.h"
+#include "work_thread.h"
+
+namespace {
+
+struct RecordedMessage {
+    // Milliseconds since recording started, or 0 if the recording has no
+    // timestamps.
+    long long time_ms = 0;
+    std::string content;
+};
+
+// Splits the contents of a <path>.in recording into messages.
+std::vector<RecordedMessage> ParseRecording(const std::string& recording) {
+    const std::string k_content_length = "Content-Length: ";
+    std::vector<RecordedMessage> result;
+    size_t pos = 0;
+    while (pos < recording.size()) {
+        RecordedMessage message;
+        long long content_length = -1;
+        // Header fields are terminated by "\r\n", the header by an empty one.
+        while (true) {
+            size_t end = recording.find("\r\n", pos);
+            if (end == std::string::npos) return result;
+            std::string field = recording.substr(pos, end - pos);
+            pos = end + 2;
+            if (field.empty()) break;
+            if (StartsWith(field, k_content_length)) {
+                content_length =
+                    atoll(field.c_str() + k_content_length.size());
+            } else if (StartsWith(field, k_recorded_time_header)) {
+                message.time_ms =
+                    atoll(field.c_str() + strlen(k_recorded_time_header));
+            }
+        }
+        if (content_length < 0 || pos + content_length > recording.size()) {
+            LOG_S(WARNING) << "replay: truncated message at offset " << pos;
+            return result;
+        }
+        message.content = recording.substr(pos, content_length);
+        pos += content_length;
+        result.push_back(std::move(message));
+    }
+    return result;
+}
+
+// Returns the "id" of a JSON-RPC message serialized as JSON, so that int and
+// string ids can be compared, or an empty string if it has none.
+std::string GetSerializedId(const rapidjson::Document& document) {
+    if (!document.IsObject()) return "";
+    auto id = document.FindMember("id");
+    if (id == document.MemberEnd() || id->value.IsNull()) return "";
+    rapidjson::StringBuffer output;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+    id->value.Accept(writer);
+    return output.GetString();
+}
+
+std::string GetMethod(const rapidjson::Document& document) {
+    if (!document.IsObject()) return "";
+    auto method = document.FindMember("method");
+    if (method == document.MemberEnd() || !method->value.IsString())
+        return "";
+    return method->value.GetString();
+}
+
+// Nearest-rank percentile of |sorted|, which must not be empty.
+long long Percentile(const std::vector<long long>& sorted, double percentile) {
+    size_t rank = size_t(std::ceil(sorted.size() * percentile / 100));
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+struct ReplayReport {
+    struct Method {
+        std::string method;
+        int count = 0;
+        double meanMs = 0;
+        double p50Ms = 0;
+        double p90Ms = 0;
+        double p99Ms = 0;
+        double maxMs = 0;
+    };
+    struct Request {
+        std::string id;
+        std::string method;
+        // When the request was sent, relative to the start of the replay.
+        double sentMs = 0;
+        // Not set if cquery did not respond before the replay ended.
+        optional<double> latencyMs;
+    };
+
+    std::string recording;
+    double speed = 0;
+    // Time until the response to "initialize".
+    double initializeMs = 0;
+    // Time spent waiting for indexing after initialization.
+    double indexingMs = 0;
+    // Time spent sending the rest of the session and waiting for responses.
+    double replayMs = 0;
+    int numRequests = 0;
+    int numUnanswered = 0;
+    // Responses per second of |replayMs|.
+    double requestsPerSecond = 0;
+    std::vector<Method> methods;
+    std::vector<Request> requests;
+};
+MAKE_REFLECT_STRUCT(ReplayReport::Method, method, count, meanMs, p50Ms, p90Ms,
+                    p99Ms, maxMs);
+MAKE_REFLECT_STRUCT(ReplayReport::Request, id, method, sentMs, latencyMs);
+MAKE_REFLECT_STRUCT(ReplayReport, recording, speed, initializeMs, indexingMs,
+                    replayMs, numRequests, numUnanswered, requestsPerSecond,
+                    methods, requests);
+
+double ToMs(long long us) { return us / 1000.0; }
+
+struct Replay {
+    struct Request {
+        std::string id;
+        std::string method;
+        long long sent_us = 0;
+        long long latency_us = -1;
+        // False for requests sent by replay itself.
+        bool recorded = true;
+    };
+
+    std::string path;
+    std::string report_path;
+    double speed = 0;
+    std::vector<RecordedMessage> messages;
+
+    // Started when replay starts.
+    Timer time;
+    std::mutex mutex;
+    std::condition_variable responded;
+    std::vector<Request> requests;
+    // Serialized id -> index into |requests|, for requests without a response.
+    std::unordered_map<std::string, size_t> pending;
+
+    // Sends |content| to querydb. Returns the index into |requests| if it is a
+    // request.
+    optional<size_t> Send(const std::string& content, bool recorded) {
+        rapidjson::Document document;
+        document.Parse(content.c_str(), content.size());
+        if (document.HasParseError()) {
+            LOG_S(WARNING) << "replay: skipping malformed message";
+            return nullopt;
+        }
+        JsonReader json_reader{&document};
+        std::unique_ptr<InMessage> message;
+        optional<std::string> error =
+            MessageRegistry::Instance()->Parse(json_reader, &message);
+        if (error) {
+            LOG_S(WARNING) << "replay: skipping message: " << *error;
+            return nullopt;
+        }
+
+        optional<size_t> index;
+        std::string id = GetSerializedId(document);
+        if (!id.empty()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            Request request;
+            request.id = id;
+            request.method = GetMethod(document);
+            request.sent_us = time.ElapsedMicroseconds();
+            request.recorded = recorded;
+            index = requests.size();
+            pending[id] = *index;
+            requests.push_back(request);
+        }
+        QueueManager::Instance()->for_querydb.Enqueue(std::move(message),
+                                                      false /*priority*/);
+        return index;
+    }
+
+    // Blocks until the request at |index| gets a response.
+    void WaitForResponse(size_t index) {
+        std::unique_lock<std::mutex> lock(mutex);
+        responded.wait(lock,
+                       [&]() { return requests[index].latency_us >= 0; });
+    }
+
+    void OnResponse(const std::string& id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pending.find(id);
+        if (it == pending.end()) return;
+        Request& request = requests[it->second];
+        request.latency_us = time.ElapsedMicroseconds() - request.sent_us;
+        pending.erase(it);
+        responded.notify_all();
+    }
+
+    // Sends $cquery/wait, which blocks querydb until indexing is done, followed
+    // by a request which querydb only answers after that.
+    void WaitForIndexing() {
+        Send(R"({"jsonrpc":"2.0","method":"$cquery/wait"})", false);
+        optional<size_t> index = Send(
+            R"({"jsonrpc":"2.0","id":"cquery-replay-sync",)"
+            R"("method":"$cquery/stats"})",
+            false);
+        if (index) WaitForResponse(*index);
+    }
+
+    void Run();
+    ReplayReport BuildReport(long long initialize_us, long long indexing_us,
+                             long long replay_us);
+};
+
+void Replay::Run() {
+    long long initialize_us = 0, indexing_us = 0;
+    // Messages are sent |speed| times as fast as they were recorded, relative
+    // to |base_ms| which was sent at |base_us| of the replay.
+    long long base_ms = messages.empty() ? 0 : messages[0].time_ms;
+    long long base_us = 0;
+
+    std::vector<std::string> methods;
+    for (const RecordedMessage& message : messages) {
+        rapidjson::Document document;
+        document.Parse(message.content.c_str(), message.content.size());
+        methods.push_back(document.HasParseError() ? "" : GetMethod(document));
+    }
+
+    for (size_t i = 0; i < messages.size(); ++i) {
+        const RecordedMessage& message = messages[i];
+        // The report is written instead of exiting.
+        if (methods[i] == kMethodType_Exit) break;
+
+        if (speed > 0) {
+            long long target_us =
+                base_us +
+                (long long)((message.time_ms - base_ms) * 1000 / speed);
+            long long delay_us = target_us - time.ElapsedMicroseconds();
+            if (delay_us > 0) {
+                std::this_thread::sleep_for(
+                    std::chrono::microseconds(delay_us));
+            }
+        }
+        optional<size_t> index = Send(message.content, true);
+
+        // Wait for indexing after the client is initialized, so latency is not
+        // dominated by how long the initial import takes.
+        bool initialized = methods[i] == "initialized";
+        if (methods[i] == "initialize" && index) {
+            WaitForResponse(*index);
+            initialize_us = time.ElapsedMicroseconds();
+            // Clients should send "initialized" next, but do not rely on it.
+            initialized =
+                i + 1 == methods.size() || methods[i + 1] != "initialized";
+        }
+        if (initialized) {
+            long long start_us = time.ElapsedMicroseconds();
+            WaitForIndexing();
+            indexing_us = time.ElapsedMicroseconds() - start_us;
+            LOG_S(INFO) << "replay: indexing took " << indexing_us / 1000
+                        << "ms";
+            if (i + 1 < messages.size()) base_ms = messages[i + 1].time_ms;
+            base_us = time.ElapsedMicroseconds();
+        }
+    }
+    long long replay_start_us = initialize_us + indexing_us;
+
+    // Give outstanding requests some time to finish.
+    const long long k_response_timeout_us = 60 * 1000 * 1000;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        responded.wait_for(lock,
+                           std::chrono::microseconds(k_response_timeout_us),
+                           [&]() { return pending.empty(); });
+    }
+
+    ReplayReport report =
+        BuildReport(initialize_us, indexing_us,
+                    time.ElapsedMicroseconds() - replay_start_us);
+    rapidjson::StringBuffer output;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+    JsonWriter json_writer(&writer);
+    Reflect(json_writer, report);
+    WriteToFile(report_path, output.GetString());
+    LOG_S(INFO) << "replay: wrote report for " << report.numRequests
+                << " requests to " << report_path;
+    exit(0);
+}
+
+ReplayReport Replay::BuildReport(long long initialize_us,
+                                 long long indexing_us, long long replay_us) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ReplayReport report;
+    report.recording = path + ".in";
+    report.speed = speed;
+    report.initializeMs = ToMs(initialize_us);
+    report.indexingMs = ToMs(indexing_us);
+    report.replayMs = ToMs(replay_us);
+
+    std::unordered_map<std::string, std::vector<long long>> latencies;
+    std::vector<std::string> methods;
+    for (const Request& request : requests) {
+        if (!request.recorded) continue;
+        ReplayReport::Request entry;
+        entry.id = request.id;
+        entry.method = request.method;
+        entry.sentMs = ToMs(request.sent_us);
+        ++report.numRequests;
+        if (request.latency_us >= 0) {
+            entry.latencyMs = ToMs(request.latency_us);
+            std::vector<long long>& method_latencies =
+                latencies[request.method];
+            if (method_latencies.empty()) methods.push_back(request.method);
+            method_latencies.push_back(request.latency_us);
+        } else {
+            ++report.numUnanswered;
+        }
+        report.requests.push_back(entry);
+    }
+    if (replay_us > 0) {
+        report.requestsPerSecond =
+            (report.numRequests - report.numUnanswered) / (replay_us / 1e6);
+    }
+
+    std::sort(methods.begin(), methods.end());
+    for (const std::string& method : methods) {
+        std::vector<long long>& sorted = latencies[method];
+        std::sort(sorted.begin(), sorted.end());
+        ReplayReport::Method entry;
+        entry.method = method;
+        entry.count = int(sorted.size());
+        long long total_us = 0;
+        for (long long latency_us : sorted) total_us += latency_us;
+        entry.meanMs = ToMs(total_us) / sorted.size();
+        entry.p50Ms = ToMs(Percentile(sorted, 50));
+        entry.p90Ms = ToMs(Percentile(sorted, 90));
+        entry.p99Ms = ToMs(Percentile(sorted, 99));
+        entry.maxMs = ToMs(sorted.back());
+        report.methods.push_back(entry);
+    }
+    return report;
+}
+
+Replay* g_replay = nullptr;
+
+}  // namespace
+
+bool StartReplay(const std::string& path, double speed,
+                 const std::string& report_path) {
+    // We can only call |StartReplay| once.
+    assert(!g_replay);
+    optional<std::string> recording = ReadContent(path + ".in");
+    if (!recording) {
+        LOG_S(ERROR) << "replay: cannot read " << path << ".in";
+        return false;
+    }
+
+    g_replay = new Replay();
+    g_replay->path = path;
+    g_replay->report_path = report_path;
+    g_replay->speed = speed;
+    g_replay->messages = ParseRecording(*recording);
+    LOG_S(INFO) << "replay: replaying " << g_replay->messages.size()
+                << " messages from " << path << ".in";
+    WorkThread::StartThread("replay", []() { g_replay->Run(); });
+    return true;
+}
+
+bool IsReplaying() { return g_replay != nullptr; }
+
+void OnReplayOutput(const std::string& content) {
+    size_t body = content.find("\r\n\r\n");
+    if (body == std::string::npos) return;
+    rapidjson::Document document;
+    document.Parse(content.c_str() + body + 4, content.size() - body - 4);
+    if (document.HasParseError()) return;
+    // Requests sent by cquery to the client also have an id.
+    if (!GetMethod(document).empty()) return;
+    std::string id = GetSerializedId(document);
+    if (!id.empty()) g_replay->OnResponse(id);
+}
+
+TEST_SUITE("Replay") {
+    TEST_CASE("parse recording") {
+        std::vector<RecordedMessage> messages = ParseRecording(
+            "Cquery-Time-Ms: 0\r\nContent-Length: 2\r\n\r\n{}"
+            "Cquery-Time-Ms: 1500\r\nContent-Length: 3\r\n\r\n[1]"
+            // Recorded before timestamps were added.
+            "Content-Length: 1\r\n\r\n1"
+            // Truncated.
+            "Content-Length: 5\r\n\r\nab");
+        REQUIRE(messages.size() == 3);
+        REQUIRE(messages[0].time_ms == 0);
+        REQUIRE(messages[0].content == "{}");
+        REQUIRE(messages[1].time_ms == 1500);
+        REQUIRE(messages[1].content == "[1]");
+        REQUIRE(messages[2].time_ms == 0);
+        REQUIRE(messages[2].content == "1");
+    }
+
+    TEST_CASE("serialized ids") {
+        rapidjson::Document document;
+        document.Parse(R"({"id":3,"method":"a"})");
+        REQUIRE(GetSerializedId(document) == "3");
+        REQUIRE(GetMethod(document) == "a");
+        document.Parse(R"({"id":"3"})");
+        REQUIRE(GetSerializedId(document) == "\"3\"");
+        REQUIRE(GetMethod(document) == "");
+        document.Parse(R"({"method":"b"})");
+        REQUIRE(GetSerializedId(document) == "");
+    }
+
+    TEST_CASE("percentile") {
+        std::vector<long long> sorted = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        REQUIRE(Percentile(sorted, 50) == 5);
+        REQUIRE(Percentile(sorted, 90) == 9);
+        REQUIRE(Percentile(sorted, 99) == 10);
+        REQUIRE(Percentile(sorted, 0) == 1);
+    }
+}
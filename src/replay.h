@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+// Replays a session recorded with --record against this build, which allows
+// comparing the latency of different builds on the same real session.
+//
+// The messages in <path>.in are sent to querydb instead of reading stdin, with
+// the delays between them as recorded divided by |speed|; a |speed| of 0 sends
+// them as fast as possible. Once the client is initialized, replay waits until
+// indexing is done before sending more messages. When the recorded client
+// exits, a JSON report of the latency of every request is written to
+// |report_path| and cquery exits.
+//
+// Returns false if the recording cannot be read.
+bool StartReplay(const std::string& path, double speed,
+                 const std::string& report_path);
+bool IsReplaying();
+// Called by the stdout thread with every message which would be sent to the
+// client.
+void OnReplayOutput(const std::string& content);
@@ -3,112 +3,26 @@
 #include <doctest/doctest.h>
 
 #include <loguru.hpp>
+#include <functional>
 #include <stdexcept>
 
 #include "indexer.h"
 #include "serializers/json.h"
 #include "serializers/msgpack.h"
+#include "timer.h"
 
 bool g_test_output_mode = false;
 
-//// Elementary types
-
-void Reflect(Reader& visitor, uint8_t& value) {
-    if (!visitor.IsInt()) throw std::invalid_argument("uint8_t");
-    value = (uint8_t)visitor.GetInt();
-}
-void Reflect(Writer& visitor, uint8_t& value) { visitor.Int(value); }
-
-void Reflect(Reader& visitor, short& value) {
-    if (!visitor.IsInt()) throw std::invalid_argument("short");
-    value = (short)visitor.GetInt();
-}
-void Reflect(Writer& visitor, short& value) { visitor.Int(value); }
-
-void Reflect(Reader& visitor, unsigned short& value) {
-    if (!visitor.IsInt()) throw std::invalid_argument("unsigned short");
-    value = (unsigned short)visitor.GetInt();
-}
-void Reflect(Writer& visitor, unsigned short& value) { visitor.Int(value); }
-
-void Reflect(Reader& visitor, int& value) {
-    if (!visitor.IsInt()) throw std::invalid_argument("int");
-    value = visitor.GetInt();
-}
-void Reflect(Writer& visitor, int& value) { visitor.Int(value); }
-
-void Reflect(Reader& visitor, unsigned& value) {
-    if (!visitor.IsUint64()) throw std::invalid_argument("unsigned");
-    value = visitor.GetUint32();
-}
-void Reflect(Writer& visitor, unsigned& value) { visitor.Uint32(value); }
-
-void Reflect(Reader& visitor, long& value) {
-    if (!visitor.IsInt64()) throw std::invalid_argument("long");
-    value = long(visitor.GetInt64());
-}
-void Reflect(Writer& visitor, long& value) { visitor.Int64(value); }
-
-void Reflect(Reader& visitor, unsigned long& value) {
-    if (!visitor.IsUint64()) throw std::invalid_argument("unsigned long");
-    value = (unsigned long)visitor.GetUint64();
-}
-void Reflect(Writer& visitor, unsigned long& value) { visitor.Uint64(value); }
-
-void Reflect(Reader& visitor, long long& value) {
-    if (!visitor.IsInt64()) throw std::invalid_argument("long long");
-    value = visitor.GetInt64();
-}
-void Reflect(Writer& visitor, long long& value) { visitor.Int64(value); }
-
-void Reflect(Reader& visitor, unsigned long long& value) {
-    if (!visitor.IsUint64()) throw std::invalid_argument("unsigned long long");
-    value = visitor.GetUint64();
-}
-void Reflect(Writer& visitor, unsigned long long& value) {
-    visitor.Uint64(value);
-}
-
-void Reflect(Reader& visitor, double& value) {
-    if (!visitor.IsDouble()) throw std::invalid_argument("double");
-    value = visitor.GetDouble();
-}
-void Reflect(Writer& visitor, double& value) { visitor.Double(value); }
-
-void Reflect(Reader& visitor, bool& value) {
-    if (!visitor.IsBool()) throw std::invalid_argument("bool");
-    value = visitor.GetBool();
-}
-void Reflect(Writer& visitor, bool& value) { visitor.Bool(value); }
-
-void Reflect(Reader& visitor, std::string& value) {
-    if (!visitor.IsString()) throw std::invalid_argument("std::string");
-    value = visitor.GetString();
-}
-void Reflect(Writer& visitor, std::string& value) {
-    visitor.String(value.c_str(), (rapidjson::SizeType)value.size());
-}
-
-void Reflect(Reader&, std::string_view&) { assert(0); }
-void Reflect(Writer& visitor, std::string_view& data) {
-    if (data.empty())
-        visitor.String("");
-    else
-        visitor.String(&data[0], (rapidjson::SizeType)data.size());
-}
-
-void Reflect(Reader& visitor, JsonNull& value) { visitor.GetNull(); }
-
-void Reflect(Writer& visitor, JsonNull& value) { visitor.Null(); }
-
 // TODO: Move this to indexer.cc
-void Reflect(Reader& visitor, IndexInclude& value) {
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, IndexInclude& value) {
     REFLECT_MEMBER_START();
     REFLECT_MEMBER(line);
     REFLECT_MEMBER(resolved_path);
     REFLECT_MEMBER_END();
 }
-void Reflect(Writer& visitor, IndexInclude& value) {
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, IndexInclude& value) {
     REFLECT_MEMBER_START();
     REFLECT_MEMBER(line);
     if (g_test_output_mode) {
@@ -121,14 +35,14 @@ void Reflect(Writer& visitor, IndexInclude& value) {
     REFLECT_MEMBER_END();
 }
 
-template <typename Def>
-void ReflectHoverAndComments(Reader& visitor, Def& def) {
+template <typename TVisitor, typename Def>
+EnableIfReader<TVisitor> ReflectHoverAndComments(TVisitor& visitor, Def& def) {
     ReflectMember(visitor, "hover", def.hover);
     ReflectMember(visitor, "comments", def.comments);
 }
 
-template <typename Def>
-void ReflectHoverAndComments(Writer& visitor, Def& def) {
+template <typename TVisitor, typename Def>
+EnableIfWriter<TVisitor> ReflectHoverAndComments(TVisitor& visitor, Def& def) {
     // Don't emit empty hover and comments in JSON test mode.
     if (!g_test_output_mode || !def.hover.empty())
         ReflectMember(visitor, "hover", def.hover);
@@ -136,8 +50,8 @@ void ReflectHoverAndComments(Writer& visitor, Def& def) {
         ReflectMember(visitor, "comments", def.comments);
 }
 
-template <typename Def>
-void ReflectShortName(Reader& visitor, Def& def) {
+template <typename TVisitor, typename Def>
+EnableIfReader<TVisitor> ReflectShortName(TVisitor& visitor, Def& def) {
     if (g_test_output_mode) {
         std::string short_name;
         ReflectMember(visitor, "short_name", short_name);
@@ -150,8 +64,8 @@ void ReflectShortName(Reader& visitor, Def& def) {
     }
 }
 
-template <typename Def>
-void ReflectShortName(Writer& visitor, Def& def) {
+template <typename TVisitor, typename Def>
+EnableIfWriter<TVisitor> ReflectShortName(TVisitor& visitor, Def& def) {
     if (g_test_output_mode) {
         std::string short_name(def.detailed_name.substr(def.short_name_offset,
                                                         def.short_name_size));
@@ -182,6 +96,8 @@ void Reflect(TVisitor& visitor, IndexType& value) {
     REFLECT_MEMBER2("vars", value.def.vars);
     REFLECT_MEMBER2("instances", value.instances);
     REFLECT_MEMBER2("uses", value.uses);
+    if (!g_test_output_mode)
+        REFLECT_MEMBER2("fingerprints", value.fingerprints);
     REFLECT_MEMBER_END();
 }
 
@@ -204,6 +120,8 @@ void Reflect(TVisitor& visitor, IndexFunc& value) {
     REFLECT_MEMBER2("vars", value.def.vars);
     REFLECT_MEMBER2("uses", value.uses);
     REFLECT_MEMBER2("callees", value.def.callees);
+    if (!g_test_output_mode)
+        REFLECT_MEMBER2("fingerprints", value.fingerprints);
     REFLECT_MEMBER_END();
 }
 
@@ -222,13 +140,17 @@ void Reflect(TVisitor& visitor, IndexVar& value) {
     REFLECT_MEMBER2("uses", value.uses);
     REFLECT_MEMBER2("kind", value.def.kind);
     REFLECT_MEMBER2("storage", value.def.storage);
+    if (!g_test_output_mode)
+        REFLECT_MEMBER2("fingerprints", value.fingerprints);
     REFLECT_MEMBER_END();
 }
 
 // IndexFile
-bool ReflectMemberStart(Writer& visitor, IndexFile& value) {
+template <typename TVisitor>
+EnableIfWriter<TVisitor, bool> ReflectMemberStart(TVisitor& visitor,
+                                                  IndexFile& value) {
     // FIXME
-    auto it = value.id_cache.usr_to_type_id.find(HashUsr(""));
+    auto it = value.id_cache.usr_to_type_id.find(HashClangUsr(""));
     if (it != value.id_cache.usr_to_type_id.end()) {
         value.Resolve(it->second)->def.detailed_name = "<fundamental>";
         assert(value.Resolve(it->second)->uses.size() == 0);
@@ -242,6 +164,7 @@ void Reflect(TVisitor& visitor, IndexFile& value) {
     REFLECT_MEMBER_START();
     if (!g_test_output_mode) {
         REFLECT_MEMBER(last_modification_time);
+        REFLECT_MEMBER(content_hash);
         REFLECT_MEMBER(language);
         REFLECT_MEMBER(import_file);
         REFLECT_MEMBER(args_hash);
@@ -387,6 +310,162 @@ std::unique_ptr<IndexFile> Deserialize(
 
 void SetTestOutputMode() { g_test_output_mode = true; }
 
+namespace {
+
+// The tests below instantiate these with the concrete readers and writers,
+// and with the Reader and Writer interfaces which use virtual dispatch.
+template <typename TWriter>
+std::string ToMessagePack(IndexFile& file) {
+    msgpack::sbuffer buf;
+    msgpack::packer<msgpack::sbuffer> pk(&buf);
+    MessagePackWriter msgpack_writer(&pk);
+    TWriter& writer = msgpack_writer;
+    Reflect(writer, file);
+    return std::string(buf.data(), buf.size());
+}
+
+template <typename TReader>
+void FromMessagePack(const std::string& serialized, IndexFile* file) {
+    msgpack::unpacker upk;
+    upk.reserve_buffer(serialized.size());
+    memcpy(upk.buffer(), serialized.data(), serialized.size());
+    upk.buffer_consumed(serialized.size());
+    MessagePackReader msgpack_reader(&upk);
+    TReader& reader = msgpack_reader;
+    Reflect(reader, *file);
+}
+
+template <typename TWriter>
+std::string ToJson(IndexFile& file) {
+    rapidjson::StringBuffer output;
+    rapidjson::Writer<rapidjson::StringBuffer> json_writer(output);
+    JsonWriter writer_impl(&json_writer);
+    TWriter& writer = writer_impl;
+    Reflect(writer, file);
+    return output.GetString();
+}
+
+template <typename TReader>
+void FromJson(const std::string& serialized, IndexFile* file) {
+    rapidjson::Document document;
+    document.Parse(serialized.c_str());
+    JsonReader reader_impl(&document);
+    TReader& reader = reader_impl;
+    Reflect(reader, *file);
+}
+
+// Adds |num_entities| functions and variables with |num_uses| uses each.
+void AddTestEntities(IndexFile* file, int num_entities, int num_uses) {
+    for (int i = 0; i < num_entities; ++i) {
+        file->funcs.emplace_back(IndexId::Func(i), Usr(i));
+        IndexFunc& func = file->funcs.back();
+        func.def.detailed_name =
+            "void ns::Function" + std::to_string(i) + "(int a, int b)";
+        func.def.short_name_offset = 9;
+        func.def.short_name_size = 8;
+        func.def.hover = func.def.detailed_name;
+        func.def.kind = ls_symbol_kind::Function;
+        func.def.spell = IndexId::LexicalRef(
+            Range(Position(i, 5), Position(i, 17)), AnyId(i),
+            SymbolKind::File, role::Definition);
+        for (int j = 0; j < num_uses; ++j) {
+            Range range(Position(i + j, 4), Position(i + j, 20));
+            func.uses.emplace_back(range, AnyId(j), SymbolKind::Func,
+                                   role::Reference | role::Call);
+            func.def.callees.emplace_back(range, AnyId(j),
+                                          SymbolKind::Func, role::Call);
+        }
+
+        file->vars.emplace_back(IndexId::Var(i), Usr(i));
+        IndexVar& var = file->vars.back();
+        var.def.detailed_name = "int ns::variable" + std::to_string(i);
+        var.def.short_name_offset = 8;
+        var.def.short_name_size = 8;
+        for (int j = 0; j < num_uses; ++j) {
+            var.uses.emplace_back(
+                Range(Position(i + j, 1), Position(i + j, 9)), AnyId(j),
+                SymbolKind::Func, role::Reference | role::Read);
+        }
+    }
+}
+
+}  // namespace
+
+TEST_SUITE("Serializer") {
+    TEST_CASE("concrete and virtual visitors agree") {
+        const int k_entities = 20;
+        const int k_uses = 5;
+
+        AbsolutePath path = AbsolutePath::BuildDoNotUse("/serializer_test.cc");
+        IndexFile file(path);
+        AddTestEntities(&file, k_entities, k_uses);
+
+        std::string msgpack = ToMessagePack<MessagePackWriter>(file);
+        REQUIRE(msgpack == ToMessagePack<Writer>(file));
+        std::string json = ToJson<JsonWriter>(file);
+        REQUIRE(json == ToJson<Writer>(file));
+
+        // Reading through either reader restores the same file.
+        IndexFile from_msgpack(path);
+        FromMessagePack<MessagePackReader>(msgpack, &from_msgpack);
+        REQUIRE(ToMessagePack<MessagePackWriter>(from_msgpack) == msgpack);
+        IndexFile from_msgpack_virtual(path);
+        FromMessagePack<Reader>(msgpack, &from_msgpack_virtual);
+        REQUIRE(ToMessagePack<MessagePackWriter>(from_msgpack_virtual) ==
+                msgpack);
+        IndexFile from_json(path);
+        FromJson<JsonReader>(json, &from_json);
+        REQUIRE(ToJson<JsonWriter>(from_json) == json);
+        IndexFile from_json_virtual(path);
+        FromJson<Reader>(json, &from_json_virtual);
+        REQUIRE(ToJson<JsonWriter>(from_json_virtual) == json);
+    }
+
+    // Run with --test-unit --no-skip -tc="*serializer benchmark*".
+    TEST_CASE("serializer benchmark" * doctest::skip()) {
+        const int k_entities = 5000;
+        const int k_uses = 20;
+        const int k_iterations = 20;
+
+        AbsolutePath path =
+            AbsolutePath::BuildDoNotUse("/serializer_benchmark.cc");
+        IndexFile file(path);
+        AddTestEntities(&file, k_entities, k_uses);
+
+        Timer timer;
+        auto time = [&](const std::string& name, std::function<void()> run) {
+            timer.Reset();
+            for (int i = 0; i < k_iterations; ++i) run();
+            timer.ResetAndPrint("[perf] " + name);
+        };
+
+        std::string msgpack = ToMessagePack<MessagePackWriter>(file);
+        time("msgpack write, virtual", [&]() { ToMessagePack<Writer>(file); });
+        time("msgpack write, static",
+             [&]() { ToMessagePack<MessagePackWriter>(file); });
+        time("msgpack read, virtual", [&]() {
+            IndexFile loaded(path);
+            FromMessagePack<Reader>(msgpack, &loaded);
+        });
+        time("msgpack read, static", [&]() {
+            IndexFile loaded(path);
+            FromMessagePack<MessagePackReader>(msgpack, &loaded);
+        });
+
+        std::string json = ToJson<JsonWriter>(file);
+        time("json write, virtual", [&]() { ToJson<Writer>(file); });
+        time("json write, static", [&]() { ToJson<JsonWriter>(file); });
+        time("json read, virtual", [&]() {
+            IndexFile loaded(path);
+            FromJson<Reader>(json, &loaded);
+        });
+        time("json read, static", [&]() {
+            IndexFile loaded(path);
+            FromJson<JsonReader>(json, &loaded);
+        });
+    }
+}
+
 TEST_SUITE("Serializer utils") {
     TEST_CASE("GetBaseName") {
         REQUIRE(GetBaseName("foo.cc") == "foo.cc");
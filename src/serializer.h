@@ -7,6 +7,7 @@
 #include <cassert>
 #include <functional>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
 #include <vector>
@@ -74,6 +75,19 @@ class Writer {
 
 struct IndexFile;
 
+// Reflect overloads are templated on the visitor and constrained with these,
+// instead of taking a Reader& or Writer&, so that the concrete reader or writer
+// type is kept all the way down. The concrete visitors are final, so when
+// reflecting through them (ie, the IndexFile cache) every call is resolved
+// statically and can be inlined. Reflecting through a Reader& or Writer& still
+// works and goes through virtual dispatch.
+template <typename TVisitor, typename R = void>
+using EnableIfReader =
+    typename std::enable_if<std::is_base_of<Reader, TVisitor>::value, R>::type;
+template <typename TVisitor, typename R = void>
+using EnableIfWriter =
+    typename std::enable_if<std::is_base_of<Writer, TVisitor>::value, R>::type;
+
 struct OptionalsMandatoryTag {};
 
 #define REFLECT_MEMBER_START() ReflectMemberStart(visitor, value)
@@ -86,15 +100,17 @@ struct OptionalsMandatoryTag {};
 
 #define MAKE_REFLECT_TYPE_PROXY(type_name) \
     MAKE_REFLECT_TYPE_PROXY2(type_name, std::underlying_type<type_name>::type)
-#define MAKE_REFLECT_TYPE_PROXY2(type, as_type)         \
-    inline void Reflect(Reader& visitor, type& value) { \
-        as_type value0;                                 \
-        ::Reflect(visitor, value0);                     \
-        value = static_cast<type>(value0);              \
-    }                                                   \
-    inline void Reflect(Writer& visitor, type& value) { \
-        auto value0 = static_cast<as_type>(value);      \
-        ::Reflect(visitor, value0);                     \
+#define MAKE_REFLECT_TYPE_PROXY2(type, as_type)                        \
+    template <typename TVisitor>                                       \
+    EnableIfReader<TVisitor> Reflect(TVisitor& visitor, type& value) { \
+        as_type value0;                                                \
+        ::Reflect(visitor, value0);                                    \
+        value = static_cast<type>(value0);                             \
+    }                                                                  \
+    template <typename TVisitor>                                       \
+    EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, type& value) { \
+        auto value0 = static_cast<as_type>(value);                     \
+        ::Reflect(visitor, value0);                                    \
     }
 
 #define _MAPPABLE_REFLECT_MEMBER(name) REFLECT_MEMBER(name);
@@ -142,55 +158,154 @@ struct OptionalsMandatoryTag {};
 
 //// Elementary types
 
-void Reflect(Reader& visitor, uint8_t& value);
-void Reflect(Writer& visitor, uint8_t& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, uint8_t& value) {
+    if (!visitor.IsInt()) throw std::invalid_argument("uint8_t");
+    value = (uint8_t)visitor.GetInt();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, uint8_t& value) {
+    visitor.Int(value);
+}
 
-void Reflect(Reader& visitor, short& value);
-void Reflect(Writer& visitor, short& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, short& value) {
+    if (!visitor.IsInt()) throw std::invalid_argument("short");
+    value = (short)visitor.GetInt();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, short& value) {
+    visitor.Int(value);
+}
 
-void Reflect(Reader& visitor, unsigned short& value);
-void Reflect(Writer& visitor, unsigned short& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, unsigned short& value) {
+    if (!visitor.IsInt()) throw std::invalid_argument("unsigned short");
+    value = (unsigned short)visitor.GetInt();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, unsigned short& value) {
+    visitor.Int(value);
+}
 
-void Reflect(Reader& visitor, int& value);
-void Reflect(Writer& visitor, int& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, int& value) {
+    if (!visitor.IsInt()) throw std::invalid_argument("int");
+    value = visitor.GetInt();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, int& value) {
+    visitor.Int(value);
+}
 
-void Reflect(Reader& visitor, unsigned& value);
-void Reflect(Writer& visitor, unsigned& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, unsigned& value) {
+    if (!visitor.IsUint64()) throw std::invalid_argument("unsigned");
+    value = visitor.GetUint32();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, unsigned& value) {
+    visitor.Uint32(value);
+}
 
-void Reflect(Reader& visitor, long& value);
-void Reflect(Writer& visitor, long& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, long& value) {
+    if (!visitor.IsInt64()) throw std::invalid_argument("long");
+    value = long(visitor.GetInt64());
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, long& value) {
+    visitor.Int64(value);
+}
 
-void Reflect(Reader& visitor, unsigned long& value);
-void Reflect(Writer& visitor, unsigned long& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, unsigned long& value) {
+    if (!visitor.IsUint64()) throw std::invalid_argument("unsigned long");
+    value = (unsigned long)visitor.GetUint64();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, unsigned long& value) {
+    visitor.Uint64(value);
+}
 
-void Reflect(Reader& visitor, long long& value);
-void Reflect(Writer& visitor, long long& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, long long& value) {
+    if (!visitor.IsInt64()) throw std::invalid_argument("long long");
+    value = visitor.GetInt64();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, long long& value) {
+    visitor.Int64(value);
+}
 
-void Reflect(Reader& visitor, unsigned long long& value);
-void Reflect(Writer& visitor, unsigned long long& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, unsigned long long& value) {
+    if (!visitor.IsUint64()) throw std::invalid_argument("unsigned long long");
+    value = visitor.GetUint64();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, unsigned long long& value) {
+    visitor.Uint64(value);
+}
 
-void Reflect(Reader& visitor, double& value);
-void Reflect(Writer& visitor, double& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, double& value) {
+    if (!visitor.IsDouble()) throw std::invalid_argument("double");
+    value = visitor.GetDouble();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, double& value) {
+    visitor.Double(value);
+}
 
-void Reflect(Reader& visitor, bool& value);
-void Reflect(Writer& visitor, bool& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, bool& value) {
+    if (!visitor.IsBool()) throw std::invalid_argument("bool");
+    value = visitor.GetBool();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, bool& value) {
+    visitor.Bool(value);
+}
 
-void Reflect(Reader& visitor, std::string& value);
-void Reflect(Writer& visitor, std::string& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, std::string& value) {
+    if (!visitor.IsString()) throw std::invalid_argument("std::string");
+    value = visitor.GetString();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, std::string& value) {
+    visitor.String(value.c_str(), value.size());
+}
 
-void Reflect(Reader& visitor, std::string_view& view);
-void Reflect(Writer& visitor, std::string_view& view);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, std::string_view& view) {
+    assert(0);
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, std::string_view& view) {
+    if (view.empty())
+        visitor.String("");
+    else
+        visitor.String(&view[0], view.size());
+}
 
-void Reflect(Reader& visitor, JsonNull& value);
-void Reflect(Writer& visitor, JsonNull& value);
+template <typename TVisitor>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, JsonNull& value) {
+    visitor.GetNull();
+}
+template <typename TVisitor>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, JsonNull& value) {
+    visitor.Null();
+}
 
 void Reflect(Reader& visitor, serialize_format& value);
 void Reflect(Writer& visitor, serialize_format& value);
 
 //// Type constructors
 
-template <typename T>
-void Reflect(Reader& visitor, optional<T>& value) {
+template <typename TVisitor, typename T>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, optional<T>& value) {
     if (visitor.IsNull()) {
         visitor.GetNull();
         return;
@@ -199,8 +314,8 @@ void Reflect(Reader& visitor, optional<T>& value) {
     Reflect(visitor, real_value);
     value = std::move(real_value);
 }
-template <typename T>
-void Reflect(Writer& visitor, optional<T>& value) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, optional<T>& value) {
     if (value)
         Reflect(visitor, *value);
     else
@@ -208,8 +323,8 @@ void Reflect(Writer& visitor, optional<T>& value) {
 }
 
 // The same as std::optional
-template <typename T>
-void Reflect(Reader& visitor, Maybe<T>& value) {
+template <typename TVisitor, typename T>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, Maybe<T>& value) {
     if (visitor.IsNull()) {
         visitor.GetNull();
         return;
@@ -218,16 +333,18 @@ void Reflect(Reader& visitor, Maybe<T>& value) {
     Reflect(visitor, real_value);
     value = std::move(real_value);
 }
-template <typename T>
-void Reflect(Writer& visitor, Maybe<T>& value) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, Maybe<T>& value) {
     if (value)
         Reflect(visitor, *value);
     else
         visitor.Null();
 }
 
-template <typename T>
-void ReflectMember(Writer& visitor, const char* name, optional<T>& value) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> ReflectMember(TVisitor& visitor,
+                                       const char* name,
+                                       optional<T>& value) {
     // For TypeScript optional property key?: value in the spec,
     // We omit both key and value if value is std::nullopt (null) for JsonWriter
     // to reduce output. But keep it for other serialization formats.
@@ -238,32 +355,36 @@ void ReflectMember(Writer& visitor, const char* name, optional<T>& value) {
 }
 
 // The same as std::optional
-template <typename T>
-void ReflectMember(Writer& visitor, const char* name, Maybe<T>& value) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> ReflectMember(TVisitor& visitor,
+                                       const char* name,
+                                       Maybe<T>& value) {
     if (value.HasValue() || visitor.Format() != serialize_format::Json) {
         visitor.Key(name);
         Reflect(visitor, value);
     }
 }
 
-template <typename T>
-void ReflectMember(Writer& visitor, const char* name, T& value,
-                   OptionalsMandatoryTag) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> ReflectMember(TVisitor& visitor,
+                                       const char* name,
+                                       T& value,
+                                       OptionalsMandatoryTag) {
     visitor.Key(name);
     Reflect(visitor, value);
 }
 
 // std::vector
-template <typename T>
-void Reflect(Reader& visitor, std::vector<T>& values) {
-    visitor.IterArray([&](Reader& entry) {
+template <typename TVisitor, typename T>
+EnableIfReader<TVisitor> Reflect(TVisitor& visitor, std::vector<T>& values) {
+    visitor.IterArray([&](TVisitor& entry) {
         T entry_value;
         Reflect(entry, entry_value);
         values.push_back(std::move(entry_value));
     });
 }
-template <typename T>
-void Reflect(Writer& visitor, std::vector<T>& values) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> Reflect(TVisitor& visitor, std::vector<T>& values) {
     visitor.StartArray(values.size());
     for (auto& value : values) Reflect(visitor, value);
     visitor.EndArray();
@@ -276,29 +397,35 @@ inline void DefaultReflectMemberStart(Writer& visitor) {
 }
 inline void DefaultReflectMemberStart(Reader& visitor) {}
 
-template <typename T>
-bool ReflectMemberStart(Reader& visitor, T& value) {
+template <typename TVisitor, typename T>
+EnableIfReader<TVisitor, bool> ReflectMemberStart(TVisitor& visitor,
+                                                  T& value) {
     return false;
 }
-template <typename T>
-bool ReflectMemberStart(Writer& visitor, T& value) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor, bool> ReflectMemberStart(TVisitor& visitor,
+                                                  T& value) {
     visitor.StartObject();
     return true;
 }
 
-template <typename T>
-void ReflectMemberEnd(Reader& visitor, T& value) {}
-template <typename T>
-void ReflectMemberEnd(Writer& visitor, T& value) {
+template <typename TVisitor, typename T>
+EnableIfReader<TVisitor> ReflectMemberEnd(TVisitor& visitor, T& value) {}
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> ReflectMemberEnd(TVisitor& visitor, T& value) {
     visitor.EndObject();
 }
 
-template <typename T>
-void ReflectMember(Reader& visitor, const char* name, T& value) {
-    visitor.DoMember(name, [&](Reader& child) { Reflect(child, value); });
+template <typename TVisitor, typename T>
+EnableIfReader<TVisitor> ReflectMember(TVisitor& visitor,
+                                       const char* name,
+                                       T& value) {
+    visitor.DoMember(name, [&](TVisitor& child) { Reflect(child, value); });
 }
-template <typename T>
-void ReflectMember(Writer& visitor, const char* name, T& value) {
+template <typename TVisitor, typename T>
+EnableIfWriter<TVisitor> ReflectMember(TVisitor& visitor,
+                                       const char* name,
+                                       T& value) {
     visitor.Key(name);
     Reflect(visitor, value);
 }
@@ -5,7 +5,7 @@
 
 #include "serializer.h"
 
-class JsonReader : public Reader {
+class JsonReader final : public Reader {
     rapidjson::GenericValue<rapidjson::UTF8<>>* m;
     std::vector<const char*> path;
 
@@ -38,6 +38,12 @@ class JsonReader : public Reader {
     }
 
     void IterArray(std::function<void(Reader&)> fn) override {
+        IterArray([&](JsonReader& entry) { fn(entry); });
+    }
+    // Same as above, but |fn| is called with the concrete reader and can be
+    // inlined.
+    template <typename TFn>
+    void IterArray(TFn&& fn) {
         if (!m->IsArray()) throw std::invalid_argument("array");
         // Use "0" to indicate any element for now.
         path.push_back("0");
@@ -51,6 +57,10 @@ class JsonReader : public Reader {
     }
 
     void DoMember(const char* name, std::function<void(Reader&)> fn) override {
+        DoMember(name, [&](JsonReader& child) { fn(child); });
+    }
+    template <typename TFn>
+    void DoMember(const char* name, TFn&& fn) {
         path.push_back(name);
         auto it = m->FindMember(name);
         if (it != m->MemberEnd()) {
@@ -73,7 +83,7 @@ class JsonReader : public Reader {
     }
 };
 
-class JsonWriter : public Writer {
+class JsonWriter final : public Writer {
     rapidjson::Writer<rapidjson::StringBuffer>* m_;
 
    public:
@@ -4,7 +4,7 @@
 
 #include "serializer.h"
 
-class MessagePackReader : public Reader {
+class MessagePackReader final : public Reader {
     msgpack::unpacker* pk;
     msgpack::object_handle oh;
 
@@ -48,16 +48,26 @@ class MessagePackReader : public Reader {
     std::unique_ptr<Reader> operator[](const char* x) override { return {}; }
 
     void IterArray(std::function<void(Reader&)> fn) override {
+        IterArray([&](MessagePackReader& entry) { fn(entry); });
+    }
+    // Same as above, but |fn| is called with the concrete reader and can be
+    // inlined.
+    template <typename TFn>
+    void IterArray(TFn&& fn) {
         size_t n = Get<size_t>();
         for (size_t i = 0; i < n; i++) fn(*this);
     }
 
-    void DoMember(const char*, std::function<void(Reader&)> fn) override {
+    void DoMember(const char* name, std::function<void(Reader&)> fn) override {
+        DoMember(name, [&](MessagePackReader& child) { fn(child); });
+    }
+    template <typename TFn>
+    void DoMember(const char*, TFn&& fn) {
         fn(*this);
     }
 };
 
-class MessagePackWriter : public Writer {
+class MessagePackWriter final : public Writer {
     msgpack::packer<msgpack::sbuffer>* m;
 
    public:
@@ -74,9 +84,9 @@ class MessagePackWriter : public Writer {
     void Uint64(uint64_t x) override { m->pack(x); }
     void Double(double x) override { m->pack(x); }
     void String(const char* x) override { m->pack(x); }
-    // TODO Remove std::string
     void String(const char* x, size_t len) override {
-        m->pack(std::string(x, len));
+        m->pack_str(uint32_t(len));
+        m->pack_str_body(x, uint32_t(len));
     }
     void StartArray(size_t n) override { m->pack(n); }
     void EndArray() override {}
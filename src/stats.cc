@@ -0,0 +1,264 @@
+#include "stats.h"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "indexer.h"
+#include "query.h"
+
+namespace {
+
+// Heap memory used by |s|. Short strings are stored inline.
+long long StringBytes(const std::string& s) {
+    static const size_t k_inline_capacity = std::string().capacity();
+    return s.capacity() > k_inline_capacity ? s.capacity() + 1 : 0;
+}
+
+// Pooled strings are counted once, in the StringPool row.
+long long StringBytes(const PooledString& s) {
+    return 0;
+}
+
+template <typename T>
+long long VectorBytes(const std::vector<T>& v) {
+    return v.capacity() * sizeof(T);
+}
+
+template <typename TMap>
+long long MapBytes(const TMap& map) {
+    return map.size() * sizeof(typename TMap::value_type);
+}
+
+template <typename TDef>
+long long DefStringBytes(const TDef& def) {
+    return StringBytes(def.detailed_name) + StringBytes(def.hover) +
+           StringBytes(def.comments);
+}
+
+// Heap memory owned by the vectors in a definition.
+long long DefVectorBytes(const TypeDefDefinitionData<QueryId>& def) {
+    return VectorBytes(def.bases) + VectorBytes(def.types) +
+           VectorBytes(def.funcs) + VectorBytes(def.vars);
+}
+long long DefVectorBytes(const FuncDefDefinitionData<QueryId>& def) {
+    return VectorBytes(def.bases) + VectorBytes(def.vars) +
+           VectorBytes(def.callees);
+}
+long long DefVectorBytes(const VarDefDefinitionData<QueryId>& def) {
+    return 0;
+}
+
+struct MemoryUsageBuilder {
+    std::vector<MemoryUsage> result;
+
+    void Add(const char* kind, const char* field, long long count,
+             long long bytes) {
+        MemoryUsage usage;
+        usage.kind = kind;
+        usage.field = field;
+        usage.count = count;
+        usage.bytes = bytes;
+        result.push_back(usage);
+    }
+
+    // Adds the fields shared by types, funcs and vars.
+    template <typename TEntity>
+    void AddEntities(const char* kind, const std::vector<TEntity>& entities) {
+        long long num_defs = 0, def_bytes = 0, def_string_bytes = 0;
+        long long num_declarations = 0, declaration_bytes = 0;
+        long long num_uses = 0, use_bytes = 0;
+        for (const TEntity& entity : entities) {
+            num_defs += entity.def.size();
+            def_bytes += VectorBytes(entity.def);
+            for (const auto& def : entity.def) {
+                def_bytes += DefVectorBytes(def);
+                def_string_bytes += DefStringBytes(def);
+            }
+            num_declarations += entity.declarations.size();
+            declaration_bytes += VectorBytes(entity.declarations);
+            num_uses += entity.uses.size();
+            use_bytes += entity.uses.AllocatedBytes();
+        }
+        Add(kind, "entities", entities.size(), VectorBytes(entities));
+        Add(kind, "def", num_defs, def_bytes);
+        Add(kind, "defStrings", num_defs, def_string_bytes);
+        Add(kind, "declarations", num_declarations, declaration_bytes);
+        Add(kind, "uses", num_uses, use_bytes);
+    }
+};
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : m_count(0), m_total_us(0), m_max_us(0) {
+    for (std::atomic<long long>& bucket : m_buckets) bucket = 0;
+}
+
+void LatencyHistogram::Record(long long elapsed_us) {
+    int bucket = 0;
+    while (bucket + 1 < k_num_buckets && (elapsed_us >> (bucket + 1)) > 0)
+        ++bucket;
+    ++m_buckets[bucket];
+    ++m_count;
+    m_total_us += elapsed_us;
+    long long max = m_max_us.load();
+    while (elapsed_us > max &&
+           !m_max_us.compare_exchange_weak(max, elapsed_us)) {
+    }
+}
+
+long long LatencyHistogram::PercentileUs(double percentile) const {
+    long long count = m_count.load();
+    if (count == 0) return 0;
+    long long rank =
+        std::max(1LL, (long long)std::ceil(count * percentile / 100));
+    long long seen = 0;
+    for (int i = 0; i < k_num_buckets; ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank) return std::min(1LL << (i + 1), m_max_us.load());
+    }
+    return m_max_us;
+}
+
+// static
+Stats* Stats::Instance() {
+    static Stats instance;
+    return &instance;
+}
+
+void Stats::RecordRequest(MethodType method, long long elapsed_us) {
+    LatencyHistogram* histogram;
+    {
+        std::lock_guard<std::mutex> lock(m_requests_mutex);
+        std::unique_ptr<LatencyHistogram>& entry = m_requests[method];
+        if (!entry) entry = std::make_unique<LatencyHistogram>();
+        histogram = entry.get();
+    }
+    histogram->Record(elapsed_us);
+}
+
+void Stats::RecordIndexed(size_t num_bytes) {
+    ++m_indexed_translation_units;
+    m_indexed_bytes += num_bytes;
+}
+
+std::vector<MemoryUsage> EstimateMemoryUsage(const QueryDatabase& db) {
+    MemoryUsageBuilder builder;
+
+    long long file_def_bytes = 0, num_includes = 0, include_bytes = 0;
+    long long num_symbol_refs = 0, symbol_ref_bytes = 0;
+    for (const QueryFile& file : db.files) {
+        if (!file.def) continue;
+        const QueryFile::Def& def = *file.def;
+        file_def_bytes += StringBytes(def.path.path) +
+                          StringBytes(def.language) +
+                          VectorBytes(def.inactive_regions) +
+                          VectorBytes(def.dependencies);
+        for (const AbsolutePath& dependency : def.dependencies)
+            file_def_bytes += StringBytes(dependency.path);
+        num_includes += def.includes.size();
+        include_bytes += VectorBytes(def.includes);
+        for (const IndexInclude& include : def.includes)
+            include_bytes += StringBytes(include.resolved_path);
+        num_symbol_refs += def.outline.size() + def.all_symbols.size();
+        symbol_ref_bytes +=
+            VectorBytes(def.outline) + VectorBytes(def.all_symbols);
+    }
+    builder.Add("file", "entities", db.files.size(), VectorBytes(db.files));
+    builder.Add("file", "def", db.files.size(), file_def_bytes);
+    builder.Add("file", "includes", num_includes, include_bytes);
+    builder.Add("file", "symbols", num_symbol_refs, symbol_ref_bytes);
+    builder.Add("file", "index", db.usr_to_file.size(),
+                MapBytes(db.usr_to_file));
+
+    builder.AddEntities("type", db.types);
+    long long num_derived = 0, derived_bytes = 0;
+    long long num_instances = 0, instance_bytes = 0;
+    for (const QueryType& type : db.types) {
+        num_derived += type.derived.size();
+        derived_bytes += VectorBytes(type.derived);
+        num_instances += type.instances.size();
+        instance_bytes += VectorBytes(type.instances);
+    }
+    builder.Add("type", "derived", num_derived, derived_bytes);
+    builder.Add("type", "instances", num_instances, instance_bytes);
+    builder.Add("type", "index", db.usr_to_type.size(),
+                MapBytes(db.usr_to_type));
+
+    builder.AddEntities("func", db.funcs);
+    num_derived = 0;
+    derived_bytes = 0;
+    long long num_callers = 0, caller_bytes = 0;
+    for (const QueryFunc& func : db.funcs) {
+        num_derived += func.derived.size();
+        derived_bytes += VectorBytes(func.derived);
+        num_callers += func.callers.size();
+        caller_bytes += func.callers.AllocatedBytes();
+    }
+    builder.Add("func", "derived", num_derived, derived_bytes);
+    builder.Add("func", "callers", num_callers, caller_bytes);
+    builder.Add("func", "index", db.usr_to_func.size(),
+                MapBytes(db.usr_to_func));
+
+    builder.AddEntities("var", db.vars);
+    builder.Add("var", "index", db.usr_to_var.size(),
+                MapBytes(db.usr_to_var));
+
+    builder.Add("symbol", "entities", db.symbols.size(),
+                VectorBytes(db.symbols));
+    StringPool::Usage strings = StringPool::Instance()->GetUsage();
+    builder.Add("string", "pool", strings.num_strings,
+                strings.allocated_bytes);
+    return builder.result;
+}
+
+long long EstimateMemoryUsage(const IndexFile& file) {
+    long long bytes = sizeof(IndexFile) + StringBytes(file.file_contents) +
+                      VectorBytes(file.skipped_by_preprocessor) +
+                      VectorBytes(file.includes) +
+                      VectorBytes(file.dependencies) +
+                      VectorBytes(file.types) + VectorBytes(file.funcs) +
+                      VectorBytes(file.vars);
+    for (const IndexType& type : file.types) {
+        bytes += DefStringBytes(type.def) + VectorBytes(type.declarations) +
+                 VectorBytes(type.uses);
+    }
+    for (const IndexFunc& func : file.funcs) {
+        bytes += DefStringBytes(func.def) + VectorBytes(func.declarations) +
+                 VectorBytes(func.uses) + VectorBytes(func.def.callees);
+    }
+    for (const IndexVar& var : file.vars) {
+        bytes += DefStringBytes(var.def) + VectorBytes(var.declarations) +
+                 VectorBytes(var.uses);
+    }
+    return bytes;
+}
+
+TEST_SUITE("Stats") {
+    TEST_CASE("latency histogram") {
+        LatencyHistogram histogram;
+        REQUIRE(histogram.PercentileUs(50) == 0);
+
+        // 90 fast requests and 10 slow ones.
+        for (int i = 0; i < 90; ++i) histogram.Record(100);
+        for (int i = 0; i < 10; ++i) histogram.Record(5000);
+        REQUIRE(histogram.m_count == 100);
+        REQUIRE(histogram.m_total_us == 90 * 100 + 10 * 5000);
+        REQUIRE(histogram.m_max_us == 5000);
+        REQUIRE(histogram.m_buckets[6] == 90);   // [64, 128)
+        REQUIRE(histogram.m_buckets[12] == 10);  // [4096, 8192)
+
+        REQUIRE(histogram.PercentileUs(50) == 128);
+        REQUIRE(histogram.PercentileUs(90) == 128);
+        // Bounded by the largest recorded latency.
+        REQUIRE(histogram.PercentileUs(99) == 5000);
+    }
+
+    TEST_CASE("zero latency") {
+        LatencyHistogram histogram;
+        histogram.Record(0);
+        REQUIRE(histogram.m_buckets[0] == 1);
+        REQUIRE(histogram.PercentileUs(100) == 0);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "method.h"
+#include "timer.h"
+
+struct IndexFile;
+struct QueryDatabase;
+
+// Histogram of latencies with power-of-two buckets, ie, bucket i counts
+// latencies in [2^i, 2^(i+1)) microseconds. Lock-free.
+struct LatencyHistogram {
+    static const int k_num_buckets = 32;
+
+    LatencyHistogram();
+
+    void Record(long long elapsed_us);
+    // Returns an upper bound of the latency below which |percentile| (in
+    // [0, 100]) of the recorded latencies fall.
+    long long PercentileUs(double percentile) const;
+
+    std::atomic<long long> m_count;
+    std::atomic<long long> m_total_us;
+    std::atomic<long long> m_max_us;
+    std::atomic<long long> m_buckets[k_num_buckets];
+};
+
+// Process wide counters which are reported by $cquery/stats.
+struct Stats {
+    static Stats* Instance();
+
+    // Called when the response to a |method| request is written, |elapsed_us|
+    // after the request was read.
+    void RecordRequest(MethodType method, long long elapsed_us);
+    // Called after a translation unit was parsed. |num_bytes| is the size of
+    // all files which were indexed while parsing it.
+    void RecordIndexed(size_t num_bytes);
+
+    // Invokes |fn| with every method that has a recorded latency.
+    template <typename Fn>
+    void IterateRequests(Fn fn) {
+        std::lock_guard<std::mutex> lock(m_requests_mutex);
+        for (auto& entry : m_requests) fn(entry.first, *entry.second);
+    }
+
+    // Started when cquery starts.
+    Timer m_uptime;
+    std::atomic<long long> m_indexed_translation_units{0};
+    std::atomic<long long> m_indexed_bytes{0};
+
+    // Number and estimated size of index files which were loaded from the cache
+    // and are held by an ICacheManager.
+    std::atomic<long long> m_loaded_caches{0};
+    std::atomic<long long> m_loaded_cache_bytes{0};
+
+    // Completion sessions built by ClangCompleteManager::WarmSession, and how
+    // many of them the user went on to use or were dropped unused.
+    std::atomic<long long> m_warmed_sessions{0};
+    std::atomic<long long> m_warmed_session_hits{0};
+    std::atomic<long long> m_warmed_session_misses{0};
+
+   private:
+    std::mutex m_requests_mutex;
+    std::unordered_map<std::string, std::unique_ptr<LatencyHistogram>>
+        m_requests;
+};
+
+// Estimated heap usage of a part of a QueryDatabase, ie, "uses" of "func".
+struct MemoryUsage {
+    std::string kind;
+    std::string field;
+    long long count = 0;
+    long long bytes = 0;
+};
+MAKE_REFLECT_STRUCT(MemoryUsage, kind, field, count, bytes);
+
+// Estimates the memory used by |db|, broken down by entity kind and field.
+// Must be called on the querydb thread.
+std::vector<MemoryUsage> EstimateMemoryUsage(const QueryDatabase& db);
+// Estimates the memory used by an index file loaded from the cache.
+long long EstimateMemoryUsage(const IndexFile& file);
@@ -0,0 +1,243 @@
+#include "string_pool.h"
+
+#include <doctest/doctest.h>
+
+#include <cassert>
+#include <cstring>
+
+#include "serializer.h"
+#include "utils.h"
+
+namespace {
+
+// Index of the smallest power of two which is at least |size|.
+int SizeClass(size_t size) {
+    int size_class = 0;
+    while ((size_t(1) << size_class) < size) ++size_class;
+    return size_class;
+}
+
+}  // namespace
+
+// static
+StringPool* StringPool::Instance() {
+    static StringPool instance;
+    return &instance;
+}
+
+StringPool::StringPool() {
+    for (std::atomic<Chunk*>& chunk : m_chunks) chunk = nullptr;
+}
+
+StringPool::~StringPool() {
+    for (std::atomic<Chunk*>& chunk : m_chunks) delete chunk.load();
+}
+
+size_t StringPool::ViewHash::operator()(std::string_view s) const {
+    return size_t(HashContents(s));
+}
+
+StringPool::Handle StringPool::Intern(std::string_view s) {
+    if (s.empty()) return 0;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_handles.find(s);
+    if (it != m_handles.end()) {
+        // Do not revive a string whose last reference is being released; it
+        // is replaced below.
+        Entry& entry = GetEntry(it->second);
+        uint32_t refs = entry.refs.load();
+        while (refs > 0) {
+            if (entry.refs.compare_exchange_weak(refs, refs + 1))
+                return it->second;
+        }
+    }
+
+    Handle handle = AllocateEntry();
+    Entry& entry = GetEntry(handle);
+    char* data = AllocateBytes(s.size());
+    memcpy(data, s.data(), s.size());
+    entry.data = data;
+    entry.size = uint32_t(s.size());
+    entry.refs = 1;
+    m_handles[std::string_view(data, s.size())] = handle;
+    ++m_usage.num_strings;
+    m_usage.string_bytes += s.size();
+    return handle;
+}
+
+void StringPool::AddRef(Handle handle) {
+    if (handle != 0) ++GetEntry(handle).refs;
+}
+
+void StringPool::Release(Handle handle) {
+    if (handle == 0) return;
+    Entry& entry = GetEntry(handle);
+    if (--entry.refs != 0) return;
+
+    // Only the thread which released the last reference gets here, since
+    // Intern never takes a reference to a string without one.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string_view s(entry.data, entry.size);
+    auto it = m_handles.find(s);
+    if (it != m_handles.end() && it->second == handle) m_handles.erase(it);
+    FreeBytes(const_cast<char*>(entry.data), entry.size);
+    entry.data = nullptr;
+    entry.size = 0;
+    m_free_handles.push_back(handle);
+    --m_usage.num_strings;
+    m_usage.string_bytes -= s.size();
+}
+
+std::string_view StringPool::Get(Handle handle) const {
+    if (handle == 0) return std::string_view();
+    const Entry& entry = GetEntry(handle);
+    return std::string_view(entry.data, entry.size);
+}
+
+StringPool::Usage StringPool::GetUsage() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_usage;
+}
+
+StringPool::Entry& StringPool::GetEntry(Handle handle) const {
+    Chunk* chunk = m_chunks[handle / k_chunk_size].load();
+    assert(chunk);
+    return (*chunk)[handle % k_chunk_size];
+}
+
+StringPool::Handle StringPool::AllocateEntry() {
+    if (!m_free_handles.empty()) {
+        Handle handle = m_free_handles.back();
+        m_free_handles.pop_back();
+        return handle;
+    }
+
+    Handle handle = m_next_handle++;
+    std::atomic<Chunk*>& chunk = m_chunks[handle / k_chunk_size];
+    if (!chunk.load()) {
+        // Readers never look at a chunk before a handle in it was returned,
+        // so it does not need to be published atomically with its contents.
+        Chunk* new_chunk = new Chunk();
+        for (Entry& entry : *new_chunk) {
+            entry.refs = 0;
+            entry.size = 0;
+            entry.data = nullptr;
+        }
+        chunk = new_chunk;
+    }
+    return handle;
+}
+
+char* StringPool::AllocateBytes(size_t size) {
+    int size_class = SizeClass(size);
+    if (size_class >= k_num_size_classes) {
+        m_usage.allocated_bytes += size;
+        return new char[size];
+    }
+
+    std::vector<char*>& free_bytes = m_free_bytes[size_class];
+    if (!free_bytes.empty()) {
+        char* data = free_bytes.back();
+        free_bytes.pop_back();
+        return data;
+    }
+
+    size_t class_size = size_t(1) << size_class;
+    if (m_arena_used + class_size > k_arena_block_size) {
+        m_arena_blocks.emplace_back(new char[k_arena_block_size]);
+        m_arena_used = 0;
+        m_usage.allocated_bytes += k_arena_block_size;
+    }
+    char* data = m_arena_blocks.back().get() + m_arena_used;
+    m_arena_used += class_size;
+    return data;
+}
+
+void StringPool::FreeBytes(char* data, size_t size) {
+    int size_class = SizeClass(size);
+    if (size_class >= k_num_size_classes) {
+        m_usage.allocated_bytes -= size;
+        delete[] data;
+        return;
+    }
+    m_free_bytes[size_class].push_back(data);
+}
+
+PooledString::PooledString(std::string_view s)
+    : m_handle(StringPool::Instance()->Intern(s)) {}
+
+PooledString::PooledString(const PooledString& other)
+    : m_handle(other.m_handle) {
+    StringPool::Instance()->AddRef(m_handle);
+}
+
+PooledString::~PooledString() {
+    StringPool::Instance()->Release(m_handle);
+}
+
+void Reflect(Reader& visitor, PooledString& value) {
+    std::string s;
+    Reflect(visitor, s);
+    value = s;
+}
+
+void Reflect(Writer& visitor, PooledString& value) {
+    std::string_view s = value.view();
+    Reflect(visitor, s);
+}
+
+TEST_SUITE("StringPool") {
+    TEST_CASE("equal strings share storage") {
+        StringPool pool;
+        StringPool::Handle a = pool.Intern("void foo()");
+        StringPool::Handle b = pool.Intern(std::string("void foo()"));
+        StringPool::Handle c = pool.Intern("void bar()");
+        REQUIRE(a == b);
+        REQUIRE(a != c);
+        REQUIRE(pool.Get(a) == "void foo()");
+        REQUIRE(pool.Get(c) == "void bar()");
+        REQUIRE(pool.Intern("") == 0);
+        REQUIRE(pool.Get(0).empty());
+        REQUIRE(pool.GetUsage().num_strings == 2);
+        REQUIRE(pool.GetUsage().string_bytes == 20);
+    }
+
+    TEST_CASE("strings are freed with their last reference") {
+        StringPool pool;
+        StringPool::Handle a = pool.Intern("int a");
+        pool.AddRef(a);
+        pool.Release(a);
+        REQUIRE(pool.Get(a) == "int a");
+        pool.Release(a);
+        REQUIRE(pool.GetUsage().num_strings == 0);
+
+        // The handle and the bytes are reused.
+        StringPool::Handle b = pool.Intern("int b");
+        REQUIRE(b == a);
+        REQUIRE(pool.Get(b) == "int b");
+
+        std::string large(10000, 'x');
+        StringPool::Handle c = pool.Intern(large);
+        REQUIRE(pool.Get(c) == large);
+        pool.Release(c);
+        pool.Release(b);
+        REQUIRE(pool.GetUsage().string_bytes == 0);
+    }
+
+    TEST_CASE("PooledString") {
+        PooledString a("int x");
+        PooledString b = a;
+        PooledString c(std::string("int x"));
+        PooledString d;
+        REQUIRE(a == b);
+        REQUIRE(a == c);
+        REQUIRE(a.handle() == c.handle());
+        REQUIRE(a != d);
+        REQUIRE(d.empty());
+        REQUIRE(std::string_view(a) == "int x");
+        d = std::move(a);
+        REQUIRE(a.empty());
+        REQUIRE(d.view() == "int x");
+    }
+}
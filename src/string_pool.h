@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string_view.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Reader;
+class Writer;
+
+// Interns the strings of querydb definitions (detailed names, hover and
+// comments), so that equal strings, ie, the same declaration seen from many
+// files, are stored once. Strings are allocated from an arena and freed when
+// the last PooledString referring to them is destroyed.
+//
+// Interning takes a lock; reading a string does not.
+class StringPool {
+   public:
+    // 0 is always the empty string.
+    using Handle = uint32_t;
+
+    struct Usage {
+        size_t num_strings = 0;
+        // Bytes of the strings themselves.
+        size_t string_bytes = 0;
+        // Bytes allocated by the pool, including free blocks.
+        size_t allocated_bytes = 0;
+    };
+
+    static StringPool* Instance();
+
+    StringPool();
+    ~StringPool();
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    // Returns a handle to |s| with one reference.
+    Handle Intern(std::string_view s);
+    void AddRef(Handle handle);
+    void Release(Handle handle);
+    // Valid while a reference to |handle| is held.
+    std::string_view Get(Handle handle) const;
+
+    Usage GetUsage();
+
+   private:
+    struct Entry {
+        std::atomic<uint32_t> refs;
+        uint32_t size;
+        const char* data;
+    };
+    struct ViewHash {
+        size_t operator()(std::string_view s) const;
+    };
+
+    static const size_t k_chunk_size = 4096;
+    // Allows for 16M distinct strings.
+    static const size_t k_max_chunks = 4096;
+    // Strings up to 2^(k_num_size_classes - 1) bytes are carved from the
+    // arena in power of two blocks; larger ones are allocated separately.
+    static const int k_num_size_classes = 13;
+    static const size_t k_arena_block_size = 1 << 20;
+
+    using Chunk = std::array<Entry, k_chunk_size>;
+
+    Entry& GetEntry(Handle handle) const;
+    Handle AllocateEntry();
+    char* AllocateBytes(size_t size);
+    void FreeBytes(char* data, size_t size);
+
+    std::mutex m_mutex;
+    std::atomic<Chunk*> m_chunks[k_max_chunks];
+    // Next never used handle.
+    Handle m_next_handle = 1;
+    std::vector<Handle> m_free_handles;
+    std::unordered_map<std::string_view, Handle, ViewHash> m_handles;
+
+    std::vector<std::unique_ptr<char[]>> m_arena_blocks;
+    size_t m_arena_used = k_arena_block_size;
+    std::vector<char*> m_free_bytes[k_num_size_classes];
+    Usage m_usage;
+};
+
+// A reference counted handle to a string in the StringPool. Behaves like an
+// immutable std::string which is cheap to copy and compare.
+class PooledString {
+   public:
+    PooledString() = default;
+    PooledString(std::string_view s);
+    PooledString(const std::string& s) : PooledString(std::string_view(s)) {}
+    PooledString(const char* s) : PooledString(std::string_view(s)) {}
+    PooledString(const PooledString& other);
+    PooledString(PooledString&& other) noexcept : m_handle(other.m_handle) {
+        other.m_handle = 0;
+    }
+    PooledString& operator=(PooledString other) noexcept {
+        std::swap(m_handle, other.m_handle);
+        return *this;
+    }
+    ~PooledString();
+
+    std::string_view view() const {
+        return StringPool::Instance()->Get(m_handle);
+    }
+    operator std::string_view() const { return view(); }
+    bool empty() const { return m_handle == 0; }
+    size_t size() const { return view().size(); }
+    StringPool::Handle handle() const { return m_handle; }
+
+    bool operator==(const PooledString& o) const {
+        // Equal strings have the same handle unless one was interned while
+        // the other was being freed.
+        return m_handle == o.m_handle || view() == o.view();
+    }
+    bool operator!=(const PooledString& o) const { return !(*this == o); }
+
+   private:
+    StringPool::Handle m_handle = 0;
+};
+
+void Reflect(Reader& visitor, PooledString& value);
+void Reflect(Writer& visitor, PooledString& value);
@@ -16,3 +16,11 @@ bool MultiQueueWaiter::ValidateWaiter(
     }
     return true;
 }
+
+void QueueWaitStats::Record(long long wait_us) {
+    ++num_dequeued;
+    total_wait_us += wait_us;
+    long long max = max_wait_us.load();
+    while (wait_us > max && !max_wait_us.compare_exchange_weak(max, wait_us)) {
+    }
+}
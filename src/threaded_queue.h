@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <memory>
@@ -72,6 +73,15 @@ struct MultiQueueWaiter {
     std::condition_variable_any cv;
 };
 
+// How long elements waited in a queue before being dequeued. Lock-free.
+struct QueueWaitStats {
+    void Record(long long wait_us);
+
+    std::atomic<long long> num_dequeued{0};
+    std::atomic<long long> total_wait_us{0};
+    std::atomic<long long> max_wait_us{0};
+};
+
 // A threadsafe-queue. http://stackoverflow.com/a/16075550
 template <class T>
 struct ThreadedQueue : public BaseThreadQueue {
@@ -86,14 +96,17 @@ struct ThreadedQueue : public BaseThreadQueue {
     // Returns the number of elements in the queue. This is lock-free.
     size_t Size() const { return m_total_count; }
 
+    const QueueWaitStats& WaitStats() const { return m_wait_stats; }
+
     // Add an element to the queue.
     void Enqueue(T&& t, bool priority) {
         {
             std::lock_guard<std::mutex> lock(mutex);
+            Entry entry{std::move(t), Clock::now()};
             if (priority)
-                m_priority.push_back(std::move(t));
+                m_priority.push_back(std::move(entry));
             else
-                m_queue.push_back(std::move(t));
+                m_queue.push_back(std::move(entry));
             ++m_total_count;
         }
         waiter->cv.notify_one();
@@ -106,11 +119,13 @@ struct ThreadedQueue : public BaseThreadQueue {
         {
             std::lock_guard<std::mutex> lock(mutex);
             m_total_count += elements.size();
+            Clock::time_point now = Clock::now();
             for (T& element : elements) {
+                Entry entry{std::move(element), now};
                 if (priority)
-                    m_priority.push_back(std::move(element));
+                    m_priority.push_back(std::move(entry));
                 else
-                    m_queue.push_back(std::move(element));
+                    m_queue.push_back(std::move(entry));
             }
             elements.clear();
         }
@@ -127,14 +142,8 @@ struct ThreadedQueue : public BaseThreadQueue {
         waiter->cv.wait(
             lock, [&]() { return !m_priority.empty() || !m_queue.empty(); });
 
-        auto execute = [&](std::deque<T>* q) {
-            auto val = std::move(q->front());
-            q->pop_front();
-            --m_total_count;
-            return val;
-        };
-        if (!m_priority.empty()) return execute(&m_priority);
-        return execute(&m_queue);
+        if (!m_priority.empty()) return Pop(&m_priority);
+        return Pop(&m_queue);
     }
 
     // Get the first element from the queue without blocking. Returns a null
@@ -142,17 +151,10 @@ struct ThreadedQueue : public BaseThreadQueue {
     optional<T> TryDequeue(bool priority) {
         std::lock_guard<std::mutex> lock(mutex);
 
-        auto pop = [&](std::deque<T>* q) {
-            auto val = std::move(q->front());
-            q->pop_front();
-            --m_total_count;
-            return val;
-        };
-
-        auto get_result = [&](std::deque<T>* first,
-                              std::deque<T>* second) -> optional<T> {
-            if (!first->empty()) return pop(first);
-            if (!second->empty()) return pop(second);
+        auto get_result = [&](std::deque<Entry>* first,
+                              std::deque<Entry>* second) -> optional<T> {
+            if (!first->empty()) return Pop(first);
+            if (!second->empty()) return Pop(second);
             return nullopt;
         };
 
@@ -160,17 +162,45 @@ struct ThreadedQueue : public BaseThreadQueue {
         return get_result(&m_queue, &m_priority);
     }
 
+    // Get the first priority element from the queue without blocking. Returns
+    // a null value if there are no priority elements.
+    optional<T> TryDequeuePriority() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (m_priority.empty()) return nullopt;
+        return Pop(&m_priority);
+    }
+
     template <typename Fn>
     void Iterate(Fn fn) {
         std::lock_guard<std::mutex> lock(mutex);
-        for (auto& entry : m_priority) fn(entry);
-        for (auto& entry : m_queue) fn(entry);
+        for (auto& entry : m_priority) fn(entry.value);
+        for (auto& entry : m_queue) fn(entry.value);
     }
 
     mutable std::mutex mutex;
 
    private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        T value;
+        Clock::time_point enqueued_at;
+    };
+
+    // Removes the first element of |q|. |mutex| must be held.
+    T Pop(std::deque<Entry>* q) {
+        Entry entry = std::move(q->front());
+        q->pop_front();
+        --m_total_count;
+        m_wait_stats.Record(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - entry.enqueued_at)
+                .count());
+        return std::move(entry.value);
+    }
+
     std::atomic<int> m_total_count;
-    std::deque<T> m_priority;
-    std::deque<T> m_queue;
+    std::deque<Entry> m_priority;
+    std::deque<Entry> m_queue;
+    QueueWaitStats m_wait_stats;
 };
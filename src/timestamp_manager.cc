@@ -3,22 +3,35 @@
 #include "cache_manager.h"
 #include "indexer.h"
 
+#include <limits>
+
+// static
+const int64_t TimestampManager::k_no_timestamp =
+    std::numeric_limits<int64_t>::min();
+
 optional<int64_t> TimestampManager::GetLastCachedModificationTime(
     ICacheManager* cache_manager, const std::string& path) {
-    {
-        std::lock_guard<std::mutex> guard(m_mutex);
-        auto it = m_timestamps.find(path);
-        if (it != m_timestamps.end()) return it->second;
-    }
+    FileId file_id = PathInterner::Instance()->Intern(path);
+    int64_t timestamp = m_timestamps.Get(file_id);
+    if (timestamp != k_no_timestamp) return timestamp;
+
     IndexFile* file = cache_manager->TryLoad(path);
     if (!file) return nullopt;
 
-    UpdateCachedModificationTime(path, file->last_modification_time);
+    // Set the hash first; it is only read once the timestamp is known.
+    m_content_hashes.Set(file_id, file->content_hash);
+    m_timestamps.Set(file_id, file->last_modification_time);
     return file->last_modification_time;
 }
 
+uint64_t TimestampManager::GetLastCachedContentHash(const std::string& path) {
+    return m_content_hashes.Get(PathInterner::Instance()->Intern(path));
+}
+
 void TimestampManager::UpdateCachedModificationTime(const std::string& path,
-                                                    int64_t timestamp) {
-    std::lock_guard<std::mutex> guard(m_mutex);
-    m_timestamps[path] = timestamp;
+                                                    int64_t timestamp,
+                                                    uint64_t content_hash) {
+    FileId file_id = PathInterner::Instance()->Intern(path);
+    m_content_hashes.Set(file_id, content_hash);
+    m_timestamps.Set(file_id, timestamp);
 }
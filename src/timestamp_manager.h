@@ -2,22 +2,33 @@
 
 #include <optional.h>
 
-#include <mutex>
-#include <unordered_map>
+#include <string>
+
+#include "path_interner.h"
 
 struct ICacheManager;
 
 // Caches timestamps of cc files so we can avoid a filesystem reads. This is
 // important for import perf, as during dependency checking the same files are
 // checked over and over again if they are common headers.
+//
+// Timestamps are kept in a lock-free table indexed by the interned FileId of
+// the path, so indexer threads checking dependencies do not serialize.
 struct TimestampManager {
     optional<int64_t> GetLastCachedModificationTime(
         ICacheManager* cache_manager, const std::string& path);
 
+    // Returns the hash of the contents |path| had when it was indexed, or 0 if
+    // it is not known. Only valid after GetLastCachedModificationTime or
+    // UpdateCachedModificationTime has been called for |path|.
+    uint64_t GetLastCachedContentHash(const std::string& path);
+
     void UpdateCachedModificationTime(const std::string& path,
-                                      int64_t timestamp);
+                                      int64_t timestamp,
+                                      uint64_t content_hash);
 
-    // TODO: use std::shared_mutex so we can have multiple readers.
-    std::mutex m_mutex;
-    std::unordered_map<std::string, int64_t> m_timestamps;
+    // Marks a file which does not have a cached timestamp yet.
+    static const int64_t k_no_timestamp;
+    FileIdTable<int64_t> m_timestamps{k_no_timestamp};
+    FileIdTable<uint64_t> m_content_hashes{0};
 };
@@ -0,0 +1,195 @@
+#include "trace.h"
+
+#include <doctest/doctest.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include <loguru.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+
+namespace {
+
+struct TraceEvent {
+    const char* category;
+    const char* name;
+    std::string detail;
+    long long start_us;
+    long long duration_us;
+};
+
+// Older events are overwritten once a thread has recorded this many.
+const size_t k_max_events_per_thread = 1 << 16;
+
+struct ThreadBuffer {
+    std::mutex mutex;
+    int tid = 0;
+    std::string name;
+    std::vector<TraceEvent> events;
+    // Total number of events recorded; |events| is a ring buffer once this
+    // reaches k_max_events_per_thread.
+    size_t num_recorded = 0;
+
+    void Record(TraceEvent&& event) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (events.size() < k_max_events_per_thread)
+            events.push_back(std::move(event));
+        else
+            events[num_recorded % k_max_events_per_thread] = std::move(event);
+        ++num_recorded;
+    }
+};
+
+std::atomic<bool> g_tracing_enabled(false);
+std::string g_trace_path;
+std::chrono::steady_clock::time_point g_trace_start;
+
+// Buffers are kept alive after their thread exits so they still get written.
+std::mutex g_buffers_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+
+ThreadBuffer* GetThreadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        buffer->tid = int(g_buffers.size()) + 1;
+        g_buffers.push_back(buffer);
+    }
+    return buffer.get();
+}
+
+long long NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - g_trace_start)
+        .count();
+}
+
+std::string SerializeTrace() {
+    rapidjson::StringBuffer output;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(output);
+    writer.StartObject();
+    writer.Key("traceEvents");
+    writer.StartArray();
+
+    std::lock_guard<std::mutex> buffers_lock(g_buffers_mutex);
+    for (const std::shared_ptr<ThreadBuffer>& buffer : g_buffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        if (!buffer->name.empty()) {
+            writer.StartObject();
+            writer.Key("name");
+            writer.String("thread_name");
+            writer.Key("ph");
+            writer.String("M");
+            writer.Key("pid");
+            writer.Int(1);
+            writer.Key("tid");
+            writer.Int(buffer->tid);
+            writer.Key("args");
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(buffer->name.c_str());
+            writer.EndObject();
+            writer.EndObject();
+        }
+
+        for (const TraceEvent& event : buffer->events) {
+            writer.StartObject();
+            writer.Key("name");
+            writer.String(event.name);
+            writer.Key("cat");
+            writer.String(event.category);
+            writer.Key("ph");
+            writer.String("X");
+            writer.Key("ts");
+            writer.Int64(event.start_us);
+            writer.Key("dur");
+            writer.Int64(event.duration_us);
+            writer.Key("pid");
+            writer.Int(1);
+            writer.Key("tid");
+            writer.Int(buffer->tid);
+            if (!event.detail.empty()) {
+                writer.Key("args");
+                writer.StartObject();
+                writer.Key("detail");
+                writer.String(event.detail.c_str(), event.detail.size());
+                writer.EndObject();
+            }
+            writer.EndObject();
+        }
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+    return output.GetString();
+}
+
+}  // namespace
+
+void EnableTracing(const std::string& path) {
+    // We can only call |EnableTracing| once.
+    assert(!g_tracing_enabled);
+    g_trace_path = path;
+    g_trace_start = std::chrono::steady_clock::now();
+    g_tracing_enabled = true;
+    std::atexit(WriteTrace);
+}
+
+bool IsTracingEnabled() { return g_tracing_enabled; }
+
+void SetTraceThreadName(const std::string& name) {
+    if (!g_tracing_enabled) return;
+    ThreadBuffer* buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->name = name;
+}
+
+void WriteTrace() {
+    if (!g_tracing_enabled) return;
+    LOG_S(INFO) << "Writing trace to " << g_trace_path;
+    WriteToFile(g_trace_path, SerializeTrace());
+}
+
+TraceScope::TraceScope(const char* category, const char* name)
+    : m_category(category), m_name(name) {
+    if (g_tracing_enabled) m_start_us = NowUs();
+}
+
+TraceScope::TraceScope(const char* category, const char* name,
+                       const std::string& detail)
+    : m_category(category), m_name(name) {
+    if (!g_tracing_enabled) return;
+    m_detail = detail;
+    m_start_us = NowUs();
+}
+
+TraceScope::~TraceScope() {
+    if (m_start_us < 0) return;
+    GetThreadBuffer()->Record(TraceEvent{m_category, m_name,
+                                         std::move(m_detail), m_start_us,
+                                         NowUs() - m_start_us});
+}
+
+void TraceScope::SetDetail(const std::string& detail) {
+    if (m_start_us >= 0) m_detail = detail;
+}
+
+TEST_SUITE("Trace") {
+    TEST_CASE("ring buffer") {
+        ThreadBuffer buffer;
+        for (size_t i = 0; i < k_max_events_per_thread + 2; ++i)
+            buffer.Record(TraceEvent{"test", "event", "", (long long)i, 0});
+        REQUIRE(buffer.events.size() == k_max_events_per_thread);
+        REQUIRE(buffer.events[0].start_us == k_max_events_per_thread);
+        REQUIRE(buffer.events[1].start_us == k_max_events_per_thread + 1);
+        REQUIRE(buffer.events[2].start_us == 2);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+// Records how long pipeline stages take, tagged with the file or request they
+// worked on. Spans go into a fixed-size ring buffer per thread and are written
+// in the Chrome trace event format, which chrome://tracing and
+// https://ui.perfetto.dev can display.
+//
+// Tracing is off unless EnableTracing() is called (--trace-file), in which case
+// TraceScope only checks a flag.
+
+// Starts tracing. The trace is written to |path| when cquery exits.
+void EnableTracing(const std::string& path);
+bool IsTracingEnabled();
+// Names the calling thread in the trace.
+void SetTraceThreadName(const std::string& name);
+// Writes all events still in the ring buffers to the trace file.
+void WriteTrace();
+
+// Records the time between construction and destruction. Only the pointers to
+// |category| and |name| are stored, so they must be string literals.
+struct TraceScope {
+    TraceScope(const char* category, const char* name);
+    TraceScope(const char* category, const char* name,
+               const std::string& detail);
+    ~TraceScope();
+
+    // Replaces the detail shown for this span, ie, once it is known. Check
+    // IsTracingEnabled() before building a detail string.
+    void SetDetail(const std::string& detail);
+
+    const char* m_category;
+    const char* m_name;
+    std::string m_detail;
+    // -1 if tracing was disabled when the scope started.
+    long long m_start_us = -1;
+};
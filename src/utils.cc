@@ -66,6 +66,87 @@ uint64_t HashUsr(std::string_view s) {
     return ret;
 }
 
+namespace {
+const uint64_t k_xxh_prime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t k_xxh_prime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t k_xxh_prime3 = 0x165667B19E3779F9ULL;
+const uint64_t k_xxh_prime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t k_xxh_prime5 = 0x27D4EB2F165667C5ULL;
+
+uint64_t RotateLeft(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+uint64_t Read64(const char* p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+uint32_t Read32(const char* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+uint64_t XxhRound(uint64_t acc, uint64_t input) {
+    acc += input * k_xxh_prime2;
+    acc = RotateLeft(acc, 31);
+    return acc * k_xxh_prime1;
+}
+uint64_t XxhMergeRound(uint64_t acc, uint64_t val) {
+    acc ^= XxhRound(0, val);
+    return acc * k_xxh_prime1 + k_xxh_prime4;
+}
+}  // namespace
+
+// See https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md. Assumes
+// a little-endian host.
+uint64_t HashContents(std::string_view s) {
+    const char* p = s.data();
+    const char* end = p + s.size();
+    uint64_t h;
+    if (s.size() >= 32) {
+        uint64_t v1 = k_xxh_prime1 + k_xxh_prime2;
+        uint64_t v2 = k_xxh_prime2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - k_xxh_prime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = XxhRound(v1, Read64(p));
+            v2 = XxhRound(v2, Read64(p + 8));
+            v3 = XxhRound(v3, Read64(p + 16));
+            v4 = XxhRound(v4, Read64(p + 24));
+        }
+        h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) +
+            RotateLeft(v4, 18);
+        h = XxhMergeRound(h, v1);
+        h = XxhMergeRound(h, v2);
+        h = XxhMergeRound(h, v3);
+        h = XxhMergeRound(h, v4);
+    } else {
+        h = k_xxh_prime5;
+    }
+    h += s.size();
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= XxhRound(0, Read64(p));
+        h = RotateLeft(h, 27) * k_xxh_prime1 + k_xxh_prime4;
+    }
+    if (p + 4 <= end) {
+        h ^= uint64_t(Read32(p)) * k_xxh_prime1;
+        h = RotateLeft(h, 23) * k_xxh_prime2 + k_xxh_prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= uint8_t(*p) * k_xxh_prime5;
+        h = RotateLeft(h, 11) * k_xxh_prime1;
+    }
+
+    h ^= h >> 33;
+    h *= k_xxh_prime2;
+    h ^= h >> 29;
+    h *= k_xxh_prime3;
+    h ^= h >> 32;
+    return h;
+}
+
 // See http://stackoverflow.com/a/2072890
 bool EndsWith(std::string_view value, std::string_view ending) {
     if (ending.size() > value.size()) return false;
@@ -346,15 +427,21 @@ std::string TextReplacer::Apply(const std::string& content) {
     return result;
 }
 
-void WriteToFile(const std::string& filename, const std::string& content) {
+bool WriteToFile(const std::string& filename, const std::string& content) {
     std::ofstream file(filename,
                        std::ios::out | std::ios::trunc | std::ios::binary);
     if (!file.good()) {
         LOG_S(ERROR) << "Cannot write to " << filename;
-        return;
+        return false;
     }
 
     file << content;
+    file.close();
+    if (!file.good()) {
+        LOG_S(ERROR) << "Failed to write " << filename;
+        return false;
+    }
+    return true;
 }
 
 float GetProcessMemoryUsedInMb() {
@@ -463,20 +550,49 @@ bool IsDirectory(const std::string& path) {
     return path_stat.st_mode & S_IFDIR;
 }
 
-size_t HashArguments(const std::vector<std::string>& args) {
+size_t HashArguments(const std::vector<std::string>& args,
+                     const std::string& relative_to) {
     auto is_file = [](const std::string& arg) {
         return EndsWithAny(arg,
                            {".h", ".c", ".cc", ".cpp", ".hpp", ".m", ".mm"});
     };
+    std::string root = relative_to;
+    if (!root.empty()) EnsureEndsInSlash(root);
     size_t hash = 0;
     for (auto it = args.begin(); it != args.end(); it++) {
         if (!is_file(*it)) {
-            HashCombine(hash, *it);
+            if (root.empty())
+                HashCombine(hash, *it);
+            else
+                HashCombine(hash, ReplaceAll(*it, root, ""));
         }
     }
     return hash;
 }
 
+TEST_SUITE("HashContents") {
+    TEST_CASE("matches xxh64") {
+        REQUIRE(HashContents("") == 0xEF46DB3751D8E999ULL);
+        REQUIRE(HashContents("abc") == 0x44BC2CF5AD770999ULL);
+        REQUIRE(HashContents("0123456789abcdefghijklmnopqrstuvwxyz") ==
+                0x69196C1B3AF0BFF9ULL);
+    }
+}
+
+TEST_SUITE("HashArguments") {
+    TEST_CASE("relative to a directory") {
+        std::vector<std::string> a = {"clang", "-I/a/proj/include", "-DX",
+                                      "/a/proj/foo.cc"};
+        std::vector<std::string> b = {"clang", "-I/b/proj/include", "-DX",
+                                      "/b/proj/foo.cc"};
+        REQUIRE(HashArguments(a) != HashArguments(b));
+        REQUIRE(HashArguments(a, "/a/proj/") == HashArguments(b, "/b/proj/"));
+        REQUIRE(HashArguments(a, "/a/proj") == HashArguments(b, "/b/proj/"));
+        b.push_back("-DY");
+        REQUIRE(HashArguments(a, "/a/proj/") != HashArguments(b, "/b/proj/"));
+    }
+}
+
 TEST_SUITE("AbsolutePath") {
     TEST_CASE("IsWindowsAbsolutePath works correctly") {
         REQUIRE(IsWindowsAbsolutePath("C:/Users/projects/"));
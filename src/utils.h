@@ -21,6 +21,9 @@ void TrimInPlace(std::string& s);
 std::string Trim(std::string s);
 
 uint64_t HashUsr(std::string_view s);
+// Fast non-cryptographic hash of file contents (XXH64 with a zero seed), used
+// to detect files which were touched but not changed.
+uint64_t HashContents(std::string_view s);
 
 // Returns true if |value| starts/ends with |start| or |ending|.
 bool StartsWith(std::string_view value, std::string_view start);
@@ -104,7 +107,8 @@ struct TextReplacer {
     std::string Apply(const std::string& content);
 };
 
-void WriteToFile(const std::string& filename, const std::string& content);
+// Returns false and logs an error if |content| could not be written.
+bool WriteToFile(const std::string& filename, const std::string& content);
 
 template <typename T>
 void AddRange(std::vector<T>* dest, const std::vector<T>& to_add) {
@@ -141,4 +145,8 @@ bool IsWindowsAbsolutePath(const std::string& path);
 
 bool IsDirectory(const std::string& path);
 
-size_t HashArguments(const std::vector<std::string>& args);
+// Hashes |args|, ignoring source files. If |relative_to| is not empty it is
+// removed from the arguments first, so that the hash does not change when the
+// directory is moved.
+size_t HashArguments(const std::vector<std::string>& args,
+                     const std::string& relative_to = std::string());